@@ -89,7 +89,29 @@ SegmentReader* ReaderArena::tryGetSegment(SegmentId id) {
 }
 
 void ReaderArena::reportReadLimitReached() {
-  FAIL_VALIDATE_INPUT("Exceeded message traversal limit.  See capnproto::ReaderOptions.");
+  FAIL_VALIDATE_INPUT_OR_RECORD(getErrorRecord(),
+      "Exceeded message traversal limit.  See capnproto::ReaderOptions.");
+}
+
+Maybe<Exception>* ReaderArena::getErrorRecord() {
+  return message->getErrorRecord();
+}
+
+ReadCost ReaderArena::getReadCost() {
+  const ReaderOptions& options = message->getOptions();
+  ReadCost result;
+
+  result.wordsTraversed =
+      (options.traversalLimitInWords * WORDS - readLimiter.getRemaining()) / WORDS;
+
+  // Segments other than the first are only looked up when a far pointer leads into them, and are
+  // added to the map the first time that happens.
+  result.segmentsTouched = (segment0.getArray() == nullptr ? 0 : 1) +
+      (moreSegments == nullptr ? 0 : moreSegments->size());
+
+  result.farPointersFollowed = readLimiter.getCostCounter().getFarPointers();
+  result.nestingDepth = readLimiter.getCostCounter().getDepth(options.nestingLimit);
+  return result;
 }
 
 // =======================================================================================
@@ -205,5 +227,9 @@ void BuilderArena::reportReadLimitReached() {
       "Read limit reached for BuilderArena, but it should have been unlimited.") {}
 }
 
+Maybe<Exception>* BuilderArena::getErrorRecord() {
+  return nullptr;
+}
+
 }  // namespace internal
 }  // namespace capnproto
@@ -48,6 +48,38 @@ class ReadLimiter;
 class Segment;
 typedef Id<uint32_t, Segment> SegmentId;
 
+template <bool enabled>
+class ReadCostCounter {
+  // Counts the parts of ReadCost that nothing else keeps track of.  ReadLimiter holds one of these
+  // selected by CAPNPROTO_READ_COST_ACCOUNTING; the disabled specialization below does nothing.
+
+public:
+  inline void farPointerFollowed() { ++farPointers; }
+  inline void nestingLimitReached(int nestingLimit) {
+    if (nestingLimit < minNestingLimit) minNestingLimit = nestingLimit;
+  }
+
+  inline uint getFarPointers() const { return farPointers; }
+  inline uint getDepth(int initialNestingLimit) const {
+    return minNestingLimit > initialNestingLimit ? 0 : initialNestingLimit - minNestingLimit + 1;
+  }
+
+private:
+  uint farPointers = 0;
+  int minNestingLimit = 0x7fffffff;
+  // Smallest nesting limit remaining at any object read.
+};
+
+template <>
+class ReadCostCounter<false> {
+public:
+  inline void farPointerFollowed() {}
+  inline void nestingLimitReached(int) {}
+
+  inline uint getFarPointers() const { return 0; }
+  inline uint getDepth(int) const { return 0; }
+};
+
 class ReadLimiter {
   // Used to keep track of how much data has been processed from a message, and cut off further
   // processing if and when a particular limit is reached.  This is primarily intended to guard
@@ -75,8 +107,15 @@ public:
   // Adds back some words to the limit.  Useful when the caller knows they are double-reading
   // some data.
 
+  inline WordCount64 getRemaining() { return limit; }
+  // How much is left of the limit.
+
+  typedef ReadCostCounter<CAPNPROTO_READ_COST_ACCOUNTING != 0> CostCounter;
+  inline CostCounter& getCostCounter() { return costCounter; }
+
 private:
   WordCount64 limit;
+  CostCounter costCounter;
 
   CAPNPROTO_DISALLOW_COPY(ReadLimiter);
 };
@@ -100,6 +139,10 @@ public:
   inline void unread(WordCount64 amount);
   // Add back some words to the ReadLimiter.
 
+  inline void farPointerFollowed();
+  inline void nestingLimitReached(int nestingLimit);
+  // Count towards MessageReader::getReadCost().  No-ops unless CAPNPROTO_READ_COST_ACCOUNTING.
+
 private:
   Arena* arena;
   SegmentId id;
@@ -145,6 +188,10 @@ public:
   // the VALIDATE_INPUT() macro which may throw an exception; if it return normally, the caller
   // will need to continue with default values.
 
+  virtual Maybe<Exception>* getErrorRecord() = 0;
+  // Where to record invalid input found in this arena, or null if it should be reported to the
+  // ExceptionCallback as usual.  See ReaderOptions::recordErrors.
+
   // TODO(someday):  Methods to deal with bundled capabilities.
 };
 
@@ -157,6 +204,10 @@ public:
   // implements Arena ------------------------------------------------
   SegmentReader* tryGetSegment(SegmentId id) override;
   void reportReadLimitReached() override;
+  Maybe<Exception>* getErrorRecord() override;
+
+  ReadCost getReadCost();
+  // Implements MessageReader::getReadCost().
 
 private:
   MessageReader* message;
@@ -192,6 +243,7 @@ public:
   // implements Arena ------------------------------------------------
   SegmentReader* tryGetSegment(SegmentId id) override;
   void reportReadLimitReached() override;
+  Maybe<Exception>* getErrorRecord() override;
 
 private:
   MessageBuilder* message;
@@ -250,6 +302,12 @@ inline WordCount SegmentReader::getOffsetTo(const word* ptr) {
 inline WordCount SegmentReader::getSize() { return ptr.size() * WORDS; }
 inline ArrayPtr<const word> SegmentReader::getArray() { return ptr; }
 inline void SegmentReader::unread(WordCount64 amount) { readLimiter->unread(amount); }
+inline void SegmentReader::farPointerFollowed() {
+  readLimiter->getCostCounter().farPointerFollowed();
+}
+inline void SegmentReader::nestingLimitReached(int nestingLimit) {
+  readLimiter->getCostCounter().nestingLimitReached(nestingLimit);
+}
 
 // -------------------------------------------------------------------
 
@@ -0,0 +1,155 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Benchmark regenerating schema files with the capnpc-capnp plugin.  This program is itself a
+// capnpc plugin:  it captures the CodeGeneratorRequest it is given, then feeds it to the real
+// plugin over and over, discarding the output, and reports the average time per run.  E.g.:
+//
+//     capnpc -o ./capnpc-capnp-bench src/capnproto/schema.capnp src/capnproto/test.capnp
+//
+// The plugin to run is taken from $CAPNPC_CAPNP (default: ./capnpc-capnp) and the number of
+// runs from $ITERATIONS (default: 200).  Each run is a separate process, as under capnpc, so
+// the time includes reading the request and loading the schemas as well as generating text.
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+
+namespace capnproto {
+namespace benchmark {
+namespace capnpccapnp {
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+std::string readAll(int fd) {
+  std::string result;
+  char buffer[65536];
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0) {
+      perror("read");
+      exit(1);
+    } else if (n == 0) {
+      return result;
+    }
+    result.append(buffer, n);
+  }
+}
+
+size_t runPlugin(const char* plugin, const std::string& request) {
+  // Runs the plugin once with `request` on stdin.  Returns the number of bytes it wrote.
+
+  int in[2], out[2];
+  if (pipe(in) < 0 || pipe(out) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(1);
+  } else if (child == 0) {
+    dup2(in[0], STDIN_FILENO);
+    dup2(out[1], STDOUT_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    execlp(plugin, plugin, (char*)nullptr);
+    perror(plugin);
+    _exit(1);
+  }
+
+  close(in[0]);
+  close(out[1]);
+
+  // The request is far bigger than a pipe buffer, so write it from another process while we
+  // drain the output here.
+  pid_t writer = fork();
+  if (writer == 0) {
+    close(out[0]);
+    const char* pos = request.data();
+    const char* end = pos + request.size();
+    while (pos < end) {
+      ssize_t n = write(in[1], pos, end - pos);
+      if (n <= 0) _exit(1);
+      pos += n;
+    }
+    _exit(0);
+  }
+  close(in[1]);
+
+  size_t outputSize = readAll(out[0]).size();
+  close(out[0]);
+
+  int status;
+  waitpid(writer, &status, 0);
+  waitpid(child, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed\n", plugin);
+    exit(1);
+  }
+  return outputSize;
+}
+
+int main(int argc, char* argv[]) {
+  const char* plugin = getenv("CAPNPC_CAPNP");
+  if (plugin == nullptr) plugin = "./capnpc-capnp";
+  const char* iterationsStr = getenv("ITERATIONS");
+  uint iterations = iterationsStr == nullptr ? 200 : strtoul(iterationsStr, nullptr, 0);
+
+  std::string request = readAll(STDIN_FILENO);
+
+  // Warm up, and find out how much text one run produces.
+  size_t outputSize = runPlugin(plugin, request);
+
+  uint64_t start = nowNanos();
+  for (uint i = 0; i < iterations; i++) {
+    runPlugin(plugin, request);
+  }
+  uint64_t time = nowNanos() - start;
+
+  // capnpc passes the plugin's stdout through, so report on stderr to keep it separate.
+  fprintf(stderr, "%u runs, %zu bytes in, %zu bytes out:  %.3f ms/run, %.1f MB/s\n",
+          iterations, request.size(), outputSize, time / 1e6 / iterations,
+          (double)outputSize * iterations / (time / 1e9) / 1e6);
+  return 0;
+}
+
+}  // namespace capnpccapnp
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::capnpccapnp::main(argc, argv);
+}
@@ -28,9 +28,11 @@
 #include "common.h"
 #include <capnproto/serialize.h>
 #include <capnproto/serialize-packed.h>
+#include <capnproto/serialize-shm.h>
 #include <capnproto/logging.h>
 #if HAVE_SNAPPY
 #include <capnproto/serialize-snappy.h>
+#include <capnproto/serialize-adaptive.h>
 #endif  // HAVE_SNAPPY
 #include <thread>
 
@@ -125,6 +127,53 @@ struct SnappyCompressed {
         arrayPtr(snappyCompressedBuffer, SNAPPY_COMPRESSED_BUFFER_SIZE));
   }
 };
+
+struct SnappyUnpacked {
+  typedef BufferedInputStreamWrapper BufferedInput;
+  typedef SnappyMessageReader MessageReader;
+
+  class ArrayMessageReader: private ArrayInputStream, public SnappyMessageReader {
+  public:
+    ArrayMessageReader(ArrayPtr<const byte> array,
+                       ReaderOptions options = ReaderOptions(),
+                       ArrayPtr<word> scratchSpace = nullptr)
+      : ArrayInputStream(array),
+        SnappyMessageReader(static_cast<ArrayInputStream&>(*this), options, scratchSpace) {}
+  };
+
+  static inline void write(OutputStream& output, MessageBuilder& builder) {
+    writeSnappyMessage(output, builder,
+        arrayPtr(snappyCompressedBuffer, SNAPPY_COMPRESSED_BUFFER_SIZE));
+  }
+};
+
+struct AdaptiveCompressed {
+  typedef BufferedInputStreamWrapper BufferedInput;
+
+  class MessageReader: public AdaptiveMessageReader {
+  public:
+    MessageReader(BufferedInputStream& input,
+                  ReaderOptions options = ReaderOptions(),
+                  ArrayPtr<word> scratchSpace = nullptr)
+      : AdaptiveMessageReader(input, options, scratchSpace,
+                              arrayPtr(snappyReadBuffer, SNAPPY_BUFFER_SIZE)) {}
+  };
+
+  class ArrayMessageReader: public AdaptiveMessageReader {
+  public:
+    ArrayMessageReader(ArrayPtr<const byte> array,
+                       ReaderOptions options = ReaderOptions(),
+                       ArrayPtr<word> scratchSpace = nullptr)
+      : AdaptiveMessageReader(array, options, scratchSpace,
+                              arrayPtr(snappyReadBuffer, SNAPPY_BUFFER_SIZE)) {}
+  };
+
+  static inline void write(OutputStream& output, MessageBuilder& builder) {
+    writeAdaptiveMessage(output, builder, AdaptiveWriterOptions(),
+        arrayPtr(snappyWriteBuffer, SNAPPY_BUFFER_SIZE),
+        arrayPtr(snappyCompressedBuffer, SNAPPY_COMPRESSED_BUFFER_SIZE));
+  }
+};
 #endif  // HAVE_SNAPPY
 
 // =======================================================================================
@@ -237,6 +286,16 @@ struct UseScratch {
 
 // =======================================================================================
 
+constexpr size_t SHM_RING_WORDS = 1024 * 1024;
+
+inline uint64_t messageSize(MessageBuilder& builder) {
+  uint64_t result = 0;
+  for (auto segment: builder.getSegmentsForOutput()) {
+    result += segment.size() * sizeof(word);
+  }
+  return result;
+}
+
 template <typename TestCase, typename ReuseStrategy, typename Compression>
 struct BenchmarkMethods {
   static uint64_t syncClient(int inputFd, int outputFd, uint64_t iters) {
@@ -331,6 +390,73 @@ struct BenchmarkMethods {
     return output.throughput;
   }
 
+  static uint64_t passByShm(uint64_t iters) {
+    // Compression doesn't apply here:  messages are built directly in shared memory and read in
+    // place, so there's no byte stream to compress.
+    ShmRing clientToServer(SHM_RING_WORDS);
+    ShmRing serverToClient(SHM_RING_WORDS);
+
+    int throughputPipe[2];
+    if (pipe(throughputPipe) < 0) throw OsException(errno);
+
+    pid_t child = fork();
+    if (child == 0) {
+      // Client.
+      close(throughputPipe[0]);
+      uint64_t throughput = 0;
+
+      for (; iters > 0; --iters) {
+        typename TestCase::Expectation expected;
+        {
+          ShmMessageBuilder builder(clientToServer);
+          expected = TestCase::setupRequest(
+              builder.template initRoot<typename TestCase::Request>());
+          throughput += messageSize(builder);
+          builder.send();
+        }
+
+        {
+          ShmMessageReader reader(serverToClient);
+          if (!TestCase::checkResponse(
+              reader.template getRoot<typename TestCase::Response>(), expected)) {
+            throw std::logic_error("Incorrect response.");
+          }
+        }
+      }
+
+      writeAll(throughputPipe[1], &throughput, sizeof(throughput));
+      exit(0);
+    } else {
+      // Server.
+      close(throughputPipe[1]);
+      uint64_t throughput = 0;
+
+      for (; iters > 0; --iters) {
+        ShmMessageReader reader(clientToServer);
+        ShmMessageBuilder builder(serverToClient);
+        TestCase::handleRequest(reader.template getRoot<typename TestCase::Request>(),
+                                builder.template initRoot<typename TestCase::Response>());
+        throughput += messageSize(builder);
+        builder.send();
+      }
+
+      uint64_t clientThroughput = 0;
+      readAll(throughputPipe[0], &clientThroughput, sizeof(clientThroughput));
+      close(throughputPipe[0]);
+      throughput += clientThroughput;
+
+      int status;
+      if (waitpid(child, &status, 0) != child) {
+        throw OsException(errno);
+      }
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::logic_error("Child exited abnormally.");
+      }
+
+      return throughput;
+    }
+  }
+
   static uint64_t passByObject(uint64_t iters, bool countObjectSize) {
     typename ReuseStrategy::ScratchSpace requestScratch;
     typename ReuseStrategy::ScratchSpace responseScratch;
@@ -405,6 +531,8 @@ struct BenchmarkTypes {
   typedef capnp::Packed Packed;
 #if HAVE_SNAPPY
   typedef capnp::SnappyCompressed SnappyCompressed;
+  typedef capnp::SnappyUnpacked SnappyUnpacked;
+  typedef capnp::AdaptiveCompressed AdaptiveCompressed;
 #endif  // HAVE_SNAPPY
 
   typedef capnp::UseScratch ReusableResources;
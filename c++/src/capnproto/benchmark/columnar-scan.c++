@@ -0,0 +1,184 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Compares scanning a large List(SearchResult) (the catrank benchmark's data) row by row against
+// scanning it after transcoding to columns with ColumnarList.  Reports nanoseconds per element for
+// each kind of scan, and for the transcoding itself.
+
+#include "catrank.capnp.h"
+#include "common.h"
+#include "../columnar.h"
+#include "../message.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+namespace capnproto {
+namespace benchmark {
+namespace columnarscan {
+
+using capnp::SearchResult;
+using capnp::SearchResultList;
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void fill(List<SearchResult>::Builder list) {
+  std::string snippet;
+  for (uint i = 0; i < list.size(); i++) {
+    SearchResult::Builder result = list[i];
+    result.setScore(fastRandDouble(1000));
+
+    static const char URL_PREFIX[] = "http://example.com/";
+    int urlSize = fastRand(100);
+    auto url = result.initUrl(urlSize + sizeof(URL_PREFIX));
+    strcpy(url.data(), URL_PREFIX);
+    char* pos = url.data() + strlen(URL_PREFIX);
+    for (int j = 0; j < urlSize; j++) {
+      *pos++ = 'a' + fastRand(26);
+    }
+
+    snippet.assign(" ");
+    int prefix = fastRand(20);
+    for (int j = 0; j < prefix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    if (fastRand(8) == 0) snippet.append("cat ");
+    int suffix = fastRand(20);
+    for (int j = 0; j < suffix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    result.setSnippet(snippet);
+  }
+}
+
+template <typename Func>
+double timePerElement(uint size, uint reps, Func&& func) {
+  uint64_t start = nowNanos();
+  for (uint i = 0; i < reps; i++) {
+    func();
+  }
+  return (double)(nowNanos() - start) / ((double)size * reps);
+}
+
+int main(int argc, char* argv[]) {
+  uint size = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+  uint reps = argc > 2 ? strtoul(argv[2], nullptr, 0) : 20;
+  static const double THRESHOLD = 900;
+
+  MallocMessageBuilder message;
+  fill(message.initRoot<SearchResultList>().initResults(size));
+
+  List<SearchResult>::Reader rows = message.getRoot<SearchResultList>().asReader().getResults();
+  DynamicList::Reader dynamicRows =
+      message.getRoot<DynamicStruct>(Schema::from<SearchResultList>()).asReader()
+          .get("results").as<DynamicList>();
+  StructSchema schema = dynamicRows.getSchema().getStructElementType();
+  StructSchema::Member scoreField = schema.getMemberByName("score");
+  StructSchema::Member snippetField = schema.getMemberByName("snippet");
+
+  // Keep the compiler from discarding the scans.
+  volatile double sink = 0;
+
+  printf("%-36s %10s\n", "scan", "ns/elem");
+
+  printf("%-36s %10.2f\n", "row: sum score > threshold",
+      timePerElement(size, reps, [&]() {
+        double sum = 0;
+        for (auto row: rows) {
+          double score = row.getScore();
+          if (score > THRESHOLD) sum += score;
+        }
+        sink = sum;
+      }));
+
+  printf("%-36s %10.2f\n", "row (dynamic): sum score > threshold",
+      timePerElement(size, reps, [&]() {
+        double sum = 0;
+        for (auto row: dynamicRows) {
+          double score = row.as<DynamicStruct>().get(scoreField).as<double>();
+          if (score > THRESHOLD) sum += score;
+        }
+        sink = sum;
+      }));
+
+  StructSchema::Member fields[2] = {scoreField, snippetField};
+  printf("%-36s %10.2f\n", "transcode score + snippet",
+      timePerElement(size, 1, [&]() {
+        ColumnarList columns(dynamicRows, arrayPtr(fields, 2));
+        sink = columns.getColumn<double>(scoreField)[0];
+      }));
+
+  ColumnarList columns(dynamicRows, arrayPtr(fields, 2));
+  ArrayPtr<const double> scores = columns.getColumn<double>(scoreField);
+  ArrayPtr<DynamicValue::Reader> snippets = columns.getPointerColumn(snippetField);
+
+  printf("%-36s %10.2f\n", "column: sum score > threshold",
+      timePerElement(size, reps, [&]() {
+        double sum = 0;
+        for (double score: scores) {
+          if (score > THRESHOLD) sum += score;
+        }
+        sink = sum;
+      }));
+
+  printf("%-36s %10.2f\n", "row: count cats with score > thresh",
+      timePerElement(size, reps, [&]() {
+        uint count = 0;
+        for (auto row: rows) {
+          if (row.getScore() > THRESHOLD &&
+              strstr(row.getSnippet().c_str(), " cat ") != nullptr) {
+            ++count;
+          }
+        }
+        sink = count;
+      }));
+
+  printf("%-36s %10.2f\n", "column: count cats with score > thresh",
+      timePerElement(size, reps, [&]() {
+        uint count = 0;
+        for (uint i = 0; i < size; i++) {
+          if (scores[i] > THRESHOLD &&
+              strstr(snippets[i].as<Text>().c_str(), " cat ") != nullptr) {
+            ++count;
+          }
+        }
+        sink = count;
+      }));
+
+  return 0;
+}
+
+}  // namespace columnarscan
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::columnarscan::main(argc, argv);
+}
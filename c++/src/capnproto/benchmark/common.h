@@ -223,6 +223,8 @@ uint64_t doBenchmark(const std::string& mode, uint64_t iters) {
     return passByPipe<BenchmarkMethods>(BenchmarkMethods::syncClient, iters);
   } else if (mode == "pipe-async") {
     return passByPipe<BenchmarkMethods>(BenchmarkMethods::asyncClient, iters);
+  } else if (mode == "shm") {
+    return BenchmarkMethods::passByShm(iters);
   } else {
     fprintf(stderr, "Unknown mode: %s\n", mode.c_str());
     exit(1);
@@ -258,6 +260,12 @@ uint64_t doBenchmark3(const std::string& mode, const std::string& reuse,
   } else if (compression == "snappy") {
     return doBenchmark2<BenchmarkTypes, TestCase, typename BenchmarkTypes::SnappyCompressed>(
         mode, reuse, iters);
+  } else if (compression == "snappy-unpacked") {
+    return doBenchmark2<BenchmarkTypes, TestCase, typename BenchmarkTypes::SnappyUnpacked>(
+        mode, reuse, iters);
+  } else if (compression == "adaptive") {
+    return doBenchmark2<BenchmarkTypes, TestCase, typename BenchmarkTypes::AdaptiveCompressed>(
+        mode, reuse, iters);
 #endif  // HAVE_SNAPPY
   } else {
     fprintf(stderr, "Unknown compression mode: %s\n", compression.c_str());
@@ -0,0 +1,203 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Measures JsonCodec on the catrank benchmark's data (mostly text) and the carsales benchmark's
+// data (mostly numbers, bools, and enums).  Encoding is compared against stringify(); decoding
+// parses the encoded corpus back into a fresh message each time.  Reports nanoseconds per element
+// and throughput, in MB of JSON text per second.
+
+#include "catrank.capnp.h"
+#include "carsales.capnp.h"
+#include "common.h"
+#include "../json.h"
+#include "../stringify.h"
+#include "../message.h"
+#include "../util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+namespace capnproto {
+namespace benchmark {
+namespace jsonperf {
+
+using capnp::SearchResult;
+using capnp::SearchResultList;
+using capnp::Car;
+using capnp::Color;
+using capnp::ParkingLot;
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void fill(List<SearchResult>::Builder list) {
+  std::string snippet;
+  for (uint i = 0; i < list.size(); i++) {
+    SearchResult::Builder result = list[i];
+    result.setScore(fastRandDouble(1000));
+
+    static const char URL_PREFIX[] = "http://example.com/";
+    int urlSize = fastRand(100);
+    auto url = result.initUrl(urlSize + sizeof(URL_PREFIX));
+    strcpy(url.data(), URL_PREFIX);
+    char* pos = url.data() + strlen(URL_PREFIX);
+    for (int j = 0; j < urlSize; j++) {
+      *pos++ = 'a' + fastRand(26);
+    }
+
+    snippet.assign(" ");
+    int prefix = fastRand(20);
+    for (int j = 0; j < prefix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    if (fastRand(8) == 0) snippet.append("\"cat\" ");
+    int suffix = fastRand(20);
+    for (int j = 0; j < suffix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    result.setSnippet(snippet);
+  }
+}
+
+void randomCar(Car::Builder car) {
+  static const char* const MAKES[] = { "Toyota", "GM", "Ford", "Honda", "Tesla" };
+  static const char* const MODELS[] = { "Camry", "Prius", "Volt", "Accord", "Leaf", "Model S" };
+
+  car.setMake(MAKES[fastRand(sizeof(MAKES) / sizeof(MAKES[0]))]);
+  car.setModel(MODELS[fastRand(sizeof(MODELS) / sizeof(MODELS[0]))]);
+
+  car.setColor((Color)fastRand((uint)Color::SILVER + 1));
+  car.setSeats(2 + fastRand(6));
+  car.setDoors(2 + fastRand(3));
+
+  for (auto wheel: car.initWheels(4)) {
+    wheel.setDiameter(25 + fastRand(15));
+    wheel.setAirPressure(30 + fastRandDouble(20));
+    wheel.setSnowTires(fastRand(16) == 0);
+  }
+
+  car.setLength(170 + fastRand(150));
+  car.setWidth(48 + fastRand(36));
+  car.setHeight(54 + fastRand(48));
+  car.setWeight(car.getLength() * car.getWidth() * car.getHeight() / 200);
+
+  auto engine = car.initEngine();
+  engine.setHorsepower(100 * fastRand(400));
+  engine.setCylinders(4 + 2 * fastRand(3));
+  engine.setCc(800 + fastRand(10000));
+  engine.setUsesGas(true);
+  engine.setUsesElectric(fastRand(2));
+
+  car.setFuelCapacity(10.0 + fastRandDouble(30.0));
+  car.setFuelLevel(fastRandDouble(car.getFuelCapacity()));
+  car.setHasPowerWindows(fastRand(2));
+  car.setHasPowerSteering(fastRand(2));
+  car.setHasCruiseControl(fastRand(2));
+  car.setCupHolders(fastRand(12));
+  car.setHasNavSystem(fastRand(2));
+}
+
+template <typename Func>
+void report(const char* name, uint size, uint reps, size_t outputBytes, Func&& func) {
+  uint64_t start = nowNanos();
+  for (uint i = 0; i < reps; i++) {
+    func();
+  }
+  double nanos = nowNanos() - start;
+  printf("%-36s %10.2f %10.1f\n", name,
+         nanos / ((double)size * reps), (double)outputBytes * reps / nanos * 1000);
+}
+
+void run(const char* title, DynamicStruct::Reader root, uint size, uint reps) {
+  JsonCodec json;
+
+  size_t stringifyBytes = capnproto::stringify(root).size();
+  size_t jsonBytes = json.encode(root).size();
+
+  // Keep the compiler from discarding the output.
+  volatile size_t sink = 0;
+
+  printf("%-36s %10s %10s\n", title, "ns/elem", "MB/s");
+
+  report("stringify() -> String", size, reps, stringifyBytes, [&]() {
+    sink = capnproto::stringify(root).size();
+  });
+
+  report("JsonCodec::encode() -> String", size, reps, jsonBytes, [&]() {
+    sink = json.encode(root).size();
+  });
+
+  Array<byte> buffer = newArray<byte>(jsonBytes);
+  report("JsonCodec::encode() -> ArrayOutputStream", size, reps, jsonBytes, [&]() {
+    ArrayOutputStream out(buffer);
+    json.encode(root, out);
+    sink = out.getArray().size();
+  });
+
+  String text = json.encode(root);
+  report("JsonCodec::decode()", size, reps, jsonBytes, [&]() {
+    MallocMessageBuilder message;
+    json.decode(arrayPtr(text.begin(), text.size()),
+                message.initRoot<DynamicStruct>(root.getSchema()));
+    sink = message.getSegmentsForOutput().size();
+  });
+
+  printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+  uint size = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+  uint reps = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+  {
+    MallocMessageBuilder message;
+    fill(message.initRoot<SearchResultList>().initResults(size));
+    run("catrank", message.getRoot<DynamicStruct>(Schema::from<SearchResultList>()).asReader(),
+        size, reps);
+  }
+
+  {
+    MallocMessageBuilder message;
+    for (auto car: message.initRoot<ParkingLot>().initCars(size)) {
+      randomCar(car);
+    }
+    run("carsales", message.getRoot<DynamicStruct>(Schema::from<ParkingLot>()).asReader(),
+        size, reps);
+  }
+
+  return 0;
+}
+
+}  // namespace jsonperf
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::jsonperf::main(argc, argv);
+}
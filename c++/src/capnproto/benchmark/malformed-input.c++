@@ -0,0 +1,183 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Measures how fast a server can get through a stream of incoming messages when some of them are
+// malformed, i.e. when VALIDATE_INPUT fails and an exception is raised for a fraction of the
+// input.  Each message is a small catrank SearchResultList.  A malformed message has either a
+// corrupt root pointer or a truncated segment, so that reading it fails either immediately or
+// partway through.  Reports throughput under each Exception::TraceMode, and with
+// ReaderOptions::recordErrors, where no exception is thrown at all.
+
+#include "catrank.capnp.h"
+#include "common.h"
+#include "../serialize.h"
+#include "../exception.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace capnproto {
+namespace benchmark {
+namespace malformedinput {
+
+using capnp::SearchResult;
+using capnp::SearchResultList;
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Array<word> makeMessage(uint resultCount) {
+  MallocMessageBuilder message;
+  auto list = message.initRoot<SearchResultList>().initResults(resultCount);
+  std::string snippet;
+  for (uint i = 0; i < resultCount; i++) {
+    SearchResult::Builder result = list[i];
+    result.setScore(fastRandDouble(1000));
+    result.setUrl("http://example.com/");
+    snippet.clear();
+    int count = fastRand(20);
+    for (int j = 0; j < count; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    result.setSnippet(snippet);
+  }
+  return messageToFlatArray(message);
+}
+
+void corrupt(Array<word>& message, bool truncate) {
+  // A single-segment flat message starts with a one-word segment table -- the segment count minus
+  // one, then the segment size -- followed by the segment itself, whose first word is the root
+  // pointer.
+  uint32_t* table = reinterpret_cast<uint32_t*>(message.begin());
+  if (truncate) {
+    // Keep the root struct but cut off the list it points to.
+    table[1] = 2;
+  } else {
+    // Point the root far outside the segment.
+    uint32_t* root = reinterpret_cast<uint32_t*>(message.begin() + 1);
+    root[0] = 0x1fffffffu << 2;
+  }
+}
+
+uint64_t read(MessageReader& reader) {
+  uint64_t total = 0;
+  for (SearchResult::Reader result: reader.getRoot<SearchResultList>().getResults()) {
+    total += result.getUrl().size() + result.getSnippet().size() + (uint64_t)result.getScore();
+  }
+  return total;
+}
+
+uint64_t process(ArrayPtr<const word> data, uint& errors) {
+  try {
+    FlatArrayMessageReader reader(data);
+    return read(reader);
+  } catch (const Exception& e) {
+    ++errors;
+    return 0;
+  }
+}
+
+uint64_t processRecordingErrors(ArrayPtr<const word> data, uint& errors) {
+  ReaderOptions options;
+  options.recordErrors = true;
+  FlatArrayMessageReader reader(data, options);
+  uint64_t total = read(reader);
+  if (reader.hasError()) {
+    ++errors;
+    return 0;
+  }
+  return total;
+}
+
+int main(int argc, char* argv[]) {
+  uint count = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10000;
+  uint reps = argc > 2 ? strtoul(argv[2], nullptr, 0) : 100;
+  uint malformedPercent = argc > 3 ? strtoul(argv[3], nullptr, 0) : 1;
+
+  std::vector<Array<word>> messages;
+  for (uint i = 0; i < count; i++) {
+    messages.push_back(makeMessage(10));
+    if (fastRandDouble(100) < malformedPercent) {
+      corrupt(messages.back(), fastRand(2) == 0);
+    }
+  }
+
+  // Keep the compiler from discarding the work.
+  volatile uint64_t sink = 0;
+
+  printf("%u messages, %u%% malformed\n", count, malformedPercent);
+  printf("%-24s %12s %10s\n", "errors", "messages/s", "ns/msg");
+
+  struct Mode {
+    const char* name;
+    Exception::TraceMode mode;
+  };
+  static const Mode MODES[] = {
+    { "thrown, traced", Exception::TraceMode::ALWAYS },
+    { "thrown, 1 in 100 traced", Exception::TraceMode::SAMPLED },
+    { "thrown, untraced", Exception::TraceMode::NEVER },
+  };
+
+  auto run = [&](const char* name, uint64_t (*process)(ArrayPtr<const word> data, uint& errors)) {
+    uint errors = 0;
+    uint64_t start = nowNanos();
+    for (uint r = 0; r < reps; r++) {
+      for (auto& message: messages) {
+        sink = sink + process(message, errors);
+      }
+    }
+    double nanos = nowNanos() - start;
+    double total = (double)count * reps;
+    printf("%-24s %12.0f %10.1f   (%u errors)\n", name,
+           total / nanos * 1e9, nanos / total, errors);
+  };
+
+  for (const Mode& mode: MODES) {
+    Exception::setTraceMode(mode.mode, 100);
+    run(mode.name, &process);
+  }
+
+  // The first error in each message is still described, so trace that as little as the fastest
+  // exception mode does.
+  Exception::setTraceMode(Exception::TraceMode::NEVER);
+  run("recorded, untraced", &processRecordingErrors);
+
+  Exception::setTraceMode(Exception::TraceMode::ALWAYS);
+  return 0;
+}
+
+}  // namespace malformedinput
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::malformedinput::main(argc, argv);
+}
@@ -155,6 +155,11 @@ struct BenchmarkMethods {
     fprintf(stderr, "Null benchmark doesn't do I/O.\n");
     exit(1);
   }
+
+  static uint64_t passByShm(uint64_t iters) {
+    fprintf(stderr, "Null benchmark doesn't do I/O.\n");
+    exit(1);
+  }
 };
 
 struct BenchmarkTypes {
@@ -162,6 +167,8 @@ struct BenchmarkTypes {
   typedef void Packed;
 #if HAVE_SNAPPY
   typedef void SnappyCompressed;
+  typedef void SnappyUnpacked;
+  typedef void AdaptiveCompressed;
 #endif  // HAVE_SNAPPY
 
   typedef ReusableObjects ReusableResources;
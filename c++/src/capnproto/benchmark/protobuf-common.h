@@ -339,6 +339,11 @@ struct BenchmarkMethods {
 
     return throughput;
   }
+
+  static uint64_t passByShm(uint64_t iters) {
+    fprintf(stderr, "Protobuf benchmark doesn't support shared memory.\n");
+    exit(1);
+  }
 };
 
 struct BenchmarkTypes {
@@ -346,6 +351,8 @@ struct BenchmarkTypes {
   typedef protobuf::Uncompressed Packed;
 #if HAVE_SNAPPY
   typedef protobuf::SnappyCompressed SnappyCompressed;
+  typedef protobuf::SnappyCompressed SnappyUnpacked;
+  typedef protobuf::Uncompressed AdaptiveCompressed;
 #endif  // HAVE_SNAPPY
 
   typedef protobuf::ReusableMessages ReusableResources;
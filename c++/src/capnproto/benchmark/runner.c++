@@ -113,7 +113,8 @@ enum class Mode {
   OBJECT_SIZE,
   BYTES,
   PIPE_SYNC,
-  PIPE_ASYNC
+  PIPE_ASYNC,
+  SHM
 };
 
 enum class Reuse {
@@ -124,7 +125,9 @@ enum class Reuse {
 enum class Compression {
   NONE,
   PACKED,
-  SNAPPY
+  SNAPPY,
+  SNAPPY_UNPACKED,
+  ADAPTIVE
 };
 
 TestResult runTest(Product product, TestCase testCase, Mode mode, Reuse reuse,
@@ -164,6 +167,9 @@ TestResult runTest(Product product, TestCase testCase, Mode mode, Reuse reuse,
     case Mode::PIPE_ASYNC:
       argv[1] = strdup("pipe-async");
       break;
+    case Mode::SHM:
+      argv[1] = strdup("shm");
+      break;
   }
 
   switch (reuse) {
@@ -185,6 +191,12 @@ TestResult runTest(Product product, TestCase testCase, Mode mode, Reuse reuse,
     case Compression::SNAPPY:
       argv[3] = strdup("snappy");
       break;
+    case Compression::SNAPPY_UNPACKED:
+      argv[3] = strdup("snappy-unpacked");
+      break;
+    case Compression::ADAPTIVE:
+      argv[3] = strdup("adaptive");
+      break;
   }
 
   char itersStr[64];
@@ -286,6 +298,36 @@ void reportOldNewComparisonHeader() {
   cout << setfill('=') << setw(85) << "" << setfill(' ') << endl;
 }
 
+void reportCompressionTradeoffHeader() {
+  cout << setw(40) << left << "Cap'n Proto compression"
+       << setw(15) << right << "I/O user us"
+       << setw(15) << right << "I/O bytes"
+       << setw(15) << right << "bytes saved"
+       << endl;
+  cout << setfill('=') << setw(85) << "" << setfill(' ') << endl;
+}
+
+void reportCompressionTradeoff(const char* name, TestResult base, TestResult uncompressed,
+                               TestResult result, uint64_t iters) {
+  // CPU time is measured relative to pass-by-object, like "I/O time" in the main comparison.
+  // Savings are relative to sending the same messages uncompressed.
+  cout << setw(40) << left << name
+       << setw(15) << fixed << right << setprecision(2)
+       << (((int64_t)result.time.user - (int64_t)base.time.user) / 1000.0 / iters)
+       << setw(15) << right << (result.messageSize / iters)
+       << setw(14) << right << (int)(100 - result.messageSize * 100.0 / uncompressed.messageSize)
+       << "%" << endl;
+}
+
+void reportPipeShmComparisonHeader() {
+  cout << setw(40) << left << "Measure"
+       << setw(15) << right << "Pipe"
+       << setw(15) << right << "Shm"
+       << setw(15) << right << "Improvement"
+       << endl;
+  cout << setfill('=') << setw(85) << "" << setfill(' ') << endl;
+}
+
 class Gain {
 public:
   Gain(double oldValue, double newValue)
@@ -380,12 +422,16 @@ int main(int argc, char* argv[]) {
       mode = Mode::PIPE_ASYNC;
     } else if (arg == "inmem") {
       mode = Mode::BYTES;
+    } else if (arg == "shm") {
+      mode = Mode::SHM;
     } else if (arg == "eval") {
       testCase = TestCase::EVAL;
     } else if (arg == "carsales") {
       testCase = TestCase::CARSALES;
     } else if (arg == "snappy") {
       compression = Compression::SNAPPY;
+    } else if (arg == "adaptive") {
+      compression = Compression::ADAPTIVE;
     } else if (arg == "-c") {
       ++i;
       if (i == argc) {
@@ -446,6 +492,12 @@ int main(int argc, char* argv[]) {
       cout << "  * with client and server in separate processes" << endl;
       cout << "  * client sends as many simultaneous requests as it can" << endl;
       break;
+    case Mode::SHM:
+      cout << "* shared memory ring I/O for Cap'n Proto, pipe I/O for Protobuf" << endl;
+      cout << "  * with client and server in separate processes" << endl;
+      cout << "  * client waits for each response before sending next request" << endl;
+      cout << "  * compression applies only to pipe I/O" << endl;
+      break;
   }
   switch (compression) {
     case Compression::NONE:
@@ -458,6 +510,13 @@ int main(int argc, char* argv[]) {
     case Compression::SNAPPY:
       cout << "* Snappy compression" << endl;
       break;
+    case Compression::SNAPPY_UNPACKED:
+      // Not selectable from the command line; only run alongside SNAPPY.
+      break;
+    case Compression::ADAPTIVE:
+      cout << "* per-message choice of none, packed, or Snappy for Cap'n Proto" << endl;
+      cout << "* no compression for Protobuf" << endl;
+      break;
   }
 
   cout << endl;
@@ -496,8 +555,12 @@ int main(int argc, char* argv[]) {
       Product::CAPNPROTO, testCase, Mode::OBJECT_SIZE, Reuse::NO, compression, iters).objectSize;
   reportResults("Cap'n Proto w/o object reuse", iters, capnpNoReuse);
 
+  // Only Cap'n Proto has a shared memory transport.  Everything else falls back to pipes, since
+  // packing and compression need a byte stream.
+  Mode streamMode = mode == Mode::SHM ? Mode::PIPE_SYNC : mode;
+
   TestResult protobuf = runTest(
-      Product::PROTOBUF, testCase, mode, Reuse::YES, compression, iters);
+      Product::PROTOBUF, testCase, streamMode, Reuse::YES, compression, iters);
   protobuf.objectSize = protobufBase.objectSize;
   reportResults("Protobuf I/O", iters, protobuf);
 
@@ -506,10 +569,47 @@ int main(int argc, char* argv[]) {
   capnp.objectSize = capnpBase.objectSize;
   reportResults("Cap'n Proto I/O", iters, capnp);
   TestResult capnpPacked = runTest(
-      Product::CAPNPROTO, testCase, mode, Reuse::YES, Compression::PACKED, iters);
+      Product::CAPNPROTO, testCase, streamMode, Reuse::YES, Compression::PACKED, iters);
   capnpPacked.objectSize = capnpBase.objectSize;
   reportResults("Cap'n Proto packed I/O", iters, capnpPacked);
 
+  TestResult capnpSnappyUnpacked;
+  if (compression == Compression::SNAPPY) {
+    capnpSnappyUnpacked = runTest(
+        Product::CAPNPROTO, testCase, streamMode, Reuse::YES, Compression::SNAPPY_UNPACKED, iters);
+    capnpSnappyUnpacked.objectSize = capnpBase.objectSize;
+    reportResults("Cap'n Proto unpacked snappy I/O", iters, capnpSnappyUnpacked);
+  }
+
+  TestResult capnpUncompressed;
+  TestResult capnpSnappy;
+  TestResult capnpAdaptive = capnp;
+  if (compression == Compression::ADAPTIVE) {
+    if (mode == Mode::SHM) {
+      // The ring doesn't compress, so measure adaptive compression over a pipe.
+      capnpAdaptive = runTest(
+          Product::CAPNPROTO, testCase, streamMode, Reuse::YES, Compression::ADAPTIVE, iters);
+      capnpAdaptive.objectSize = capnpBase.objectSize;
+      reportResults("Cap'n Proto adaptive pipe I/O", iters, capnpAdaptive);
+    }
+    capnpUncompressed = runTest(
+        Product::CAPNPROTO, testCase, streamMode, Reuse::YES, Compression::NONE, iters);
+    capnpUncompressed.objectSize = capnpBase.objectSize;
+    reportResults("Cap'n Proto uncompressed I/O", iters, capnpUncompressed);
+    capnpSnappy = runTest(
+        Product::CAPNPROTO, testCase, streamMode, Reuse::YES, Compression::SNAPPY, iters);
+    capnpSnappy.objectSize = capnpBase.objectSize;
+    reportResults("Cap'n Proto snappy I/O", iters, capnpSnappy);
+  }
+
+  TestResult capnpPipe;
+  if (mode == Mode::SHM) {
+    capnpPipe = runTest(
+        Product::CAPNPROTO, testCase, Mode::PIPE_SYNC, Reuse::YES, compression, iters);
+    capnpPipe.objectSize = capnpBase.objectSize;
+    reportResults("Cap'n Proto pipe I/O", iters, capnpPipe);
+  }
+
   size_t protobufBinarySize = fileSize("protobuf-" + std::string(testCaseName(testCase)));
   size_t capnpBinarySize = fileSize("capnproto-" + std::string(testCaseName(testCase)));
   size_t protobufCodeSize = fileSize(std::string(testCaseName(testCase)) + ".pb.cc")
@@ -586,6 +686,13 @@ int main(int argc, char* argv[]) {
   reportIntComparison("message size (bytes)", "", protobuf.messageSize, capnp.messageSize, iters);
   reportIntComparison("packed message size (bytes)", "",
                       protobuf.messageSize, capnpPacked.messageSize, iters);
+  if (compression == Compression::SNAPPY) {
+    reportComparison("unpacked snappy I/O time (us)", "",
+        ((int64_t)protobuf.time.user - (int64_t)protobufBase.time.user) / 1000.0,
+        ((int64_t)capnpSnappyUnpacked.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
+    reportIntComparison("unpacked snappy message size (bytes)", "",
+                        protobuf.messageSize, capnpSnappyUnpacked.messageSize, iters);
+  }
 
   reportComparison("binary size (KiB)", "",
       protobufBinarySize / 1024.0, capnpBinarySize / 1024.0, 1);
@@ -594,6 +701,30 @@ int main(int argc, char* argv[]) {
   reportComparison("generated obj size (KiB)", "",
       protobufObjSize / 1024.0, capnpObjSize / 1024.0, 1);
 
+  if (compression == Compression::ADAPTIVE) {
+    cout << endl;
+    reportCompressionTradeoffHeader();
+
+    reportCompressionTradeoff("none", capnpBase, capnpUncompressed, capnpUncompressed, iters);
+    reportCompressionTradeoff("packed", capnpBase, capnpUncompressed, capnpPacked, iters);
+    reportCompressionTradeoff("snappy", capnpBase, capnpUncompressed, capnpSnappy, iters);
+    reportCompressionTradeoff("adaptive", capnpBase, capnpUncompressed, capnpAdaptive, iters);
+  }
+
+  if (mode == Mode::SHM) {
+    cout << endl;
+    reportPipeShmComparisonHeader();
+
+    reportComparison("I/O time (us)", "",
+        ((int64_t)capnpPipe.time.user - (int64_t)capnpBase.time.user) / 1000.0,
+        ((int64_t)capnp.time.user - (int64_t)capnpBase.time.user) / 1000.0, iters);
+    reportComparison("I/O sys time (us)", "",
+        ((int64_t)capnpPipe.time.sys - (int64_t)capnpBase.time.sys) / 1000.0,
+        ((int64_t)capnp.time.sys - (int64_t)capnpBase.time.sys) / 1000.0, iters);
+    reportComparison("round trip wall time (us)", "",
+        capnpPipe.time.real / 1000.0, capnp.time.real / 1000.0, iters);
+  }
+
   if (oldDir != nullptr) {
     cout << endl;
     reportOldNewComparisonHeader();
@@ -0,0 +1,124 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Microbenchmark for schema name and dependency lookups on wide structs.  Builds structs with
+// varying numbers of enum-typed fields via SchemaLoader and reports the average cost of
+// StructSchema::findMemberByName() and Schema::getDependency().
+
+#include "../schema-loader.h"
+#include "../message.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace capnproto {
+namespace benchmark {
+namespace schemalookup {
+
+static const uint64_t STRUCT_ID = 0x8000000000000000ull;
+
+uint64_t enumId(uint i) {
+  // Scatter IDs the way randomly-generated ones would be.
+  return 0x9e3779b97f4a7c15ull * (i + 1) | 0x8000000000000000ull;
+}
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+StructSchema loadWideStruct(SchemaLoader& loader, uint width, std::vector<std::string>& names) {
+  MallocMessageBuilder message;
+  auto node = message.initRoot<schema::Node>();
+  node.setId(STRUCT_ID);
+  node.setDisplayName("bench.Wide");
+
+  auto structNode = node.getBody().initStructNode();
+  structNode.setDataSectionWordSize((width + 3) / 4);
+  structNode.setPointerSectionSize(0);
+  structNode.setPreferredListEncoding(schema::ElementSize::INLINE_COMPOSITE);
+
+  auto members = structNode.initMembers(width);
+  for (uint i = 0; i < width; i++) {
+    names.push_back("field" + std::to_string(i));
+    auto member = members[i];
+    member.setName(names.back().c_str());
+    member.setOrdinal(i);
+    member.setCodeOrder(i);
+    auto field = member.getBody().initFieldMember();
+    field.setOffset(i);
+    field.getType().getBody().setEnumType(enumId(i));
+    field.getDefaultValue().getBody().setEnumValue(0);
+  }
+
+  // Dependencies which were never loaded are filled in with empty placeholders.
+  return loader.load(node).asStruct();
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t iters = argc > 1 ? strtoull(argv[1], nullptr, 0) : 10000000;
+
+  printf("%8s %16s %16s\n", "width", "ns/name lookup", "ns/dep lookup");
+
+  for (uint width: {4, 16, 64, 256, 1024}) {
+    SchemaLoader loader;
+    std::vector<std::string> names;
+    names.reserve(width);
+    StructSchema schema = loadWideStruct(loader, width, names);
+
+    uint64_t found = 0;
+    uint64_t start = nowNanos();
+    for (uint64_t i = 0; i < iters; i++) {
+      found += schema.findMemberByName(names[i % width]) != nullptr;
+    }
+    uint64_t nameTime = nowNanos() - start;
+
+    start = nowNanos();
+    for (uint64_t i = 0; i < iters; i++) {
+      found += schema.getDependency(enumId(i % width)).getProto().getId() != 0;
+    }
+    uint64_t depTime = nowNanos() - start;
+
+    if (found != iters * 2) {
+      fprintf(stderr, "lookup failed\n");
+      return 1;
+    }
+
+    printf("%8u %16.1f %16.1f\n", width,
+           (double)nameTime / iters, (double)depTime / iters);
+  }
+
+  return 0;
+}
+
+}  // namespace schemalookup
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::schemalookup::main(argc, argv);
+}
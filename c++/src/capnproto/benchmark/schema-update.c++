@@ -0,0 +1,140 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Benchmark replaying a stream of schema updates into a SchemaLoader, the way a consumer that
+// receives schemas from many producers would see them:  a handful of types, each sent over and
+// over in one of a few versions, mostly the same version it already has.  Reports the average
+// cost of SchemaLoader::load() per update.
+
+#include "../schema-loader.h"
+#include "../message.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+namespace capnproto {
+namespace benchmark {
+namespace schemaupdate {
+
+static const uint FIELD_COUNT = 32;
+// Fields in the oldest version of each type.  Each later version adds one more.
+
+uint64_t typeId(uint i) {
+  return 0x9e3779b97f4a7c15ull * (i + 1) | 0x8000000000000000ull;
+}
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void buildVersion(MallocMessageBuilder& message, uint type, uint version,
+                  std::vector<std::string>& names) {
+  uint width = FIELD_COUNT + version;
+
+  auto node = message.initRoot<schema::Node>();
+  node.setId(typeId(type));
+  node.setDisplayName("bench.Type");
+
+  auto structNode = node.getBody().initStructNode();
+  structNode.setDataSectionWordSize(width);
+  structNode.setPointerSectionSize(0);
+  structNode.setPreferredListEncoding(schema::ElementSize::INLINE_COMPOSITE);
+
+  auto members = structNode.initMembers(width);
+  for (uint i = 0; i < width; i++) {
+    auto member = members[i];
+    member.setName(names[i].c_str());
+    member.setOrdinal(i);
+    member.setCodeOrder(i);
+    auto field = member.getBody().initFieldMember();
+    field.setOffset(i);
+    field.getType().getBody().setUint64Type(Void::VOID);
+    field.getDefaultValue().getBody().setUint64Value(0);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  uint64_t updates = argc > 1 ? strtoull(argv[1], nullptr, 0) : 100000;
+  uint typeCount = argc > 2 ? strtoul(argv[2], nullptr, 0) : 16;
+  uint versionCount = argc > 3 ? strtoul(argv[3], nullptr, 0) : 4;
+
+  std::vector<std::string> names;
+  for (uint i = 0; i < FIELD_COUNT + versionCount; i++) {
+    names.push_back("field" + std::to_string(i));
+  }
+
+  // All versions of all types, as a producer would send them.
+  std::vector<MallocMessageBuilder*> nodes;
+  for (uint type = 0; type < typeCount; type++) {
+    for (uint version = 0; version < versionCount; version++) {
+      nodes.push_back(new MallocMessageBuilder);
+      buildVersion(*nodes.back(), type, version, names);
+    }
+  }
+
+  // Most updates resend the newest version; some producers lag behind and send older ones.
+  std::vector<schema::Node::Reader> stream;
+  stream.reserve(updates);
+  srand(1234);
+  for (uint64_t i = 0; i < updates; i++) {
+    uint type = rand() % typeCount;
+    uint version = rand() % 4 == 0 ? rand() % versionCount : versionCount - 1;
+    stream.push_back(nodes[type * versionCount + version]->getRoot<schema::Node>().asReader());
+  }
+
+  SchemaLoader loader;
+  uint64_t start = nowNanos();
+  for (auto node: stream) {
+    loader.load(node);
+  }
+  uint64_t time = nowNanos() - start;
+
+  for (uint type = 0; type < typeCount; type++) {
+    if (loader.get(typeId(type)).asStruct().getMembers().size() !=
+        FIELD_COUNT + versionCount - 1) {
+      fprintf(stderr, "newest version was not kept\n");
+      return 1;
+    }
+  }
+
+  printf("%" PRIu64 " updates of %u types x %u versions:  %.1f ns/update\n",
+         updates, typeCount, versionCount, (double)time / updates);
+
+  for (auto node: nodes) {
+    delete node;
+  }
+  return 0;
+}
+
+}  // namespace schemaupdate
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::schemaupdate::main(argc, argv);
+}
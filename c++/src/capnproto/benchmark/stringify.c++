@@ -0,0 +1,279 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Compares stringify() against the std::ostream-based printer it replaced, on the catrank
+// benchmark's data:  a large List(SearchResult), which is mostly text plus one float per element.
+// Reports nanoseconds per element and output throughput for each way of producing the text.
+
+#include "catrank.capnp.h"
+#include "common.h"
+#include "../stringify.h"
+#include "../message.h"
+#include "../util.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+
+namespace capnproto {
+namespace benchmark {
+namespace stringifyperf {
+
+using capnp::SearchResult;
+using capnp::SearchResultList;
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void fill(List<SearchResult>::Builder list) {
+  std::string snippet;
+  for (uint i = 0; i < list.size(); i++) {
+    SearchResult::Builder result = list[i];
+    result.setScore(fastRandDouble(1000));
+
+    static const char URL_PREFIX[] = "http://example.com/";
+    int urlSize = fastRand(100);
+    auto url = result.initUrl(urlSize + sizeof(URL_PREFIX));
+    strcpy(url.data(), URL_PREFIX);
+    char* pos = url.data() + strlen(URL_PREFIX);
+    for (int j = 0; j < urlSize; j++) {
+      *pos++ = 'a' + fastRand(26);
+    }
+
+    snippet.assign(" ");
+    int prefix = fastRand(20);
+    for (int j = 0; j < prefix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    if (fastRand(8) == 0) snippet.append("\"cat\" ");
+    int suffix = fastRand(20);
+    for (int j = 0; j < suffix; j++) {
+      snippet.append(WORDS[fastRand(WORDS_COUNT)]);
+    }
+    result.setSnippet(snippet);
+  }
+}
+
+// The previous implementation of stringify(), for comparison.
+void legacyPrint(std::ostream& os, DynamicValue::Reader value, schema::Type::Body::Which which) {
+  static const char HEXDIGITS[] = "0123456789abcdef";
+
+  switch (value.getType()) {
+    case DynamicValue::UNKNOWN:
+    case DynamicValue::INTERFACE:
+      os << "?";
+      break;
+    case DynamicValue::VOID:
+      os << "void";
+      break;
+    case DynamicValue::BOOL:
+      os << (value.as<bool>() ? "true" : "false");
+      break;
+    case DynamicValue::INT:
+      os << value.as<int64_t>();
+      break;
+    case DynamicValue::UINT:
+      os << value.as<uint64_t>();
+      break;
+    case DynamicValue::FLOAT: {
+      if (which == schema::Type::Body::FLOAT32_TYPE) {
+        auto buf = STR * value.as<float>();
+        os.write(buf.begin(), buf.size());
+      } else {
+        auto buf = STR * value.as<double>();
+        os.write(buf.begin(), buf.size());
+      }
+      break;
+    }
+    case DynamicValue::TEXT:
+    case DynamicValue::DATA: {
+      os << '\"';
+      for (char c: value.as<Data>()) {
+        switch (c) {
+          case '\a': os << "\\a"; break;
+          case '\b': os << "\\b"; break;
+          case '\f': os << "\\f"; break;
+          case '\n': os << "\\n"; break;
+          case '\r': os << "\\r"; break;
+          case '\t': os << "\\t"; break;
+          case '\v': os << "\\v"; break;
+          case '\'': os << "\\\'"; break;
+          case '\"': os << "\\\""; break;
+          case '\\': os << "\\\\"; break;
+          default:
+            if (c < 0x20) {
+              uint8_t c2 = c;
+              os << "\\x" << HEXDIGITS[c2 / 16] << HEXDIGITS[c2 % 16];
+            } else {
+              os << c;
+            }
+            break;
+        }
+      }
+      os << '\"';
+      break;
+    }
+    case DynamicValue::LIST: {
+      os << "[";
+      bool first = true;
+      auto listValue = value.as<DynamicList>();
+      for (auto element: listValue) {
+        if (first) {
+          first = false;
+        } else {
+          os << ", ";
+        }
+        legacyPrint(os, element, listValue.getSchema().whichElementType());
+      }
+      os << "]";
+      break;
+    }
+    case DynamicValue::ENUM: {
+      auto enumValue = value.as<DynamicEnum>();
+      Maybe<EnumSchema::Enumerant> enumerant = enumValue.getEnumerant();
+      if (enumerant == nullptr) {
+        os << enumValue.getRaw();
+      } else {
+        os << enumerant->getProto().getName().c_str();
+      }
+      break;
+    }
+    case DynamicValue::STRUCT: {
+      os << "(";
+      auto structValue = value.as<DynamicStruct>();
+      bool first = true;
+      for (auto member: structValue.getSchema().getMembers()) {
+        if (structValue.has(member)) {
+          if (first) {
+            first = false;
+          } else {
+            os << ", ";
+          }
+          os << member.getProto().getName().c_str() << " = ";
+
+          auto memberBody = member.getProto().getBody();
+          switch (memberBody.which()) {
+            case schema::StructNode::Member::Body::UNION_MEMBER:
+              legacyPrint(os, structValue.get(member), schema::Type::Body::VOID_TYPE);
+              break;
+            case schema::StructNode::Member::Body::FIELD_MEMBER:
+              legacyPrint(os, structValue.get(member),
+                          memberBody.getFieldMember().getType().getBody().which());
+              break;
+          }
+        }
+      }
+      os << ")";
+      break;
+    }
+    case DynamicValue::UNION: {
+      auto unionValue = value.as<DynamicUnion>();
+      Maybe<StructSchema::Member> tag = unionValue.which();
+      if (tag == nullptr) {
+        os << "?";
+      } else {
+        os << tag->getProto().getName().c_str() << "(";
+        legacyPrint(os, unionValue.get(),
+                    tag->getProto().getBody().getFieldMember().getType().getBody().which());
+        os << ")";
+      }
+      break;
+    }
+    case DynamicValue::OBJECT:
+      os << "(opaque object)";
+      break;
+  }
+}
+
+template <typename Func>
+void report(const char* name, uint size, uint reps, size_t outputBytes, Func&& func) {
+  uint64_t start = nowNanos();
+  for (uint i = 0; i < reps; i++) {
+    func();
+  }
+  double nanos = nowNanos() - start;
+  printf("%-36s %10.2f %10.1f\n", name,
+         nanos / ((double)size * reps), (double)outputBytes * reps / nanos * 1000);
+}
+
+int main(int argc, char* argv[]) {
+  uint size = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+  uint reps = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+  MallocMessageBuilder message;
+  fill(message.initRoot<SearchResultList>().initResults(size));
+  DynamicStruct::Reader root =
+      message.getRoot<DynamicStruct>(Schema::from<SearchResultList>()).asReader();
+
+  // Throughput is computed from the new output's size.  The legacy output differs only in floats
+  // which need 16 digits to round-trip, which it prints with 17.
+  size_t outputBytes = capnproto::stringify(root).size();
+
+  // Keep the compiler from discarding the output.
+  volatile size_t sink = 0;
+
+  printf("%-36s %10s %10s\n", "stringify", "ns/elem", "MB/s");
+
+  report("legacy std::ostream", size, reps, outputBytes, [&]() {
+    std::stringstream out;
+    legacyPrint(out, root, schema::Type::Body::STRUCT_TYPE);
+    sink = out.str().size();
+  });
+
+  report("stringify() -> String", size, reps, outputBytes, [&]() {
+    sink = capnproto::stringify(root).size();
+  });
+
+  Array<byte> buffer = newArray<byte>(outputBytes);
+  report("stringify() -> ArrayOutputStream", size, reps, outputBytes, [&]() {
+    ArrayOutputStream out(buffer);
+    capnproto::stringify(root, out);
+    sink = out.getArray().size();
+  });
+
+  AutoCloseFd devNull(open("/dev/null", O_WRONLY));
+  report("stringify() -> /dev/null", size, reps, outputBytes, [&]() {
+    FdOutputStream out(devNull.get());
+    capnproto::stringify(root, out);
+    sink = 1;
+  });
+
+  return 0;
+}
+
+}  // namespace stringifyperf
+}  // namespace benchmark
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::benchmark::stringifyperf::main(argc, argv);
+}
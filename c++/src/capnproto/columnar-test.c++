@@ -0,0 +1,299 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "columnar.h"
+#include "message.h"
+#include <gtest/gtest.h>
+#include <vector>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+TEST(Columnar, AllFields) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  ColumnExtractor extractor(Schema::from<TestAllTypes>());
+  auto fields = extractor.getFields();
+  ASSERT_EQ(12u, fields.size());
+  EXPECT_EQ("boolField", fields[0].getProto().getName());
+  EXPECT_EQ("float64Field", fields[10].getProto().getName());
+  EXPECT_EQ("enumField", fields[11].getProto().getName());
+
+  bool boolValue;
+  int8_t int8Value;
+  int16_t int16Value;
+  int32_t int32Value;
+  int64_t int64Value;
+  uint8_t uint8Value;
+  uint16_t uint16Value;
+  uint32_t uint32Value;
+  uint64_t uint64Value;
+  float float32Value;
+  double float64Value;
+  uint16_t enumValue;
+  bool present[12];
+  ColumnExtractor::Column columns[12] = {
+    {&boolValue, &present[0]}, {&int8Value, &present[1]}, {&int16Value, &present[2]},
+    {&int32Value, &present[3]}, {&int64Value, &present[4]}, {&uint8Value, &present[5]},
+    {&uint16Value, &present[6]}, {&uint32Value, &present[7]}, {&uint64Value, &present[8]},
+    {&float32Value, &present[9]}, {&float64Value, &present[10]}, {&enumValue, &present[11]}
+  };
+
+  extractor.extract(toDynamic(root.asReader()), arrayPtr(columns, 12));
+
+  auto reader = root.asReader();
+  EXPECT_EQ(reader.getBoolField(), boolValue);
+  EXPECT_EQ(reader.getInt8Field(), int8Value);
+  EXPECT_EQ(reader.getInt16Field(), int16Value);
+  EXPECT_EQ(reader.getInt32Field(), int32Value);
+  EXPECT_EQ(reader.getInt64Field(), int64Value);
+  EXPECT_EQ(reader.getUInt8Field(), uint8Value);
+  EXPECT_EQ(reader.getUInt16Field(), uint16Value);
+  EXPECT_EQ(reader.getUInt32Field(), uint32Value);
+  EXPECT_EQ(reader.getUInt64Field(), uint64Value);
+  EXPECT_FLOAT_EQ(reader.getFloat32Field(), float32Value);
+  EXPECT_DOUBLE_EQ(reader.getFloat64Field(), float64Value);
+  EXPECT_EQ(static_cast<uint16_t>(reader.getEnumField()), enumValue);
+  for (bool p: present) {
+    EXPECT_TRUE(p);
+  }
+}
+
+TEST(Columnar, Defaults) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestDefaults>();
+
+  StructSchema schema = Schema::from<TestDefaults>();
+  StructSchema::Member fields[3] = {
+    schema.getMemberByName("int32Field"),
+    schema.getMemberByName("float64Field"),
+    schema.getMemberByName("enumField")
+  };
+  ColumnExtractor extractor(schema, arrayPtr(fields, 3));
+
+  int32_t int32Value;
+  double float64Value;
+  uint16_t enumValue;
+  ColumnExtractor::Column columns[3] = {
+    {&int32Value, nullptr}, {&float64Value, nullptr}, {&enumValue, nullptr}
+  };
+
+  extractor.extract(toDynamic(root.asReader()), arrayPtr(columns, 3));
+  EXPECT_EQ(-12345678, int32Value);
+  EXPECT_DOUBLE_EQ(-123e45, float64Value);
+  EXPECT_EQ(static_cast<uint16_t>(TestEnum::CORGE), enumValue);
+}
+
+TEST(Columnar, List) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  auto list = root.initStructList(1000);
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].setInt32Field(i * 3);
+    list[i].setFloat64Field(i * 0.5);
+    list[i].setBoolField(i % 3 == 0);
+    list[i].setEnumField(static_cast<TestEnum>(i % 8));
+  }
+
+  StructSchema schema = Schema::from<TestAllTypes>();
+  StructSchema::Member fields[4] = {
+    schema.getMemberByName("int32Field"),
+    schema.getMemberByName("float64Field"),
+    schema.getMemberByName("boolField"),
+    schema.getMemberByName("enumField")
+  };
+  ColumnExtractor extractor(schema, arrayPtr(fields, 4));
+
+  // Leave room to check that extract() writes at the requested index and no further.
+  std::vector<int32_t> int32Column(1002, -1);
+  std::vector<double> float64Column(1002);
+  bool boolColumn[1002];
+  std::vector<uint16_t> enumColumn(1002);
+  ColumnExtractor::Column columns[4] = {
+    {&int32Column[0], nullptr}, {&float64Column[0], nullptr},
+    {boolColumn, nullptr}, {&enumColumn[0], nullptr}
+  };
+
+  extractor.extract(toDynamic(root.asReader()).get("structList").as<DynamicList>(),
+                    arrayPtr(columns, 4), 1);
+
+  EXPECT_EQ(-1, int32Column[0]);
+  EXPECT_EQ(-1, int32Column[1001]);
+  for (uint i = 0; i < 1000; i++) {
+    EXPECT_EQ(static_cast<int32_t>(i * 3), int32Column[i + 1]);
+    EXPECT_EQ(i * 0.5, float64Column[i + 1]);
+    EXPECT_EQ(i % 3 == 0, boolColumn[i + 1]);
+    EXPECT_EQ(i % 8, enumColumn[i + 1]);
+  }
+}
+
+TEST(Columnar, Unions) {
+  StructSchema schema = Schema::from<TestUnion>();
+  StructSchema::Union union0 = schema.getMemberByName("union0").asUnion();
+  StructSchema::Member fields[2] = {
+    union0.getMemberByName("u0f0s32"),
+    union0.getMemberByName("u0f1s32")
+  };
+  ColumnExtractor extractor(schema, arrayPtr(fields, 2));
+
+  int32_t s0Values[3];
+  int32_t s1Values[3];
+  bool s0Present[3];
+  bool s1Present[3];
+  ColumnExtractor::Column columns[2] = {{s0Values, s0Present}, {s1Values, s1Present}};
+
+  for (uint i = 0; i < 3; i++) {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<TestUnion>();
+    if (i == 0) {
+      root.getUnion0().setU0f0s32(123);
+    } else if (i == 1) {
+      root.getUnion0().setU0f1s32(456);
+    } else {
+      root.getUnion0().setU0f0s64(789);
+    }
+    extractor.extract(toDynamic(root.asReader()), arrayPtr(columns, 2), i);
+  }
+
+  EXPECT_TRUE(s0Present[0]);
+  EXPECT_EQ(123, s0Values[0]);
+  EXPECT_FALSE(s1Present[0]);
+  EXPECT_EQ(0, s1Values[0]);
+
+  EXPECT_FALSE(s0Present[1]);
+  EXPECT_EQ(0, s0Values[1]);
+  EXPECT_TRUE(s1Present[1]);
+  EXPECT_EQ(456, s1Values[1]);
+
+  EXPECT_FALSE(s0Present[2]);
+  EXPECT_FALSE(s1Present[2]);
+}
+
+TEST(Columnar, Transcode) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  auto list = root.initStructList(100);
+  for (uint i = 0; i < list.size(); i++) {
+    if (i % 10 == 0) continue;  // Leave some elements at their defaults.
+    initTestMessage(list[i]);
+    list[i].setInt32Field(i);
+  }
+
+  auto dynamicList = toDynamic(root.asReader()).get("structList").as<DynamicList>();
+  ColumnarList columns(dynamicList);
+  EXPECT_EQ(100u, columns.size());
+
+  StructSchema schema = Schema::from<TestAllTypes>();
+  auto int32Column = columns.getColumn<int32_t>(schema.getMemberByName("int32Field"));
+  auto float64Column = columns.getColumn<double>(schema.getMemberByName("float64Field"));
+  auto enumColumn = columns.getColumn<uint16_t>(schema.getMemberByName("enumField"));
+  auto textColumn = columns.getPointerColumn(schema.getMemberByName("textField"));
+  auto textPresence = columns.getPresence(schema.getMemberByName("textField"));
+  auto structColumn = columns.getPointerColumn(schema.getMemberByName("structField"));
+
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(float64Column.begin()) % 64);
+
+  for (uint i = 0; i < 100; i++) {
+    if (i % 10 == 0) {
+      EXPECT_EQ(0, int32Column[i]);
+      EXPECT_EQ(0, float64Column[i]);
+      EXPECT_EQ(0u, enumColumn[i]);
+      EXPECT_FALSE(textPresence[i]);
+      EXPECT_EQ("", textColumn[i].as<Text>());
+      EXPECT_EQ(0, structColumn[i].as<DynamicStruct>().get("int32Field").as<int32_t>());
+    } else {
+      EXPECT_EQ(static_cast<int32_t>(i), int32Column[i]);
+      EXPECT_EQ(-123e45, float64Column[i]);
+      EXPECT_EQ(static_cast<uint16_t>(TestEnum::CORGE), enumColumn[i]);
+      EXPECT_TRUE(textPresence[i]);
+      EXPECT_EQ("foo", textColumn[i].as<Text>());
+      EXPECT_EQ(-12345678,
+                structColumn[i].as<DynamicStruct>().get("int32Field").as<int32_t>());
+    }
+  }
+
+  EXPECT_ANY_THROW(columns.getColumn<int64_t>(schema.getMemberByName("int32Field")));
+  EXPECT_ANY_THROW(columns.getPointerColumn(schema.getMemberByName("int32Field")));
+
+  // And back.
+  MallocMessageBuilder builder2;
+  auto root2 = builder2.initRoot<TestAllTypes>();
+  columns.copyTo(toDynamic(root2).init("structList", 100).as<DynamicList>());
+
+  auto list2 = root2.asReader().getStructList();
+  ASSERT_EQ(100u, list2.size());
+  for (uint i = 0; i < list2.size(); i++) {
+    if (i % 10 == 0) {
+      checkTestMessageAllZero(list2[i]);
+    } else {
+      EXPECT_EQ(static_cast<int32_t>(i), list2[i].getInt32Field());
+      // Restore the value initTestMessage() set, so we can compare everything else.
+      root2.getStructList()[i].setInt32Field(-12345678);
+      checkTestMessage(list2[i]);
+    }
+  }
+}
+
+TEST(Columnar, TranscodeSomeFields) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  auto list = root.initStructList(3);
+  for (uint i = 0; i < list.size(); i++) {
+    list[i].setUInt64Field(i + 1);
+    list[i].setTextField("bar");
+  }
+
+  StructSchema schema = Schema::from<TestAllTypes>();
+  StructSchema::Member fields[1] = { schema.getMemberByName("uInt64Field") };
+  ColumnarList columns(toDynamic(root.asReader()).get("structList").as<DynamicList>(),
+                       arrayPtr(fields, 1));
+  ASSERT_EQ(1u, columns.getFields().size());
+  EXPECT_EQ(3u, columns.getColumn<uint64_t>(fields[0])[2]);
+  EXPECT_ANY_THROW(columns.getPointerColumn(schema.getMemberByName("textField")));
+
+  // Fields that weren't transcoded are left alone by copyTo().
+  MallocMessageBuilder builder2;
+  auto root2 = builder2.initRoot<TestAllTypes>();
+  columns.copyTo(toDynamic(root2).init("structList", 3).as<DynamicList>());
+  EXPECT_EQ(2u, root2.getStructList()[1].getUInt64Field());
+  EXPECT_FALSE(root2.getStructList()[1].hasTextField());
+}
+
+TEST(Columnar, WrongType) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestDefaults>();
+
+  ColumnExtractor extractor(Schema::from<TestAllTypes>());
+  EXPECT_ANY_THROW(extractor.extract(toDynamic(root.asReader()), nullptr));
+
+  StructSchema::Member textField = Schema::from<TestAllTypes>().getMemberByName("textField");
+  EXPECT_ANY_THROW(ColumnExtractor(Schema::from<TestAllTypes>(), arrayPtr(&textField, 1)));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
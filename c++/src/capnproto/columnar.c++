@@ -0,0 +1,524 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "columnar.h"
+#include "logging.h"
+#include <algorithm>
+
+namespace capnproto {
+
+struct ColumnExtractor::FieldPlan {
+  schema::Type::Body::Which type;
+  uint32_t offset;
+  // In multiples of the field's size.
+
+  uint64_t defaultBits;
+
+  bool inUnion;
+  uint16_t discriminantValue;
+  uint32_t discriminantOffset;
+  // If the field is a member of a union, the union's discriminant value for this field and the
+  // discriminant's offset, in multiples of 16 bits.
+};
+
+namespace {
+
+bool isColumnType(schema::Type::Body::Which type) {
+  switch (type) {
+    case schema::Type::Body::BOOL_TYPE:
+    case schema::Type::Body::INT8_TYPE:
+    case schema::Type::Body::INT16_TYPE:
+    case schema::Type::Body::INT32_TYPE:
+    case schema::Type::Body::INT64_TYPE:
+    case schema::Type::Body::UINT8_TYPE:
+    case schema::Type::Body::UINT16_TYPE:
+    case schema::Type::Body::UINT32_TYPE:
+    case schema::Type::Body::UINT64_TYPE:
+    case schema::Type::Body::FLOAT32_TYPE:
+    case schema::Type::Body::FLOAT64_TYPE:
+    case schema::Type::Body::ENUM_TYPE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool isPointerType(schema::Type::Body::Which type) {
+  switch (type) {
+    case schema::Type::Body::TEXT_TYPE:
+    case schema::Type::Body::DATA_TYPE:
+    case schema::Type::Body::LIST_TYPE:
+    case schema::Type::Body::STRUCT_TYPE:
+    case schema::Type::Body::OBJECT_TYPE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+schema::Type::Body::Which fieldType(StructSchema::Member member) {
+  auto body = member.getProto().getBody();
+  if (body.which() != schema::StructNode::Member::Body::FIELD_MEMBER) {
+    return schema::Type::Body::VOID_TYPE;
+  }
+  return body.getFieldMember().getType().getBody().which();
+}
+
+template <typename Func>
+void forEachField(StructSchema schema, Func&& func) {
+  // Calls func() on each field of the struct, including members of unions, in schema order.
+  for (auto member: schema.getMembers()) {
+    if (member.getProto().getBody().which() == schema::StructNode::Member::Body::UNION_MEMBER) {
+      for (auto unionMember: member.asUnion().getMembers()) {
+        func(unionMember);
+      }
+    } else {
+      func(member);
+    }
+  }
+}
+
+bool isColumnField(StructSchema::Member member) {
+  return isColumnType(fieldType(member));
+}
+
+}  // namespace
+
+ColumnExtractor::ColumnExtractor(StructSchema schema): schema(schema) {
+  uint count = 0;
+  forEachField(schema, [&](StructSchema::Member member) {
+    if (isColumnField(member)) ++count;
+  });
+
+  fields = newArray<StructSchema::Member>(count);
+  uint pos = 0;
+  forEachField(schema, [&](StructSchema::Member member) {
+    if (isColumnField(member)) fields[pos++] = member;
+  });
+
+  plan();
+}
+
+ColumnExtractor::ColumnExtractor(StructSchema schema, ArrayPtr<const StructSchema::Member> fields)
+    : schema(schema), fields(newArray<StructSchema::Member>(fields.size())) {
+  for (uint i = 0; i < fields.size(); i++) {
+    PRECOND(fields[i].getContainingStruct() == schema,
+            "Field is not a member of the extractor's struct type.",
+            fields[i].getProto().getName());
+    PRECOND(isColumnField(fields[i]), "Only primitive and enum fields can be extracted.",
+            fields[i].getProto().getName());
+    this->fields[i] = fields[i];
+  }
+
+  plan();
+}
+
+ColumnExtractor::~ColumnExtractor() {}
+
+void ColumnExtractor::plan() {
+  plans = newArray<FieldPlan>(fields.size());
+
+  for (uint i = 0; i < fields.size(); i++) {
+    const internal::MemberPlan& memberPlan = fields[i].getPlan();
+    FieldPlan& plan = plans[i];
+    plan.type = memberPlan.type;
+    plan.offset = memberPlan.offset;
+    plan.defaultBits = memberPlan.defaultBits;
+
+    auto containingUnion = fields[i].getContainingUnion();
+    if (containingUnion == nullptr) {
+      plan.inUnion = false;
+      plan.discriminantValue = 0;
+      plan.discriminantOffset = 0;
+    } else {
+      plan.inUnion = true;
+      plan.discriminantValue = fields[i].getIndex();
+      plan.discriminantOffset = containingUnion->getPlan().offset;
+    }
+  }
+}
+
+template <typename T>
+void ColumnExtractor::extractColumn(const internal::StructReader* rows, uint count,
+                                    const FieldPlan& plan, const Column& column, size_t index) {
+  T* values = reinterpret_cast<T*>(column.values) + index;
+  internal::Mask<T> mask = static_cast<internal::Mask<T>>(plan.defaultBits);
+  ElementCount offset = plan.offset * ELEMENTS;
+
+  if (plan.inUnion) {
+    T defaultValue = internal::unmask<T>(0, mask);
+    ElementCount discriminantOffset = plan.discriminantOffset * ELEMENTS;
+    bool* present = column.present == nullptr ? nullptr : column.present + index;
+    for (uint i = 0; i < count; i++) {
+      bool active = rows[i].getDataField<uint16_t>(discriminantOffset) == plan.discriminantValue;
+      values[i] = active ? rows[i].getDataField<T>(offset, mask) : defaultValue;
+      if (present != nullptr) present[i] = active;
+    }
+  } else {
+    for (uint i = 0; i < count; i++) {
+      values[i] = rows[i].getDataField<T>(offset, mask);
+    }
+    if (column.present != nullptr) {
+      std::fill(column.present + index, column.present + index + count, true);
+    }
+  }
+}
+
+void ColumnExtractor::extractBlock(const internal::StructReader* rows, uint count,
+                                   ArrayPtr<const Column> columns, size_t index) const {
+  for (uint i = 0; i < plans.size(); i++) {
+    const FieldPlan& plan = plans[i];
+    switch (plan.type) {
+#define HANDLE_TYPE(discrim, type) \
+      case schema::Type::Body::discrim##_TYPE: \
+        extractColumn<type>(rows, count, plan, columns[i], index); \
+        break;
+
+      HANDLE_TYPE(BOOL, bool)
+      HANDLE_TYPE(INT8, int8_t)
+      HANDLE_TYPE(INT16, int16_t)
+      HANDLE_TYPE(INT32, int32_t)
+      HANDLE_TYPE(INT64, int64_t)
+      HANDLE_TYPE(UINT8, uint8_t)
+      HANDLE_TYPE(UINT16, uint16_t)
+      HANDLE_TYPE(UINT32, uint32_t)
+      HANDLE_TYPE(UINT64, uint64_t)
+      HANDLE_TYPE(FLOAT32, float)
+      HANDLE_TYPE(FLOAT64, double)
+      HANDLE_TYPE(ENUM, uint16_t)
+
+#undef HANDLE_TYPE
+
+      default:
+        FAIL_CHECK("Not a column type.", plan.type);
+    }
+  }
+}
+
+void ColumnExtractor::extract(DynamicStruct::Reader row, ArrayPtr<const Column> columns,
+                              size_t index) const {
+  PRECOND(row.getSchema() == schema, "Struct is not of the extractor's type.");
+  PRECOND(columns.size() == plans.size(), "Need exactly one column per field.",
+          columns.size(), plans.size());
+  extractBlock(&row.reader, 1, columns, index);
+}
+
+void ColumnExtractor::extract(DynamicList::Reader rows, ArrayPtr<const Column> columns,
+                              size_t index) const {
+  PRECOND(rows.getSchema().whichElementType() == schema::Type::Body::STRUCT_TYPE &&
+          rows.getSchema().getStructElementType() == schema,
+          "List elements are not of the extractor's type.");
+  PRECOND(columns.size() == plans.size(), "Need exactly one column per field.",
+          columns.size(), plans.size());
+
+  // Locate a block of elements, then fill each column for the whole block.  The block is small
+  // enough that the elements' data stays in cache while we go through the columns.
+  static constexpr uint BLOCK_SIZE = 64;
+  internal::StructReader block[BLOCK_SIZE];
+
+  uint size = rows.size();
+  for (uint start = 0; start < size; start += BLOCK_SIZE) {
+    uint count = std::min(BLOCK_SIZE, size - start);
+    for (uint i = 0; i < count; i++) {
+      block[i] = rows.reader.getStructElement((start + i) * ELEMENTS);
+    }
+    extractBlock(block, count, columns, index + start);
+  }
+}
+
+// =======================================================================================
+
+namespace {
+
+constexpr uint COLUMN_ALIGNMENT = 64;
+// Columns start on a cache line, which is also enough for any vector instruction set.
+
+uint columnElementSize(schema::Type::Body::Which type) {
+  switch (type) {
+    case schema::Type::Body::BOOL_TYPE: return sizeof(bool);
+    case schema::Type::Body::INT8_TYPE: return 1;
+    case schema::Type::Body::INT16_TYPE: return 2;
+    case schema::Type::Body::INT32_TYPE: return 4;
+    case schema::Type::Body::INT64_TYPE: return 8;
+    case schema::Type::Body::UINT8_TYPE: return 1;
+    case schema::Type::Body::UINT16_TYPE: return 2;
+    case schema::Type::Body::UINT32_TYPE: return 4;
+    case schema::Type::Body::UINT64_TYPE: return 8;
+    case schema::Type::Body::FLOAT32_TYPE: return 4;
+    case schema::Type::Body::FLOAT64_TYPE: return 8;
+    case schema::Type::Body::ENUM_TYPE: return 2;
+    default:
+      FAIL_CHECK("Not a column type.", type);
+      return 0;
+  }
+}
+
+}  // namespace
+
+struct ColumnarList::Column {
+  StructSchema::Member field;
+  schema::Type::Body::Which type;
+  void* values;
+  bool* present;
+
+  // Layout, for copyTo().
+  uint32_t offset;
+  uint64_t defaultBits;
+  bool inUnion;
+  uint16_t discriminantValue;
+  uint32_t discriminantOffset;
+};
+
+ColumnarList::ColumnarList(DynamicList::Reader list)
+    : schema(list.getSchema().getStructElementType()), size_(list.size()) {
+  uint count = 0;
+  forEachField(schema, [&](StructSchema::Member member) {
+    auto type = fieldType(member);
+    if (isColumnType(type) || isPointerType(type)) ++count;
+  });
+
+  fields = newArray<StructSchema::Member>(count);
+  uint pos = 0;
+  forEachField(schema, [&](StructSchema::Member member) {
+    auto type = fieldType(member);
+    if (isColumnType(type) || isPointerType(type)) fields[pos++] = member;
+  });
+
+  transcode(list);
+}
+
+ColumnarList::ColumnarList(DynamicList::Reader list, ArrayPtr<const StructSchema::Member> fields)
+    : schema(list.getSchema().getStructElementType()), size_(list.size()),
+      fields(newArray<StructSchema::Member>(fields.size())) {
+  for (uint i = 0; i < fields.size(); i++) {
+    PRECOND(fields[i].getContainingStruct() == schema,
+            "Field is not a member of the list's struct type.", fields[i].getProto().getName());
+    auto type = fieldType(fields[i]);
+    PRECOND(isColumnType(type) || isPointerType(type), "Field can't be transcoded.",
+            fields[i].getProto().getName(), type);
+    this->fields[i] = fields[i];
+  }
+
+  transcode(list);
+}
+
+ColumnarList::~ColumnarList() {}
+
+void ColumnarList::transcode(DynamicList::Reader list) {
+  columns = arena.allocateArray<Column>(fields.size());
+
+  // Primitive fields are handed to a ColumnExtractor in one go; pointer fields are read row by
+  // row below.
+  uint primitiveCount = 0;
+  for (auto field: fields) {
+    if (isColumnField(field)) ++primitiveCount;
+  }
+  Array<StructSchema::Member> primitiveFields = newArray<StructSchema::Member>(primitiveCount);
+  Array<ColumnExtractor::Column> primitiveColumns =
+      newArray<ColumnExtractor::Column>(primitiveCount);
+  uint primitivePos = 0;
+
+  for (uint i = 0; i < fields.size(); i++) {
+    Column& column = columns[i];
+    column.field = fields[i];
+    column.type = fieldType(fields[i]);
+    column.present = reinterpret_cast<bool*>(
+        arena.allocateBytes(size_ * sizeof(bool), COLUMN_ALIGNMENT));
+
+    const internal::MemberPlan& plan = fields[i].getPlan();
+    column.offset = plan.offset;
+    column.defaultBits = plan.defaultBits;
+
+    auto containingUnion = fields[i].getContainingUnion();
+    column.inUnion = containingUnion != nullptr;
+    if (column.inUnion) {
+      column.discriminantValue = fields[i].getIndex();
+      column.discriminantOffset = containingUnion->getPlan().offset;
+    } else {
+      column.discriminantValue = 0;
+      column.discriminantOffset = 0;
+    }
+
+    if (isColumnType(column.type)) {
+      column.values = arena.allocateBytes(size_ * columnElementSize(column.type),
+                                          COLUMN_ALIGNMENT);
+      primitiveFields[primitivePos] = fields[i];
+      primitiveColumns[primitivePos].values = column.values;
+      primitiveColumns[primitivePos].present = column.present;
+      ++primitivePos;
+    } else {
+      column.values = arena.allocateArray<DynamicValue::Reader>(size_).begin();
+    }
+  }
+
+  if (primitiveCount > 0) {
+    ColumnExtractor extractor(schema, primitiveFields);
+    extractor.extract(list, primitiveColumns);
+  }
+
+  if (primitiveCount < fields.size()) {
+    static constexpr uint BLOCK_SIZE = 64;
+    internal::StructReader block[BLOCK_SIZE];
+
+    for (uint start = 0; start < size_; start += BLOCK_SIZE) {
+      uint count = std::min(BLOCK_SIZE, size_ - start);
+      for (uint i = 0; i < count; i++) {
+        block[i] = list.reader.getStructElement((start + i) * ELEMENTS);
+      }
+
+      for (Column& column: columns) {
+        if (!isPointerType(column.type)) continue;
+
+        DynamicValue::Reader* values =
+            reinterpret_cast<DynamicValue::Reader*>(column.values) + start;
+        bool* present = column.present + start;
+        for (uint i = 0; i < count; i++) {
+          if (column.inUnion && block[i].getDataField<uint16_t>(
+                  column.discriminantOffset * ELEMENTS) != column.discriminantValue) {
+            // Another member of the union is set.  Read the default from an empty struct.
+            present[i] = false;
+            values[i] = DynamicStruct::Reader::getImpl(internal::StructReader(), column.field);
+          } else {
+            present[i] = !block[i].isPointerFieldNull(column.offset * POINTERS);
+            values[i] = DynamicStruct::Reader::getImpl(block[i], column.field);
+          }
+        }
+      }
+    }
+  }
+}
+
+const ColumnarList::Column& ColumnarList::findColumn(StructSchema::Member field) const {
+  const Column* result = nullptr;
+  for (const Column& column: columns) {
+    if (column.field == field) {
+      result = &column;
+      break;
+    }
+  }
+  PRECOND(result != nullptr, "Field was not transcoded.", field.getProto().getName());
+  return *result;
+}
+
+const void* ColumnarList::getColumnImpl(StructSchema::Member field,
+                                        schema::Type::Body::Which type) const {
+  const Column& column = findColumn(field);
+  PRECOND(column.type == type ||
+          (column.type == schema::Type::Body::ENUM_TYPE && type == schema::Type::Body::UINT16_TYPE),
+          "Column type doesn't match the field's type.", field.getProto().getName());
+  return column.values;
+}
+
+ArrayPtr<DynamicValue::Reader> ColumnarList::getPointerColumn(StructSchema::Member field) {
+  const Column& column = findColumn(field);
+  PRECOND(isPointerType(column.type), "Not a pointer field.", field.getProto().getName());
+  return arrayPtr(reinterpret_cast<DynamicValue::Reader*>(column.values), size_);
+}
+
+ArrayPtr<const bool> ColumnarList::getPresence(StructSchema::Member field) const {
+  return arrayPtr(findColumn(field).present, size_);
+}
+
+template <typename T>
+void ColumnarList::copyColumn(const internal::StructBuilder* rows, uint count,
+                              const Column& column, uint index) const {
+  const T* values = reinterpret_cast<const T*>(column.values) + index;
+  internal::Mask<T> mask = static_cast<internal::Mask<T>>(column.defaultBits);
+  ElementCount offset = column.offset * ELEMENTS;
+
+  if (column.inUnion) {
+    const bool* present = column.present + index;
+    ElementCount discriminantOffset = column.discriminantOffset * ELEMENTS;
+    for (uint i = 0; i < count; i++) {
+      if (present[i]) {
+        rows[i].setDataField<uint16_t>(discriminantOffset, column.discriminantValue);
+        rows[i].setDataField<T>(offset, values[i], mask);
+      }
+    }
+  } else {
+    for (uint i = 0; i < count; i++) {
+      rows[i].setDataField<T>(offset, values[i], mask);
+    }
+  }
+}
+
+void ColumnarList::copyTo(DynamicList::Builder list) const {
+  PRECOND(list.getSchema().whichElementType() == schema::Type::Body::STRUCT_TYPE &&
+          list.getSchema().getStructElementType() == schema,
+          "List elements are not of the transcoded type.");
+  PRECOND(list.size() == size_, "List size doesn't match.", list.size(), size_);
+
+  static constexpr uint BLOCK_SIZE = 64;
+  internal::StructBuilder block[BLOCK_SIZE];
+
+  for (uint start = 0; start < size_; start += BLOCK_SIZE) {
+    uint count = std::min(BLOCK_SIZE, size_ - start);
+    for (uint i = 0; i < count; i++) {
+      block[i] = list.builder.getStructElement((start + i) * ELEMENTS);
+    }
+
+    for (const Column& column: columns) {
+      switch (column.type) {
+#define HANDLE_TYPE(discrim, type) \
+        case schema::Type::Body::discrim##_TYPE: \
+          copyColumn<type>(block, count, column, start); \
+          break;
+
+        HANDLE_TYPE(BOOL, bool)
+        HANDLE_TYPE(INT8, int8_t)
+        HANDLE_TYPE(INT16, int16_t)
+        HANDLE_TYPE(INT32, int32_t)
+        HANDLE_TYPE(INT64, int64_t)
+        HANDLE_TYPE(UINT8, uint8_t)
+        HANDLE_TYPE(UINT16, uint16_t)
+        HANDLE_TYPE(UINT32, uint32_t)
+        HANDLE_TYPE(UINT64, uint64_t)
+        HANDLE_TYPE(FLOAT32, float)
+        HANDLE_TYPE(FLOAT64, double)
+        HANDLE_TYPE(ENUM, uint16_t)
+
+#undef HANDLE_TYPE
+
+        default: {
+          // Pointer field.  These are deep copies, so per-row dynamic calls cost little extra.
+          const DynamicValue::Reader* values =
+              reinterpret_cast<const DynamicValue::Reader*>(column.values);
+          for (uint i = 0; i < count; i++) {
+            if (!column.present[start + i]) continue;
+            DynamicStruct::Builder element = list[start + i].as<DynamicStruct>();
+            if (column.inUnion) {
+              element.get(*column.field.getContainingUnion()).as<DynamicUnion>()
+                  .set(column.field, values[start + i]);
+            } else {
+              element.set(column.field, values[start + i]);
+            }
+          }
+          break;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace capnproto
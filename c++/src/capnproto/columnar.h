@@ -0,0 +1,164 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Bulk conversion between structs and per-field arrays ("columns"), for exporting messages to
+// columnar formats and for scans that only touch a few fields of many structs.
+
+#ifndef CAPNPROTO_COLUMNAR_H_
+#define CAPNPROTO_COLUMNAR_H_
+
+#include "dynamic.h"
+#include "memory-arena.h"
+
+namespace capnproto {
+
+class ColumnExtractor {
+  // Copies the primitive fields of structs of one type into caller-provided column arrays.
+  //
+  // The fields' layout is resolved once, when the extractor is constructed.  Extracting then costs
+  // a bounds check and a load per field, rather than a DynamicStruct::Reader::get() with its
+  // member lookup, union check, and DynamicValue construction.  Lists are processed a block of
+  // elements at a time, one column after another, so that each column's inner loop is a tight
+  // loop over a single type.
+
+public:
+  explicit ColumnExtractor(StructSchema schema);
+  // Extracts every primitive and enum field of `schema`, including members of unions, in the
+  // order they appear in the schema.  Void fields and pointer fields are skipped.
+
+  ColumnExtractor(StructSchema schema, ArrayPtr<const StructSchema::Member> fields);
+  // Extracts just the given fields, which must be primitive or enum fields of `schema` or of one
+  // of its unions.
+
+  CAPNPROTO_DISALLOW_COPY(ColumnExtractor);
+  ~ColumnExtractor();
+
+  inline StructSchema getSchema() const { return schema; }
+
+  inline ArrayPtr<const StructSchema::Member> getFields() const { return fields; }
+  // The extracted fields, in column order.
+
+  struct Column {
+    void* values;
+    // Array receiving the field's values, one per row, as the field's C++ type:  bool, int8_t, ...,
+    // double, or uint16_t for enums.
+
+    bool* present;
+    // Optional (may be null):  array receiving, for each row, whether the field holds a value.  A
+    // field which is a member of a union has no value when the union holds a different member; in
+    // that case the field's default value is written to `values`.  Other fields always have a
+    // value.
+  };
+
+  void extract(DynamicStruct::Reader row, ArrayPtr<const Column> columns, size_t index = 0) const;
+  // Extracts one struct into element `index` of each column.  `columns` corresponds to
+  // getFields().
+
+  void extract(DynamicList::Reader rows, ArrayPtr<const Column> columns, size_t index = 0) const;
+  // Extracts every element of a list of structs, element i going to element index + i of each
+  // column.
+
+private:
+  struct FieldPlan;
+
+  StructSchema schema;
+  Array<StructSchema::Member> fields;
+  Array<FieldPlan> plans;
+
+  void plan();
+  void extractBlock(const internal::StructReader* rows, uint count,
+                    ArrayPtr<const Column> columns, size_t index) const;
+
+  template <typename T>
+  static void extractColumn(const internal::StructReader* rows, uint count,
+                            const FieldPlan& plan, const Column& column, size_t index);
+};
+
+class ColumnarList {
+  // A list of structs transcoded into struct-of-arrays form:  one contiguous array per field,
+  // aligned to a cache line, so that a scan over a few fields of a large list reads only those
+  // fields' bytes and can be vectorized.  Can be converted back into a list with copyTo().
+  //
+  // Primitive and enum fields are copied.  Pointer fields (text, data, lists, structs, objects) are
+  // stored as DynamicValue::Readers pointing into the original message, which must therefore
+  // outlive the ColumnarList.  Void fields have no column.
+
+public:
+  explicit ColumnarList(DynamicList::Reader list);
+  // Transcodes every non-void field, including members of unions.  `list` must be a list of
+  // structs.
+
+  ColumnarList(DynamicList::Reader list, ArrayPtr<const StructSchema::Member> fields);
+  // Transcodes just the given fields of `list`'s element type or of its unions.
+
+  CAPNPROTO_DISALLOW_COPY(ColumnarList);
+  ~ColumnarList();
+
+  inline StructSchema getSchema() const { return schema; }
+  inline uint size() const { return size_; }
+
+  inline ArrayPtr<const StructSchema::Member> getFields() const { return fields; }
+  // The transcoded fields.
+
+  template <typename T>
+  inline ArrayPtr<const T> getColumn(StructSchema::Member field) const {
+    return arrayPtr(reinterpret_cast<const T*>(getColumnImpl(field, Schema::from<T>())), size_);
+  }
+  // Get the values of a primitive field.  T must be the field's C++ type, or uint16_t for an enum.
+  // Rows without a value (see getPresence()) hold the field's default.
+
+  ArrayPtr<DynamicValue::Reader> getPointerColumn(StructSchema::Member field);
+  // Get the values of a pointer field.  As with DynamicStruct::Reader::get(), null pointers read
+  // as the field's default value.
+
+  ArrayPtr<const bool> getPresence(StructSchema::Member field) const;
+  // For each row, whether the field holds a value:  false for a member of a union that holds a
+  // different member, and for a null pointer.  Always true for other fields.
+
+  void copyTo(DynamicList::Builder list) const;
+  // Writes the transcoded fields into `list`, which must be a list of the same struct type and
+  // size, e.g. a fresh one from DynamicStruct::Builder::init().  Union members are only written
+  // where present, and null pointers are left null.
+
+private:
+  struct Column;
+
+  StructSchema schema;
+  uint size_;
+  Array<StructSchema::Member> fields;
+  Arena arena;
+  ArrayPtr<Column> columns;
+  // Column data lives in `arena`.
+
+  void transcode(DynamicList::Reader list);
+  const Column& findColumn(StructSchema::Member field) const;
+  const void* getColumnImpl(StructSchema::Member field, schema::Type::Body::Which type) const;
+
+  template <typename T>
+  void copyColumn(const internal::StructBuilder* rows, uint count, const Column& column,
+                  uint index) const;
+};
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_COLUMNAR_H_
@@ -0,0 +1,321 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// This program compares successive versions of a schema set and reports changes that matter on
+// the wire:  incompatibilities, as SchemaLoader's compatibility check sees them, and layout
+// changes that are compatible but affect how fast messages can be read.  Usage:
+//
+//     capnp-compat VERSION1 VERSION2 [VERSION3 ...]
+//
+// Each file holds a CodeGeneratorRequest -- what capnpc sends a plugin on stdin -- listing every
+// node of one version of the schemas.  Each version is compared against the one before it.  The
+// exit status is 1 if any version is incompatible with its predecessor, 0 otherwise.
+//
+// Layout changes reported:
+// - A struct's data or pointer section changing size, which changes the size of every instance
+//   and of every element in a list of the struct.
+// - A struct's preferred list encoding changing, e.g. from packed 16-bit elements to inline
+//   composite.  Readers of lists written with the old encoding take a slower path.
+// - A list field or method result upgraded from a primitive or blob list to a struct list.
+//   This is allowed, but old data is then read through the struct-list path and new data is
+//   written inline composite, which old readers must handle the same way.
+//
+// All versions are loaded into one SchemaLoader, in order.  A node whose fingerprint matches
+// the previous version is skipped without being loaded or compared, so the cost of each
+// version is proportional to what changed in it.
+
+#define CAPNPROTO_PRIVATE
+
+#include "../schema.capnp.h"
+#include "../serialize.h"
+#include "../logging.h"
+#include "../schema-loader.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace capnproto {
+namespace {
+
+class MappedFile {
+  // A file mapped into memory as an array of words.
+
+public:
+  explicit MappedFile(const char* path) {
+    int fd;
+    SYSCALL(fd = open(path, O_RDONLY), path);
+    struct stat stats;
+    SYSCALL(fstat(fd, &stats), path);
+    size = stats.st_size;
+    if (size == 0) {
+      data = nullptr;
+    } else {
+      data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        FAIL_SYSCALL("mmap", error, path);
+      }
+    }
+    close(fd);
+  }
+  CAPNPROTO_DISALLOW_COPY(MappedFile);
+
+  ~MappedFile() {
+    if (data != nullptr) {
+      munmap(data, size);
+    }
+  }
+
+  ArrayPtr<const word> getWords() {
+    return arrayPtr(reinterpret_cast<const word*>(data), size / sizeof(word));
+  }
+
+private:
+  void* data;
+  size_t size;
+};
+
+class IncompatibilityCollector: public ExceptionCallback {
+  // Records the problems SchemaLoader reports instead of throwing, so that the compatibility
+  // check carries on and finds all of them rather than only the first.
+
+public:
+  std::vector<Array<char>> problems;
+
+  void onRecoverableException(Exception&& exception) override {
+    // Prefix the description with its context, e.g. the struct member being compared.
+    Array<char> text = str("");
+    Maybe<const Exception::Context&> maybeContext = exception.getContext();
+    const Exception::Context* context = maybeContext == nullptr ? nullptr : &*maybeContext;
+    while (context != nullptr) {
+      text = str(text, context->description, ": ");
+      context = context->next == nullptr ? nullptr : &**context->next;
+    }
+    problems.push_back(str(text, exception.getDescription()));
+  }
+};
+
+const char* elementSizeName(schema::ElementSize size) {
+  switch (size) {
+    case schema::ElementSize::EMPTY: return "void";
+    case schema::ElementSize::BIT: return "1-bit";
+    case schema::ElementSize::BYTE: return "8-bit";
+    case schema::ElementSize::TWO_BYTES: return "16-bit";
+    case schema::ElementSize::FOUR_BYTES: return "32-bit";
+    case schema::ElementSize::EIGHT_BYTES: return "64-bit";
+    case schema::ElementSize::POINTER: return "pointer";
+    case schema::ElementSize::INLINE_COMPOSITE: return "inline composite";
+  }
+  return "?";
+}
+
+bool isStructList(schema::Type::Reader type) {
+  return type.getBody().which() == schema::Type::Body::LIST_TYPE &&
+      type.getBody().getListType().getBody().which() == schema::Type::Body::STRUCT_TYPE;
+}
+
+class Reporter {
+public:
+  Reporter(): incompatible(false) {}
+
+  bool sawIncompatibility() { return incompatible; }
+
+  void compareVersion(const char* path, schema::CodeGeneratorRequest::Reader request) {
+    currentPath = path;
+    std::unordered_map<uint64_t, uint64_t> currentFingerprints;
+    currentFingerprints.reserve(request.getNodes().size());
+
+    for (auto node: request.getNodes()) {
+      uint64_t id = node.getId();
+      uint64_t fingerprint = node.fingerprint();
+      currentFingerprints[id] = fingerprint;
+
+      auto iter = fingerprints.find(id);
+      if (iter == fingerprints.end()) {
+        if (!first) {
+          report(node, "added");
+        }
+        load(node, nullptr);
+      } else if (iter->second != fingerprint) {
+        // Compare against whichever version the loader kept, i.e. the newest compatible one.
+        load(node, loader.get(id).getProto());
+      }
+    }
+
+    if (!first) {
+      for (auto& entry: fingerprints) {
+        if (currentFingerprints.count(entry.first) == 0) {
+          report(loader.get(entry.first).getProto(), "removed");
+        }
+      }
+    }
+
+    fingerprints = std::move(currentFingerprints);
+    first = false;
+  }
+
+private:
+  SchemaLoader loader;
+  std::unordered_map<uint64_t, uint64_t> fingerprints;
+  // Fingerprint of each node in the previous version, by ID.
+
+  const char* currentPath;
+  bool first = true;
+  bool incompatible;
+
+  template <typename... Params>
+  void report(schema::Node::Reader node, Params&&... params) {
+    auto line = str(currentPath, ": ", node.getDisplayName(), " (0x", hex(node.getId()), "): ",
+                    capnproto::forward<Params>(params)..., '\n');
+    fwrite(line.begin(), 1, line.size(), stdout);
+  }
+
+  void load(schema::Node::Reader node, Maybe<schema::Node::Reader> previous) {
+    IncompatibilityCollector collector;
+    {
+      ExceptionCallback::ScopedRegistration registration(collector);
+      try {
+        loader.load(node);
+      } catch (const Exception& exception) {
+        collector.onRecoverableException(Exception(exception));
+      }
+    }
+
+    if (!collector.problems.empty()) {
+      incompatible = true;
+      for (auto& problem: collector.problems) {
+        report(node, "incompatible: ", problem);
+      }
+      return;
+    }
+
+    if (previous != nullptr) {
+      compareLayout(*previous, node);
+    }
+  }
+
+  void compareLayout(schema::Node::Reader previous, schema::Node::Reader node) {
+    if (previous.getBody().which() != node.getBody().which()) return;
+
+    switch (node.getBody().which()) {
+      case schema::Node::Body::STRUCT_NODE:
+        compareLayout(node, previous.getBody().getStructNode(), node.getBody().getStructNode());
+        break;
+      case schema::Node::Body::INTERFACE_NODE: {
+        auto methods = previous.getBody().getInterfaceNode().getMethods();
+        auto newMethods = node.getBody().getInterfaceNode().getMethods();
+        uint count = std::min(methods.size(), newMethods.size());
+        for (uint i = 0; i < count; i++) {
+          compareType(node, "method ", newMethods[i].getName(),
+                      methods[i].getReturnType(), newMethods[i].getReturnType());
+        }
+        break;
+      }
+      default:
+        // Nothing else affects layout.
+        break;
+    }
+  }
+
+  void compareLayout(schema::Node::Reader node, schema::StructNode::Reader previous,
+                     schema::StructNode::Reader structNode) {
+    if (previous.getDataSectionWordSize() != structNode.getDataSectionWordSize()) {
+      report(node, "data section ", previous.getDataSectionWordSize(), " -> ",
+             structNode.getDataSectionWordSize(), " words");
+    }
+    if (previous.getPointerSectionSize() != structNode.getPointerSectionSize()) {
+      report(node, "pointer section ", previous.getPointerSectionSize(), " -> ",
+             structNode.getPointerSectionSize(), " pointers");
+    }
+    if (previous.getPreferredListEncoding() != structNode.getPreferredListEncoding()) {
+      report(node, "list encoding ", elementSizeName(previous.getPreferredListEncoding()), " -> ",
+             elementSizeName(structNode.getPreferredListEncoding()));
+    }
+    compareMembers(node, previous.getMembers(), structNode.getMembers());
+  }
+
+  void compareMembers(schema::Node::Reader node,
+                      List<schema::StructNode::Member>::Reader previous,
+                      List<schema::StructNode::Member>::Reader members) {
+    // Members are sorted by ordinal, so shared members are at the same positions.
+    uint count = std::min(previous.size(), members.size());
+    for (uint i = 0; i < count; i++) {
+      auto body = members[i].getBody();
+      auto previousBody = previous[i].getBody();
+      if (body.which() != previousBody.which()) continue;
+
+      switch (body.which()) {
+        case schema::StructNode::Member::Body::FIELD_MEMBER:
+          compareType(node, "field ", members[i].getName(),
+                      previousBody.getFieldMember().getType(), body.getFieldMember().getType());
+          break;
+        case schema::StructNode::Member::Body::UNION_MEMBER:
+          compareMembers(node, previousBody.getUnionMember().getMembers(),
+                         body.getUnionMember().getMembers());
+          break;
+      }
+    }
+  }
+
+  void compareType(schema::Node::Reader node, const char* what, Text::Reader name,
+                   schema::Type::Reader previous, schema::Type::Reader type) {
+    // The loader already accepted the change, so a list that became a struct list must have been
+    // upgraded from a primitive or blob list.
+    if (isStructList(type) && previous.getBody().which() == schema::Type::Body::LIST_TYPE &&
+        !isStructList(previous)) {
+      report(node, what, name, " upgraded to a struct list");
+    }
+  }
+};
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s VERSION1 VERSION2 [VERSION3 ...]\n", argv[0]);
+    return 2;
+  }
+
+  ReaderOptions options;
+  options.traversalLimitInWords = 1 << 30;  // Don't limit.
+
+  Reporter reporter;
+  for (int i = 1; i < argc; i++) {
+    MappedFile file(argv[i]);
+    FlatArrayMessageReader reader(file.getWords(), options);
+    reporter.compareVersion(argv[i], reader.getRoot<schema::CodeGeneratorRequest>());
+  }
+
+  return reporter.sawIncompatibility() ? 1 : 0;
+}
+
+}  // namespace
+}  // namespace capnproto
+
+int main(int argc, char* argv[]) {
+  return capnproto::main(argc, argv);
+}
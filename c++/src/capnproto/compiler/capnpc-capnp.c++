@@ -33,6 +33,8 @@
 #include "../schema-loader.h"
 #include "../dynamic.h"
 #include "../stringify.h"
+#include "../memory-arena.h"
+#include <string.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -40,19 +42,33 @@
 namespace capnproto {
 namespace {
 
+Arena arena(1 << 16);
+// Holds all generated text until the output is written.  The plugin runs once and exits, so
+// nothing is ever freed early.
+
 class TextBlob {
+  // A tree of text fragments.  Blobs are composed bottom-up -- a declaration's text is built
+  // from its members' blobs -- so the pieces can't be appended to one buffer in output order
+  // as they're generated.  Instead each blob's own text and branch table live in `arena`, which
+  // makes blobs cheap to copy and lets flattenTo() assemble the final output in one pass.
+
 public:
   TextBlob() = default;
   template <typename... Params>
   TextBlob(Params&&... params);
-  TextBlob(Array<TextBlob>&& params);
+  TextBlob(ArrayPtr<TextBlob> params);
+
+  size_t size() const { return flatSize; }
+  // Total size of the text, including all branches.
 
-  void writeTo(OutputStream& out) const;
+  char* flattenTo(char* pos) const;
+  // Copies the text to `pos`, which must have room for size() chars, and returns the end.
 
 private:
-  Array<char> text;
+  ArrayPtr<char> text;
   struct Branch;
-  Array<Branch> branches;
+  ArrayPtr<Branch> branches;
+  size_t flatSize = 0;
 
   void allocate(size_t textSize, size_t branchCount);
   template <typename First, typename... Rest>
@@ -94,27 +110,31 @@ TextBlob::TextBlob(Params&&... params) {
   init(toContainer(capnproto::forward<Params>(params))...);
 }
 
-TextBlob::TextBlob(Array<TextBlob>&& params) {
-  branches = newArray<Branch>(params.size());
+TextBlob::TextBlob(ArrayPtr<TextBlob> params) {
+  branches = arena.allocateUninitializedArray<Branch>(params.size());
   for (size_t i = 0; i < params.size(); i++) {
-    branches[i].pos = nullptr;
-    branches[i].content = move(params[i]);
+    branches[i].pos = text.begin();
+    branches[i].content = params[i];
+    flatSize += params[i].flatSize;
   }
 }
 
-void TextBlob::writeTo(OutputStream& out) const {
+char* TextBlob::flattenTo(char* out) const {
   const char* pos = text.begin();
   for (auto& branch: branches) {
-    out.write(pos, branch.pos - pos);
+    memcpy(out, pos, branch.pos - pos);
+    out += branch.pos - pos;
     pos = branch.pos;
-    branch.content.writeTo(out);
+    out = branch.content.flattenTo(out);
   }
-  out.write(pos, text.end() - pos);
+  memcpy(out, pos, text.end() - pos);
+  return out + (text.end() - pos);
 }
 
 void TextBlob::allocate(size_t textSize, size_t branchCount) {
-  text = newArray<char>(textSize);
-  branches = newArray<Branch>(branchCount);
+  text = arena.allocateUninitializedArray<char>(textSize);
+  branches = arena.allocateUninitializedArray<Branch>(branchCount);
+  flatSize = textSize;
 }
 
 template <typename First, typename... Rest>
@@ -142,7 +162,8 @@ void TextBlob::fill(char* textPos, Branch* branchesPos, First&& first, Rest&&...
 template <typename... Rest>
 void TextBlob::fill(char* textPos, Branch* branchesPos, TextBlob&& first, Rest&&... rest) {
   branchesPos->pos = textPos;
-  branchesPos->content = move(first);
+  branchesPos->content = first;
+  flatSize += first.flatSize;
   ++branchesPos;
   fill(textPos, branchesPos, capnproto::forward<Rest>(rest)...);
 }
@@ -160,11 +181,11 @@ TextBlob text(Params&&... params) {
 
 template <typename List, typename Func>
 TextBlob forText(List&& list, Func&& func) {
-  Array<TextBlob> items = newArray<TextBlob>(list.size());
+  ArrayPtr<TextBlob> items = arena.allocateArray<TextBlob>(list.size());
   for (size_t i = 0; i < list.size(); i++) {
     items[i] = func(list[i]);
   }
-  return TextBlob(capnproto::move(items));
+  return TextBlob(items);
 }
 
 template <typename T>
@@ -598,13 +619,19 @@ int main(int argc, char* argv[]) {
     schemaLoader.load(node);
   }
 
-  FdOutputStream rawOut(STDOUT_FILENO);
-  BufferedOutputStreamWrapper out(rawOut);
-
-  for (auto fileId: request.getRequestedFiles()) {
-    genFile(schemaLoader.get(fileId)).writeTo(out);
+  // Flatten each file into a single buffer, then write them all with one writev().
+  auto requestedFiles = request.getRequestedFiles();
+  auto pieces = arena.allocateArray<ArrayPtr<const byte>>(requestedFiles.size());
+  for (uint i = 0; i < requestedFiles.size(); i++) {
+    TextBlob blob = genFile(schemaLoader.get(requestedFiles[i]));
+    char* buffer = arena.allocateUninitializedArray<char>(blob.size()).begin();
+    blob.flattenTo(buffer);
+    pieces[i] = arrayPtr(reinterpret_cast<const byte*>(buffer), blob.size());
   }
 
+  FdOutputStream out(STDOUT_FILENO);
+  out.write(pieces);
+
   return 0;
 }
 
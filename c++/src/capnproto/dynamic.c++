@@ -90,6 +90,15 @@ internal::FieldSize elementSizeFor(schema::Type::Body::Which elementType) {
   return internal::FieldSize::VOID;
 }
 
+template <typename T>
+inline internal::Mask<T> defaultMask(const internal::MemberPlan& plan) {
+  return static_cast<internal::Mask<T>>(plan.defaultBits);
+}
+
+inline const word* defaultMessage(const internal::MemberPlan& plan) {
+  return reinterpret_cast<const word*>(plan.defaultPointer);
+}
+
 inline internal::StructSize structSizeFromSchema(StructSchema schema) {
   auto node = schema.getProto().getBody().getStructNode();
   return internal::StructSize(
@@ -147,8 +156,7 @@ DynamicList::Reader DynamicObject::as(ListSchema schema) {
 
 Maybe<StructSchema::Member> DynamicUnion::Reader::which() {
   auto members = schema.getMembers();
-  uint16_t discrim = reader.getDataField<uint16_t>(
-      schema.getProto().getBody().getUnionMember().getDiscriminantOffset() * ELEMENTS);
+  uint16_t discrim = reader.getDataField<uint16_t>(schema.getPlan().offset * ELEMENTS);
 
   if (discrim < members.size()) {
     return members[discrim];
@@ -158,8 +166,7 @@ Maybe<StructSchema::Member> DynamicUnion::Reader::which() {
 }
 Maybe<StructSchema::Member> DynamicUnion::Builder::which() {
   auto members = schema.getMembers();
-  uint16_t discrim = builder.getDataField<uint16_t>(
-      schema.getProto().getBody().getUnionMember().getDiscriminantOffset() * ELEMENTS);
+  uint16_t discrim = builder.getDataField<uint16_t>(schema.getPlan().offset * ELEMENTS);
 
   if (discrim < members.size()) {
     return members[discrim];
@@ -269,9 +276,7 @@ void DynamicUnion::Builder::setDiscriminant(StructSchema::Member member) {
   auto containingUnion = member.getContainingUnion();
   PRECOND(containingUnion != nullptr && *containingUnion == schema,
           "`member` is not a member of this union.");
-  builder.setDataField<uint16_t>(
-      schema.getProto().getBody().getUnionMember().getDiscriminantOffset() * ELEMENTS,
-      member.getIndex());
+  builder.setDataField<uint16_t>(schema.getPlan().offset * ELEMENTS, member.getIndex());
 }
 
 void DynamicUnion::Builder::setObjectDiscriminant(StructSchema::Member member) {
@@ -294,11 +299,10 @@ DynamicValue::Builder DynamicStruct::Builder::get(StructSchema::Member member) {
 bool DynamicStruct::Reader::has(StructSchema::Member member) {
   PRECOND(member.getContainingStruct() == schema, "`member` is not a member of this struct.");
 
-  auto body = member.getProto().getBody();
-  switch (body.which()) {
+  const internal::MemberPlan* plan = &member.getPlan();
+  switch (plan->kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER: {
-      auto u = body.getUnionMember();
-      if (reader.getDataField<uint16_t>(u.getDiscriminantOffset() * ELEMENTS) != 0) {
+      if (reader.getDataField<uint16_t>(plan->offset * ELEMENTS) != 0) {
         // Union has non-default member set.
         return true;
       }
@@ -311,6 +315,7 @@ bool DynamicStruct::Reader::has(StructSchema::Member member) {
       // The union has the default member set, so now the question is whether that member is set
       // to its default value.  So, continue on with the function using that member.
       member = members[0];
+      plan = &member.getPlan();
       break;
     }
 
@@ -319,16 +324,13 @@ bool DynamicStruct::Reader::has(StructSchema::Member member) {
       break;
   }
 
-  auto field = member.getProto().getBody().getFieldMember();
-  auto type = field.getType().getBody();
-
-  switch (type.which()) {
+  switch (plan->type) {
     case schema::Type::Body::VOID_TYPE:
       return false;
 
 #define HANDLE_TYPE(discrim, type) \
     case schema::Type::Body::discrim##_TYPE: \
-      return reader.getDataField<type>(field.getOffset() * ELEMENTS) != 0;
+      return reader.getDataField<type>(plan->offset * ELEMENTS) != 0;
 
     HANDLE_TYPE(BOOL, bool)
     HANDLE_TYPE(INT8, uint8_t)
@@ -351,7 +353,7 @@ bool DynamicStruct::Reader::has(StructSchema::Member member) {
     case schema::Type::Body::STRUCT_TYPE:
     case schema::Type::Body::OBJECT_TYPE:
     case schema::Type::Body::INTERFACE_TYPE:
-      return !reader.isPointerFieldNull(field.getOffset() * POINTERS);
+      return !reader.isPointerFieldNull(plan->offset * POINTERS);
   }
 
   // Unknown type.  As far as we know, it isn't set.
@@ -360,11 +362,10 @@ bool DynamicStruct::Reader::has(StructSchema::Member member) {
 bool DynamicStruct::Builder::has(StructSchema::Member member) {
   PRECOND(member.getContainingStruct() == schema, "`member` is not a member of this struct.");
 
-  auto body = member.getProto().getBody();
-  switch (body.which()) {
+  const internal::MemberPlan* plan = &member.getPlan();
+  switch (plan->kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER: {
-      auto u = body.getUnionMember();
-      if (builder.getDataField<uint16_t>(u.getDiscriminantOffset() * ELEMENTS) != 0) {
+      if (builder.getDataField<uint16_t>(plan->offset * ELEMENTS) != 0) {
         // Union has non-default member set.
         return true;
       }
@@ -377,6 +378,7 @@ bool DynamicStruct::Builder::has(StructSchema::Member member) {
       // The union has the default member set, so now the question is whether that member is set
       // to its default value.  So, continue on with the function using that member.
       member = members[0];
+      plan = &member.getPlan();
       break;
     }
 
@@ -385,16 +387,13 @@ bool DynamicStruct::Builder::has(StructSchema::Member member) {
       break;
   }
 
-  auto field = member.getProto().getBody().getFieldMember();
-  auto type = field.getType().getBody();
-
-  switch (type.which()) {
+  switch (plan->type) {
     case schema::Type::Body::VOID_TYPE:
       return false;
 
 #define HANDLE_TYPE(discrim, type) \
     case schema::Type::Body::discrim##_TYPE: \
-      return builder.getDataField<type>(field.getOffset() * ELEMENTS) != 0;
+      return builder.getDataField<type>(plan->offset * ELEMENTS) != 0;
 
     HANDLE_TYPE(BOOL, bool)
     HANDLE_TYPE(INT8, uint8_t)
@@ -417,7 +416,7 @@ bool DynamicStruct::Builder::has(StructSchema::Member member) {
     case schema::Type::Body::STRUCT_TYPE:
     case schema::Type::Body::OBJECT_TYPE:
     case schema::Type::Body::INTERFACE_TYPE:
-      return !builder.isPointerFieldNull(field.getOffset() * POINTERS);
+      return !builder.isPointerFieldNull(plan->offset * POINTERS);
   }
 
   // Unknown type.  As far as we know, it isn't set.
@@ -643,82 +642,65 @@ Data::Builder DynamicStruct::Builder::initObjectAsData(Text::Reader name, uint s
 
 DynamicValue::Reader DynamicStruct::Reader::getImpl(
     internal::StructReader reader, StructSchema::Member member) {
-  switch (member.getProto().getBody().which()) {
+  const internal::MemberPlan& plan = member.getPlan();
+
+  switch (plan.kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER:
       return DynamicUnion::Reader(member.asUnion(), reader);
 
     case schema::StructNode::Member::Body::FIELD_MEMBER: {
-      auto field = member.getProto().getBody().getFieldMember();
-      auto type = field.getType().getBody();
-      auto dval = field.getDefaultValue().getBody();
-
-      switch (type.which()) {
+      switch (plan.type) {
         case schema::Type::Body::VOID_TYPE:
-          return DynamicValue::Reader(reader.getDataField<Void>(field.getOffset() * ELEMENTS));
+          return DynamicValue::Reader(reader.getDataField<Void>(plan.offset * ELEMENTS));
 
-#define HANDLE_TYPE(discrim, titleCase, type) \
+#define HANDLE_TYPE(discrim, type) \
         case schema::Type::Body::discrim##_TYPE: \
           return DynamicValue::Reader(reader.getDataField<type>( \
-              field.getOffset() * ELEMENTS, \
-              bitCast<typename internal::MaskType<type>::Type>(dval.get##titleCase##Value())));
-
-        HANDLE_TYPE(BOOL, Bool, bool)
-        HANDLE_TYPE(INT8, Int8, int8_t)
-        HANDLE_TYPE(INT16, Int16, int16_t)
-        HANDLE_TYPE(INT32, Int32, int32_t)
-        HANDLE_TYPE(INT64, Int64, int64_t)
-        HANDLE_TYPE(UINT8, Uint8, uint8_t)
-        HANDLE_TYPE(UINT16, Uint16, uint16_t)
-        HANDLE_TYPE(UINT32, Uint32, uint32_t)
-        HANDLE_TYPE(UINT64, Uint64, uint64_t)
-        HANDLE_TYPE(FLOAT32, Float32, float)
-        HANDLE_TYPE(FLOAT64, Float64, double)
+              plan.offset * ELEMENTS, defaultMask<type>(plan)));
+
+        HANDLE_TYPE(BOOL, bool)
+        HANDLE_TYPE(INT8, int8_t)
+        HANDLE_TYPE(INT16, int16_t)
+        HANDLE_TYPE(INT32, int32_t)
+        HANDLE_TYPE(INT64, int64_t)
+        HANDLE_TYPE(UINT8, uint8_t)
+        HANDLE_TYPE(UINT16, uint16_t)
+        HANDLE_TYPE(UINT32, uint32_t)
+        HANDLE_TYPE(UINT64, uint64_t)
+        HANDLE_TYPE(FLOAT32, float)
+        HANDLE_TYPE(FLOAT64, double)
 
 #undef HANDLE_TYPE
 
-        case schema::Type::Body::ENUM_TYPE: {
-          uint16_t typedDval;
-          typedDval = dval.getEnumValue();
-          return DynamicValue::Reader(DynamicEnum(
-              member.getContainingStruct().getDependency(type.getEnumType()).asEnum(),
-              reader.getDataField<uint16_t>(field.getOffset() * ELEMENTS, typedDval)));
-        }
+        case schema::Type::Body::ENUM_TYPE:
+          return DynamicValue::Reader(DynamicEnum(plan.enumType,
+              reader.getDataField<uint16_t>(plan.offset * ELEMENTS, defaultMask<uint16_t>(plan))));
 
-        case schema::Type::Body::TEXT_TYPE: {
-          Text::Reader typedDval = dval.getTextValue();
+        case schema::Type::Body::TEXT_TYPE:
           return DynamicValue::Reader(
-              reader.getBlobField<Text>(field.getOffset() * POINTERS,
-                                        typedDval.data(), typedDval.size() * BYTES));
-        }
+              reader.getBlobField<Text>(plan.offset * POINTERS,
+                                        plan.defaultPointer, plan.defaultSize * BYTES));
 
-        case schema::Type::Body::DATA_TYPE: {
-          Data::Reader typedDval = dval.getDataValue();
+        case schema::Type::Body::DATA_TYPE:
           return DynamicValue::Reader(
-              reader.getBlobField<Data>(field.getOffset() * POINTERS,
-                                        typedDval.data(), typedDval.size() * BYTES));
-        }
+              reader.getBlobField<Data>(plan.offset * POINTERS,
+                                        plan.defaultPointer, plan.defaultSize * BYTES));
 
-        case schema::Type::Body::LIST_TYPE: {
-          auto elementType = type.getListType();
+        case schema::Type::Body::LIST_TYPE:
           return DynamicValue::Reader(DynamicList::Reader(
-              ListSchema::of(elementType, member.getContainingStruct()),
-              reader.getListField(field.getOffset() * POINTERS,
-                                  elementSizeFor(elementType.getBody().which()),
-                                  dval.getListValue<internal::UncheckedMessage>())));
-        }
+              plan.listType,
+              reader.getListField(plan.offset * POINTERS,
+                                  elementSizeFor(plan.listType.whichElementType()),
+                                  defaultMessage(plan))));
 
-        case schema::Type::Body::STRUCT_TYPE: {
+        case schema::Type::Body::STRUCT_TYPE:
           return DynamicValue::Reader(DynamicStruct::Reader(
-              member.getContainingStruct().getDependency(type.getStructType()).asStruct(),
-              reader.getStructField(field.getOffset() * POINTERS,
-                                    dval.getStructValue<internal::UncheckedMessage>())));
-        }
+              plan.structType,
+              reader.getStructField(plan.offset * POINTERS, defaultMessage(plan))));
 
-        case schema::Type::Body::OBJECT_TYPE: {
+        case schema::Type::Body::OBJECT_TYPE:
           return DynamicValue::Reader(DynamicObject(
-              reader.getObjectField(field.getOffset() * POINTERS,
-                                    dval.getObjectValue<internal::UncheckedMessage>())));
-        }
+              reader.getObjectField(plan.offset * POINTERS, defaultMessage(plan))));
 
         case schema::Type::Body::INTERFACE_TYPE:
           FAIL_CHECK("Interfaces not yet implemented.");
@@ -729,99 +711,82 @@ DynamicValue::Reader DynamicStruct::Reader::getImpl(
     }
   }
 
-  FAIL_CHECK("switch() missing case.", member.getProto().getBody().which());
+  FAIL_CHECK("switch() missing case.", plan.kind);
   return nullptr;
 }
 
 DynamicValue::Builder DynamicStruct::Builder::getImpl(
     internal::StructBuilder builder, StructSchema::Member member) {
-  switch (member.getProto().getBody().which()) {
+  const internal::MemberPlan& plan = member.getPlan();
+
+  switch (plan.kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER:
       return DynamicUnion::Builder(member.asUnion(), builder);
 
     case schema::StructNode::Member::Body::FIELD_MEMBER: {
-      auto field = member.getProto().getBody().getFieldMember();
-      auto type = field.getType().getBody();
-      auto dval = field.getDefaultValue().getBody();
-
-      switch (type.which()) {
+      switch (plan.type) {
         case schema::Type::Body::VOID_TYPE:
-          return DynamicValue::Builder(builder.getDataField<Void>(field.getOffset() * ELEMENTS));
+          return DynamicValue::Builder(builder.getDataField<Void>(plan.offset * ELEMENTS));
 
-#define HANDLE_TYPE(discrim, titleCase, type) \
+#define HANDLE_TYPE(discrim, type) \
         case schema::Type::Body::discrim##_TYPE: \
           return DynamicValue::Builder(builder.getDataField<type>( \
-              field.getOffset() * ELEMENTS, \
-              bitCast<typename internal::MaskType<type>::Type>(dval.get##titleCase##Value())));
-
-        HANDLE_TYPE(BOOL, Bool, bool)
-        HANDLE_TYPE(INT8, Int8, int8_t)
-        HANDLE_TYPE(INT16, Int16, int16_t)
-        HANDLE_TYPE(INT32, Int32, int32_t)
-        HANDLE_TYPE(INT64, Int64, int64_t)
-        HANDLE_TYPE(UINT8, Uint8, uint8_t)
-        HANDLE_TYPE(UINT16, Uint16, uint16_t)
-        HANDLE_TYPE(UINT32, Uint32, uint32_t)
-        HANDLE_TYPE(UINT64, Uint64, uint64_t)
-        HANDLE_TYPE(FLOAT32, Float32, float)
-        HANDLE_TYPE(FLOAT64, Float64, double)
+              plan.offset * ELEMENTS, defaultMask<type>(plan)));
+
+        HANDLE_TYPE(BOOL, bool)
+        HANDLE_TYPE(INT8, int8_t)
+        HANDLE_TYPE(INT16, int16_t)
+        HANDLE_TYPE(INT32, int32_t)
+        HANDLE_TYPE(INT64, int64_t)
+        HANDLE_TYPE(UINT8, uint8_t)
+        HANDLE_TYPE(UINT16, uint16_t)
+        HANDLE_TYPE(UINT32, uint32_t)
+        HANDLE_TYPE(UINT64, uint64_t)
+        HANDLE_TYPE(FLOAT32, float)
+        HANDLE_TYPE(FLOAT64, double)
 
 #undef HANDLE_TYPE
 
-        case schema::Type::Body::ENUM_TYPE: {
-          uint16_t typedDval;
-          typedDval = dval.getEnumValue();
-          return DynamicValue::Builder(DynamicEnum(
-              member.getContainingStruct().getDependency(type.getEnumType()).asEnum(),
-              builder.getDataField<uint16_t>(field.getOffset() * ELEMENTS, typedDval)));
-        }
+        case schema::Type::Body::ENUM_TYPE:
+          return DynamicValue::Builder(DynamicEnum(plan.enumType,
+              builder.getDataField<uint16_t>(plan.offset * ELEMENTS, defaultMask<uint16_t>(plan))));
 
-        case schema::Type::Body::TEXT_TYPE: {
-          Text::Reader typedDval = dval.getTextValue();
+        case schema::Type::Body::TEXT_TYPE:
           return DynamicValue::Builder(
-              builder.getBlobField<Text>(field.getOffset() * POINTERS,
-                                         typedDval.data(), typedDval.size() * BYTES));
-        }
+              builder.getBlobField<Text>(plan.offset * POINTERS,
+                                         plan.defaultPointer, plan.defaultSize * BYTES));
 
-        case schema::Type::Body::DATA_TYPE: {
-          Data::Reader typedDval = dval.getDataValue();
+        case schema::Type::Body::DATA_TYPE:
           return DynamicValue::Builder(
-              builder.getBlobField<Data>(field.getOffset() * POINTERS,
-                                         typedDval.data(), typedDval.size() * BYTES));
-        }
+              builder.getBlobField<Data>(plan.offset * POINTERS,
+                                         plan.defaultPointer, plan.defaultSize * BYTES));
 
         case schema::Type::Body::LIST_TYPE: {
-          ListSchema listType = ListSchema::of(type.getListType(), member.getContainingStruct());
-          if (listType.whichElementType() == schema::Type::Body::STRUCT_TYPE) {
-            return DynamicValue::Builder(DynamicList::Builder(listType,
-                builder.getStructListField(field.getOffset() * POINTERS,
-                                           structSizeFromSchema(listType.getStructElementType()),
-                                           dval.getListValue<internal::UncheckedMessage>())));
+          if (plan.listType.whichElementType() == schema::Type::Body::STRUCT_TYPE) {
+            return DynamicValue::Builder(DynamicList::Builder(plan.listType,
+                builder.getStructListField(
+                    plan.offset * POINTERS,
+                    structSizeFromSchema(plan.listType.getStructElementType()),
+                    defaultMessage(plan))));
           } else {
-            return DynamicValue::Builder(DynamicList::Builder(listType,
-                builder.getListField(field.getOffset() * POINTERS,
-                                     elementSizeFor(listType.whichElementType()),
-                                     dval.getListValue<internal::UncheckedMessage>())));
+            return DynamicValue::Builder(DynamicList::Builder(plan.listType,
+                builder.getListField(plan.offset * POINTERS,
+                                     elementSizeFor(plan.listType.whichElementType()),
+                                     defaultMessage(plan))));
           }
         }
 
-        case schema::Type::Body::STRUCT_TYPE: {
-          auto structSchema =
-              member.getContainingStruct().getDependency(type.getStructType()).asStruct();
+        case schema::Type::Body::STRUCT_TYPE:
           return DynamicValue::Builder(DynamicStruct::Builder(
-              structSchema,
+              plan.structType,
               builder.getStructField(
-                  field.getOffset() * POINTERS,
-                  structSizeFromSchema(structSchema),
-                  dval.getStructValue<internal::UncheckedMessage>())));
-        }
+                  plan.offset * POINTERS,
+                  structSizeFromSchema(plan.structType),
+                  defaultMessage(plan))));
 
-        case schema::Type::Body::OBJECT_TYPE: {
+        case schema::Type::Body::OBJECT_TYPE:
           return DynamicValue::Builder(DynamicObject(
-              builder.asReader().getObjectField(
-                  field.getOffset() * POINTERS,
-                  dval.getObjectValue<internal::UncheckedMessage>())));
-        }
+              builder.asReader().getObjectField(plan.offset * POINTERS, defaultMessage(plan))));
 
         case schema::Type::Body::INTERFACE_TYPE:
           FAIL_CHECK("Interfaces not yet implemented.");
@@ -832,14 +797,14 @@ DynamicValue::Builder DynamicStruct::Builder::getImpl(
     }
   }
 
-  FAIL_CHECK("switch() missing case.", member.getProto().getBody().which());
+  FAIL_CHECK("switch() missing case.", plan.kind);
   return nullptr;
 }
 DynamicStruct::Builder DynamicStruct::Builder::getObjectImpl(
     internal::StructBuilder builder, StructSchema::Member field, StructSchema type) {
   return DynamicStruct::Builder(type,
       builder.getStructField(
-          field.getProto().getBody().getFieldMember().getOffset() * POINTERS,
+          field.getPlan().offset * POINTERS,
           structSizeFromSchema(type), nullptr));
 }
 DynamicList::Builder DynamicStruct::Builder::getObjectImpl(
@@ -847,31 +812,31 @@ DynamicList::Builder DynamicStruct::Builder::getObjectImpl(
   if (type.whichElementType() == schema::Type::Body::STRUCT_TYPE) {
     return DynamicList::Builder(type,
         builder.getStructListField(
-            field.getProto().getBody().getFieldMember().getOffset() * POINTERS,
+            field.getPlan().offset * POINTERS,
             structSizeFromSchema(type.getStructElementType()),
             nullptr));
   } else {
     return DynamicList::Builder(type,
         builder.getListField(
-            field.getProto().getBody().getFieldMember().getOffset() * POINTERS,
+            field.getPlan().offset * POINTERS,
             elementSizeFor(type.whichElementType()),
             nullptr));
   }
 }
 Text::Builder DynamicStruct::Builder::getObjectAsTextImpl(
     internal::StructBuilder builder, StructSchema::Member field) {
-  return builder.getBlobField<Text>(
-      field.getProto().getBody().getFieldMember().getOffset() * POINTERS, nullptr, 0 * BYTES);
+  return builder.getBlobField<Text>(field.getPlan().offset * POINTERS, nullptr, 0 * BYTES);
 }
 Data::Builder DynamicStruct::Builder::getObjectAsDataImpl(
     internal::StructBuilder builder, StructSchema::Member field) {
-  return builder.getBlobField<Data>(
-      field.getProto().getBody().getFieldMember().getOffset() * POINTERS, nullptr, 0 * BYTES);
+  return builder.getBlobField<Data>(field.getPlan().offset * POINTERS, nullptr, 0 * BYTES);
 }
 
 void DynamicStruct::Builder::setImpl(
     internal::StructBuilder builder, StructSchema::Member member, DynamicValue::Reader value) {
-  switch (member.getProto().getBody().which()) {
+  const internal::MemberPlan& plan = member.getPlan();
+
+  switch (plan.kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER: {
       auto src = value.as<DynamicUnion>();
       auto which = src.which();
@@ -882,80 +847,74 @@ void DynamicStruct::Builder::setImpl(
         return;
       }
 
-      getImpl(builder, member).as<DynamicUnion>().set(member, src.get());
+      getImpl(builder, member).as<DynamicUnion>().set(*which, src.get());
       return;
     }
 
     case schema::StructNode::Member::Body::FIELD_MEMBER: {
-      auto field = member.getProto().getBody().getFieldMember();
-      auto type = field.getType().getBody();
-      auto dval = field.getDefaultValue().getBody();
-
-      switch (type.which()) {
+      switch (plan.type) {
         case schema::Type::Body::VOID_TYPE:
-          builder.setDataField<Void>(field.getOffset() * ELEMENTS, value.as<Void>());
+          builder.setDataField<Void>(plan.offset * ELEMENTS, value.as<Void>());
           return;
 
-#define HANDLE_TYPE(discrim, titleCase, type) \
+#define HANDLE_TYPE(discrim, type) \
         case schema::Type::Body::discrim##_TYPE: \
           builder.setDataField<type>( \
-              field.getOffset() * ELEMENTS, value.as<type>(), \
-              bitCast<internal::Mask<type> >(dval.get##titleCase##Value())); \
+              plan.offset * ELEMENTS, value.as<type>(), defaultMask<type>(plan)); \
           return;
 
-        HANDLE_TYPE(BOOL, Bool, bool)
-        HANDLE_TYPE(INT8, Int8, int8_t)
-        HANDLE_TYPE(INT16, Int16, int16_t)
-        HANDLE_TYPE(INT32, Int32, int32_t)
-        HANDLE_TYPE(INT64, Int64, int64_t)
-        HANDLE_TYPE(UINT8, Uint8, uint8_t)
-        HANDLE_TYPE(UINT16, Uint16, uint16_t)
-        HANDLE_TYPE(UINT32, Uint32, uint32_t)
-        HANDLE_TYPE(UINT64, Uint64, uint64_t)
-        HANDLE_TYPE(FLOAT32, Float32, float)
-        HANDLE_TYPE(FLOAT64, Float64, double)
+        HANDLE_TYPE(BOOL, bool)
+        HANDLE_TYPE(INT8, int8_t)
+        HANDLE_TYPE(INT16, int16_t)
+        HANDLE_TYPE(INT32, int32_t)
+        HANDLE_TYPE(INT64, int64_t)
+        HANDLE_TYPE(UINT8, uint8_t)
+        HANDLE_TYPE(UINT16, uint16_t)
+        HANDLE_TYPE(UINT32, uint32_t)
+        HANDLE_TYPE(UINT64, uint64_t)
+        HANDLE_TYPE(FLOAT32, float)
+        HANDLE_TYPE(FLOAT64, double)
 
 #undef HANDLE_TYPE
 
         case schema::Type::Body::ENUM_TYPE: {
           uint16_t rawValue;
-          auto enumSchema = member.getContainingStruct().getDependency(type.getEnumType()).asEnum();
           if (value.getType() == DynamicValue::TEXT) {
             // Convert from text.
-            rawValue = enumSchema.getEnumerantByName(value.as<Text>()).getOrdinal();
+            rawValue = plan.enumType.getEnumerantByName(value.as<Text>()).getOrdinal();
           } else {
             DynamicEnum enumValue = value.as<DynamicEnum>();
-            RECOVERABLE_PRECOND(enumValue.getSchema() == enumSchema,
+            RECOVERABLE_PRECOND(enumValue.getSchema() == plan.enumType,
                                 "Type mismatch when using DynamicList::Builder::set().") {
               return;
             }
             rawValue = enumValue.getRaw();
           }
-          builder.setDataField<uint16_t>(field.getOffset() * ELEMENTS, rawValue,
-                                         dval.getEnumValue());
+          builder.setDataField<uint16_t>(plan.offset * ELEMENTS, rawValue,
+                                         defaultMask<uint16_t>(plan));
           return;
         }
 
         case schema::Type::Body::TEXT_TYPE:
-          builder.setBlobField<Text>(field.getOffset() * POINTERS, value.as<Text>());
+          builder.setBlobField<Text>(plan.offset * POINTERS, value.as<Text>());
           return;
 
         case schema::Type::Body::DATA_TYPE:
-          builder.setBlobField<Data>(field.getOffset() * POINTERS, value.as<Data>());
+          builder.setBlobField<Data>(plan.offset * POINTERS, value.as<Data>());
           return;
 
         case schema::Type::Body::LIST_TYPE: {
-          builder.setListField(field.getOffset() * POINTERS, value.as<DynamicList>().reader);
+          builder.setListField(plan.offset * POINTERS, value.as<DynamicList>().reader);
           return;
         }
 
         case schema::Type::Body::STRUCT_TYPE: {
-          builder.setStructField(field.getOffset() * POINTERS, value.as<DynamicStruct>().reader);
+          builder.setStructField(plan.offset * POINTERS, value.as<DynamicStruct>().reader);
           return;
         }
 
         case schema::Type::Body::OBJECT_TYPE: {
-          builder.setObjectField(field.getOffset() * POINTERS, value.as<DynamicObject>().reader);
+          builder.setObjectField(plan.offset * POINTERS, value.as<DynamicObject>().reader);
           return;
         }
 
@@ -964,35 +923,35 @@ void DynamicStruct::Builder::setImpl(
           return;
       }
 
-      FAIL_RECOVERABLE_PRECOND("can't set field of unknown type", type.which());
+      FAIL_RECOVERABLE_PRECOND("can't set field of unknown type", plan.type);
       return;
     }
   }
 
-  FAIL_CHECK("switch() missing case.", member.getProto().getBody().which());
+  FAIL_CHECK("switch() missing case.", plan.kind);
 }
 
 DynamicValue::Builder DynamicStruct::Builder::initImpl(
     internal::StructBuilder builder, StructSchema::Member member, uint size) {
-  switch (member.getProto().getBody().which()) {
+  const internal::MemberPlan& plan = member.getPlan();
+
+  switch (plan.kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER:
       FAIL_PRECOND(
           "Can't init() a union.  get() it first and then init() one of its members.");
       break;
 
     case schema::StructNode::Member::Body::FIELD_MEMBER: {
-      auto type = member.getProto().getBody().getFieldMember().getType().getBody();
-      switch (type.which()) {
+      switch (plan.type) {
         case schema::Type::Body::LIST_TYPE:
-          return initFieldImpl(builder, member, ListSchema::of(
-              type.getListType(), member.getContainingStruct()), size);
+          return initFieldImpl(builder, member, plan.listType, size);
         case schema::Type::Body::TEXT_TYPE:
           return initFieldAsTextImpl(builder, member, size);
         case schema::Type::Body::DATA_TYPE:
           return initFieldAsDataImpl(builder, member, size);
         default:
           FAIL_PRECOND(
-              "init() with size is only valid for list, text, or data fields.", type.which());
+              "init() with size is only valid for list, text, or data fields.", plan.type);
           break;
       }
       break;
@@ -1005,18 +964,18 @@ DynamicValue::Builder DynamicStruct::Builder::initImpl(
 
 DynamicValue::Builder DynamicStruct::Builder::initImpl(
     internal::StructBuilder builder, StructSchema::Member member) {
-  switch (member.getProto().getBody().which()) {
+  const internal::MemberPlan& plan = member.getPlan();
+
+  switch (plan.kind) {
     case schema::StructNode::Member::Body::UNION_MEMBER:
       FAIL_PRECOND(
           "Can't init() a union.  get() it first and then init() one of its members.");
       break;
 
     case schema::StructNode::Member::Body::FIELD_MEMBER: {
-      auto type = member.getProto().getBody().getFieldMember().getType().getBody();
-      PRECOND(type.which() == schema::Type::Body::STRUCT_TYPE,
+      PRECOND(plan.type == schema::Type::Body::STRUCT_TYPE,
               "init() without a size is only valid for struct fields.");
-      return initFieldImpl(builder, member,
-          member.getContainingStruct().getDependency(type.getStructType()).asStruct());
+      return initFieldImpl(builder, member, plan.structType);
     }
   }
 
@@ -1027,7 +986,7 @@ DynamicStruct::Builder DynamicStruct::Builder::initFieldImpl(
     internal::StructBuilder builder, StructSchema::Member field, StructSchema type) {
   return DynamicStruct::Builder(
       type, builder.initStructField(
-          field.getProto().getBody().getFieldMember().getOffset() * POINTERS,
+          field.getPlan().offset * POINTERS,
           structSizeFromSchema(type)));
 }
 DynamicList::Builder DynamicStruct::Builder::initFieldImpl(
@@ -1036,25 +995,23 @@ DynamicList::Builder DynamicStruct::Builder::initFieldImpl(
   if (type.whichElementType() == schema::Type::Body::STRUCT_TYPE) {
     return DynamicList::Builder(
         type, builder.initStructListField(
-            field.getProto().getBody().getFieldMember().getOffset() * POINTERS, size * ELEMENTS,
+            field.getPlan().offset * POINTERS, size * ELEMENTS,
             structSizeFromSchema(type.getStructElementType())));
   } else {
     return DynamicList::Builder(
         type, builder.initListField(
-            field.getProto().getBody().getFieldMember().getOffset() * POINTERS,
+            field.getPlan().offset * POINTERS,
             elementSizeFor(type.whichElementType()),
             size * ELEMENTS));
   }
 }
 Text::Builder DynamicStruct::Builder::initFieldAsTextImpl(
     internal::StructBuilder builder, StructSchema::Member field, uint size) {
-  return builder.initBlobField<Text>(
-      field.getProto().getBody().getFieldMember().getOffset() * POINTERS, size * BYTES);
+  return builder.initBlobField<Text>(field.getPlan().offset * POINTERS, size * BYTES);
 }
 Data::Builder DynamicStruct::Builder::initFieldAsDataImpl(
     internal::StructBuilder builder, StructSchema::Member field, uint size) {
-  return builder.initBlobField<Data>(
-      field.getProto().getBody().getFieldMember().getOffset() * POINTERS, size * BYTES);
+  return builder.initBlobField<Data>(field.getPlan().offset * POINTERS, size * BYTES);
 }
 
 // =======================================================================================
@@ -285,6 +285,8 @@ private:
   friend struct DynamicList;
   friend class MessageReader;
   friend class MessageBuilder;
+  friend class ColumnExtractor;
+  friend class ColumnarList;
   template <typename T, ::capnproto::Kind k>
   friend struct ::capnproto::ToDynamic_;
   friend String internal::debugString(StructReader reader, const RawSchema& schema);
@@ -426,6 +428,8 @@ private:
   friend struct DynamicStruct;
   friend class DynamicObject;
   friend class DynamicList::Builder;
+  friend class ColumnExtractor;
+  friend class ColumnarList;
   template <typename T, ::capnproto::Kind k>
   friend struct ::capnproto::ToDynamic_;
 };
@@ -466,6 +470,7 @@ private:
   template <typename T>
   friend struct internal::PointerHelpers;
   friend struct DynamicStruct;
+  friend class ColumnarList;
   template <typename T, ::capnproto::Kind k>
   friend struct ::capnproto::ToDynamic_;
 };
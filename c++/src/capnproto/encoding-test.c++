@@ -1335,6 +1335,51 @@ TEST(Encoding, Has) {
   EXPECT_TRUE(root.asReader().hasInt32List());
 }
 
+TEST(Encoding, Fingerprint) {
+  MallocMessageBuilder builder1;
+  MallocMessageBuilder builder2(0, AllocationStrategy::FIXED_SIZE);
+
+  initTestMessage(builder1.initRoot<TestAllTypes>());
+  initTestMessage(builder2.initRoot<TestAllTypes>());
+  auto root1 = builder1.getRoot<TestAllTypes>();
+  auto root2 = builder2.getRoot<TestAllTypes>();
+
+  // Same content, even though one is spread across many segments.
+  EXPECT_EQ(root1.fingerprint(), root2.fingerprint());
+  EXPECT_EQ(root1.fingerprint(), root1.asReader().fingerprint());
+
+  root2.getStructField().getStructList()[1].setTextField("x structlist 3");
+  EXPECT_NE(root1.fingerprint(), root2.fingerprint());
+  root2.getStructField().getStructList()[1].setTextField("x structlist 2");
+  EXPECT_EQ(root1.fingerprint(), root2.fingerprint());
+
+  root2.setUInt8Field(root2.getUInt8Field() + 1);
+  EXPECT_NE(root1.fingerprint(), root2.fingerprint());
+
+  EXPECT_NE(MallocMessageBuilder().initRoot<TestAllTypes>().fingerprint(), root1.fingerprint());
+}
+
+TEST(Encoding, FingerprintIgnoresPadding) {
+  // A newer version of a struct with its new fields unset has larger sections than the old
+  // version, but the same content.
+  MallocMessageBuilder oldBuilder;
+  auto oldRoot = oldBuilder.initRoot<test::TestOldVersion>();
+  oldRoot.setOld1(123);
+  oldRoot.setOld2("foo");
+  oldRoot.initOld3().setOld1(456);
+
+  MallocMessageBuilder newBuilder;
+  auto newRoot = newBuilder.initRoot<test::TestNewVersion>();
+  newRoot.setOld1(123);
+  newRoot.setOld2("foo");
+  newRoot.initOld3().setOld1(456);
+
+  EXPECT_EQ(oldRoot.fingerprint(), newRoot.fingerprint());
+
+  newRoot.setNew1(789);
+  EXPECT_NE(oldRoot.fingerprint(), newRoot.fingerprint());
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace capnproto
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <execinfo.h>
 #include <stdlib.h>
+#include <mutex>
 
 namespace capnproto {
 
@@ -55,16 +56,63 @@ ArrayPtr<const char> operator*(const Stringifier&, Exception::Durability durabil
   return arrayPtr(s, strlen(s));
 }
 
+namespace {
+
+#if __GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 8)
+#define thread_local __thread
+#endif
+
+Exception::TraceMode traceMode = Exception::TraceMode::ALWAYS;
+uint traceSampleInterval = 100;
+thread_local uint traceSampleCountdown = 0;
+
+}  // namespace
+
+void Exception::setTraceMode(TraceMode mode, uint sampleInterval) {
+  PRECOND(sampleInterval > 0);
+  __atomic_store_n(&traceSampleInterval, sampleInterval, __ATOMIC_RELAXED);
+  __atomic_store_n(&traceMode, mode, __ATOMIC_RELAXED);
+}
+
+Exception::DescriptionBuilder::~DescriptionBuilder() noexcept {}
+
 Exception::Exception(Nature nature, Durability durability, const char* file, int line,
                      Array<char> description) noexcept
     : file(file), line(line), nature(nature), durability(durability),
-      description(move(description)) {
+      description(move(description)), descriptionBuilt(true) {
+  captureTrace();
+}
+
+Exception::Exception(Nature nature, Durability durability, const char* file, int line,
+                     Own<DescriptionBuilder> description) noexcept
+    : file(file), line(line), nature(nature), durability(durability),
+      descriptionBuilder(move(description)), descriptionBuilt(false) {
+  captureTrace();
+}
+
+void Exception::captureTrace() {
+  switch (__atomic_load_n(&traceMode, __ATOMIC_RELAXED)) {
+    case TraceMode::NEVER:
+      traceCount = 0;
+      return;
+    case TraceMode::SAMPLED:
+      if (traceSampleCountdown > 0) {
+        --traceSampleCountdown;
+        traceCount = 0;
+        return;
+      }
+      traceSampleCountdown = __atomic_load_n(&traceSampleInterval, __ATOMIC_RELAXED) - 1;
+      break;
+    case TraceMode::ALWAYS:
+      break;
+  }
   traceCount = backtrace(trace, 16);
 }
 
 Exception::Exception(const Exception& other) noexcept
     : file(other.file), line(other.line), nature(other.nature), durability(other.durability),
-      description(str(other.description)), traceCount(other.traceCount) {
+      description(str(other.getDescription())), descriptionBuilt(true),
+      traceCount(other.traceCount) {
   memcpy(trace, other.trace, sizeof(trace[0]) * traceCount);
 
   if (other.context != nullptr) {
@@ -81,6 +129,26 @@ Exception::Context::Context(const Context& other) noexcept
   }
 }
 
+namespace {
+
+std::mutex descriptionMutex;
+// Serializes building lazy descriptions.  Building is rare and quick, so one lock for all
+// exceptions is enough.
+
+}  // namespace
+
+ArrayPtr<const char> Exception::getDescription() const {
+  if (!__atomic_load_n(&descriptionBuilt, __ATOMIC_ACQUIRE)) {
+    std::lock_guard<std::mutex> lock(descriptionMutex);
+    if (!descriptionBuilt) {
+      description = (*descriptionBuilder)->build();
+      descriptionBuilder = nullptr;
+      __atomic_store_n(&descriptionBuilt, true, __ATOMIC_RELEASE);
+    }
+  }
+  return description;
+}
+
 void Exception::wrapContext(const char* file, int line, Array<char>&& description) {
   context = heap<Context>(file, line, move(description), move(context));
 }
@@ -109,7 +177,7 @@ const char* Exception::what() const noexcept {
   whatBuffer = str(strArray(contextText, ""),
                    file, ":", line, ": ", nature,
                    durability == Durability::TEMPORARY ? " (temporary)" : "",
-                   this->description == nullptr ? "" : ": ", this->description,
+                   getDescription() == nullptr ? "" : ": ", this->description,
                    "\nstack: ", strArray(arrayPtr(trace, traceCount), " "), '\0');
 
   return whatBuffer.begin();
@@ -119,10 +187,6 @@ const char* Exception::what() const noexcept {
 
 namespace {
 
-#if __GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 8)
-#define thread_local __thread
-#endif
-
 thread_local ExceptionCallback::ScopedRegistration* threadLocalCallback = nullptr;
 ExceptionCallback* globalCallback = nullptr;
 
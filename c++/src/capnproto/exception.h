@@ -62,8 +62,32 @@ public:
     // Make sure to update the stringifier if you add a new durability.
   };
 
+  enum class TraceMode {
+    // Whether newly-constructed exceptions capture a stack trace.  Capturing one is by far the
+    // most expensive part of raising an exception, which matters when e.g. a flood of malformed
+    // input trips VALIDATE_INPUT over and over.
+
+    NEVER,    // Don't capture traces.
+    SAMPLED,  // Capture a trace for one in every `sampleInterval` exceptions on each thread.
+    ALWAYS    // Capture a trace for every exception.  This is the default.
+  };
+
+  static void setTraceMode(TraceMode mode, uint sampleInterval = 100);
+  // Set the trace mode for all threads.  Exceptions without a trace print an empty "stack:" line.
+
+  class DescriptionBuilder {
+    // Produces an exception's description the first time it is needed, so that an exception
+    // which is caught and discarded never pays for formatting it.
+
+  public:
+    virtual ~DescriptionBuilder() noexcept;
+    virtual Array<char> build() = 0;
+  };
+
   Exception(Nature nature, Durability durability, const char* file, int line,
             Array<char> description = nullptr) noexcept;
+  Exception(Nature nature, Durability durability, const char* file, int line,
+            Own<DescriptionBuilder> description) noexcept;
   Exception(const Exception& other) noexcept;
   Exception(Exception&& other) = default;
   ~Exception() noexcept;
@@ -72,7 +96,9 @@ public:
   int getLine() const { return line; }
   Nature getNature() const { return nature; }
   Durability getDurability() const { return durability; }
-  ArrayPtr<const char> getDescription() const { return description; }
+  ArrayPtr<const char> getDescription() const;
+  // If the description is built lazily, the first call builds it.  That is done under a lock, so
+  // several threads may call this on the same exception, e.g. one rethrown from an exception_ptr.
 
   struct Context {
     // Describes a bit about what was going on when the exception was thrown.
@@ -107,11 +133,17 @@ private:
   int line;
   Nature nature;
   Durability durability;
-  Array<char> description;
+  mutable Array<char> description;
+  mutable Maybe<Own<DescriptionBuilder>> descriptionBuilder;
+  mutable bool descriptionBuilt;
+  // Until `descriptionBuilt` is set (with release semantics), `description` has not been built
+  // yet and `descriptionBuilder` will build it.
   Maybe<Own<Context>> context;
   void* trace[16];
   uint traceCount;
   mutable Array<char> whatBuffer;
+
+  void captureTrace();
 };
 
 class Stringifier;
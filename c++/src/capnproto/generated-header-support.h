@@ -126,6 +126,35 @@ struct PointerHelpers<UncheckedMessage> {
 
 #endif
 
+struct MemberPlan;
+// Defined in schema.h.
+
+// The hash functions and table sizing below are also implemented by the code generator
+// (compiler/src/CxxGenerator.hs), which emits pre-built tables.  The two must stay in sync.
+
+inline uint32_t hashTableSize(uint32_t count) {
+  // Number of slots in a RawSchema hash table holding `count` entries:  the smallest power of two
+  // that is at least twice the count.  An empty table still has one (empty) slot.
+  uint32_t result = 1;
+  while (result < count * 2) result <<= 1;
+  return result;
+}
+
+inline uint32_t hashSchemaId(uint64_t id) {
+  uint32_t h = static_cast<uint32_t>(id ^ (id >> 32));
+  h = (h ^ (h >> 16)) * 0x85ebca6bu;
+  return h ^ (h >> 13);
+}
+
+inline uint32_t hashMemberName(uint unionIndex, const char* name, size_t size) {
+  // FNV-1a over the union index followed by the name's bytes.
+  uint32_t h = (2166136261u ^ unionIndex) * 16777619u;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ static_cast<uint8_t>(name[i])) * 16777619u;
+  }
+  return h;
+}
+
 struct RawSchema {
   // The generated code defines a constant RawSchema for every compiled declaration.
   //
@@ -136,7 +165,12 @@ struct RawSchema {
 
   const RawSchema* const* dependencies;
   // Pointers to other types on which this one depends, sorted by ID.
-  // TODO(someday):  Make this a hashtable.
+
+  const uint32_t* dependencyTable;
+  // Open-addressed hash table indexing `dependencies` by hashSchemaId().  The first element is the
+  // table's mask, i.e. its slot count minus one.  The hashTableSize(dependencyCount) slots follow,
+  // each holding an index into `dependencies` plus one, or zero if empty.  Collisions are resolved
+  // by linear probing.
 
   struct MemberInfo {
     uint16_t unionIndex;  // 0 = not in a union, >0 = parent union's index + 1
@@ -147,8 +181,11 @@ struct RawSchema {
   };
 
   const MemberInfo* membersByName;
-  // Indexes of members sorted by name.  Used to implement name lookup.
-  // TODO(someday):  Make this a hashtable.
+  // Indexes of members sorted by (unionIndex, name).
+
+  const uint32_t* memberTable;
+  // Open-addressed hash table indexing `membersByName` by hashMemberName(), laid out the same way
+  // as `dependencyTable`.  Used to implement name lookup.
 
   uint32_t dependencyCount;
   uint32_t memberCount;
@@ -158,6 +195,40 @@ struct RawSchema {
   // Points to the RawSchema of a compiled-in type to which it is safe to cast any DynamicValue
   // with this schema.  This is null for all compiled-in types; it is only set by SchemaLoader on
   // dynamically-loaded types.
+
+  mutable const MemberPlan* memberPlans;
+  // For structs, the precomputed layout of every member, used by the dynamic API.  The struct's
+  // own members come first, in order, followed by the members of each union.  SchemaLoader fills
+  // this in when it loads a struct.  Compiled-in structs start out with null, and the table is
+  // built and published the first time it is needed.
+
+  class Initializer {
+  public:
+    virtual void init(const RawSchema* schema) const = 0;
+  };
+
+  const Initializer* lazyInitializer;
+  // Non-null if this is a placeholder which a SchemaLoader will fill in on first use.  The
+  // encodedNode of a placeholder is an empty node with the right ID and kind.  Always null for
+  // compiled-in types.
+
+  inline void ensureInitialized() const {
+    const Initializer* initializer = __atomic_load_n(&lazyInitializer, __ATOMIC_ACQUIRE);
+    if (initializer != nullptr) initializer->init(this);
+  }
+
+  const RawSchema* version;
+  // Non-null if this schema belongs to a SchemaLoader, in which case the node, the tables, and the
+  // member plans are found in `*version` rather than here.  The loader never modifies a version
+  // once it is published; it replaces a schema by swapping in a new one.  Always null for
+  // compiled-in types.
+
+  inline const RawSchema* getVersion() const {
+    // Returns the RawSchema holding the current node, tables, and member plans.  Load it once and
+    // read everything from the result, so that all of it comes from the same version.
+    const RawSchema* result = __atomic_load_n(&version, __ATOMIC_ACQUIRE);
+    return result == nullptr ? this : result;
+  }
 };
 
 template <typename T>
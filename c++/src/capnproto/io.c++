@@ -233,6 +233,15 @@ AutoCloseFd::~AutoCloseFd() {
   }
 }
 
+AutoCloseFd& AutoCloseFd::operator=(AutoCloseFd&& other) {
+  if (fd >= 0 && close(fd) < 0) {
+    FAIL_RECOVERABLE_SYSCALL("close", errno, fd);
+  }
+  fd = other.fd;
+  other.fd = -1;
+  return *this;
+}
+
 FdInputStream::~FdInputStream() {}
 
 size_t FdInputStream::read(void* buffer, size_t minBytes, size_t maxBytes) {
@@ -284,7 +293,7 @@ void FdOutputStream::write(ArrayPtr<const ArrayPtr<const byte>> pieces) {
     ssize_t n = SYSCALL(::writev(fd, current, iov.end() - current), fd);
     CHECK(n > 0, "writev() returned zero.");
 
-    while (static_cast<size_t>(n) >= current->iov_len) {
+    while (current < iov.end() && static_cast<size_t>(n) >= current->iov_len) {
       n -= current->iov_len;
       ++current;
     }
@@ -228,6 +228,9 @@ public:
   CAPNPROTO_DISALLOW_COPY(AutoCloseFd);
   ~AutoCloseFd();
 
+  AutoCloseFd& operator=(AutoCloseFd&& other);
+  // Closes the current descriptor, if any, and takes ownership of the other one.
+
   inline operator int() { return fd; }
   inline int get() { return fd; }
 
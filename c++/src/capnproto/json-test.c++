@@ -0,0 +1,339 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "json.h"
+#include "exception.h"
+#include "message.h"
+#include <gtest/gtest.h>
+#include <limits>
+#include <string>
+#include <string.h>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+class TestOutputStream: public OutputStream {
+public:
+  TestOutputStream(): writeCount(0) {}
+  ~TestOutputStream() {}
+
+  void write(const void* buffer, size_t size) override {
+    data.append(reinterpret_cast<const char*>(buffer), size);
+    ++writeCount;
+  }
+
+  const std::string& getData() { return data; }
+  uint getWriteCount() { return writeCount; }
+
+private:
+  std::string data;
+  uint writeCount;
+};
+
+TEST(Json, Scalars) {
+  JsonCodec json;
+
+  EXPECT_STREQ("null", json.encode(Void::VOID).cStr());
+  EXPECT_STREQ("true", json.encode(true).cStr());
+  EXPECT_STREQ("false", json.encode(false).cStr());
+  EXPECT_STREQ("123", json.encode(123).cStr());
+  EXPECT_STREQ("-9223372036854775808",
+               json.encode(std::numeric_limits<int64_t>::min()).cStr());
+  EXPECT_STREQ("1.5", json.encode(1.5).cStr());
+  EXPECT_STREQ("-1.23e47", json.encode(-123e45).cStr());
+  EXPECT_STREQ("\"Infinity\"",
+               json.encode(std::numeric_limits<double>::infinity()).cStr());
+  EXPECT_STREQ("\"-Infinity\"",
+               json.encode(-std::numeric_limits<double>::infinity()).cStr());
+  EXPECT_STREQ("\"NaN\"", json.encode(std::numeric_limits<double>::quiet_NaN()).cStr());
+}
+
+TEST(Json, Text) {
+  JsonCodec json;
+
+  EXPECT_STREQ("\"\"", json.encode("").cStr());
+  EXPECT_STREQ("\"foo\"", json.encode("foo").cStr());
+
+  // Only quotes, backslashes, and control characters are escaped; everything else, including
+  // UTF-8 sequences, passes through.
+  EXPECT_STREQ("\"a\\\"b\\\\c\\n\\t\\r\\b\\f\\u0001\\u001f\x7f\xc3\xa9'/\"",
+               json.encode("a\"b\\c\n\t\r\b\f\x01\x1f\x7f\xc3\xa9'/").cStr());
+
+  // Long enough to exercise the vectorized scan, with special characters at various offsets.
+  EXPECT_STREQ("\"0123456789abcdefghij\\\"0123456789abcdefghijklmnopqrstuvwxyz\\n\"",
+               json.encode("0123456789abcdefghij\"0123456789abcdefghijklmnopqrstuvwxyz\n").cStr());
+  EXPECT_STREQ("\"\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8\xf7\xf6\xf5\xf4\xf3\xf2\xf1\xf0\\u0000\"",
+               json.encode(Text::Reader("\xff\xfe\xfd\xfc\xfb\xfa\xf9\xf8"
+                                        "\xf7\xf6\xf5\xf4\xf3\xf2\xf1\xf0\0", 17)).cStr());
+}
+
+TEST(Json, Data) {
+  JsonCodec json;
+
+  // Test vectors from RFC 4648.
+  EXPECT_STREQ("\"\"", json.encode(Data::Reader("")).cStr());
+  EXPECT_STREQ("\"Zg==\"", json.encode(Data::Reader("f")).cStr());
+  EXPECT_STREQ("\"Zm8=\"", json.encode(Data::Reader("fo")).cStr());
+  EXPECT_STREQ("\"Zm9v\"", json.encode(Data::Reader("foo")).cStr());
+  EXPECT_STREQ("\"Zm9vYg==\"", json.encode(Data::Reader("foob")).cStr());
+  EXPECT_STREQ("\"Zm9vYmE=\"", json.encode(Data::Reader("fooba")).cStr());
+  EXPECT_STREQ("\"Zm9vYmFy\"", json.encode(Data::Reader("foobar")).cStr());
+
+  // Longer than one 48-byte block.
+  std::string input, expected = "\"";
+  for (uint i = 0; i < 20; i++) {
+    input += "foobar";
+    expected += "Zm9vYmFy";
+  }
+  input += "f";
+  expected += "Zg==\"";
+  EXPECT_EQ(expected, json.encode(Data::Reader(input.data(), input.size())).cStr());
+
+  EXPECT_STREQ("\"AP+A\"", json.encode(Data::Reader("\x00\xff\x80", 3)).cStr());
+}
+
+TEST(Json, Struct) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+
+  EXPECT_STREQ("{}", json.encode(root.asReader()).cStr());
+
+  root.setBoolField(true);
+  root.setInt32Field(-123);
+  root.setInt64Field(-1234567890123456789ll);
+  root.setUInt64Field(12345678901234567890ull);
+  root.setFloat32Field(0.1f);
+  root.setFloat64Field(0.1);
+  root.setTextField("foo");
+  root.setDataField("bar");
+  root.initStructField().setTextField("baz");
+  root.setEnumField(TestEnum::CORGE);
+  root.setInt32List({1, 2, 3});
+  root.setInt64List({4});
+  root.setTextList({"a", "b"});
+  root.initStructList(1)[0].setInt8Field(5);
+  root.setEnumList({TestEnum::FOO, static_cast<TestEnum>(123)});
+
+  EXPECT_STREQ("{"
+      "\"boolField\":true,"
+      "\"int32Field\":-123,"
+      "\"int64Field\":\"-1234567890123456789\","
+      "\"uInt64Field\":\"12345678901234567890\","
+      "\"float32Field\":0.1,"
+      "\"float64Field\":0.1,"
+      "\"textField\":\"foo\","
+      "\"dataField\":\"YmFy\","
+      "\"structField\":{\"textField\":\"baz\"},"
+      "\"enumField\":\"corge\","
+      "\"int32List\":[1,2,3],"
+      "\"int64List\":[\"4\"],"
+      "\"textList\":[\"a\",\"b\"],"
+      "\"structList\":[{\"int8Field\":5}],"
+      "\"enumList\":[\"foo\",123]}",
+      json.encode(root.asReader()).cStr());
+}
+
+TEST(Json, Unions) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnion>();
+  root.getUnion0().setU0f1s32(1234567);
+  root.getUnion1().setU1f1sp("foo");
+
+  EXPECT_STREQ("{\"union0\":{\"u0f1s32\":1234567},\"union1\":{\"u1f1sp\":\"foo\"}}",
+               json.encode(root.asReader()).cStr());
+}
+
+TEST(Json, Streams) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  String expected = json.encode(root.asReader());
+
+  {
+    // Directly into an array.
+    byte buffer[8192];
+    ArrayOutputStream output(arrayPtr(buffer, sizeof(buffer)));
+    json.encode(root.asReader(), output);
+    EXPECT_EQ(std::string(expected.cStr()),
+              std::string(reinterpret_cast<char*>(buffer), output.getArray().size()));
+  }
+
+  {
+    // Unbuffered stream.
+    TestOutputStream output;
+    json.encode(root.asReader(), output);
+    EXPECT_EQ(expected.cStr(), output.getData());
+    EXPECT_EQ(1u, output.getWriteCount());
+  }
+
+  {
+    // Buffers too small for a whole number or escape sequence.
+    for (uint size = 1; size < 80; size++) {
+      TestOutputStream output;
+      byte buffer[80];
+      BufferedOutputStreamWrapper wrapper(output, arrayPtr(buffer, size));
+      json.encode(root.asReader(), wrapper);
+      wrapper.flush();
+      EXPECT_EQ(expected.cStr(), output.getData()) << "buffer size: " << size;
+    }
+  }
+}
+
+void decode(JsonCodec& json, const char* input, DynamicStruct::Builder output) {
+  json.decode(arrayPtr(input, strlen(input)), output);
+}
+
+TEST(Json, DecodeRoundTrip) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  String text = json.encode(builder.getRoot<TestAllTypes>().asReader());
+
+  MallocMessageBuilder builder2;
+  auto root = builder2.initRoot<TestAllTypes>();
+  json.decode(arrayPtr(text.begin(), text.size()), root);
+  checkTestMessage(root.asReader());
+  EXPECT_STREQ(text.cStr(), json.encode(root.asReader()).cStr());
+}
+
+TEST(Json, DecodeUnions) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnion>();
+  decode(json, "{\"union0\":{\"u0f1s32\":1234567},\"union1\":{\"u1f0s0\":null},\"union2\":{}}",
+         root);
+
+  EXPECT_EQ(TestUnion::Union0::U0F1S32, root.getUnion0().which());
+  EXPECT_EQ(1234567, root.getUnion0().getU0f1s32());
+  EXPECT_EQ(TestUnion::Union1::U1F0S0, root.getUnion1().which());
+}
+
+TEST(Json, DecodeLenient) {
+  JsonCodec json;
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  decode(json,
+      " {\n"
+      "  \"int8Field\": \"-128\",\n"
+      "  \"uInt64Field\": 18446744073709551615,\n"
+      "  \"float32Field\": 2,\n"
+      "  \"float64Field\": -1.5e-3,\n"
+      "  \"textField\": \"caf\\u00e9 \\ud83d\\ude00 \\/\\\"\\\\\\n\",\n"
+      "  \"dataField\": \"Zm9v\\/w==\",\n"
+      "  \"enumField\": 5,\n"
+      "  \"structField\": null,\n"
+      "  \"noSuchField\": {\"a\": [1, \"]\", {\"b\": null}], \"c\": true},\n"
+      "  \"int32List\": [ ]\n"
+      "} \n", root);
+
+  EXPECT_EQ(-128, root.getInt8Field());
+  EXPECT_EQ(18446744073709551615ull, root.getUInt64Field());
+  EXPECT_EQ(2.0f, root.getFloat32Field());
+  EXPECT_EQ(-1.5e-3, root.getFloat64Field());
+  EXPECT_STREQ("caf\xc3\xa9 \xf0\x9f\x98\x80 /\"\\\n", root.getTextField().c_str());
+  EXPECT_EQ(Data::Reader("foo\xff", 4), root.getDataField());
+  EXPECT_EQ(TestEnum::CORGE, root.getEnumField());
+  EXPECT_FALSE(root.hasStructField());
+  EXPECT_TRUE(root.hasInt32List());
+  EXPECT_EQ(0u, root.getInt32List().size());
+}
+
+TEST(Json, DecodeErrors) {
+  JsonCodec json;
+
+  const char* inputs[] = {
+    "", "[]", "{", "{\"int32Field\"}", "{\"int32Field\":}", "{\"int32Field\":1,}",
+    "{\"int8Field\":128}", "{\"int8Field\":-129}", "{\"uInt32Field\":-1}", "{\"int32Field\":1.5}",
+    "{\"uInt64Field\":18446744073709551616}", "{\"textField\":\"abc}", "{\"textField\":\"a\nb\"}",
+    "{\"textField\":\"\\ud800\"}", "{\"textField\":5}", "{\"dataField\":\"Zm9=v\"}",
+    "{\"enumField\":\"nosuch\"}", "{\"int32List\":[1,,2]}", "{\"int32List\":[1,2,]}",
+    "{\"float64Field\":1.}", "{\"float64Field\":\"Inf\"}", "{\"structField\":[]}", "{} {}",
+  };
+
+  for (const char* input: inputs) {
+    MallocMessageBuilder builder;
+    EXPECT_ANY_THROW(decode(json, input, builder.initRoot<TestAllTypes>())) << input;
+  }
+
+  // Errors give the position.
+  MallocMessageBuilder builder;
+  try {
+    decode(json, "{\n  \"int32Field\": 1,\n  \"int32List\": [1, x]\n}",
+           builder.initRoot<TestAllTypes>());
+    ADD_FAILURE() << "Expected an exception.";
+  } catch (const Exception& e) {
+    std::string description(e.getDescription().begin(), e.getDescription().size());
+    EXPECT_EQ(Exception::Nature::INPUT, e.getNature());
+    EXPECT_NE(std::string::npos, description.find("line = 3; column = 20")) << description;
+  }
+
+  // Deeply nested input doesn't overflow the stack.
+  std::string deep = "{\"noSuchField\":";
+  for (uint i = 0; i < 10000; i++) {
+    deep += '[';
+  }
+  EXPECT_ANY_THROW(decode(json, deep.c_str(), builder.initRoot<TestAllTypes>()));
+}
+
+TEST(Json, DecodeTruncated) {
+  // Every proper prefix of a document is rejected without reading past the end of the input, even
+  // if it stops in the middle of an escape sequence.
+  JsonCodec json;
+  std::string text =
+      "{\"textList\":[\"a\\\"b\\\\\",\"\\u00e9\"],\"structList\":[{\"textField\":\"\\n\"}]}";
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<TestAllTypes>();
+    decode(json, text.c_str(), root);
+    ASSERT_EQ(2u, root.getTextList().size());
+    EXPECT_EQ("a\"b\\", root.getTextList()[0]);
+    EXPECT_EQ("\n", root.getStructList()[0].getTextField());
+  }
+
+  for (size_t size = 0; size < text.size(); size++) {
+    // Copy into an allocation of exactly the right size, so that a sanitizer catches over-reads.
+    Array<char> input = newArray<char>(size);
+    memcpy(input.begin(), text.data(), size);
+    MallocMessageBuilder builder;
+    EXPECT_ANY_THROW(json.decode(arrayPtr(static_cast<const char*>(input.begin()), size),
+                                 builder.initRoot<TestAllTypes>())) << text.substr(0, size);
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
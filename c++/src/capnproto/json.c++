@@ -0,0 +1,1238 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#define CAPNPROTO_PRIVATE
+#include "json.h"
+#include "logging.h"
+#include "memory-arena.h"
+#include "text-input.h"
+#include "text-output.h"
+#include <string.h>
+#include <limits>
+#include <unordered_map>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace capnproto {
+
+namespace {
+
+static const char HEXDIGITS[] = "0123456789abcdef";
+
+static const char BASE64_DIGITS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+inline bool needsEscape(char c) {
+  return static_cast<uint8_t>(c) < 0x20 || c == '\"' || c == '\\';
+}
+
+const char* findEscape(const char* pos, const char* end) {
+  // Returns a pointer to the first character in [pos, end) which must be escaped in a JSON
+  // string, or `end` if there is none.
+
+#if __SSE2__
+  // Check 16 bytes at a time.  SSE2 has no unsigned byte comparison, but a byte is at most 0x1f
+  // exactly when max(byte, 0x1f) is 0x1f.
+  const __m128i controlMax = _mm_set1_epi8(0x1f);
+  const __m128i quote = _mm_set1_epi8('\"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  while (end - pos >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    __m128i special = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_max_epu8(chunk, controlMax), controlMax),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)));
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+#endif
+
+  while (pos < end && !needsEscape(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+size_t quote(char* out, Text::Reader text) {
+  // Writes `text` as a JSON string to `out`, which must have room for 6 * text.size() + 2 bytes,
+  // and returns the number of bytes written.  Used for member names, which are only quoted once.
+
+  char* start = out;
+  *out++ = '\"';
+  for (char c: text) {
+    if (needsEscape(c)) {
+      uint8_t c2 = c;
+      char escape[6] = { '\\', 'u', '0', '0', HEXDIGITS[c2 / 16], HEXDIGITS[c2 % 16] };
+      memcpy(out, escape, sizeof(escape));
+      out += sizeof(escape);
+    } else {
+      *out++ = c;
+    }
+  }
+  *out++ = '\"';
+  return out - start;
+}
+
+struct SchemaHash {
+  inline size_t operator()(const Schema& schema) const { return schema.hashCode(); }
+};
+
+// =======================================================================================
+// Parsing
+
+inline int parseHex4(const char* p) {
+  // Parses four hex digits, returning -1 if any of them isn't one.
+  int d0 = internal::hexDigitValue(p[0]);
+  int d1 = internal::hexDigitValue(p[1]);
+  int d2 = internal::hexDigitValue(p[2]);
+  int d3 = internal::hexDigitValue(p[3]);
+  if ((d0 | d1 | d2 | d3) < 0) return -1;
+  return (d0 << 12) | (d1 << 8) | (d2 << 4) | d3;
+}
+
+inline int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+inline uint utf8Size(uint32_t codePoint) {
+  return codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+}
+
+struct StringToken {
+  // A string literal in the input which has been validated but not yet decoded.
+
+  const char* begin;
+  const char* end;
+  // The raw text between the quotes.
+
+  size_t size;
+  // The size of the string once escape sequences are decoded.
+
+  bool escaped;
+  // Whether the raw text contains any escape sequences.  If not, it can be copied as-is.
+};
+
+class JsonParser {
+  // Tokenizer and low-level parsing for JsonCodec::decode().  Errors are reported through
+  // VALIDATE_INPUT, so they throw by default.  If exceptions are disabled, the first error is
+  // logged, the rest of the input is skipped, and every method returns false from then on.
+
+public:
+  explicit JsonParser(ArrayPtr<const char> input)
+      : start(input.begin()), pos(input.begin()), end(input.end()), failed(false) {}
+
+  inline bool ok() const { return !failed; }
+
+  void fail(const char* error) { failAt(pos, error); }
+  void failAt(const char* at, const char* error);
+  // Report invalid input, giving the line and column of `at`.
+
+  inline void skipWhitespace() {
+    while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+      ++pos;
+    }
+  }
+
+  inline bool atEnd() {
+    skipWhitespace();
+    return pos == end;
+  }
+
+  inline bool consume(char c) {
+    // Skips whitespace and then `c`, if `c` is next.  Returns whether it was.
+    skipWhitespace();
+    if (pos < end && *pos == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  inline bool expect(char c, const char* error) {
+    if (consume(c)) return true;
+    fail(error);
+    return false;
+  }
+
+  bool consumeNull();
+  // Skips whitespace and then the literal `null`, if it's next.  Returns whether it was.
+
+  uint countElements();
+  // Called just after the '[' opening an array.  Returns the number of elements in the array by
+  // scanning ahead to the matching ']', without parsing the elements.  The count is only a hint
+  // if the array is malformed; parsing the elements will then report the actual error.
+
+  bool parseString(StringToken& token);
+  void decodeString(const StringToken& token, char* out);
+  // Parse a string literal, then decode it into a buffer of token.size bytes.
+
+  bool parseName(Text::Reader& name);
+  // Parse an object member's name and the following ':'.  The name is decoded into a scratch
+  // buffer, valid until the next call that uses it.
+
+  bool parseBool(bool& value);
+  bool parseSigned(int64_t& value, int64_t max);
+  bool parseUnsigned(uint64_t& value, uint64_t max);
+  // Parse an integer, given either as a number or as a string containing a number, and check
+  // that it's in range for a type whose maximum value is `max`.
+
+  bool parseFloat(double& value);
+  // Parse a number, or one of the strings "NaN", "Infinity", or "-Infinity".
+
+  bool parseBase64(ArrayPtr<const char>& text, size_t& size);
+  void decodeBase64(ArrayPtr<const char> text, char* out);
+  // Parse a base64 string, setting `text` to the digits (without padding) and `size` to the
+  // decoded size, then decode the digits into a buffer of that size.
+
+  bool parseEnumerant(EnumSchema schema, Text::Reader& name);
+  // Parse an enum value, given as an enumerant name or number, and look up its name.
+
+  bool skipValue(uint depth);
+  // Skip over any JSON value, e.g. the value of a member not known to the schema.
+
+private:
+  const char* start;
+  const char* pos;
+  const char* end;
+  bool failed;
+
+  Array<char> scratch;
+
+  char* getScratch(size_t size);
+  // Returns a buffer of at least `size` bytes, reused between calls.
+
+  bool parseInteger(bool& negative, uint64_t& magnitude);
+  const char* parseUnicodeEscape(const char* p, uint32_t& codePoint);
+};
+
+void JsonParser::failAt(const char* at, const char* error) {
+  if (failed) return;
+  failed = true;
+
+  uint line, column;
+  internal::findLineAndColumn(start, at, line, column);
+  FAIL_VALIDATE_INPUT("Invalid JSON.", error, line, column) {
+    // Skip the rest of the input.
+  }
+  pos = end;
+}
+
+char* JsonParser::getScratch(size_t size) {
+  if (scratch.size() < size) {
+    scratch = newArray<char>(size < 256 ? 256 : size * 2);
+  }
+  return scratch.begin();
+}
+
+bool JsonParser::consumeNull() {
+  skipWhitespace();
+  if (end - pos >= 4 && memcmp(pos, "null", 4) == 0) {
+    pos += 4;
+    return true;
+  }
+  return false;
+}
+
+uint JsonParser::countElements() {
+  return internal::countElements(pos, end, '{', '}', false);
+}
+
+const char* JsonParser::parseUnicodeEscape(const char* p, uint32_t& codePoint) {
+  // `p` points at "\u".  Returns a pointer past the escape -- or past both escapes, for a
+  // surrogate pair -- or nullptr if it's invalid.
+
+  if (end - p < 6) return nullptr;
+  int value = parseHex4(p + 2);
+  if (value < 0) return nullptr;
+  codePoint = value;
+  p += 6;
+
+  if (codePoint >= 0xdc00 && codePoint < 0xe000) {
+    // Low surrogate without a high surrogate.
+    return nullptr;
+  } else if (codePoint >= 0xd800 && codePoint < 0xdc00) {
+    if (end - p < 6 || p[0] != '\\' || p[1] != 'u') return nullptr;
+    int low = parseHex4(p + 2);
+    if (low < 0xdc00 || low >= 0xe000) return nullptr;
+    codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+    p += 6;
+  }
+
+  return p;
+}
+
+bool JsonParser::parseString(StringToken& token) {
+  skipWhitespace();
+  if (pos == end || *pos != '\"') {
+    fail("Expected a string.");
+    return false;
+  }
+
+  const char* p = pos + 1;
+  token.begin = p;
+  token.escaped = false;
+  size_t size = 0;
+
+  for (;;) {
+    // Skip the longest run that needs no decoding all at once.
+    const char* special = findEscape(p, end);
+    size += special - p;
+    p = special;
+
+    if (p == end) {
+      failAt(pos, "Unterminated string.");
+      return false;
+    } else if (*p == '\"') {
+      break;
+    } else if (*p != '\\') {
+      failAt(p, "Control characters in strings must be escaped.");
+      return false;
+    }
+
+    token.escaped = true;
+    if (end - p < 2) {
+      failAt(pos, "Unterminated string.");
+      return false;
+    }
+    switch (p[1]) {
+      case '\"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+        size += 1;
+        p += 2;
+        break;
+      case 'u': {
+        uint32_t codePoint;
+        const char* next = parseUnicodeEscape(p, codePoint);
+        if (next == nullptr) {
+          failAt(p, "Invalid \\u escape sequence.");
+          return false;
+        }
+        size += utf8Size(codePoint);
+        p = next;
+        break;
+      }
+      default:
+        failAt(p, "Invalid escape sequence.");
+        return false;
+    }
+  }
+
+  token.end = p;
+  token.size = size;
+  pos = p + 1;
+  return true;
+}
+
+void JsonParser::decodeString(const StringToken& token, char* out) {
+  if (!token.escaped) {
+    memcpy(out, token.begin, token.size);
+    return;
+  }
+
+  // parseString() already validated the escape sequences.
+  const char* p = token.begin;
+  while (p < token.end) {
+    const char* escape = reinterpret_cast<const char*>(memchr(p, '\\', token.end - p));
+    if (escape == nullptr) escape = token.end;
+    memcpy(out, p, escape - p);
+    out += escape - p;
+    p = escape;
+    if (p == token.end) break;
+
+    switch (p[1]) {
+      case 'b': *out++ = '\b'; p += 2; break;
+      case 'f': *out++ = '\f'; p += 2; break;
+      case 'n': *out++ = '\n'; p += 2; break;
+      case 'r': *out++ = '\r'; p += 2; break;
+      case 't': *out++ = '\t'; p += 2; break;
+      case 'u': {
+        uint32_t codePoint;
+        p = parseUnicodeEscape(p, codePoint);
+        if (codePoint < 0x80) {
+          *out++ = codePoint;
+        } else if (codePoint < 0x800) {
+          *out++ = 0xc0 | (codePoint >> 6);
+          *out++ = 0x80 | (codePoint & 0x3f);
+        } else if (codePoint < 0x10000) {
+          *out++ = 0xe0 | (codePoint >> 12);
+          *out++ = 0x80 | ((codePoint >> 6) & 0x3f);
+          *out++ = 0x80 | (codePoint & 0x3f);
+        } else {
+          *out++ = 0xf0 | (codePoint >> 18);
+          *out++ = 0x80 | ((codePoint >> 12) & 0x3f);
+          *out++ = 0x80 | ((codePoint >> 6) & 0x3f);
+          *out++ = 0x80 | (codePoint & 0x3f);
+        }
+        break;
+      }
+      default:
+        // '"', '\\', or '/'.
+        *out++ = p[1];
+        p += 2;
+        break;
+    }
+  }
+}
+
+bool JsonParser::parseName(Text::Reader& name) {
+  StringToken token;
+  if (!parseString(token)) return false;
+
+  // Text::Reader must be NUL-terminated, so the name can't be used in place.
+  char* buffer = getScratch(token.size + 1);
+  decodeString(token, buffer);
+  buffer[token.size] = '\0';
+  name = Text::Reader(buffer, token.size);
+
+  return expect(':', "Expected ':'.");
+}
+
+bool JsonParser::parseBool(bool& value) {
+  skipWhitespace();
+  if (end - pos >= 4 && memcmp(pos, "true", 4) == 0) {
+    value = true;
+    pos += 4;
+    return true;
+  } else if (end - pos >= 5 && memcmp(pos, "false", 5) == 0) {
+    value = false;
+    pos += 5;
+    return true;
+  }
+  fail("Expected true or false.");
+  return false;
+}
+
+bool JsonParser::parseInteger(bool& negative, uint64_t& magnitude) {
+  skipWhitespace();
+  const char* p = pos;
+  bool quoted = p < end && *p == '\"';
+  p += quoted;
+  negative = p < end && *p == '-';
+  p += negative;
+
+  if (p == end || !internal::isDigit(*p)) {
+    fail("Expected an integer.");
+    return false;
+  }
+
+  magnitude = 0;
+  if (*p == '0') {
+    ++p;
+  } else {
+    while (p < end && internal::isDigit(*p)) {
+      uint digit = *p - '0';
+      if (magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+        fail("Integer is out of range for its type.");
+        return false;
+      }
+      magnitude = magnitude * 10 + digit;
+      ++p;
+    }
+  }
+
+  if (p < end && (internal::isDigit(*p) || *p == '.' || *p == 'e' || *p == 'E')) {
+    fail("Expected an integer.");
+    return false;
+  }
+  if (quoted) {
+    if (p == end || *p != '\"') {
+      fail("Expected an integer.");
+      return false;
+    }
+    ++p;
+  }
+
+  pos = p;
+  return true;
+}
+
+bool JsonParser::parseSigned(int64_t& value, int64_t max) {
+  const char* start = pos;
+  bool negative;
+  uint64_t magnitude;
+  if (!parseInteger(negative, magnitude)) return false;
+
+  // The minimum is -max - 1.
+  if (magnitude > static_cast<uint64_t>(max) + negative) {
+    failAt(start, "Integer is out of range for its type.");
+    return false;
+  }
+  value = negative ? -static_cast<int64_t>(magnitude - 1) - 1 : static_cast<int64_t>(magnitude);
+  return true;
+}
+
+bool JsonParser::parseUnsigned(uint64_t& value, uint64_t max) {
+  const char* start = pos;
+  bool negative;
+  if (!parseInteger(negative, value)) return false;
+
+  if (value > max || (negative && value != 0)) {
+    failAt(start, "Integer is out of range for its type.");
+    return false;
+  }
+  return true;
+}
+
+bool JsonParser::parseFloat(double& value) {
+  skipWhitespace();
+  const char* start = pos;
+
+  if (pos < end && *pos == '\"') {
+    StringToken token;
+    if (!parseString(token)) return false;
+    Data::Reader text(token.begin, token.end - token.begin);
+    if (text == Data::Reader("NaN")) {
+      value = std::numeric_limits<double>::quiet_NaN();
+    } else if (text == Data::Reader("Infinity")) {
+      value = std::numeric_limits<double>::infinity();
+    } else if (text == Data::Reader("-Infinity")) {
+      value = -std::numeric_limits<double>::infinity();
+    } else {
+      failAt(start, "Expected a number.");
+      return false;
+    }
+    return true;
+  }
+
+  // Check the number's syntax, then convert it.
+  const char* p = pos;
+  p += p < end && *p == '-';
+  if (p == end || !internal::isDigit(*p)) {
+    fail("Expected a number.");
+    return false;
+  }
+  if (*p == '0') {
+    ++p;
+  } else {
+    while (p < end && internal::isDigit(*p)) ++p;
+  }
+
+  if (p < end && *p == '.') {
+    ++p;
+    if (p == end || !internal::isDigit(*p)) {
+      failAt(p, "Expected a digit after the decimal point.");
+      return false;
+    }
+    while (p < end && internal::isDigit(*p)) ++p;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    p += p < end && (*p == '-' || *p == '+');
+    if (p == end || !internal::isDigit(*p)) {
+      failAt(p, "Expected a digit in the exponent.");
+      return false;
+    }
+    while (p < end && internal::isDigit(*p)) ++p;
+  }
+
+  value = internal::parseDecimal(start, p);
+  pos = p;
+  return true;
+}
+
+bool JsonParser::parseBase64(ArrayPtr<const char>& text, size_t& size) {
+  skipWhitespace();
+  const char* start = pos;
+
+  StringToken token;
+  if (!parseString(token)) return false;
+
+  const char* digits = token.begin;
+  if (token.escaped) {
+    // Some encoders escape '/' as "\/".
+    char* buffer = getScratch(token.size);
+    decodeString(token, buffer);
+    digits = buffer;
+  }
+
+  size_t count = token.size;
+  if (count % 4 == 0) {
+    for (uint i = 0; i < 2 && count > 0 && digits[count - 1] == '='; i++) {
+      --count;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (base64Value(digits[i]) < 0) {
+      failAt(start, "Invalid base64.");
+      return false;
+    }
+  }
+  if (count % 4 == 1) {
+    failAt(start, "Invalid base64.");
+    return false;
+  }
+
+  text = arrayPtr(digits, count);
+  size = count / 4 * 3 + (count % 4 == 0 ? 0 : count % 4 - 1);
+  return true;
+}
+
+void JsonParser::decodeBase64(ArrayPtr<const char> text, char* out) {
+  // parseBase64() already validated the digits.
+  const char* in = text.begin();
+  const char* end = text.end();
+
+  while (end - in >= 4) {
+    uint32_t bits = (base64Value(in[0]) << 18) | (base64Value(in[1]) << 12) |
+                    (base64Value(in[2]) << 6) | base64Value(in[3]);
+    out[0] = bits >> 16;
+    out[1] = bits >> 8;
+    out[2] = bits;
+    in += 4;
+    out += 3;
+  }
+
+  if (end - in >= 2) {
+    uint32_t bits = (base64Value(in[0]) << 18) | (base64Value(in[1]) << 12);
+    out[0] = bits >> 16;
+    if (end - in == 3) {
+      bits |= base64Value(in[2]) << 6;
+      out[1] = bits >> 8;
+    }
+  }
+}
+
+bool JsonParser::parseEnumerant(EnumSchema schema, Text::Reader& name) {
+  skipWhitespace();
+  const char* start = pos;
+
+  if (pos < end && *pos == '\"') {
+    StringToken token;
+    if (!parseString(token)) return false;
+
+    char* buffer = getScratch(token.size + 1);
+    decodeString(token, buffer);
+    buffer[token.size] = '\0';
+    Maybe<EnumSchema::Enumerant> enumerant =
+        schema.findEnumerantByName(Text::Reader(buffer, token.size));
+    if (enumerant == nullptr) {
+      failAt(start, "Unknown enumerant.");
+      return false;
+    }
+    name = enumerant->getProto().getName();
+    return true;
+  }
+
+  uint64_t value;
+  if (!parseUnsigned(value, std::numeric_limits<uint16_t>::max())) return false;
+
+  // Enum values which the schema doesn't define can't be set through the dynamic API.
+  for (auto enumerant: schema.getEnumerants()) {
+    if (enumerant.getOrdinal() == value) {
+      name = enumerant.getProto().getName();
+      return true;
+    }
+  }
+  failAt(start, "Unknown enumerant.");
+  return false;
+}
+
+bool JsonParser::skipValue(uint depth) {
+  skipWhitespace();
+  if (pos == end) {
+    fail("Expected a value.");
+    return false;
+  }
+
+  switch (*pos) {
+    case '\"': {
+      StringToken token;
+      return parseString(token);
+    }
+
+    case '{':
+    case '[': {
+      bool isObject = *pos == '{';
+      if (depth == 0) {
+        fail("Nesting limit exceeded.");
+        return false;
+      }
+      ++pos;
+      if (consume(isObject ? '}' : ']')) return true;
+      do {
+        if (isObject) {
+          StringToken name;
+          if (!parseString(name) || !expect(':', "Expected ':'.")) return false;
+        }
+        if (!skipValue(depth - 1)) return false;
+      } while (consume(','));
+      return isObject ? expect('}', "Expected ',' or '}'.") : expect(']', "Expected ',' or ']'.");
+    }
+
+    case 't':
+    case 'f': {
+      bool value;
+      return parseBool(value);
+    }
+
+    case 'n':
+      if (consumeNull()) return true;
+      fail("Expected a value.");
+      return false;
+
+    default: {
+      if (*pos != '-' && !internal::isDigit(*pos)) {
+        fail("Expected a value.");
+        return false;
+      }
+      double value;
+      return parseFloat(value);
+    }
+  }
+}
+
+}  // namespace
+
+class JsonCodec::Impl {
+public:
+  Impl(): arena(4096) {}
+
+  void encode(internal::TextOutput& out, DynamicValue::Reader value,
+              schema::Type::Body::Which which);
+  void decodeStruct(JsonParser& parser, DynamicStruct::Builder builder, uint depth);
+
+private:
+  struct MemberTable {
+    // Precomputed information about the members of one struct or union, indexed by the members'
+    // getIndex().
+
+    ArrayPtr<ArrayPtr<const char>> names;
+    // The member's name, quoted and followed by ':', ready to write out.
+
+    ArrayPtr<schema::Type::Body::Which> types;
+    // For fields, the field's type.
+
+    ArrayPtr<MemberTable*> unions;
+    // For unions, the union's own members.
+  };
+
+  Arena arena;
+  std::unordered_map<StructSchema, const MemberTable*, SchemaHash> structTables;
+
+  const MemberTable& getTable(StructSchema schema);
+  MemberTable* buildTable(StructSchema::MemberList members);
+
+  void encodeStruct(internal::TextOutput& out, DynamicStruct::Reader value);
+  void encodeUnion(internal::TextOutput& out, DynamicUnion::Reader value,
+                   const MemberTable& table);
+  void encodeText(internal::TextOutput& out, Text::Reader text);
+  void encodeData(internal::TextOutput& out, Data::Reader data);
+
+  void decodeUnion(JsonParser& parser, DynamicUnion::Builder builder, const MemberTable& table,
+                   uint depth);
+  void decodeList(JsonParser& parser, DynamicList::Builder builder, uint depth);
+  template <typename Slot>
+  void decodeValue(JsonParser& parser, Slot slot, schema::Type::Body::Which which, uint depth);
+};
+
+const JsonCodec::Impl::MemberTable& JsonCodec::Impl::getTable(StructSchema schema) {
+  const MemberTable*& slot = structTables[schema];
+  if (slot == nullptr) {
+    slot = buildTable(schema.getMembers());
+  }
+  return *slot;
+}
+
+JsonCodec::Impl::MemberTable* JsonCodec::Impl::buildTable(StructSchema::MemberList members) {
+  MemberTable& table = arena.allocate<MemberTable>();
+  table.names = arena.allocateArray<ArrayPtr<const char>>(members.size());
+  table.types = arena.allocateArray<schema::Type::Body::Which>(members.size());
+  table.unions = arena.allocateArray<MemberTable*>(members.size());
+
+  for (auto member: members) {
+    uint index = member.getIndex();
+    auto proto = member.getProto();
+
+    Text::Reader name = proto.getName();
+    ArrayPtr<char> quoted = arena.allocateUninitializedArray<char>(name.size() * 6 + 3);
+    size_t size = quote(quoted.begin(), name);
+    quoted[size++] = ':';
+    table.names[index] = quoted.slice(0, size);
+
+    auto body = proto.getBody();
+    switch (body.which()) {
+      case schema::StructNode::Member::Body::FIELD_MEMBER:
+        table.types[index] = body.getFieldMember().getType().getBody().which();
+        break;
+      case schema::StructNode::Member::Body::UNION_MEMBER:
+        table.unions[index] = buildTable(member.asUnion().getMembers());
+        break;
+    }
+  }
+
+  return &table;
+}
+
+void JsonCodec::Impl::encode(internal::TextOutput& out, DynamicValue::Reader value,
+                             schema::Type::Body::Which which) {
+  switch (value.getType()) {
+    case DynamicValue::UNKNOWN:
+    case DynamicValue::VOID:
+    case DynamicValue::OBJECT:
+      out.write("null");
+      break;
+    case DynamicValue::BOOL:
+      if (value.as<bool>()) {
+        out.write("true");
+      } else {
+        out.write("false");
+      }
+      break;
+    case DynamicValue::INT:
+      if (which == schema::Type::Body::INT64_TYPE) {
+        out.put('\"');
+        out.writeSigned(value.as<int64_t>());
+        out.put('\"');
+      } else {
+        out.writeSigned(value.as<int64_t>());
+      }
+      break;
+    case DynamicValue::UINT:
+      if (which == schema::Type::Body::UINT64_TYPE) {
+        out.put('\"');
+        out.writeUnsigned(value.as<uint64_t>());
+        out.put('\"');
+      } else {
+        out.writeUnsigned(value.as<uint64_t>());
+      }
+      break;
+    case DynamicValue::FLOAT: {
+      double floatValue = value.as<double>();
+      if (floatValue != floatValue) {
+        out.write("\"NaN\"");
+      } else if (floatValue == std::numeric_limits<double>::infinity()) {
+        out.write("\"Infinity\"");
+      } else if (floatValue == -std::numeric_limits<double>::infinity()) {
+        out.write("\"-Infinity\"");
+      } else if (which == schema::Type::Body::FLOAT32_TYPE) {
+        out.writeFloat(value.as<float>(), true);
+      } else {
+        out.writeFloat(floatValue, false);
+      }
+      break;
+    }
+    case DynamicValue::TEXT:
+      encodeText(out, value.as<Text>());
+      break;
+    case DynamicValue::DATA:
+      encodeData(out, value.as<Data>());
+      break;
+    case DynamicValue::LIST: {
+      auto listValue = value.as<DynamicList>();
+      auto elementType = listValue.getSchema().whichElementType();
+      out.put('[');
+      bool first = true;
+      for (auto element: listValue) {
+        if (first) {
+          first = false;
+        } else {
+          out.put(',');
+        }
+        encode(out, element, elementType);
+      }
+      out.put(']');
+      break;
+    }
+    case DynamicValue::ENUM: {
+      auto enumValue = value.as<DynamicEnum>();
+      Maybe<EnumSchema::Enumerant> enumerant = enumValue.getEnumerant();
+      if (enumerant == nullptr) {
+        out.writeUnsigned(enumValue.getRaw());
+      } else {
+        encodeText(out, enumerant->getProto().getName());
+      }
+      break;
+    }
+    case DynamicValue::STRUCT:
+      encodeStruct(out, value.as<DynamicStruct>());
+      break;
+    case DynamicValue::UNION: {
+      // Only reached when encoding a union on its own; unions in structs are handled by
+      // encodeStruct().
+      auto unionValue = value.as<DynamicUnion>();
+      auto unionSchema = unionValue.getSchema();
+      encodeUnion(out, unionValue,
+                  *getTable(unionSchema.getContainingStruct()).unions[unionSchema.getIndex()]);
+      break;
+    }
+    case DynamicValue::INTERFACE:
+      FAIL_RECOVERABLE_CHECK("Don't know how to encode interfaces as JSON.") {}
+      out.write("null");
+      break;
+  }
+}
+
+void JsonCodec::Impl::encodeStruct(internal::TextOutput& out, DynamicStruct::Reader value) {
+  const MemberTable& table = getTable(value.getSchema());
+
+  out.put('{');
+  bool first = true;
+  for (auto member: value.getSchema().getMembers()) {
+    if (!value.has(member)) continue;
+
+    if (first) {
+      first = false;
+    } else {
+      out.put(',');
+    }
+
+    uint index = member.getIndex();
+    ArrayPtr<const char> name = table.names[index];
+    out.write(name.begin(), name.size());
+
+    const MemberTable* unionTable = table.unions[index];
+    if (unionTable == nullptr) {
+      encode(out, value.get(member), table.types[index]);
+    } else {
+      encodeUnion(out, value.get(member).as<DynamicUnion>(), *unionTable);
+    }
+  }
+  out.put('}');
+}
+
+void JsonCodec::Impl::encodeUnion(internal::TextOutput& out, DynamicUnion::Reader value,
+                                  const MemberTable& table) {
+  out.put('{');
+  Maybe<StructSchema::Member> member = value.which();
+  if (member != nullptr) {
+    uint index = member->getIndex();
+    ArrayPtr<const char> name = table.names[index];
+    out.write(name.begin(), name.size());
+    encode(out, value.get(), table.types[index]);
+  }
+  out.put('}');
+}
+
+void JsonCodec::Impl::encodeText(internal::TextOutput& out, Text::Reader text) {
+  out.put('\"');
+
+  const char* in = text.begin();
+  const char* end = text.end();
+  for (;;) {
+    // Copy the longest run that needs no escaping all at once.
+    const char* special = findEscape(in, end);
+    out.write(in, special - in);
+    if (special == end) break;
+
+    char c = *special;
+    in = special + 1;
+    switch (c) {
+      case '\b': out.write("\\b"); break;
+      case '\f': out.write("\\f"); break;
+      case '\n': out.write("\\n"); break;
+      case '\r': out.write("\\r"); break;
+      case '\t': out.write("\\t"); break;
+      case '\"': out.write("\\\""); break;
+      case '\\': out.write("\\\\"); break;
+      default: {
+        uint8_t c2 = c;
+        char escape[6] = { '\\', 'u', '0', '0', HEXDIGITS[c2 / 16], HEXDIGITS[c2 % 16] };
+        out.write(escape, sizeof(escape));
+        break;
+      }
+    }
+  }
+
+  out.put('\"');
+}
+
+void JsonCodec::Impl::encodeData(internal::TextOutput& out, Data::Reader data) {
+  out.put('\"');
+
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(data.begin());
+  const uint8_t* end = in + data.size();
+
+  // Encode in blocks of up to 48 bytes, which become 64 characters.
+  while (end - in >= 3) {
+    size_t blockSize = end - in < 48 ? (end - in) / 3 * 3 : 48;
+    const uint8_t* blockEnd = in + blockSize;
+    char* pos = out.reserve(blockSize / 3 * 4);
+    for (; in < blockEnd; in += 3) {
+      uint32_t bits = (in[0] << 16) | (in[1] << 8) | in[2];
+      pos[0] = BASE64_DIGITS[bits >> 18];
+      pos[1] = BASE64_DIGITS[(bits >> 12) & 63];
+      pos[2] = BASE64_DIGITS[(bits >> 6) & 63];
+      pos[3] = BASE64_DIGITS[bits & 63];
+      pos += 4;
+    }
+    out.advance(pos);
+  }
+
+  if (in < end) {
+    uint32_t bits = in[0] << 16;
+    if (end - in == 2) {
+      bits |= in[1] << 8;
+    }
+    char* pos = out.reserve(4);
+    pos[0] = BASE64_DIGITS[bits >> 18];
+    pos[1] = BASE64_DIGITS[(bits >> 12) & 63];
+    pos[2] = end - in == 2 ? BASE64_DIGITS[(bits >> 6) & 63] : '=';
+    pos[3] = '=';
+    out.advance(pos + 4);
+  }
+
+  out.put('\"');
+}
+
+void JsonCodec::Impl::decodeStruct(JsonParser& parser, DynamicStruct::Builder builder,
+                                   uint depth) {
+  if (!parser.expect('{', "Expected an object.")) return;
+  if (depth == 0) {
+    parser.fail("Nesting limit exceeded.");
+    return;
+  }
+  if (parser.consume('}')) return;
+
+  StructSchema schema = builder.getSchema();
+  const MemberTable& table = getTable(schema);
+
+  do {
+    Text::Reader name;
+    if (!parser.parseName(name)) return;
+
+    Maybe<StructSchema::Member> member = schema.findMemberByName(name);
+    if (member == nullptr) {
+      // Probably written using a newer version of the schema.  Ignore it.
+      parser.skipValue(depth - 1);
+    } else {
+      uint index = member->getIndex();
+      const MemberTable* unionTable = table.unions[index];
+      if (unionTable == nullptr) {
+        decodeValue(parser, internal::FieldSlot { builder, *member }, table.types[index],
+                    depth - 1);
+      } else {
+        decodeUnion(parser, builder.get(*member).as<DynamicUnion>(), *unionTable, depth - 1);
+      }
+    }
+    if (!parser.ok()) return;
+  } while (parser.consume(','));
+
+  parser.expect('}', "Expected ',' or '}'.");
+}
+
+void JsonCodec::Impl::decodeUnion(JsonParser& parser, DynamicUnion::Builder builder,
+                                  const MemberTable& table, uint depth) {
+  if (parser.consumeNull()) return;
+  if (!parser.expect('{', "Expected an object.")) return;
+  if (depth == 0) {
+    parser.fail("Nesting limit exceeded.");
+    return;
+  }
+  if (parser.consume('}')) return;
+
+  StructSchema::Union schema = builder.getSchema();
+
+  do {
+    Text::Reader name;
+    if (!parser.parseName(name)) return;
+
+    Maybe<StructSchema::Member> member = schema.findMemberByName(name);
+    if (member == nullptr) {
+      parser.skipValue(depth - 1);
+    } else {
+      decodeValue(parser, internal::UnionSlot { builder, *member },
+                  table.types[member->getIndex()], depth - 1);
+    }
+    if (!parser.ok()) return;
+  } while (parser.consume(','));
+
+  parser.expect('}', "Expected ',' or '}'.");
+}
+
+void JsonCodec::Impl::decodeList(JsonParser& parser, DynamicList::Builder builder, uint depth) {
+  // The caller already consumed the '['.
+  if (depth == 0) {
+    parser.fail("Nesting limit exceeded.");
+    return;
+  }
+  if (parser.consume(']')) return;
+
+  schema::Type::Body::Which elementType = builder.getSchema().whichElementType();
+  uint index = 0;
+
+  do {
+    if (index == builder.size()) {
+      parser.fail("Expected ']'.");
+      return;
+    }
+    decodeValue(parser, internal::ElementSlot { builder, index++ }, elementType, depth - 1);
+    if (!parser.ok()) return;
+  } while (parser.consume(','));
+
+  parser.expect(']', "Expected ',' or ']'.");
+}
+
+template <typename Slot>
+void JsonCodec::Impl::decodeValue(JsonParser& parser, Slot slot,
+                                  schema::Type::Body::Which which, uint depth) {
+  if (which == schema::Type::Body::VOID_TYPE) {
+    if (parser.consumeNull()) {
+      // Still needs setting, in case this is a union member.
+      slot.set(Void::VOID);
+    } else {
+      parser.fail("Expected null.");
+    }
+    return;
+  }
+
+  if (parser.consumeNull()) {
+    // Leave the default value.
+    return;
+  }
+
+  switch (which) {
+    case schema::Type::Body::VOID_TYPE:
+      break;
+
+    case schema::Type::Body::BOOL_TYPE: {
+      bool value;
+      if (parser.parseBool(value)) slot.set(value);
+      break;
+    }
+
+#define HANDLE_SIGNED(discrim, type) \
+    case schema::Type::Body::discrim##_TYPE: { \
+      int64_t value; \
+      if (parser.parseSigned(value, std::numeric_limits<type>::max())) slot.set(value); \
+      break; \
+    }
+#define HANDLE_UNSIGNED(discrim, type) \
+    case schema::Type::Body::discrim##_TYPE: { \
+      uint64_t value; \
+      if (parser.parseUnsigned(value, std::numeric_limits<type>::max())) slot.set(value); \
+      break; \
+    }
+
+    HANDLE_SIGNED(INT8, int8_t)
+    HANDLE_SIGNED(INT16, int16_t)
+    HANDLE_SIGNED(INT32, int32_t)
+    HANDLE_SIGNED(INT64, int64_t)
+    HANDLE_UNSIGNED(UINT8, uint8_t)
+    HANDLE_UNSIGNED(UINT16, uint16_t)
+    HANDLE_UNSIGNED(UINT32, uint32_t)
+    HANDLE_UNSIGNED(UINT64, uint64_t)
+
+#undef HANDLE_SIGNED
+#undef HANDLE_UNSIGNED
+
+    case schema::Type::Body::FLOAT32_TYPE:
+    case schema::Type::Body::FLOAT64_TYPE: {
+      double value;
+      if (parser.parseFloat(value)) slot.set(value);
+      break;
+    }
+
+    case schema::Type::Body::TEXT_TYPE: {
+      StringToken token;
+      if (parser.parseString(token)) {
+        parser.decodeString(token, slot.init(token.size).template as<Text>().data());
+      }
+      break;
+    }
+
+    case schema::Type::Body::DATA_TYPE: {
+      ArrayPtr<const char> digits;
+      size_t size;
+      if (parser.parseBase64(digits, size)) {
+        parser.decodeBase64(digits, slot.init(size).template as<Data>().data());
+      }
+      break;
+    }
+
+    case schema::Type::Body::LIST_TYPE:
+      if (parser.expect('[', "Expected an array.")) {
+        // Size the list up front, since lists can't grow once allocated.
+        uint size = parser.countElements();
+        decodeList(parser, slot.init(size).template as<DynamicList>(), depth);
+      }
+      break;
+
+    case schema::Type::Body::ENUM_TYPE: {
+      Text::Reader name;
+      if (parser.parseEnumerant(slot.getEnumSchema(), name)) slot.set(name);
+      break;
+    }
+
+    case schema::Type::Body::STRUCT_TYPE:
+      decodeStruct(parser, slot.init().template as<DynamicStruct>(), depth);
+      break;
+
+    case schema::Type::Body::INTERFACE_TYPE:
+      parser.fail("Can't decode interfaces from JSON.");
+      break;
+
+    case schema::Type::Body::OBJECT_TYPE:
+      parser.fail("Object fields can only be null.");
+      break;
+  }
+}
+
+// =======================================================================================
+
+JsonCodec::JsonCodec(): impl(heap<Impl>()) {}
+JsonCodec::~JsonCodec() {}
+
+String JsonCodec::encode(DynamicValue::Reader value) {
+  internal::StringOutputStream output;
+  encode(value, output);
+  return output.finish();
+}
+
+void JsonCodec::encode(DynamicValue::Reader value, BufferedOutputStream& output) {
+  internal::TextOutput out(output);
+  impl->encode(out, value, schema::Type::Body::VOID_TYPE);
+  out.flush();
+}
+
+void JsonCodec::encode(DynamicValue::Reader value, OutputStream& output) {
+  if (BufferedOutputStream* bufferedOutputPtr = dynamic_cast<BufferedOutputStream*>(&output)) {
+    encode(value, *bufferedOutputPtr);
+  } else {
+    byte buffer[8192];
+    BufferedOutputStreamWrapper bufferedOutput(output, arrayPtr(buffer, sizeof(buffer)));
+    encode(value, bufferedOutput);
+    bufferedOutput.flush();
+  }
+}
+
+void JsonCodec::decode(ArrayPtr<const char> input, DynamicStruct::Builder output) {
+  JsonParser parser(input);
+  impl->decodeStruct(parser, output, internal::TEXT_NESTING_LIMIT);
+  if (parser.ok() && !parser.atEnd()) {
+    parser.fail("Expected end of input.");
+  }
+}
+
+}  // namespace capnproto
@@ -0,0 +1,91 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef CAPNPROTO_JSON_H_
+#define CAPNPROTO_JSON_H_
+
+#include "dynamic.h"
+#include "io.h"
+
+namespace capnproto {
+
+class JsonCodec {
+  // Converts Cap'n Proto values to and from JSON, driven by the schema.  The mapping is:
+  //
+  // - A struct is an object with a property for each member that is set, in the sense of
+  //   DynamicStruct::Reader::has().  Members which are not set are omitted.
+  // - A union is an object with a single property, named after the union's current member.  A
+  //   union whose discriminant is not known to the schema is an empty object.
+  // - A list is an array.
+  // - Void is null, and Bool is true or false.
+  // - Integers are numbers, except that Int64 and UInt64 are strings of decimal digits, since
+  //   many JSON parsers store numbers as doubles, which can't represent them exactly.
+  // - Floats are numbers, written with as few digits as round-trip.  Infinities and NaN are the
+  //   strings "Infinity", "-Infinity", and "NaN", since JSON has no numbers for them.
+  // - Text is a string.  Text is assumed to be UTF-8 and is not validated; only '"', '\' and
+  //   control characters are escaped.
+  // - Data is a string containing the bytes in base64 (RFC 4648, with padding).
+  // - An enum is a string naming the enumerant, or a number if the value is not known to the
+  //   schema.
+  // - Object (untyped pointer) fields are null.  Interfaces can't be encoded.
+  //
+  // The codec builds a table of information about each struct type the first time it encodes or
+  // decodes a value of that type, so it's best to reuse one JsonCodec for many messages.  For
+  // the same reason, a JsonCodec must not be used by multiple threads at once.
+
+public:
+  JsonCodec();
+  CAPNPROTO_DISALLOW_COPY(JsonCodec);
+  ~JsonCodec();
+
+  String encode(DynamicValue::Reader value);
+  void encode(DynamicValue::Reader value, BufferedOutputStream& output);
+  void encode(DynamicValue::Reader value, OutputStream& output);
+  // Encode the value as compact JSON, with no whitespace.  Given a BufferedOutputStream, the
+  // JSON is written directly into the stream's buffer.  A plain OutputStream is wrapped in a
+  // temporary buffer on the stack.
+
+  void decode(ArrayPtr<const char> input, DynamicStruct::Builder output);
+  // Parse `input`, which must contain a single JSON object, into `output`, typically the root of
+  // a fresh MessageBuilder.  Values are written straight into the message as they are parsed;
+  // lists and blobs are sized up front by scanning ahead, so nothing is allocated twice.
+  //
+  // The decoder accepts everything encode() produces, and is lenient in the usual ways:  integers
+  // of any size may be numbers or strings, floats may be given as integers, null for any member
+  // leaves it at its default value, and members the schema doesn't know about are skipped.
+  // Enum numbers must name an enumerant the schema knows about, since there is no way to set
+  // any other value through the dynamic API.
+  //
+  // Malformed input, and values that don't fit the schema, throw an exception with nature
+  // INPUT whose description gives the line and column of the error.  The output may have been
+  // partially filled in by then.
+
+private:
+  class Impl;
+  Own<Impl> impl;
+};
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_JSON_H_
@@ -32,6 +32,17 @@
 namespace capnproto {
 namespace internal {
 
+static inline Maybe<Exception>* errorRecord(SegmentReader* segment) {
+  // Where invalid data found in `segment` is to be recorded; see ReaderOptions::recordErrors.
+  // A null segment means we are reading a trusted default value, so always report normally.
+  return segment == nullptr ? nullptr : segment->getArena()->getErrorRecord();
+}
+
+#define VALIDATE_SEGMENT(...) VALIDATE_INPUT_OR_RECORD(errorRecord(segment), __VA_ARGS__)
+#define FAIL_VALIDATE_SEGMENT(...) \
+    FAIL_VALIDATE_INPUT_OR_RECORD(errorRecord(segment), ##__VA_ARGS__)
+// VALIDATE_INPUT() for data read from `segment`, which must be in scope.
+
 // =======================================================================================
 
 struct WirePointer {
@@ -267,21 +278,33 @@ struct WireHelpers {
     }
   }
 
+  static CAPNPROTO_ALWAYS_INLINE(void countNesting(SegmentReader* segment, int nestingLimit)) {
+    // Notes that an object is being read at the given nesting limit, for
+    // MessageReader::getReadCost().  Compiles to nothing unless CAPNPROTO_READ_COST_ACCOUNTING.
+    if (segment != nullptr) {
+      segment->nestingLimitReached(nestingLimit);
+    }
+  }
+
   static CAPNPROTO_ALWAYS_INLINE(
       const word* followFars(const WirePointer*& ref, SegmentReader*& segment)) {
     // If the segment is null, this is an unchecked message, so there are no FAR pointers.
     if (segment != nullptr && ref->kind() == WirePointer::FAR) {
+      segment->farPointerFollowed();
+
       // Look up the segment containing the landing pad.
-      segment = segment->getArena()->tryGetSegment(ref->farRef.segmentId.get());
-      VALIDATE_INPUT(segment != nullptr, "Message contains far pointer to unknown segment.") {
+      Arena* arena = segment->getArena();
+      segment = arena->tryGetSegment(ref->farRef.segmentId.get());
+      VALIDATE_INPUT_OR_RECORD(arena->getErrorRecord(), segment != nullptr,
+                               "Message contains far pointer to unknown segment.") {
         return nullptr;
       }
 
       // Find the landing pad and check that it is within bounds.
       const word* ptr = segment->getStartPtr() + ref->farPositionInSegment();
       WordCount padWords = (1 + ref->isDoubleFar()) * POINTER_SIZE_IN_WORDS;
-      VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + padWords),
-                     "Message contains out-of-bounds far pointer.") {
+      VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + padWords),
+                       "Message contains out-of-bounds far pointer.") {
         return nullptr;
       }
 
@@ -297,9 +320,9 @@ struct WireHelpers {
       // object.
       ref = pad + 1;
 
-      segment = segment->getArena()->tryGetSegment(pad->farRef.segmentId.get());
-      VALIDATE_INPUT(segment != nullptr,
-                     "Message contains double-far pointer to unknown segment.") {
+      segment = arena->tryGetSegment(pad->farRef.segmentId.get());
+      VALIDATE_INPUT_OR_RECORD(arena->getErrorRecord(), segment != nullptr,
+                               "Message contains double-far pointer to unknown segment.") {
         return nullptr;
       }
 
@@ -435,7 +458,7 @@ struct WireHelpers {
       return 0 * WORDS;
     }
 
-    VALIDATE_INPUT(nestingLimit > 0, "Message is too deeply-nested.") {
+    VALIDATE_SEGMENT(nestingLimit > 0, "Message is too deeply-nested.") {
       return 0 * WORDS;
     }
     --nestingLimit;
@@ -446,8 +469,8 @@ struct WireHelpers {
 
     switch (ref->kind()) {
       case WirePointer::STRUCT: {
-        VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
-                       "Message contained out-of-bounds struct pointer.") {
+        VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
+                         "Message contained out-of-bounds struct pointer.") {
           break;
         }
         result += ref->structRef.wordSize();
@@ -473,8 +496,8 @@ struct WireHelpers {
             WordCount totalWords = roundUpToWords(
                 ElementCount64(ref->listRef.elementCount()) *
                 dataBitsPerElement(ref->listRef.elementSize()));
-            VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + totalWords),
-                           "Message contained out-of-bounds list pointer.") {
+            VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + totalWords),
+                             "Message contained out-of-bounds list pointer.") {
               break;
             }
             result += totalWords;
@@ -483,8 +506,8 @@ struct WireHelpers {
           case FieldSize::POINTER: {
             WirePointerCount count = ref->listRef.elementCount() * (POINTERS / ELEMENTS);
 
-            VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + count * WORDS_PER_POINTER),
-                           "Message contained out-of-bounds list pointer.") {
+            VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + count * WORDS_PER_POINTER),
+                             "Message contained out-of-bounds list pointer.") {
               break;
             }
 
@@ -498,7 +521,7 @@ struct WireHelpers {
           }
           case FieldSize::INLINE_COMPOSITE: {
             WordCount wordCount = ref->listRef.inlineCompositeWordCount();
-            VALIDATE_INPUT(
+            VALIDATE_SEGMENT(
                 boundsCheck(segment, ptr, ptr + wordCount + POINTER_SIZE_IN_WORDS),
                 "Message contained out-of-bounds list pointer.") {
               break;
@@ -509,12 +532,12 @@ struct WireHelpers {
             const WirePointer* elementTag = reinterpret_cast<const WirePointer*>(ptr);
             ElementCount count = elementTag->inlineCompositeListElementCount();
 
-            VALIDATE_INPUT(elementTag->kind() == WirePointer::STRUCT,
+            VALIDATE_SEGMENT(elementTag->kind() == WirePointer::STRUCT,
                 "Don't know how to handle non-STRUCT inline composite.") {
               break;
             }
 
-            VALIDATE_INPUT(elementTag->structRef.wordSize() / ELEMENTS * count <= wordCount,
+            VALIDATE_SEGMENT(elementTag->structRef.wordSize() / ELEMENTS * count <= wordCount,
                 "Struct list pointer's elements overran size.") {
               break;
             }
@@ -543,7 +566,7 @@ struct WireHelpers {
         }
         break;
       case WirePointer::RESERVED_3:
-        FAIL_VALIDATE_INPUT("Don't know how to handle RESERVED_3.") {
+        FAIL_VALIDATE_SEGMENT("Don't know how to handle RESERVED_3.") {
           break;
         }
         break;
@@ -554,6 +577,183 @@ struct WireHelpers {
 
   // -----------------------------------------------------------------
 
+  static CAPNPROTO_ALWAYS_INLINE(uint64_t mixFingerprint(uint64_t hash, uint64_t value)) {
+    value *= 0x87c37b91114253d5ull;
+    value = (value << 31) | (value >> 33);
+    hash ^= value * 0x4cf5ad432745937full;
+    hash = (hash << 27) | (hash >> 37);
+    return hash * 5 + 0x52dce729;
+  }
+
+  static uint64_t fingerprintBytes(uint64_t hash, const void* data, size_t size) {
+    // Trailing zeros are ignored, so that a struct section hashes the same regardless of how much
+    // zero padding an older or newer version of the struct has.
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t chunk;
+    while (size >= sizeof(chunk)) {
+      memcpy(&chunk, bytes + size - sizeof(chunk), sizeof(chunk));
+      if (chunk != 0) break;
+      size -= sizeof(chunk);
+    }
+    while (size > 0 && bytes[size - 1] == 0) --size;
+
+    hash = mixFingerprint(hash, size);
+    for (; size >= sizeof(chunk); size -= sizeof(chunk), bytes += sizeof(chunk)) {
+      memcpy(&chunk, bytes, sizeof(chunk));
+      hash = mixFingerprint(hash, chunk);
+    }
+    if (size > 0) {
+      chunk = 0;
+      for (uint i = 0; i < size; i++) {
+        chunk |= uint64_t(bytes[i]) << (i * 8);
+      }
+      hash = mixFingerprint(hash, chunk);
+    }
+    return hash;
+  }
+
+  static uint64_t fingerprintStruct(uint64_t hash, SegmentReader* segment, const void* data,
+                                    ByteCount dataSize, const WirePointer* pointers,
+                                    WirePointerCount pointerCount, uint nestingLimit) {
+    hash = fingerprintBytes(hash, data, dataSize / BYTES);
+
+    // Likewise, trailing null pointers are ignored.
+    uint count = pointerCount / POINTERS;
+    while (count > 0 && pointers[count - 1].isNull()) --count;
+
+    hash = mixFingerprint(hash, count);
+    for (uint i = 0; i < count; i++) {
+      hash = fingerprint(hash, segment, pointers + i, nestingLimit);
+    }
+    return hash;
+  }
+
+  static uint64_t fingerprint(uint64_t hash, SegmentReader* segment, const WirePointer* ref,
+                              uint nestingLimit) {
+    // Mix the content of the object pointed to into `hash`.  Follows the same structure as
+    // totalSize(), and likewise stops at anything invalid.
+
+    if (ref->isNull()) {
+      return mixFingerprint(hash, 0);
+    }
+
+    VALIDATE_SEGMENT(nestingLimit > 0, "Message is too deeply-nested.") {
+      return hash;
+    }
+    --nestingLimit;
+
+    const word* ptr = followFars(ref, segment);
+    if (ptr == nullptr) {
+      return hash;
+    }
+
+    switch (ref->kind()) {
+      case WirePointer::STRUCT: {
+        VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
+                         "Message contained out-of-bounds struct pointer.") {
+          break;
+        }
+        hash = mixFingerprint(hash, WirePointer::STRUCT + 1);
+        hash = fingerprintStruct(hash, segment, ptr,
+            ref->structRef.dataSize.get() * BYTES_PER_WORD,
+            reinterpret_cast<const WirePointer*>(ptr + ref->structRef.dataSize.get()),
+            ref->structRef.ptrCount.get(), nestingLimit);
+        break;
+      }
+      case WirePointer::LIST: {
+        hash = mixFingerprint(hash, WirePointer::LIST + 1);
+        hash = mixFingerprint(hash, static_cast<uint>(ref->listRef.elementSize()));
+
+        switch (ref->listRef.elementSize()) {
+          case FieldSize::VOID:
+            hash = mixFingerprint(hash, ref->listRef.elementCount() / ELEMENTS);
+            break;
+          case FieldSize::BIT:
+          case FieldSize::BYTE:
+          case FieldSize::TWO_BYTES:
+          case FieldSize::FOUR_BYTES:
+          case FieldSize::EIGHT_BYTES: {
+            ElementCount count = ref->listRef.elementCount();
+            WordCount totalWords = roundUpToWords(
+                ElementCount64(count) * dataBitsPerElement(ref->listRef.elementSize()));
+            VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + totalWords),
+                             "Message contained out-of-bounds list pointer.") {
+              break;
+            }
+            hash = mixFingerprint(hash, count / ELEMENTS);
+            hash = fingerprintBytes(hash, ptr,
+                roundUpToBytes(count * dataBitsPerElement(ref->listRef.elementSize())) / BYTES);
+            break;
+          }
+          case FieldSize::POINTER: {
+            WirePointerCount count = ref->listRef.elementCount() * (POINTERS / ELEMENTS);
+
+            VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + count * WORDS_PER_POINTER),
+                             "Message contained out-of-bounds list pointer.") {
+              break;
+            }
+
+            hash = mixFingerprint(hash, count / POINTERS);
+            for (uint i = 0; i < count / POINTERS; i++) {
+              hash = fingerprint(hash, segment, reinterpret_cast<const WirePointer*>(ptr) + i,
+                                 nestingLimit);
+            }
+            break;
+          }
+          case FieldSize::INLINE_COMPOSITE: {
+            WordCount wordCount = ref->listRef.inlineCompositeWordCount();
+            VALIDATE_SEGMENT(
+                boundsCheck(segment, ptr, ptr + wordCount + POINTER_SIZE_IN_WORDS),
+                "Message contained out-of-bounds list pointer.") {
+              break;
+            }
+
+            const WirePointer* elementTag = reinterpret_cast<const WirePointer*>(ptr);
+            ElementCount count = elementTag->inlineCompositeListElementCount();
+
+            VALIDATE_SEGMENT(elementTag->kind() == WirePointer::STRUCT,
+                "Don't know how to handle non-STRUCT inline composite.") {
+              break;
+            }
+
+            VALIDATE_SEGMENT(elementTag->structRef.wordSize() / ELEMENTS * count <= wordCount,
+                "Struct list pointer's elements overran size.") {
+              break;
+            }
+
+            WordCount dataSize = elementTag->structRef.dataSize.get();
+            WirePointerCount pointerCount = elementTag->structRef.ptrCount.get();
+
+            hash = mixFingerprint(hash, count / ELEMENTS);
+            const word* pos = ptr + POINTER_SIZE_IN_WORDS;
+            for (uint i = 0; i < count / ELEMENTS; i++) {
+              hash = fingerprintStruct(hash, segment, pos, dataSize * BYTES_PER_WORD,
+                  reinterpret_cast<const WirePointer*>(pos + dataSize), pointerCount,
+                  nestingLimit);
+              pos += elementTag->structRef.wordSize();
+            }
+            break;
+          }
+        }
+        break;
+      }
+      case WirePointer::FAR:
+        FAIL_RECOVERABLE_CHECK("Unexpected FAR pointer.") {
+          break;
+        }
+        break;
+      case WirePointer::RESERVED_3:
+        FAIL_VALIDATE_SEGMENT("Don't know how to handle RESERVED_3.") {
+          break;
+        }
+        break;
+    }
+
+    return hash;
+  }
+
+  // -----------------------------------------------------------------
+
   static CAPNPROTO_ALWAYS_INLINE(
       void copyStruct(SegmentBuilder* segment, word* dst, const word* src,
                       WordCount dataSize, WirePointerCount pointerCount)) {
@@ -1432,10 +1632,11 @@ struct WireHelpers {
       defaultValue = nullptr;  // If the default value is itself invalid, don't use it again.
     }
 
-    VALIDATE_INPUT(nestingLimit > 0,
+    VALIDATE_SEGMENT(nestingLimit > 0,
           "Message is too deeply-nested or contains cycles.  See capnproto::ReadOptions.") {
       goto useDefault;
     }
+    countNesting(segment, nestingLimit);
 
     const word* ptr = followFars(ref, segment);
     if (CAPNPROTO_EXPECT_FALSE(ptr == nullptr)) {
@@ -1443,12 +1644,12 @@ struct WireHelpers {
       goto useDefault;
     }
 
-    VALIDATE_INPUT(ref->kind() == WirePointer::STRUCT,
+    VALIDATE_SEGMENT(ref->kind() == WirePointer::STRUCT,
           "Message contains non-struct pointer where struct pointer was expected.") {
       goto useDefault;
     }
 
-    VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
+    VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
           "Message contained out-of-bounds struct pointer.") {
       goto useDefault;
     }
@@ -1474,10 +1675,11 @@ struct WireHelpers {
       defaultValue = nullptr;  // If the default value is itself invalid, don't use it again.
     }
 
-    VALIDATE_INPUT(nestingLimit > 0,
+    VALIDATE_SEGMENT(nestingLimit > 0,
           "Message is too deeply-nested or contains cycles.  See capnproto::ReadOptions.") {
       goto useDefault;
     }
+    countNesting(segment, nestingLimit);
 
     const word* ptr = followFars(ref, segment);
     if (CAPNPROTO_EXPECT_FALSE(ptr == nullptr)) {
@@ -1485,7 +1687,7 @@ struct WireHelpers {
       goto useDefault;
     }
 
-    VALIDATE_INPUT(ref->kind() == WirePointer::LIST,
+    VALIDATE_SEGMENT(ref->kind() == WirePointer::LIST,
           "Message contains non-list pointer where list pointer was expected.") {
       goto useDefault;
     }
@@ -1500,12 +1702,12 @@ struct WireHelpers {
       const WirePointer* tag = reinterpret_cast<const WirePointer*>(ptr);
       ptr += POINTER_SIZE_IN_WORDS;
 
-      VALIDATE_INPUT(boundsCheck(segment, ptr - POINTER_SIZE_IN_WORDS, ptr + wordCount),
+      VALIDATE_SEGMENT(boundsCheck(segment, ptr - POINTER_SIZE_IN_WORDS, ptr + wordCount),
             "Message contains out-of-bounds list pointer.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(tag->kind() == WirePointer::STRUCT,
+      VALIDATE_SEGMENT(tag->kind() == WirePointer::STRUCT,
             "INLINE_COMPOSITE lists of non-STRUCT type are not supported.") {
         goto useDefault;
       }
@@ -1513,7 +1715,7 @@ struct WireHelpers {
       size = tag->inlineCompositeListElementCount();
       wordsPerElement = tag->structRef.wordSize() / ELEMENTS;
 
-      VALIDATE_INPUT(size * wordsPerElement <= wordCount,
+      VALIDATE_SEGMENT(size * wordsPerElement <= wordCount,
             "INLINE_COMPOSITE list's elements overrun its word count.") {
         goto useDefault;
       }
@@ -1529,7 +1731,7 @@ struct WireHelpers {
           break;
 
         case FieldSize::BIT:
-          FAIL_VALIDATE_INPUT("Expected a bit list, but got a list of structs.") {
+          FAIL_VALIDATE_SEGMENT("Expected a bit list, but got a list of structs.") {
             goto useDefault;
           }
           break;
@@ -1538,7 +1740,7 @@ struct WireHelpers {
         case FieldSize::TWO_BYTES:
         case FieldSize::FOUR_BYTES:
         case FieldSize::EIGHT_BYTES:
-          VALIDATE_INPUT(tag->structRef.dataSize.get() > 0 * WORDS,
+          VALIDATE_SEGMENT(tag->structRef.dataSize.get() > 0 * WORDS,
                 "Expected a primitive list, but got a list of pointer-only structs.") {
             goto useDefault;
           }
@@ -1549,7 +1751,7 @@ struct WireHelpers {
           // in the struct is the pointer we were looking for, we want to munge the pointer to
           // point at the first element's pointer segment.
           ptr += tag->structRef.dataSize.get();
-          VALIDATE_INPUT(tag->structRef.ptrCount.get() > 0 * POINTERS,
+          VALIDATE_SEGMENT(tag->structRef.ptrCount.get() > 0 * POINTERS,
                 "Expected a pointer list, but got a list of data-only structs.") {
             goto useDefault;
           }
@@ -1572,7 +1774,7 @@ struct WireHelpers {
           pointersPerElement(ref->listRef.elementSize()) * ELEMENTS;
       auto step = (dataSize + pointerCount * BITS_PER_POINTER) / ELEMENTS;
 
-      VALIDATE_INPUT(boundsCheck(segment, ptr, ptr +
+      VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr +
             roundUpToWords(ElementCount64(ref->listRef.elementCount()) * step)),
             "Message contains out-of-bounds list pointer.") {
         goto useDefault;
@@ -1588,11 +1790,11 @@ struct WireHelpers {
       WirePointerCount expectedPointersPerElement =
           pointersPerElement(expectedElementSize) * ELEMENTS;
 
-      VALIDATE_INPUT(expectedDataBitsPerElement <= dataSize,
+      VALIDATE_SEGMENT(expectedDataBitsPerElement <= dataSize,
           "Message contained list with incompatible element type.") {
         goto useDefault;
       }
-      VALIDATE_INPUT(expectedPointersPerElement <= pointerCount,
+      VALIDATE_SEGMENT(expectedPointersPerElement <= pointerCount,
           "Message contained list with incompatible element type.") {
         goto useDefault;
       }
@@ -1619,30 +1821,30 @@ struct WireHelpers {
 
       uint size = ref->listRef.elementCount() / ELEMENTS;
 
-      VALIDATE_INPUT(ref->kind() == WirePointer::LIST,
+      VALIDATE_SEGMENT(ref->kind() == WirePointer::LIST,
             "Message contains non-list pointer where text was expected.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(ref->listRef.elementSize() == FieldSize::BYTE,
+      VALIDATE_SEGMENT(ref->listRef.elementSize() == FieldSize::BYTE,
             "Message contains list pointer of non-bytes where text was expected.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(boundsCheck(segment, ptr, ptr +
+      VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr +
             roundUpToWords(ref->listRef.elementCount() * (1 * BYTES / ELEMENTS))),
             "Message contained out-of-bounds text pointer.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(size > 0, "Message contains text that is not NUL-terminated.") {
+      VALIDATE_SEGMENT(size > 0, "Message contains text that is not NUL-terminated.") {
         goto useDefault;
       }
 
       const char* cptr = reinterpret_cast<const char*>(ptr);
       --size;  // NUL terminator
 
-      VALIDATE_INPUT(cptr[size] == '\0', "Message contains text that is not NUL-terminated.") {
+      VALIDATE_SEGMENT(cptr[size] == '\0', "Message contains text that is not NUL-terminated.") {
         goto useDefault;
       }
 
@@ -1666,17 +1868,17 @@ struct WireHelpers {
 
       uint size = ref->listRef.elementCount() / ELEMENTS;
 
-      VALIDATE_INPUT(ref->kind() == WirePointer::LIST,
+      VALIDATE_SEGMENT(ref->kind() == WirePointer::LIST,
             "Message contains non-list pointer where data was expected.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(ref->listRef.elementSize() == FieldSize::BYTE,
+      VALIDATE_SEGMENT(ref->listRef.elementSize() == FieldSize::BYTE,
             "Message contains list pointer of non-bytes where data was expected.") {
         goto useDefault;
       }
 
-      VALIDATE_INPUT(boundsCheck(segment, ptr, ptr +
+      VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr +
             roundUpToWords(ref->listRef.elementCount() * (1 * BYTES / ELEMENTS))),
             "Message contained out-of-bounds data pointer.") {
         goto useDefault;
@@ -1715,12 +1917,13 @@ struct WireHelpers {
 
     switch (ref->kind()) {
       case WirePointer::STRUCT:
-        VALIDATE_INPUT(nestingLimit > 0,
+        VALIDATE_SEGMENT(nestingLimit > 0,
               "Message is too deeply-nested or contains cycles.  See capnproto::ReadOptions.") {
           goto useDefault;
         }
+        countNesting(segment, nestingLimit);
 
-        VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
+        VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()),
               "Message contained out-of-bounds struct pointer.") {
           goto useDefault;
         }
@@ -1733,22 +1936,23 @@ struct WireHelpers {
       case WirePointer::LIST: {
         FieldSize elementSize = ref->listRef.elementSize();
 
-        VALIDATE_INPUT(nestingLimit > 0,
+        VALIDATE_SEGMENT(nestingLimit > 0,
               "Message is too deeply-nested or contains cycles.  See capnproto::ReadOptions.") {
           goto useDefault;
         }
+        countNesting(segment, nestingLimit);
 
         if (elementSize == FieldSize::INLINE_COMPOSITE) {
           WordCount wordCount = ref->listRef.inlineCompositeWordCount();
           const WirePointer* tag = reinterpret_cast<const WirePointer*>(ptr);
           ptr += POINTER_SIZE_IN_WORDS;
 
-          VALIDATE_INPUT(boundsCheck(segment, ptr - POINTER_SIZE_IN_WORDS, ptr + wordCount),
+          VALIDATE_SEGMENT(boundsCheck(segment, ptr - POINTER_SIZE_IN_WORDS, ptr + wordCount),
               "Message contains out-of-bounds list pointer.") {
             goto useDefault;
           }
 
-          VALIDATE_INPUT(tag->kind() == WirePointer::STRUCT,
+          VALIDATE_SEGMENT(tag->kind() == WirePointer::STRUCT,
                 "INLINE_COMPOSITE lists of non-STRUCT type are not supported.") {
             goto useDefault;
           }
@@ -1756,7 +1960,7 @@ struct WireHelpers {
           ElementCount elementCount = tag->inlineCompositeListElementCount();
           auto wordsPerElement = tag->structRef.wordSize() / ELEMENTS;
 
-          VALIDATE_INPUT(wordsPerElement * elementCount <= wordCount,
+          VALIDATE_SEGMENT(wordsPerElement * elementCount <= wordCount,
               "INLINE_COMPOSITE list's elements overrun its word count.");
 
           return ObjectReader(
@@ -1770,7 +1974,7 @@ struct WireHelpers {
           ElementCount elementCount = ref->listRef.elementCount();
           WordCount wordCount = roundUpToWords(ElementCount64(elementCount) * step);
 
-          VALIDATE_INPUT(boundsCheck(segment, ptr, ptr + wordCount),
+          VALIDATE_SEGMENT(boundsCheck(segment, ptr, ptr + wordCount),
                 "Message contains out-of-bounds list pointer.") {
             goto useDefault;
           }
@@ -1781,7 +1985,7 @@ struct WireHelpers {
         }
       }
       default:
-        FAIL_VALIDATE_INPUT("Message contained invalid pointer.") {}
+        FAIL_VALIDATE_SEGMENT("Message contained invalid pointer.") {}
         goto useDefault;
     }
   }
@@ -1908,8 +2112,8 @@ StructReader StructReader::readRootUnchecked(const word* location) {
 
 StructReader StructReader::readRoot(
     const word* location, SegmentReader* segment, int nestingLimit) {
-  VALIDATE_INPUT(WireHelpers::boundsCheck(segment, location, location + POINTER_SIZE_IN_WORDS),
-                 "Root location out-of-bounds.") {
+  VALIDATE_SEGMENT(WireHelpers::boundsCheck(segment, location, location + POINTER_SIZE_IN_WORDS),
+                   "Root location out-of-bounds.") {
     location = nullptr;
   }
 
@@ -1959,6 +2163,26 @@ bool StructReader::isPointerFieldNull(WirePointerCount ptrIndex) const {
   return ptrIndex >= pointerCount || (pointers + ptrIndex)->isNull();
 }
 
+uint64_t StructReader::fingerprint() const {
+  uint64_t hash = WireHelpers::mixFingerprint(0, WirePointer::STRUCT + 1);
+  if (dataSize == 1 * BITS) {
+    hash = WireHelpers::mixFingerprint(hash, getDataField<bool>(0 * ELEMENTS));
+    hash = WireHelpers::fingerprintStruct(hash, segment, nullptr, 0 * BYTES,
+                                          pointers, pointerCount, nestingLimit);
+  } else {
+    hash = WireHelpers::fingerprintStruct(hash, segment, data, dataSize / BITS_PER_BYTE,
+                                          pointers, pointerCount, nestingLimit);
+  }
+
+  // Final avalanche, so that every bit of the input affects every bit of the result.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
 WordCount64 StructReader::totalSize() const {
   WordCount64 result = WireHelpers::roundUpToWords(dataSize) + pointerCount * WORDS_PER_POINTER;
 
@@ -2100,21 +2324,21 @@ ListReader ListBuilder::asReader() const {
 // ListReader
 
 Text::Reader ListReader::asText() {
-  VALIDATE_INPUT(structDataSize == 8 * BITS && structPointerCount == 0 * POINTERS,
+  VALIDATE_SEGMENT(structDataSize == 8 * BITS && structPointerCount == 0 * POINTERS,
       "Expected Text, got list of non-bytes.") {
     return Text::Reader();
   }
 
   size_t size = elementCount / ELEMENTS;
 
-  VALIDATE_INPUT(size > 0, "Message contains text that is not NUL-terminated.") {
+  VALIDATE_SEGMENT(size > 0, "Message contains text that is not NUL-terminated.") {
     return Text::Reader();
   }
 
   const char* cptr = reinterpret_cast<const char*>(ptr);
   --size;  // NUL terminator
 
-  VALIDATE_INPUT(cptr[size] == '\0', "Message contains text that is not NUL-terminated.") {
+  VALIDATE_SEGMENT(cptr[size] == '\0', "Message contains text that is not NUL-terminated.") {
     return Text::Reader();
   }
 
@@ -2122,7 +2346,7 @@ Text::Reader ListReader::asText() {
 }
 
 Data::Reader ListReader::asData() {
-  VALIDATE_INPUT(structDataSize == 8 * BITS && structPointerCount == 0 * POINTERS,
+  VALIDATE_SEGMENT(structDataSize == 8 * BITS && structPointerCount == 0 * POINTERS,
       "Expected Text, got list of non-bytes.") {
     return Data::Reader();
   }
@@ -2131,10 +2355,11 @@ Data::Reader ListReader::asData() {
 }
 
 StructReader ListReader::getStructElement(ElementCount index) const {
-  VALIDATE_INPUT(nestingLimit > 0,
+  VALIDATE_SEGMENT(nestingLimit > 0,
         "Message is too deeply-nested or contains cycles.  See capnproto::ReadOptions.") {
     return StructReader();
   }
+  WireHelpers::countNesting(segment, nestingLimit);
 
   BitCount64 indexBit = ElementCount64(index) * step;
   const byte* structData = ptr + indexBit / BITS_PER_BYTE;
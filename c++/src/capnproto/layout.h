@@ -470,6 +470,13 @@ public:
   // use the result as a hint for allocating the first segment, do the copy, and then throw an
   // exception if it overruns.
 
+  uint64_t fingerprint() const;
+  // Return a 64-bit hash of the struct's content, including everything it points to.  Two structs
+  // with the same content have the same fingerprint even if they are laid out differently, e.g.
+  // in different segments or with data and pointer sections of different sizes (padding is
+  // ignored).  The hash is fast, not cryptographic:  deliberately crafted collisions are easy, so
+  // don't rely on it where a collision would be a security problem.
+
 private:
   SegmentReader* segment;  // Memory segment in which the struct resides.
 
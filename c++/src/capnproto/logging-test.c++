@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <thread>
 
 namespace capnproto {
 namespace internal {
@@ -198,6 +199,186 @@ TEST(Logging, Context) {
   }
 }
 
+bool hasTrace(const Exception& exception) {
+  const char* what = exception.what();
+  const char* stack = strstr(what, "\nstack: ");
+  return stack != nullptr && stack[8] != '\0';
+}
+
+TEST(Logging, ExceptionDescription) {
+  int i = 123;
+  try {
+    CHECK(1 == 2, i, "hi");
+    ADD_FAILURE() << "Expected exception.";
+  } catch (const Exception& e) {
+    // The description is put together only on request; make sure it survives copying first.
+    Exception copy = e;
+    EXPECT_EQ("expected 1 == 2; i = 123; hi",
+              std::string(copy.getDescription().begin(), copy.getDescription().size()));
+    EXPECT_EQ("expected 1 == 2; i = 123; hi",
+              std::string(e.getDescription().begin(), e.getDescription().size()));
+    EXPECT_TRUE(hasTrace(e));
+  }
+}
+
+TEST(Logging, ExceptionDescriptionThreads) {
+  // An exception rethrown from an exception_ptr may be caught on several threads at once.  The
+  // first of them to ask builds the description; the rest must see it whole.
+  std::exception_ptr ptr;
+  int i = 123;
+  try {
+    CHECK(1 == 2, i, "hi");
+  } catch (...) {
+    ptr = std::current_exception();
+  }
+  ASSERT_TRUE(ptr != nullptr);
+
+  std::string descriptions[4];
+  std::thread threads[4];
+  for (int j = 0; j < 4; j++) {
+    threads[j] = std::thread([&, j]() {
+      try {
+        std::rethrow_exception(ptr);
+      } catch (const Exception& e) {
+        descriptions[j].assign(e.getDescription().begin(), e.getDescription().size());
+      }
+    });
+  }
+  for (auto& thread: threads) {
+    thread.join();
+  }
+
+  for (auto& description: descriptions) {
+    EXPECT_EQ("expected 1 == 2; i = 123; hi", description);
+  }
+}
+
+TEST(Logging, TraceMode) {
+  std::string traces;
+  auto raise = [&]() {
+    try {
+      FAIL_CHECK("foo");
+    } catch (const Exception& e) {
+      EXPECT_STREQ("foo", std::string(e.getDescription().begin(),
+                                      e.getDescription().size()).c_str());
+      traces += hasTrace(e) ? 'y' : 'n';
+    }
+  };
+
+  Exception::setTraceMode(Exception::TraceMode::NEVER);
+  raise();
+  raise();
+  EXPECT_EQ("nn", traces);
+  traces.clear();
+
+  // Sampling is per-thread, so use a new one to start counting from scratch.
+  Exception::setTraceMode(Exception::TraceMode::SAMPLED, 3);
+  std::thread thread([&]() {
+    for (int j = 0; j < 7; j++) {
+      raise();
+    }
+  });
+  thread.join();
+  EXPECT_EQ("ynnynny", traces);
+  traces.clear();
+
+  Exception::setTraceMode(Exception::TraceMode::ALWAYS);
+  raise();
+  EXPECT_EQ("y", traces);
+}
+
+TEST(Logging, BinaryLog) {
+  MockExceptionCallback mockCallback;
+  MockExceptionCallback::ScopedRegistration reg(mockCallback);
+  int line;
+
+  Log::enableBinaryLog(4096);
+
+  int i = 123;
+  double d = 1.5;
+  std::string temporary = "foo";
+  LOG(ERROR, i, d, temporary.c_str(), Log::Severity::WARNING, "literal"); line = __LINE__;
+  temporary = "overwritten";
+  EXPECT_EQ("", mockCallback.text);
+
+  Log::flushBinaryLog();
+  EXPECT_EQ("log message: error: " + fileLine(__FILE__, line) + ": i = 123; d = 1.5; "
+            "temporary.c_str() = foo; Log::Severity::WARNING = warning; literal\n",
+            mockCallback.text);
+  mockCallback.text.clear();
+
+  // Messages logged on other threads -- including ones which have exited -- are flushed in order.
+  int line2;
+  std::thread thread([&]() {
+    for (int j = 0; j < 3; j++) {
+      LOG(INFO, j); line2 = __LINE__;
+    }
+  });
+  thread.join();
+  LOG(WARNING, "here"); line = __LINE__;
+
+  Log::flushBinaryLog();
+  std::string text = mockCallback.text;
+  EXPECT_NE(std::string::npos, text.find(
+      "log message: info: " + fileLine(__FILE__, line2) + ": j = 0\n"
+      "log message: info: " + fileLine(__FILE__, line2) + ": j = 1\n"
+      "log message: info: " + fileLine(__FILE__, line2) + ": j = 2\n")) << text;
+  EXPECT_NE(std::string::npos, text.find(
+      "log message: warning: " + fileLine(__FILE__, line) + ": here\n")) << text;
+  mockCallback.text.clear();
+
+  Log::enableBinaryLog(0);
+  LOG(INFO, "immediate"); line = __LINE__;
+  EXPECT_EQ("log message: info: " + fileLine(__FILE__, line) + ": immediate\n",
+            mockCallback.text);
+}
+
+TEST(Logging, BinaryLogFull) {
+  MockExceptionCallback mockCallback;
+  MockExceptionCallback::ScopedRegistration reg(mockCallback);
+
+  // The buffer size only applies to threads that have not logged yet, so use a new one.
+  Log::enableBinaryLog(256);
+  std::thread thread([]() {
+    for (int j = 0; j < 100; j++) {
+      LOG(INFO, j);
+    }
+  });
+  thread.join();
+
+  Log::flushBinaryLog();
+  std::string text = mockCallback.text;
+  size_t count = 0;
+  for (size_t pos = 0; (pos = text.find("log message: info: ", pos)) != std::string::npos; pos++) {
+    ++count;
+  }
+  EXPECT_GT(count, 0u);
+  EXPECT_LT(count, 100u);
+  EXPECT_NE(std::string::npos, text.find(": j = 0\n")) << text;
+  EXPECT_NE(std::string::npos, text.find(
+      "log message: warning: binary log buffer full; dropped " +
+      std::to_string(100 - count) + " messages\n")) << text;
+  mockCallback.text.clear();
+
+  // Space is reclaimed by flushing.
+  Log::enableBinaryLog(0);
+}
+
+TEST(Logging, BinaryLogFatal) {
+  MockExceptionCallback mockCallback;
+  MockExceptionCallback::ScopedRegistration reg(mockCallback);
+  int line;
+
+  // Messages recorded before a fatal fault are written before the fault is reported.
+  Log::enableBinaryLog(4096);
+  LOG(WARNING, "about to fail"); line = __LINE__;
+  EXPECT_THROW(FAIL_CHECK("failed"), MockException); int line2 = __LINE__;
+  EXPECT_EQ("log message: warning: " + fileLine(__FILE__, line) + ": about to fail\n"
+            "fatal exception: " + fileLine(__FILE__, line2) + ": bug in code: failed\n",
+            mockCallback.text);
+  Log::enableBinaryLog(0);
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace capnproto
@@ -27,10 +27,13 @@
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <mutex>
 
 namespace capnproto {
 
 Log::Severity Log::minSeverity = Log::Severity::INFO;
+bool Log::binaryLogEnabled = false;
 
 ArrayPtr<const char> operator*(const Stringifier&, Log::Severity severity) {
   static const char* SEVERITY_STRINGS[] = {
@@ -187,8 +190,231 @@ static Array<char> makeDescription(DescriptionStyle style, const char* code, int
   }
 }
 
+class DeferredDescription final: public Exception::DescriptionBuilder {
+  // Holds on to a fault's stringified parameters and puts the description together only if
+  // somebody asks for it.
+
+public:
+  DeferredDescription(DescriptionStyle style, const char* code, int errorNumber,
+                      const char* macroArgs, ArrayPtr<Array<char>> argValues)
+      : style(style), code(code), errorNumber(errorNumber), macroArgs(macroArgs),
+        argValues(newArray<Array<char>>(argValues.size())) {
+    for (size_t i = 0; i < argValues.size(); i++) {
+      this->argValues[i] = move(argValues[i]);
+    }
+  }
+
+  Array<char> build() override {
+    return makeDescription(style, code, errorNumber, macroArgs, argValues);
+  }
+
+private:
+  DescriptionStyle style;
+  const char* code;
+  int errorNumber;
+  const char* macroArgs;
+  Array<Array<char>> argValues;
+};
+
+}  // namespace
+
+// =======================================================================================
+// Binary log
+
+namespace internal {
+
+struct BinaryLogRing {
+  // A single-producer, single-consumer ring of BinaryLogRecords.  The owning thread appends and
+  // then publishes `head`; flushBinaryLog() consumes and then publishes `tail`.  Both positions
+  // count bytes since the ring was created and are reduced modulo the capacity only when indexing
+  // the buffer, so `head - tail` is always the number of bytes in use.
+
+  byte* buffer;
+  size_t mask;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t dropped;
+  // Number of messages that did not fit, since the last flush.
+
+  bool orphaned;
+  // The owning thread has exited.  The ring is freed once flushed.
+
+  BinaryLogRing* next;
+};
+
+}  // namespace internal
+
+namespace {
+
+#if __GNUC__ < 4 || (__GNUC__ == 4 && __GNUC_MINOR__ < 8)
+#define thread_local __thread
+#endif
+
+std::mutex binaryLogMutex;
+size_t binaryLogBytesPerThread = 0;
+internal::BinaryLogRing* binaryLogRings = nullptr;
+// All rings that may hold messages.  Guarded by binaryLogMutex, which is taken only when a thread
+// first logs in binary mode, when it exits, and while flushing.
+
+thread_local internal::BinaryLogRing* threadBinaryLogRing = nullptr;
+
+// We also set the ring as a pthread key, only so that we are told when its thread exits.
+pthread_key_t binaryLogRingKey;
+pthread_once_t binaryLogRingKeyOnce = PTHREAD_ONCE_INIT;
+
+void orphanBinaryLogRing(void* ring) {
+  std::lock_guard<std::mutex> lock(binaryLogMutex);
+  reinterpret_cast<internal::BinaryLogRing*>(ring)->orphaned = true;
+  threadBinaryLogRing = nullptr;
+}
+
+void flushBinaryLogAtExit() {
+  Log::flushBinaryLog();
+}
+
+void initBinaryLogRingKey() {
+  int error = pthread_key_create(&binaryLogRingKey, &orphanBinaryLogRing);
+  if (error != 0) {
+    FAIL_SYSCALL("pthread_key_create(&binaryLogRingKey, &orphanBinaryLogRing)", error);
+  }
+  atexit(&flushBinaryLogAtExit);
+}
+
 }  // namespace
 
+Log::BinaryLogWriter::BinaryLogWriter(): ring(threadBinaryLogRing) {
+  if (CAPNPROTO_EXPECT_FALSE(ring == nullptr)) {
+    pthread_once(&binaryLogRingKeyOnce, &initBinaryLogRingKey);
+
+    {
+      std::lock_guard<std::mutex> lock(binaryLogMutex);
+      if (binaryLogBytesPerThread == 0) {
+        // Binary mode was disabled after our caller checked.
+        return;
+      }
+      ring = new internal::BinaryLogRing;
+      ring->buffer = reinterpret_cast<byte*>(malloc(binaryLogBytesPerThread));
+      if (ring->buffer == nullptr) {
+        delete ring;
+        ring = nullptr;
+        return;
+      }
+      ring->mask = binaryLogBytesPerThread - 1;
+      ring->head = 0;
+      ring->tail = 0;
+      ring->dropped = 0;
+      ring->orphaned = false;
+      ring->next = binaryLogRings;
+      binaryLogRings = ring;
+    }
+
+    threadBinaryLogRing = ring;
+    pthread_setspecific(binaryLogRingKey, ring);
+  }
+
+  buffer = ring->buffer;
+  mask = ring->mask;
+  start = ring->head;
+  pos = start + sizeof(BinaryLogRecord);
+  limit = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) + mask + 1;
+  full = pos > limit;
+  if (full) {
+    // Make every write() fail too.
+    pos = limit;
+  }
+}
+
+void Log::BinaryLogWriter::finish(
+    void (*replay)(const BinaryLogRecord& record, BinaryLogReader& reader),
+    const char* file, int line, Severity severity, const char* macroArgs) {
+  if (full) {
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  BinaryLogRecord record;
+  record.replay = replay;
+  record.file = file;
+  record.macroArgs = macroArgs;
+  record.line = line;
+  record.severity = severity;
+  record.size = pos - start;
+
+  uint64_t end = pos;
+  pos = start;
+  write(&record, sizeof(record));
+  __atomic_store_n(&ring->head, end, __ATOMIC_RELEASE);
+}
+
+void Log::enableBinaryLog(size_t bytesPerThread) {
+  if (bytesPerThread == 0) {
+    __atomic_store_n(&binaryLogEnabled, false, __ATOMIC_RELAXED);
+    std::lock_guard<std::mutex> lock(binaryLogMutex);
+    binaryLogBytesPerThread = 0;
+    flushBinaryLogLocked();
+    return;
+  }
+
+  size_t capacity = 256;
+  while (capacity < bytesPerThread) {
+    capacity <<= 1;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(binaryLogMutex);
+    binaryLogBytesPerThread = capacity;
+  }
+  __atomic_store_n(&binaryLogEnabled, true, __ATOMIC_RELAXED);
+}
+
+void Log::flushBinaryLog() {
+  std::lock_guard<std::mutex> lock(binaryLogMutex);
+  flushBinaryLogLocked();
+}
+
+void Log::flushBinaryLogBeforeCrash() {
+  // If this thread is already flushing -- e.g. the callback failed a CHECK -- skip the flush
+  // rather than deadlock.
+  std::unique_lock<std::mutex> lock(binaryLogMutex, std::try_to_lock);
+  if (lock.owns_lock()) {
+    flushBinaryLogLocked();
+  }
+}
+
+void Log::flushBinaryLogLocked() {
+  internal::BinaryLogRing** link = &binaryLogRings;
+  while (internal::BinaryLogRing* ring = *link) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    while (tail < head) {
+      BinaryLogReader reader(ring->buffer, ring->mask, tail);
+      BinaryLogRecord record;
+      reader.read(&record, sizeof(record));
+      record.replay(record, reader);
+
+      // Release each record as soon as it is formatted so that the writer can reuse the space.
+      tail += record.size;
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+      getExceptionCallback().logMessage(
+          str("warning: binary log buffer full; dropped ", dropped, " messages\n"));
+    }
+
+    if (ring->orphaned) {
+      *link = ring->next;
+      free(ring->buffer);
+      delete ring;
+    } else {
+      link = &ring->next;
+    }
+  }
+}
+
+// =======================================================================================
+
 void Log::logInternal(const char* file, int line, Severity severity, const char* macroArgs,
                       ArrayPtr<Array<char>> argValues) {
   getExceptionCallback().logMessage(
@@ -201,32 +427,41 @@ void Log::recoverableFaultInternal(
     const char* condition, const char* macroArgs, ArrayPtr<Array<char>> argValues) {
   getExceptionCallback().onRecoverableException(
       Exception(nature, Exception::Durability::PERMANENT, file, line,
-                makeDescription(ASSERTION, condition, 0, macroArgs, argValues)));
+                heap<DeferredDescription>(ASSERTION, condition, 0, macroArgs, argValues)));
 }
 
 void Log::fatalFaultInternal(
     const char* file, int line, Exception::Nature nature,
     const char* condition, const char* macroArgs, ArrayPtr<Array<char>> argValues) {
+  flushBinaryLogBeforeCrash();
   getExceptionCallback().onFatalException(
       Exception(nature, Exception::Durability::PERMANENT, file, line,
-                makeDescription(ASSERTION, condition, 0, macroArgs, argValues)));
+                heap<DeferredDescription>(ASSERTION, condition, 0, macroArgs, argValues)));
   abort();
 }
 
+void Log::recordFaultInternal(
+    Maybe<Exception>& record, const char* file, int line, Exception::Nature nature,
+    const char* condition, const char* macroArgs, ArrayPtr<Array<char>> argValues) {
+  record = Exception(nature, Exception::Durability::PERMANENT, file, line,
+                     heap<DeferredDescription>(ASSERTION, condition, 0, macroArgs, argValues));
+}
+
 void Log::recoverableFailedSyscallInternal(
     const char* file, int line, const char* call,
     int errorNumber, const char* macroArgs, ArrayPtr<Array<char>> argValues) {
   getExceptionCallback().onRecoverableException(
       Exception(Exception::Nature::OS_ERROR, Exception::Durability::PERMANENT, file, line,
-                makeDescription(SYSCALL, call, errorNumber, macroArgs, argValues)));
+                heap<DeferredDescription>(SYSCALL, call, errorNumber, macroArgs, argValues)));
 }
 
 void Log::fatalFailedSyscallInternal(
     const char* file, int line, const char* call,
     int errorNumber, const char* macroArgs, ArrayPtr<Array<char>> argValues) {
+  flushBinaryLogBeforeCrash();
   getExceptionCallback().onFatalException(
       Exception(Exception::Nature::OS_ERROR, Exception::Durability::PERMANENT, file, line,
-                makeDescription(SYSCALL, call, errorNumber, macroArgs, argValues)));
+                heap<DeferredDescription>(SYSCALL, call, errorNumber, macroArgs, argValues)));
   abort();
 }
 
@@ -57,6 +57,12 @@
 //   input that may have come from the user or some other untrusted source.  Recoverability is
 //   required in this case.
 //
+// * `VALIDATE_INPUT_OR_RECORD(record, condition, ...) { ... }`:  Like `VALIDATE_INPUT`, except
+//   that if `record` -- a `Maybe<Exception>*`, evaluated only on failure -- is non-null, the
+//   failure is stored there instead of being reported to the ExceptionCallback, and only if
+//   nothing has been stored yet.  This lets a caller which would rather not deal with exceptions
+//   check for errors once at the end of a long series of operations.
+//
 // * `SYSCALL(code, ...)`:  Executes `code` assuming it makes a system call.  A negative return
 //   value is considered an error.  EINTR is handled by retrying.  Other errors are handled by
 //   throwing an exception.  The macro also returns the call's result.  For example, the following
@@ -82,6 +88,12 @@
 //   are only evaluated if an exception is thrown.  This means that any variables used must remain
 //   valid until the end of the scope.
 //
+// Binary logging:  By default, `LOG` formats its message immediately.  A program that logs from
+// hot paths can instead call `Log::enableBinaryLog()`, after which `LOG` only copies the raw values
+// of its arguments, along with pointers to the macro's static text, into a per-thread ring buffer.
+// The messages are formatted later, when some thread calls `Log::flushBinaryLog()` -- typically a
+// background thread that wakes periodically -- or just before a fatal fault is reported.
+//
 // Notes:
 // * Do not write expressions with side-effects in the message content part of the macro, as the
 //   message will not necessarily be evaluated.
@@ -105,6 +117,8 @@
 
 namespace capnproto {
 
+namespace internal { struct BinaryLogRing; }
+
 class Log {
 public:
   enum class Severity {
@@ -122,6 +136,20 @@ public:
   static inline void setLogLevel(Severity severity) { minSeverity = severity; }
   // Set the minimum message severity which will be logged.
 
+  static void enableBinaryLog(size_t bytesPerThread);
+  // Switch `LOG` to binary mode, in which each thread records messages into a ring buffer of
+  // `bytesPerThread` (rounded up to a power of two) and formatting is deferred until
+  // flushBinaryLog().  A message that does not fit into its thread's buffer is dropped and counted.
+  // The buffer size only applies to threads which have not yet logged anything in binary mode.
+  // Pass zero to return to immediate formatting; pending messages are flushed first.
+
+  static void flushBinaryLog();
+  // Format all messages recorded in binary mode so far, from every thread, and write them to the
+  // calling thread's ExceptionCallback, followed by a count of any messages that were dropped.
+  // Messages from any one thread are written in order.  Calls are serialized internally; the
+  // callback must not call flushBinaryLog() itself.  This is called automatically at exit and
+  // before a fatal fault is reported, so that a crash does not lose the messages leading up to it.
+
   template <typename... Params>
   static void log(const char* file, int line, Severity severity, const char* macroArgs,
                   Params&&... params);
@@ -135,6 +163,11 @@ public:
                          const char* condition, const char* macroArgs, Params&&... params)
                          CAPNPROTO_NORETURN;
 
+  template <typename... Params>
+  static void recordableFault(Maybe<Exception>* record, const char* file, int line,
+                              Exception::Nature nature, const char* condition,
+                              const char* macroArgs, Params&&... params);
+
   template <typename Call, typename... Params>
   static bool recoverableSyscall(Call&& call, const char* file, int line, const char* callText,
                                  const char* macroArgs, Params&&... params);
@@ -188,6 +221,19 @@ public:
 
 private:
   static Severity minSeverity;
+  static bool binaryLogEnabled;
+
+  struct BinaryLogRecord;
+  class BinaryLogWriter;
+  class BinaryLogReader;
+  template <typename T, bool raw>
+  struct BinaryLogArg;
+
+  template <typename... Params>
+  static void replayBinaryLog(const BinaryLogRecord& record, BinaryLogReader& reader);
+  // Formats a message recorded by a LOG() whose parameters had the given types.
+  static void flushBinaryLogLocked();
+  static void flushBinaryLogBeforeCrash();
 
   static void logInternal(const char* file, int line, Severity severity, const char* macroArgs,
                           ArrayPtr<Array<char>> argValues);
@@ -198,6 +244,9 @@ private:
       const char* file, int line, Exception::Nature nature,
       const char* condition, const char* macroArgs, ArrayPtr<Array<char>> argValues)
       CAPNPROTO_NORETURN;
+  static void recordFaultInternal(
+      Maybe<Exception>& record, const char* file, int line, Exception::Nature nature,
+      const char* condition, const char* macroArgs, ArrayPtr<Array<char>> argValues);
   static void recoverableFailedSyscallInternal(
       const char* file, int line, const char* call,
       int errorNumber, const char* macroArgs, ArrayPtr<Array<char>> argValues);
@@ -230,17 +279,26 @@ ArrayPtr<const char> operator*(const Stringifier&, Log::Severity severity);
             ::capnproto::Exception::Nature::nature, #cond, #__VA_ARGS__, ##__VA_ARGS__), false) {} \
     else
 
+#define RECORDABLE_FAULT(nature, record, cond, ...) \
+  if (CAPNPROTO_EXPECT_TRUE(cond)) {} else \
+    if (::capnproto::Log::recordableFault(record, __FILE__, __LINE__, \
+            ::capnproto::Exception::Nature::nature, #cond, #__VA_ARGS__, ##__VA_ARGS__), false) {} \
+    else
+
 #define CHECK(...) FAULT(LOCAL_BUG, __VA_ARGS__)
 #define RECOVERABLE_CHECK(...) RECOVERABLE_FAULT(LOCAL_BUG, __VA_ARGS__)
 #define PRECOND(...) FAULT(PRECONDITION, __VA_ARGS__)
 #define RECOVERABLE_PRECOND(...) RECOVERABLE_FAULT(PRECONDITION, __VA_ARGS__)
 #define VALIDATE_INPUT(...) RECOVERABLE_FAULT(INPUT, __VA_ARGS__)
+#define VALIDATE_INPUT_OR_RECORD(record, ...) RECORDABLE_FAULT(INPUT, record, __VA_ARGS__)
 
 #define FAIL_CHECK(...) CHECK(false, ##__VA_ARGS__)
 #define FAIL_RECOVERABLE_CHECK(...) RECOVERABLE_CHECK(false, ##__VA_ARGS__)
 #define FAIL_PRECOND(...) PRECOND(false, ##__VA_ARGS__)
 #define FAIL_RECOVERABLE_PRECOND(...) RECOVERABLE_PRECOND(false, ##__VA_ARGS__)
 #define FAIL_VALIDATE_INPUT(...) VALIDATE_INPUT(false, ##__VA_ARGS__)
+#define FAIL_VALIDATE_INPUT_OR_RECORD(record, ...) \
+  VALIDATE_INPUT_OR_RECORD(record, false, ##__VA_ARGS__)
 
 #define SYSCALL(call, ...) \
   ::capnproto::Log::syscall( \
@@ -288,9 +346,167 @@ ArrayPtr<const char> operator*(const Stringifier&, Log::Severity severity);
 #define RECOVERABLE_DPRECOND RECOVERABLE_PRECOND
 #endif
 
+namespace internal {
+
+template <typename T> struct BinaryLogType_ { typedef T Type; };
+template <typename T> struct BinaryLogType_<const T> { typedef T Type; };
+template <typename T>
+using BinaryLogType = typename BinaryLogType_<RemoveReference<T>>::Type;
+// The type under which a LOG() parameter is recorded in binary mode.
+
+template <typename T> struct IsBinaryLogRaw { static constexpr bool value = __is_enum(T); };
+#define CAPNPROTO_BINARY_LOG_RAW(type) \
+  template <> struct IsBinaryLogRaw<type> { static constexpr bool value = true; }
+CAPNPROTO_BINARY_LOG_RAW(bool);
+CAPNPROTO_BINARY_LOG_RAW(char);
+CAPNPROTO_BINARY_LOG_RAW(signed char);
+CAPNPROTO_BINARY_LOG_RAW(unsigned char);
+CAPNPROTO_BINARY_LOG_RAW(short);
+CAPNPROTO_BINARY_LOG_RAW(unsigned short);
+CAPNPROTO_BINARY_LOG_RAW(int);
+CAPNPROTO_BINARY_LOG_RAW(unsigned int);
+CAPNPROTO_BINARY_LOG_RAW(long);
+CAPNPROTO_BINARY_LOG_RAW(unsigned long);
+CAPNPROTO_BINARY_LOG_RAW(long long);
+CAPNPROTO_BINARY_LOG_RAW(unsigned long long);
+CAPNPROTO_BINARY_LOG_RAW(float);
+CAPNPROTO_BINARY_LOG_RAW(double);
+#undef CAPNPROTO_BINARY_LOG_RAW
+// Types which binary mode records by copying their bytes, and stringifies only when flushing.
+// Anything else -- strings, pointers, user types -- is stringified when recorded, since the value
+// it refers to may be gone by the time the log is flushed.
+
+}  // namespace internal
+
+struct Log::BinaryLogRecord {
+  // Header of each message in a binary log ring, followed by the parameter values.
+
+  void (*replay)(const BinaryLogRecord& record, BinaryLogReader& reader);
+  const char* file;
+  const char* macroArgs;
+  int line;
+  Severity severity;
+  size_t size;
+  // Total size of the record, including this header.
+};
+
+class Log::BinaryLogWriter {
+  // Appends one record to the calling thread's ring.  Nothing becomes visible to
+  // flushBinaryLog() until finish().
+
+public:
+  BinaryLogWriter();
+  CAPNPROTO_DISALLOW_COPY(BinaryLogWriter);
+
+  inline bool isActive() { return ring != nullptr; }
+  // False if binary mode was disabled concurrently, in which case the message should be
+  // formatted immediately instead.
+
+  inline void write(const void* data, size_t size) {
+    if (CAPNPROTO_EXPECT_FALSE(size > limit - pos)) {
+      full = true;
+      return;
+    }
+    size_t offset = pos & mask;
+    size_t first = size < mask + 1 - offset ? size : mask + 1 - offset;
+    memcpy(static_cast<void*>(buffer + offset), data, first);
+    memcpy(static_cast<void*>(buffer), reinterpret_cast<const byte*>(data) + first, size - first);
+    pos += size;
+  }
+
+  inline void addAll() {}
+  template <typename First, typename... Rest>
+  inline void addAll(First&& first, Rest&&... rest) {
+    typedef internal::BinaryLogType<First> Type;
+    BinaryLogArg<Type, internal::IsBinaryLogRaw<Type>::value>::write(*this, first);
+    addAll(capnproto::forward<Rest>(rest)...);
+  }
+
+  void finish(void (*replay)(const BinaryLogRecord& record, BinaryLogReader& reader),
+              const char* file, int line, Severity severity, const char* macroArgs);
+
+private:
+  internal::BinaryLogRing* ring;
+  byte* buffer;
+  size_t mask;
+  uint64_t start;
+  uint64_t pos;
+  uint64_t limit;
+  bool full;
+};
+
+class Log::BinaryLogReader {
+  // Reads the parameters of one record while flushing.
+
+public:
+  inline BinaryLogReader(const byte* buffer, size_t mask, uint64_t pos)
+      : buffer(buffer), mask(mask), pos(pos) {}
+
+  inline void read(void* data, size_t size) {
+    size_t offset = pos & mask;
+    size_t first = size < mask + 1 - offset ? size : mask + 1 - offset;
+    memcpy(data, buffer + offset, first);
+    memcpy(static_cast<void*>(reinterpret_cast<byte*>(data) + first), buffer, size - first);
+    pos += size;
+  }
+
+private:
+  const byte* buffer;
+  size_t mask;
+  uint64_t pos;
+};
+
+template <typename T>
+struct Log::BinaryLogArg<T, true> {
+  static inline void write(BinaryLogWriter& writer, T value) {
+    writer.write(&value, sizeof(value));
+  }
+  static Array<char> read(BinaryLogReader& reader) {
+    T value;
+    reader.read(&value, sizeof(value));
+    return str(value);
+  }
+};
+
+template <typename T>
+struct Log::BinaryLogArg<T, false> {
+  static inline void write(BinaryLogWriter& writer, const T& value) {
+    auto&& text = STR * value;
+    size_t size = text.size();
+    writer.write(&size, sizeof(size));
+    writer.write(text.begin(), size);
+  }
+  static Array<char> read(BinaryLogReader& reader) {
+    size_t size;
+    reader.read(&size, sizeof(size));
+    Array<char> result = newArray<char>(size);
+    reader.read(result.begin(), size);
+    return result;
+  }
+};
+
+template <typename... Params>
+void Log::replayBinaryLog(const BinaryLogRecord& record, BinaryLogReader& reader) {
+  // Braced initializers are evaluated in order, so the parameters are read back in order.
+  Array<char> argValues[sizeof...(Params)] = {
+      BinaryLogArg<Params, internal::IsBinaryLogRaw<Params>::value>::read(reader)...};
+  logInternal(record.file, record.line, record.severity, record.macroArgs,
+              arrayPtr(argValues, sizeof...(Params)));
+}
+
 template <typename... Params>
 void Log::log(const char* file, int line, Severity severity, const char* macroArgs,
               Params&&... params) {
+  if (__atomic_load_n(&binaryLogEnabled, __ATOMIC_RELAXED)) {
+    BinaryLogWriter writer;
+    if (writer.isActive()) {
+      writer.addAll(capnproto::forward<Params>(params)...);
+      writer.finish(&replayBinaryLog<internal::BinaryLogType<Params>...>,
+                    file, line, severity, macroArgs);
+      return;
+    }
+  }
+
   Array<char> argValues[sizeof...(Params)] = {str(params)...};
   logInternal(file, line, severity, macroArgs, arrayPtr(argValues, sizeof...(Params)));
 }
@@ -311,6 +527,20 @@ void Log::fatalFault(const char* file, int line, Exception::Nature nature,
                      arrayPtr(argValues, sizeof...(Params)));
 }
 
+template <typename... Params>
+void Log::recordableFault(Maybe<Exception>* record, const char* file, int line,
+                          Exception::Nature nature, const char* condition,
+                          const char* macroArgs, Params&&... params) {
+  if (record == nullptr) {
+    recoverableFault(file, line, nature, condition, macroArgs,
+                     capnproto::forward<Params>(params)...);
+  } else if (*record == nullptr) {
+    Array<char> argValues[sizeof...(Params)] = {str(params)...};
+    recordFaultInternal(*record, file, line, nature, condition, macroArgs,
+                        arrayPtr(argValues, sizeof...(Params)));
+  }
+}
+
 template <typename Call, typename... Params>
 bool Log::recoverableSyscall(Call&& call, const char* file, int line, const char* callText,
                              const char* macroArgs, Params&&... params) {
@@ -0,0 +1,210 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "memory-arena.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+namespace capnproto {
+namespace {
+
+struct DestructionOrder {
+  int* log;
+  int* logPos;
+  int id;
+
+  DestructionOrder(int* log, int* logPos, int id): log(log), logPos(logPos), id(id) {}
+  ~DestructionOrder() { log[(*logPos)++] = id; }
+};
+
+struct Throws {
+  static int constructed;
+  static int destroyed;
+
+  Throws() {
+    if (constructed == 3) throw 1;
+    ++constructed;
+  }
+  ~Throws() { ++destroyed; }
+};
+
+int Throws::constructed = 0;
+int Throws::destroyed = 0;
+
+TEST(Arena, Object) {
+  Arena arena;
+
+  int& i = arena.allocate<int>();
+  EXPECT_EQ(0, i);
+  EXPECT_EQ(123, arena.allocate<int>(123));
+
+  struct Pod { uint64_t a; uint8_t b; double c; };
+  Pod& pod = arena.allocate<Pod>();
+  EXPECT_EQ(0u, pod.a);
+  EXPECT_EQ(0u, pod.b);
+  EXPECT_EQ(0.0, pod.c);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(&pod) % alignof(Pod));
+}
+
+TEST(Arena, Array) {
+  Arena arena;
+
+  ArrayPtr<uint32_t> array = arena.allocateArray<uint32_t>(100);
+  ASSERT_EQ(100u, array.size());
+  for (uint32_t value: array) {
+    EXPECT_EQ(0u, value);
+  }
+
+  ArrayPtr<uint8_t> bytes = arena.allocateUninitializedArray<uint8_t>(3);
+  EXPECT_EQ(3u, bytes.size());
+
+  // Different allocations don't overlap.
+  EXPECT_TRUE(reinterpret_cast<byte*>(bytes.begin()) >= reinterpret_cast<byte*>(array.end()) ||
+              reinterpret_cast<byte*>(bytes.end()) <= reinterpret_cast<byte*>(array.begin()));
+}
+
+TEST(Arena, Alignment) {
+  Arena arena;
+
+  for (uint alignment = 1; alignment <= 256; alignment <<= 1) {
+    arena.allocateBytes(1, 1);
+    void* ptr = arena.allocateBytes(7, alignment);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(ptr) % alignment) << alignment;
+  }
+}
+
+TEST(Arena, Growth) {
+  Arena arena(64);
+
+  // Many small allocations: chunks grow geometrically, so the overhead stays bounded.
+  for (uint i = 0; i < 10000; i++) {
+    arena.allocate<uint64_t>(i);
+  }
+  EXPECT_GE(arena.getTotalChunkBytes(), 80000u);
+  EXPECT_LT(arena.getTotalChunkBytes(), 320000u);
+
+  // One allocation larger than any chunk so far.
+  size_t before = arena.getTotalChunkBytes();
+  ArrayPtr<uint64_t> big = arena.allocateArray<uint64_t>(100000);
+  big[99999] = 1;
+  EXPECT_GE(arena.getTotalChunkBytes(), before + 800000);
+  EXPECT_LT(arena.getTotalChunkBytes(), before + 900000);
+}
+
+TEST(Arena, TooLarge) {
+  // Sizes which would wrap around when the header and padding are added are rejected, rather
+  // than turning into small allocations.
+  Arena arena;
+  EXPECT_ANY_THROW(arena.allocateArray<uint64_t>(SIZE_MAX / 4));
+  EXPECT_ANY_THROW(arena.allocateUninitializedArray<uint32_t>(SIZE_MAX / 2));
+  EXPECT_ANY_THROW(arena.allocateBytes(SIZE_MAX - 8, 64));
+}
+
+TEST(Arena, Destructors) {
+  int log[8];
+  int logPos = 0;
+
+  {
+    Arena arena(64);
+    arena.allocate<DestructionOrder>(log, &logPos, 1);
+    arena.allocate<DestructionOrder>(log, &logPos, 2);
+    arena.allocateArray<uint64_t>(1000);
+    arena.allocate<DestructionOrder>(log, &logPos, 3);
+    EXPECT_EQ(0, logPos);
+  }
+
+  ASSERT_EQ(3, logPos);
+  EXPECT_EQ(3, log[0]);
+  EXPECT_EQ(2, log[1]);
+  EXPECT_EQ(1, log[2]);
+}
+
+TEST(Arena, ThrowingConstructor) {
+  Throws::constructed = 0;
+  Throws::destroyed = 0;
+
+  {
+    Arena arena;
+    EXPECT_ANY_THROW(arena.allocateArray<Throws>(5));
+    EXPECT_EQ(3, Throws::constructed);
+    EXPECT_EQ(0, Throws::destroyed);
+  }
+
+  // Only the elements that were successfully constructed are destroyed.
+  EXPECT_EQ(3, Throws::destroyed);
+}
+
+TEST(Arena, ThreadLocalChunkCache) {
+  void* first;
+  {
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    first = &arena.allocate<uint64_t>();
+  }
+
+  {
+    // Same thread:  the chunk is reused.
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_EQ(first, &arena.allocate<uint64_t>());
+  }
+
+  std::thread thread([&]() {
+    // Other thread:  the chunk is not visible.
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_NE(first, &arena.allocate<uint64_t>());
+  });
+  thread.join();
+
+  {
+    // An oversized allocation gets a chunk of its own, which is not cached in place of the first.
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_EQ(first, &arena.allocate<uint64_t>());
+    arena.allocateUninitializedArray<uint64_t>(100000);
+  }
+  {
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_EQ(first, &arena.allocate<uint64_t>());
+  }
+
+  {
+    // Nor is a first chunk enlarged to fit an oversized first allocation.
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    arena.allocateUninitializedArray<uint64_t>(100000);
+  }
+  {
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_EQ(first, &arena.allocate<uint64_t>());
+  }
+
+  {
+    // Memory in a reused chunk is not assumed to be zero.
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    arena.allocateUninitializedArray<uint64_t>(8)[0] = 123;
+  }
+  {
+    Arena arena(256, ArenaChunkCache::THREAD_LOCAL);
+    EXPECT_EQ(0u, arena.allocateArray<uint64_t>(8)[0]);
+  }
+}
+
+}  // namespace
+}  // namespace capnproto
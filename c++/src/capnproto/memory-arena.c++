@@ -0,0 +1,168 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "memory-arena.h"
+#include "logging.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <algorithm>
+
+namespace capnproto {
+
+struct Arena::ChunkHeader {
+  ChunkHeader* next;
+  size_t size;
+  // Total size of the chunk, including this header.
+};
+
+namespace {
+
+// Per-thread cache of one idle first chunk, for ArenaChunkCache::THREAD_LOCAL.  We use a pthread
+// key rather than thread_local so that the chunk is freed when its thread exits.
+
+pthread_key_t chunkCacheKey;
+pthread_once_t chunkCacheKeyOnce = PTHREAD_ONCE_INIT;
+
+void initChunkCacheKey() {
+  int error = pthread_key_create(&chunkCacheKey, &free);
+  if (error != 0) {
+    FAIL_SYSCALL("pthread_key_create(&chunkCacheKey, &free)", error);
+  }
+}
+
+pthread_key_t getChunkCacheKey() {
+  pthread_once(&chunkCacheKeyOnce, &initChunkCacheKey);
+  return chunkCacheKey;
+}
+
+}  // namespace
+
+Arena::Arena(size_t firstChunkBytes, ArenaChunkCache chunkCache)
+    : firstChunkBytes(firstChunkBytes), chunkCache(chunkCache), pos(0), end(0),
+      chunks(nullptr), reusableChunk(nullptr), objects(nullptr), totalChunkBytes(0) {}
+
+Arena::~Arena() {
+  // Objects are destroyed before any memory is released, since their destructors may refer to
+  // other objects in the arena.
+  for (ObjectHeader* object = objects; object != nullptr; object = object->next) {
+    object->destroy(object->pointer, object->count);
+  }
+
+  ChunkHeader* chunk = chunks;
+  while (chunk != nullptr) {
+    ChunkHeader* next = chunk->next;
+    if (chunk == reusableChunk) {
+      // Offer the first chunk to the thread's cache.
+      pthread_key_t key = getChunkCacheKey();
+      ChunkHeader* cached = reinterpret_cast<ChunkHeader*>(pthread_getspecific(key));
+      if (cached == nullptr || cached->size < chunk->size) {
+        pthread_setspecific(key, chunk);
+        chunk = cached;
+      }
+    }
+    free(chunk);
+    chunk = next;
+  }
+}
+
+void* Arena::allocateBytesSlow(size_t amount, uint alignment) {
+  DCHECK((alignment & (alignment - 1)) == 0, "alignment must be a power of two", alignment);
+
+  // Room for the header, the allocation, and worst-case alignment padding.
+  PRECOND(amount <= SIZE_MAX - sizeof(ChunkHeader) - (alignment - 1),
+          "Arena allocation is too large.", amount);
+  size_t needed = sizeof(ChunkHeader) + amount + alignment - 1;
+  size_t nextSize = std::max(firstChunkBytes, totalChunkBytes);
+
+  if (needed > nextSize && chunks != nullptr) {
+    // This allocation alone is bigger than a normal chunk.  Give it a chunk of its own and keep
+    // bump-allocating from the current chunk, which likely still has room for smaller things.
+    ChunkHeader* chunk = reinterpret_cast<ChunkHeader*>(malloc(needed));
+    if (chunk == nullptr) {
+      FAIL_SYSCALL("malloc(needed)", ENOMEM, needed);
+    }
+    chunk->size = needed;
+    chunk->next = chunks->next;
+    chunks->next = chunk;
+    totalChunkBytes += needed;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(chunk + 1);
+    return reinterpret_cast<void*>((start + (alignment - 1)) & ~uintptr_t(alignment - 1));
+  }
+
+  size_t size = std::max(needed, nextSize);
+  ChunkHeader* chunk = nullptr;
+
+  if (chunks == nullptr && chunkCache == ArenaChunkCache::THREAD_LOCAL) {
+    pthread_key_t key = getChunkCacheKey();
+    ChunkHeader* cached = reinterpret_cast<ChunkHeader*>(pthread_getspecific(key));
+    if (cached != nullptr && cached->size >= size) {
+      pthread_setspecific(key, nullptr);
+      chunk = cached;
+      size = cached->size;
+      reusableChunk = chunk;
+    }
+  }
+
+  if (chunk == nullptr) {
+    chunk = reinterpret_cast<ChunkHeader*>(malloc(size));
+    if (chunk == nullptr) {
+      FAIL_SYSCALL("malloc(size)", ENOMEM, size);
+    }
+    chunk->size = size;
+
+    if (chunks == nullptr && chunkCache == ArenaChunkCache::THREAD_LOCAL &&
+        size == firstChunkBytes) {
+      // Only a normal-sized first chunk is worth keeping.  One enlarged for an oversized first
+      // allocation would tie up that much memory in the thread for as long as it lives.
+      reusableChunk = chunk;
+    }
+  }
+
+  chunk->next = chunks;
+  chunks = chunk;
+  totalChunkBytes += size;
+
+  pos = reinterpret_cast<uintptr_t>(chunk + 1);
+  end = reinterpret_cast<uintptr_t>(chunk) + size;
+
+  uintptr_t result = (pos + (alignment - 1)) & ~uintptr_t(alignment - 1);
+  pos = result + amount;
+  return reinterpret_cast<void*>(result);
+}
+
+size_t& Arena::addObject(void* pointer, size_t count,
+                          void (*destroy)(void* pointer, size_t count)) {
+  ObjectHeader& header = *reinterpret_cast<ObjectHeader*>(
+      allocateBytes(sizeof(ObjectHeader), alignof(ObjectHeader)));
+  header.destroy = destroy;
+  header.pointer = pointer;
+  header.count = count;
+  header.next = objects;
+  objects = &header;
+  return header.count;
+}
+
+}  // namespace capnproto
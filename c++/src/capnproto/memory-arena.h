@@ -0,0 +1,186 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef CAPNPROTO_MEMORY_ARENA_H_
+#define CAPNPROTO_MEMORY_ARENA_H_
+
+#include <stdint.h>
+#include <type_traits>
+#include "macros.h"
+#include "type-safety.h"
+
+namespace capnproto {
+
+enum class ArenaChunkCache: uint8_t {
+  NONE,
+  // Every chunk is obtained from malloc() and returned to free().
+
+  THREAD_LOCAL
+  // When the arena is destroyed, its first chunk is kept in a per-thread cache, and the next arena
+  // created with this option on the same thread takes its first chunk from there instead of
+  // calling malloc().  This makes short-lived scratch arenas -- e.g. one per request -- nearly
+  // free to create.  Each thread holds on to at most one chunk, released when the thread exits.
+  // A first chunk that had to be enlarged for an oversized first allocation is not kept, so a
+  // thread never holds on to more than a normal first chunk.
+};
+
+class Arena {
+  // A bump-pointer allocator for objects that all live until the arena is destroyed.  Allocation
+  // is a pointer increment in the common case; memory is obtained from the system in chunks which
+  // grow geometrically, and is only released all at once.  Objects with non-trivial destructors
+  // are recorded so that their destructors run (in reverse order of allocation) when the arena
+  // is destroyed.
+  //
+  // This is meant for data structures that accompany a message or a schema and share its
+  // lifetime, e.g. the tables built by SchemaLoader, or application data derived from a message
+  // that would otherwise need many small heap allocations.  An Arena is not thread-safe; callers
+  // allocating from multiple threads must synchronize.
+
+public:
+  explicit Arena(size_t firstChunkBytes = 1024,
+                 ArenaChunkCache chunkCache = ArenaChunkCache::NONE);
+  // Creates an empty arena.  No memory is allocated until the first allocation, which obtains a
+  // chunk of at least `firstChunkBytes`.  Each subsequent chunk is as large as everything
+  // allocated so far, so the number of chunks stays logarithmic in the total size.
+  CAPNPROTO_DISALLOW_COPY(Arena);
+  ~Arena();
+
+  template <typename T, typename... Params>
+  T& allocate(Params&&... params);
+  // Allocates and constructs an object of type T.  With no parameters, the object is
+  // value-initialized, so primitives and PODs come back zeroed.
+
+  template <typename T>
+  ArrayPtr<T> allocateArray(size_t size);
+  // Allocates an array of `size` value-initialized elements (zeroed, for primitives and PODs).
+
+  template <typename T>
+  ArrayPtr<T> allocateUninitializedArray(size_t size);
+  // Like allocateArray() but skips initialization, for when the caller is about to overwrite
+  // every element anyway.  T must be trivially destructible.
+
+  CAPNPROTO_ALWAYS_INLINE(void* allocateBytes(size_t amount, uint alignment));
+  // Allocates `amount` bytes of uninitialized memory aligned to `alignment`, which must be a
+  // power of two.
+
+  size_t getTotalChunkBytes() const { return totalChunkBytes; }
+  // Total size of all chunks obtained from the system so far, including slack.
+
+private:
+  struct ChunkHeader;
+  struct ObjectHeader;
+
+  size_t firstChunkBytes;
+  ArenaChunkCache chunkCache;
+  uintptr_t pos;
+  uintptr_t end;
+  // The unused part of the current chunk.
+
+  ChunkHeader* chunks;
+  // All chunks, most recent first.
+
+  ChunkHeader* reusableChunk;
+  // The first chunk, if it is of normal size and should be offered to the thread's cache.
+
+  ObjectHeader* objects;
+  // Objects that need destroying, most recent first.
+
+  size_t totalChunkBytes;
+
+  void* allocateBytesSlow(size_t amount, uint alignment);
+  size_t& addObject(void* pointer, size_t count, void (*destroy)(void* pointer, size_t count));
+  // Records objects to destroy along with the arena.  Returns a reference to the recorded count.
+
+  template <typename T>
+  static void destroyObjects(void* pointer, size_t count);
+};
+
+// =======================================================================================
+// Inline implementation details
+
+struct Arena::ObjectHeader {
+  void (*destroy)(void* pointer, size_t count);
+  void* pointer;
+  size_t count;
+  ObjectHeader* next;
+};
+
+inline void* Arena::allocateBytes(size_t amount, uint alignment) {
+  uintptr_t result = (pos + (alignment - 1)) & ~uintptr_t(alignment - 1);
+  if (CAPNPROTO_EXPECT_TRUE(result <= end && amount <= end - result)) {
+    pos = result + amount;
+    return reinterpret_cast<void*>(result);
+  }
+  return allocateBytesSlow(amount, alignment);
+}
+
+template <typename T>
+void Arena::destroyObjects(void* pointer, size_t count) {
+  T* objects = reinterpret_cast<T*>(pointer);
+  for (size_t i = count; i > 0; i--) {
+    objects[i - 1].~T();
+  }
+}
+
+template <typename T, typename... Params>
+T& Arena::allocate(Params&&... params) {
+  T* result = reinterpret_cast<T*>(allocateBytes(sizeof(T), alignof(T)));
+  constructAt(result, capnproto::forward<Params>(params)...);
+  if (!std::is_trivially_destructible<T>::value) {
+    // Recorded only once constructed, so a throwing constructor leaves nothing to destroy.
+    addObject(result, 1, &destroyObjects<T>);
+  }
+  return *result;
+}
+
+template <typename T>
+ArrayPtr<T> Arena::allocateArray(size_t size) {
+  CAPNPROTO_INLINE_PRECOND(size <= SIZE_MAX / sizeof(T), "Arena allocation is too large.");
+  T* result = reinterpret_cast<T*>(allocateBytes(sizeof(T) * size, alignof(T)));
+  if (std::is_trivially_destructible<T>::value) {
+    for (size_t i = 0; i < size; i++) {
+      constructAt(result + i);
+    }
+  } else {
+    // Count elements as they are constructed, so that if a constructor throws, exactly the
+    // elements already constructed are destroyed along with the arena.
+    size_t& count = addObject(result, 0, &destroyObjects<T>);
+    for (size_t i = 0; i < size; i++) {
+      constructAt(result + i);
+      ++count;
+    }
+  }
+  return arrayPtr(result, size);
+}
+
+template <typename T>
+ArrayPtr<T> Arena::allocateUninitializedArray(size_t size) {
+  static_assert(std::is_trivially_destructible<T>::value,
+                "allocateUninitializedArray() requires a trivially-destructible type.");
+  CAPNPROTO_INLINE_PRECOND(size <= SIZE_MAX / sizeof(T), "Arena allocation is too large.");
+  return arrayPtr(reinterpret_cast<T*>(allocateBytes(sizeof(T) * size, alignof(T))), size);
+}
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_MEMORY_ARENA_H_
@@ -50,7 +50,7 @@ internal::StructReader MessageReader::getRootInternal() {
   }
 
   internal::SegmentReader* segment = arena()->tryGetSegment(internal::SegmentId(0));
-  VALIDATE_INPUT(segment != nullptr &&
+  VALIDATE_INPUT_OR_RECORD(getErrorRecord(), segment != nullptr &&
       segment->containsInterval(segment->getStartPtr(), segment->getStartPtr() + 1),
       "Message did not contain a root pointer.") {
     return internal::StructReader();
@@ -59,6 +59,15 @@ internal::StructReader MessageReader::getRootInternal() {
   return internal::StructReader::readRoot(segment->getStartPtr(), segment, options.nestingLimit);
 }
 
+ReadCost MessageReader::getReadCost() {
+  if (allocatedArena) {
+    return arena()->getReadCost();
+  } else {
+    // Nothing has been read yet.
+    return ReadCost();
+  }
+}
+
 // -------------------------------------------------------------------
 
 MessageBuilder::MessageBuilder(): allocatedArena(false) {}
@@ -25,6 +25,7 @@
 #include <memory>
 #include "macros.h"
 #include "type-safety.h"
+#include "exception.h"
 #include "layout.h"
 
 #include "list.h"  // TODO(cleanup):  For FromReader.  Move elsewhere?
@@ -76,6 +77,50 @@ struct ReaderOptions {
   // overflow by sending a very-deeply-nested (or even cyclic) message, without the message even
   // being very large.  The default limit of 64 is probably low enough to prevent any chance of
   // stack overflow, yet high enough that it is never a problem in practice.
+
+  uint segmentLimit = 511;
+  // Limits how many segments a message read from a stream may have.  The receiver allocates
+  // bookkeeping for every segment before validating any of them, so an attacker could otherwise
+  // send a tiny message claiming billions of empty segments.  The default of 511 is the limit
+  // readers have always enforced, and far more than any MessageBuilder produces in practice; raise
+  // it if you write messages from a segment array you assembled yourself (see serialize-wide.h
+  // for a framing suited to that).
+
+  bool recordErrors = false;
+  // Normally, invalid data is reported to the thread's ExceptionCallback, which by default throws
+  // an exception.  If this is true, the MessageReader instead remembers the first problem and
+  // carries on exactly as it would if the callback had returned:  accessors of invalid objects
+  // return default values.  Call MessageReader::hasError() once you are done reading to find out
+  // whether anything was wrong.  This avoids the cost of throwing and unwinding on bad input and
+  // keeps the latency of rejecting it predictable.  Errors in the framing of a message read from
+  // a stream, as opposed to in its content, are still reported to the callback.
+};
+
+#ifndef CAPNPROTO_READ_COST_ACCOUNTING
+#define CAPNPROTO_READ_COST_ACCOUNTING 0
+// Set this to 1 when compiling the library to have readers count the far pointers they follow and
+// the depth they reach, as reported by MessageReader::getReadCost().  This puts a compare or an
+// increment on the path of every pointer read, so it is off by default; with it off, the counting
+// code compiles away entirely.  Only the library's own setting matters -- clients may be compiled
+// either way.
+#endif
+
+struct ReadCost {
+  // How much work reading a message has taken so far.  See MessageReader::getReadCost().
+
+  uint64_t wordsTraversed = 0;
+  // Words counted against ReaderOptions::traversalLimitInWords so far.
+
+  uint segmentsTouched = 0;
+  // How many of the message's segments have been looked at, including the first.
+
+  uint farPointersFollowed = 0;
+  // How many far pointers have been followed, counting a double-far as one.  Always zero unless
+  // the library was compiled with CAPNPROTO_READ_COST_ACCOUNTING.
+
+  uint nestingDepth = 0;
+  // The deepest nesting level read, where the root struct is at depth 1.  Always zero unless the
+  // library was compiled with CAPNPROTO_READ_COST_ACCOUNTING.
 };
 
 class MessageReader {
@@ -106,8 +151,28 @@ public:
   // RootType in this case must be DynamicStruct, and you must #include <capnproto/dynamic.h> to
   // use this.
 
+  inline bool hasError() const { return error != nullptr; }
+  // With ReaderOptions::recordErrors, returns whether any part of the message read so far was
+  // invalid.  Always false otherwise.
+
+  inline Maybe<const Exception&> getError() const { return error; }
+  // With ReaderOptions::recordErrors, describes the first problem found in the message, if any.
+
+  ReadCost getReadCost();
+  // Reports how much reading this message has cost so far, e.g. to let a server throttle clients
+  // whose messages are expensive to process.  Like the traversal limit, this counts what the
+  // application actually reads, not what the message contains.
+
+protected:
+  inline Maybe<Exception>* getErrorRecord() {
+    return options.recordErrors ? &error : nullptr;
+  }
+  // For use with VALIDATE_INPUT_OR_RECORD():  Where to record invalid input, or null if it should
+  // be reported normally.
+
 private:
   ReaderOptions options;
+  Maybe<Exception> error;
 
   // Space in which we can construct a ReaderArena.  We don't use ReaderArena directly here
   // because we don't want clients to have to #include arena.h, which itself includes a bunch of
@@ -118,6 +183,8 @@ private:
 
   internal::ReaderArena* arena() { return reinterpret_cast<internal::ReaderArena*>(arenaSpace); }
   internal::StructReader getRootInternal();
+
+  friend class internal::ReaderArena;
 };
 
 class MessageBuilder {
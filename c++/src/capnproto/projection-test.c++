@@ -0,0 +1,177 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "projection.h"
+#include "message.h"
+#include "serialize.h"
+#include <gtest/gtest.h>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+TEST(Projection, TopLevelFields) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  FieldMask mask(Schema::from<TestAllTypes>(), {"int32Field", "textField", "structField"});
+
+  MallocMessageBuilder output;
+  mask.project(toDynamic(root.asReader()),
+               output.initRoot<DynamicStruct>(Schema::from<TestAllTypes>()));
+
+  auto result = output.getRoot<TestAllTypes>().asReader();
+  EXPECT_EQ(-12345678, result.getInt32Field());
+  EXPECT_EQ("foo", result.getTextField());
+  EXPECT_EQ(0, result.getInt8Field());
+  EXPECT_FALSE(result.getBoolField());
+  EXPECT_FALSE(result.hasDataField());
+  EXPECT_FALSE(result.hasStructList());
+
+  // The whole struct was copied, including its own pointers.
+  EXPECT_EQ(-78901234, result.getStructField().getInt32Field());
+  EXPECT_EQ("baz", result.getStructField().getTextField());
+  EXPECT_EQ("nested", result.getStructField().getStructField().getTextField());
+}
+
+TEST(Projection, NestedFields) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  FieldMask mask(Schema::from<TestAllTypes>(),
+                 {"structField.textField", "structField.structField.textField",
+                  "structList.textField"});
+
+  MallocMessageBuilder output;
+  mask.project(toDynamic(root.asReader()),
+               output.initRoot<DynamicStruct>(Schema::from<TestAllTypes>()));
+
+  auto result = output.getRoot<TestAllTypes>().asReader();
+  EXPECT_EQ(0, result.getInt32Field());
+  EXPECT_FALSE(result.hasTextField());
+
+  auto sub = result.getStructField();
+  EXPECT_EQ("baz", sub.getTextField());
+  EXPECT_EQ(0, sub.getInt32Field());
+  EXPECT_FALSE(sub.hasStructList());
+  EXPECT_EQ("nested", sub.getStructField().getTextField());
+  EXPECT_FALSE(sub.getStructField().hasStructField());
+
+  auto list = result.getStructList();
+  ASSERT_EQ(3u, list.size());
+  EXPECT_EQ("structlist 1", list[0].getTextField());
+  EXPECT_EQ("structlist 2", list[1].getTextField());
+  EXPECT_EQ("structlist 3", list[2].getTextField());
+}
+
+TEST(Projection, WholeMemberWins) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  FieldMask mask(Schema::from<TestAllTypes>(), {"structField.textField", "structField"});
+
+  MallocMessageBuilder output;
+  mask.project(toDynamic(root.asReader()),
+               output.initRoot<DynamicStruct>(Schema::from<TestAllTypes>()));
+
+  auto sub = output.getRoot<TestAllTypes>().asReader().getStructField();
+  EXPECT_EQ("baz", sub.getTextField());
+  EXPECT_EQ(-78901234, sub.getInt32Field());
+}
+
+TEST(Projection, Unions) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnion>();
+  root.getUnion0().setU0f0sp("foo");
+  root.getUnion1().setU1f0s16(123);
+  root.getUnion2().setU2f0s64(456);
+
+  FieldMask mask(Schema::from<TestUnion>(),
+                 {"union0.u0f0sp", "union1.u1f0s32", "union2"});
+
+  MallocMessageBuilder output;
+  mask.project(toDynamic(root.asReader()),
+               output.initRoot<DynamicStruct>(Schema::from<TestUnion>()));
+
+  auto result = output.getRoot<TestUnion>().asReader();
+  ASSERT_EQ(TestUnion::Union0::U0F0SP, result.getUnion0().which());
+  EXPECT_EQ("foo", result.getUnion0().getU0f0sp());
+
+  // union1 holds a member that wasn't selected.
+  EXPECT_EQ(TestUnion::Union1::U1F0S0, result.getUnion1().which());
+
+  ASSERT_EQ(TestUnion::Union2::U2F0S64, result.getUnion2().which());
+  EXPECT_EQ(456, result.getUnion2().getU2f0s64());
+}
+
+TEST(Projection, SkippedDataIsNotTraversed) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setInt32Field(123);
+  root.initStructField().setTextField("foo");
+  root.initDataField(8 * 1024 * 1024);
+
+  Array<word> words = messageToFlatArray(builder);
+  ReaderOptions options;
+  options.traversalLimitInWords = 1024;
+
+  {
+    FlatArrayMessageReader reader(words.asPtr(), options);
+    FieldMask mask(Schema::from<TestAllTypes>(), {"int32Field", "structField.textField"});
+
+    MallocMessageBuilder output;
+    mask.project(reader.getRoot<DynamicStruct>(Schema::from<TestAllTypes>()),
+                 output.initRoot<DynamicStruct>(Schema::from<TestAllTypes>()));
+
+    auto result = output.getRoot<TestAllTypes>().asReader();
+    EXPECT_EQ(123, result.getInt32Field());
+    EXPECT_EQ("foo", result.getStructField().getTextField());
+    EXPECT_FALSE(result.hasDataField());
+  }
+
+  {
+    FlatArrayMessageReader reader(words.asPtr(), options);
+    FieldMask mask(Schema::from<TestAllTypes>(), {"int32Field", "dataField"});
+
+    MallocMessageBuilder output;
+    EXPECT_ANY_THROW(mask.project(reader.getRoot<DynamicStruct>(Schema::from<TestAllTypes>()),
+                                  output.initRoot<DynamicStruct>(Schema::from<TestAllTypes>())));
+  }
+}
+
+TEST(Projection, BadPaths) {
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestAllTypes>(), {"noSuchField"}));
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestAllTypes>(), {"structField.noSuchField"}));
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestAllTypes>(), {"int32Field.foo"}));
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestAllTypes>(), {"int32List.foo"}));
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestAllTypes>(), {"structField."}));
+  EXPECT_ANY_THROW(FieldMask(Schema::from<TestUnion>(), {"union0.u1f0s8"}));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
@@ -0,0 +1,208 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "projection.h"
+#include "logging.h"
+#include <string.h>
+
+namespace capnproto {
+
+struct FieldMask::Node {
+  // The selected members of one struct or union.
+
+  Selection* first = nullptr;
+  // Linked list, in the order the members were first named.
+};
+
+struct FieldMask::Selection {
+  StructSchema::Member member;
+
+  bool whole = false;
+  // The member and everything it points to is selected.
+
+  Node children;
+  // If not `whole`, the selected members of the struct (or of each struct in the list, or of the
+  // union) that `member` refers to.
+
+  Selection* next = nullptr;
+
+  inline explicit Selection(StructSchema::Member member): member(member) {}
+};
+
+FieldMask::FieldMask(StructSchema schema, ArrayPtr<const Text::Reader> paths)
+    : schema(schema), root(&arena.allocate<Node>()) {
+  for (auto& path: paths) {
+    addPath(path);
+  }
+}
+
+FieldMask::FieldMask(StructSchema schema, std::initializer_list<Text::Reader> paths)
+    : FieldMask(schema, arrayPtr(paths.begin(), paths.size())) {}
+
+FieldMask::~FieldMask() {}
+
+void FieldMask::addPath(Text::Reader path) {
+  Node* node = root;
+  StructSchema structScope = schema;
+  StructSchema::Union unionScope;
+  bool inUnion = false;
+
+  // Copy the path so that each name can be NUL-terminated in place.
+  Array<char> buffer = newArray<char>(path.size() + 1);
+  memcpy(buffer.begin(), path.data(), path.size() + 1);
+
+  char* pos = buffer.begin();
+  char* end = pos + path.size();
+  for (;;) {
+    char* dot = reinterpret_cast<char*>(memchr(pos, '.', end - pos));
+    if (dot == nullptr) dot = end;
+    *dot = '\0';
+
+    Text::Reader name(pos, dot - pos);
+    Maybe<StructSchema::Member> found = inUnion ? unionScope.findMemberByName(name)
+                                                : structScope.findMemberByName(name);
+    PRECOND(found != nullptr, "Field mask path names no such member.", path, name);
+    StructSchema::Member member = *found;
+
+    Selection** link = &node->first;
+    while (*link != nullptr && (*link)->member != member) {
+      link = &(*link)->next;
+    }
+    if (*link == nullptr) {
+      *link = &arena.allocate<Selection>(member);
+    }
+    Selection* selection = *link;
+
+    if (selection->whole) {
+      // A shorter path already selected all of this member.
+      return;
+    }
+    if (dot == end) {
+      selection->whole = true;
+      selection->children.first = nullptr;
+      return;
+    }
+
+    // Descend into the member.
+    auto body = member.getProto().getBody();
+    if (body.which() == schema::StructNode::Member::Body::UNION_MEMBER) {
+      unionScope = member.asUnion();
+      inUnion = true;
+    } else {
+      auto type = body.getFieldMember().getType();
+      switch (type.getBody().which()) {
+        case schema::Type::Body::STRUCT_TYPE:
+          structScope = structScope.getDependency(type.getBody().getStructType()).asStruct();
+          break;
+
+        case schema::Type::Body::LIST_TYPE: {
+          ListSchema listSchema = ListSchema::of(type.getBody().getListType(), structScope);
+          PRECOND(listSchema.whichElementType() == schema::Type::Body::STRUCT_TYPE,
+                  "Field mask path continues past a list whose elements are not structs.", path);
+          structScope = listSchema.getStructElementType();
+          break;
+        }
+
+        default:
+          FAIL_PRECOND("Field mask path continues past a field that has no members.", path);
+          return;
+      }
+      inUnion = false;
+    }
+
+    node = &selection->children;
+    pos = dot + 1;
+  }
+}
+
+void FieldMask::project(DynamicStruct::Reader from, DynamicStruct::Builder to) const {
+  PRECOND(from.getSchema() == schema && to.getSchema() == schema,
+          "Struct is not of the field mask's type.");
+  projectStruct(*root, from, to);
+}
+
+void FieldMask::projectStruct(const Node& node, DynamicStruct::Reader from,
+                              DynamicStruct::Builder to) const {
+  for (const Selection* selection = node.first; selection != nullptr;
+       selection = selection->next) {
+    // has() checks pointers for null without following them.  There's nothing to project out of
+    // a null struct or list, nor out of a union still at its default.
+    if (!selection->whole && !from.has(selection->member)) continue;
+
+    DynamicValue::Reader value = from.get(selection->member);
+    if (selection->whole || value.getType() != DynamicValue::UNION) {
+      projectMember(*selection, value, to);
+      continue;
+    }
+
+    auto fromUnion = value.as<DynamicUnion>();
+    Maybe<StructSchema::Member> which = fromUnion.which();
+    if (which == nullptr) {
+      // The union holds a member from a newer version of the schema, so it can't have been
+      // selected.
+      continue;
+    }
+    for (const Selection* child = selection->children.first; child != nullptr;
+         child = child->next) {
+      if (child->member == *which) {
+        DynamicUnion::Builder toUnion = to.get(selection->member).as<DynamicUnion>();
+        projectMember(*child, fromUnion.get(), toUnion);
+        break;
+      }
+    }
+  }
+}
+
+template <typename Builder>
+void FieldMask::projectMember(const Selection& selection, DynamicValue::Reader value,
+                              Builder& to) const {
+  if (selection.whole) {
+    to.set(selection.member, value);
+    return;
+  }
+
+  switch (value.getType()) {
+    case DynamicValue::STRUCT:
+      projectStruct(selection.children, value.as<DynamicStruct>(),
+                    to.init(selection.member).template as<DynamicStruct>());
+      return;
+
+    case DynamicValue::LIST: {
+      DynamicList::Reader fromList = value.as<DynamicList>();
+      DynamicList::Builder toList =
+          to.init(selection.member, fromList.size()).template as<DynamicList>();
+      for (uint i = 0; i < fromList.size(); i++) {
+        projectStruct(selection.children, fromList[i].as<DynamicStruct>(),
+                      toList[i].as<DynamicStruct>());
+      }
+      return;
+    }
+
+    default:
+      FAIL_CHECK("Selected fields inside a value that has no fields.", value.getType());
+      return;
+  }
+}
+
+}  // namespace capnproto
@@ -0,0 +1,88 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Copying selected fields out of a message, for consumers that only need a few fields of large
+// structs.
+
+#ifndef CAPNPROTO_PROJECTION_H_
+#define CAPNPROTO_PROJECTION_H_
+
+#include "dynamic.h"
+#include "memory-arena.h"
+#include <initializer_list>
+
+namespace capnproto {
+
+class FieldMask {
+  // A set of fields of a struct type, possibly reaching into nested structs, along which a message
+  // can be projected:  project() copies the selected fields into a new message and leaves
+  // everything else unset.
+  //
+  // Fields are named by dotted paths relative to the struct, e.g. "id" or "author.name".  A path
+  // may pass through a struct field, a list-of-structs field (selecting from every element), or a
+  // union (naming one of its members, e.g. "body.text").  Naming a field or union without going
+  // further selects all of it, including everything it points to.
+  //
+  // Projection only follows the pointers of selected fields; unselected subtrees are never
+  // dereferenced.  Since a message's traversal limit (see ReaderOptions) is charged as pointers
+  // are followed, projecting a message costs only as much of the limit as the selected data, no
+  // matter how large the rest of the message is.
+
+public:
+  FieldMask(StructSchema schema, ArrayPtr<const Text::Reader> paths);
+  FieldMask(StructSchema schema, std::initializer_list<Text::Reader> paths);
+  // Throws an exception if a path does not name a member, or tries to continue past a field that
+  // is not a struct, list of structs, or union.
+
+  CAPNPROTO_DISALLOW_COPY(FieldMask);
+  ~FieldMask();
+
+  inline StructSchema getSchema() const { return schema; }
+
+  void project(DynamicStruct::Reader from, DynamicStruct::Builder to) const;
+  // Copies the selected fields of `from` into `to`.  Both must be of type getSchema(); `to` is
+  // normally freshly initialized, e.g. with MessageBuilder::initRoot<DynamicStruct>().
+  //
+  // A union is only copied if it holds one of its selected members; otherwise it is left as-is
+  // in `to`.  A struct-typed field whose pointer is null is left null even if fields inside it
+  // are selected.
+
+private:
+  struct Selection;
+  struct Node;
+
+  StructSchema schema;
+  Arena arena;
+  Node* root;
+
+  void addPath(Text::Reader path);
+  void projectStruct(const Node& node, DynamicStruct::Reader from,
+                     DynamicStruct::Builder to) const;
+  template <typename Builder>
+  void projectMember(const Selection& selection, DynamicValue::Reader value,
+                     Builder& to) const;
+};
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_PROJECTION_H_
@@ -26,6 +26,14 @@
 #include <gtest/gtest.h>
 #include "test-util.h"
 #include "logging.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <map>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 namespace capnproto {
 namespace internal {
@@ -58,6 +66,37 @@ TEST(SchemaLoader, Load) {
   EXPECT_EQ(0u, struct16Schema.getProto().getBody().getStructNode().getMembers().size());
 }
 
+TEST(SchemaLoader, LookupByName) {
+  // Name lookups go through hash tables built by the loader; they must agree with the compiled-in
+  // tables for every member.
+  SchemaLoader loader;
+
+  auto native = Schema::from<TestAllTypes>();
+  StructSchema schema = loader.load(native.getProto()).asStruct();
+
+  for (auto member: native.getMembers()) {
+    auto name = member.getProto().getName();
+    auto found = schema.findMemberByName(name);
+    ASSERT_TRUE(found != nullptr) << name.c_str();
+    EXPECT_EQ(member.getIndex(), found->getIndex());
+    EXPECT_EQ(member.getIndex(), native.getMemberByName(name).getIndex());
+  }
+  EXPECT_TRUE(schema.findMemberByName("noSuchField") == nullptr);
+
+  auto nativeUnion = Schema::from<TestUnion>();
+  StructSchema unionSchema = loader.load(nativeUnion.getProto()).asStruct();
+  auto u0 = unionSchema.getMemberByName("union0").asUnion();
+  for (auto member: nativeUnion.getMemberByName("union0").asUnion().getMembers()) {
+    auto name = member.getProto().getName();
+    auto found = u0.findMemberByName(name);
+    ASSERT_TRUE(found != nullptr) << name.c_str();
+    EXPECT_EQ(member.getIndex(), found->getIndex());
+  }
+  // Union members are not visible at the top level, and vice versa.
+  EXPECT_TRUE(unionSchema.findMemberByName("u0f0s0") == nullptr);
+  EXPECT_TRUE(u0.findMemberByName("union1") == nullptr);
+}
+
 TEST(SchemaLoader, Use) {
   SchemaLoader loader;
 
@@ -134,6 +173,57 @@ TEST(SchemaLoader, Use) {
   }
 }
 
+TEST(SchemaLoader, UseDefaults) {
+  // Loaded schemas are accessed through the loader's precomputed member plans rather than by
+  // decoding the schema node, so check that the plans carry defaults correctly.
+  SchemaLoader loader;
+  loader.loadCompiledTypeAndDependencies<TestDefaults>();
+  StructSchema schema = loader.get(typeId<TestDefaults>()).asStruct();
+  EXPECT_TRUE(schema != Schema::from<TestDefaults>());
+
+  {
+    AlignedData<1> nullRoot = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    ArrayPtr<const word> segments[1] = {arrayPtr(nullRoot.words, 1)};
+    SegmentArrayMessageReader reader(arrayPtr(segments, 1));
+    checkDynamicTestMessage(reader.getRoot<DynamicStruct>(schema));
+  }
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<DynamicStruct>(schema);
+
+    checkDynamicTestMessage(root.asReader());
+    checkDynamicTestMessage(root);
+    checkTestMessage(root.asReader().as<TestDefaults>());
+  }
+}
+
+TEST(SchemaLoader, UseUnions) {
+  SchemaLoader loader;
+  loader.loadCompiledTypeAndDependencies<TestUnion>();
+  StructSchema schema = loader.get(typeId<TestUnion>()).asStruct();
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<DynamicStruct>(schema);
+
+  EXPECT_FALSE(root.has("union0"));
+  root.get("union0").as<DynamicUnion>().set("u0f1s32", 1234567);
+  root.get("union3").as<DynamicUnion>().set("u3f0s64", 1234567890123456789ll);
+  EXPECT_TRUE(root.has("union0"));
+  EXPECT_FALSE(root.has("union1"));
+
+  auto reader = root.asReader().as<TestUnion>();
+  ASSERT_EQ(TestUnion::Union0::U0F1S32, reader.getUnion0().which());
+  EXPECT_EQ(1234567, reader.getUnion0().getU0f1s32());
+  ASSERT_EQ(TestUnion::Union3::U3F0S64, reader.getUnion3().which());
+  EXPECT_EQ(1234567890123456789ll, reader.getUnion3().getU3f0s64());
+
+  auto u = root.asReader().get("union3").as<DynamicUnion>();
+  ASSERT_TRUE(u.which() != nullptr);
+  EXPECT_EQ("u3f0s64", u.which()->getProto().getName());
+  EXPECT_EQ(1234567890123456789ll, u.get().as<int64_t>());
+}
+
 template <typename T>
 Schema loadUnderAlternateTypeId(SchemaLoader& loader, uint64_t id) {
   MallocMessageBuilder schemaBuilder;
@@ -196,6 +286,23 @@ TEST(SchemaLoader, Downgrade) {
   schema.requireUsableAs<test::TestNewVersion>();
 }
 
+TEST(SchemaLoader, UpgradeListToStruct) {
+  SchemaLoader loader;
+  loader.loadCompiledTypeAndDependencies<test::TestOldVersion>();
+
+  MallocMessageBuilder builder;
+  builder.setRoot(Schema::from<TestAllTypes>().getProto());
+  auto node = builder.getRoot<schema::Node>();
+  node.setId(0x8000000000001234ull);
+  loader.load(node);
+
+  // List(Int64) may become a list of a struct whose first field is an Int64.
+  uint index = Schema::from<TestAllTypes>().getMemberByName("int64List").getIndex();
+  node.getBody().getStructNode().getMembers()[index].getBody().getFieldMember().getType()
+      .getBody().getListType().getBody().setStructType(typeId<test::TestOldVersion>());
+  EXPECT_NO_THROW(loader.load(node));
+}
+
 TEST(SchemaLoader, Incompatible) {
   SchemaLoader loader;
   loader.loadCompiledTypeAndDependencies<test::TestListDefaults>();
@@ -203,6 +310,52 @@ TEST(SchemaLoader, Incompatible) {
       loadUnderAlternateTypeId<test::TestAllTypes>(loader, typeId<test::TestListDefaults>()));
 }
 
+TEST(SchemaLoader, RepeatedLoads) {
+  SchemaLoader loader;
+
+  MallocMessageBuilder newBuilder;
+  newBuilder.setRoot(Schema::from<test::TestNewVersion>().getProto());
+  auto newNode = newBuilder.getRoot<schema::Node>().asReader();
+
+  Schema schema = loader.load(newNode);
+  EXPECT_TRUE(loader.load(newNode) == schema);
+  EXPECT_TRUE(loader.load(newNode) == schema);
+  EXPECT_EQ(1u, loader.getAllLoaded().size());
+
+  // Repeatedly loading an older version keeps the newer one.
+  for (uint i = 0; i < 3; i++) {
+    loadUnderAlternateTypeId<test::TestOldVersion>(loader, typeId<test::TestNewVersion>());
+    EXPECT_STREQ(Schema::from<test::TestNewVersion>().getProto().getDisplayName(),
+                 schema.getProto().getDisplayName());
+  }
+
+  // An incompatible version is reported every time, not just the first.
+  for (uint i = 0; i < 3; i++) {
+    EXPECT_ANY_THROW(
+        loadUnderAlternateTypeId<TestAllTypes>(loader, typeId<test::TestNewVersion>()));
+  }
+}
+
+TEST(SchemaLoader, RepeatedLoadAfterUpgrade) {
+  SchemaLoader loader;
+
+  MallocMessageBuilder oldBuilder;
+  oldBuilder.setRoot(Schema::from<test::TestOldVersion>().getProto());
+  auto oldNode = oldBuilder.getRoot<schema::Node>().asReader();
+
+  Schema schema = loader.load(oldNode);
+  loader.load(oldNode);
+  loadUnderAlternateTypeId<test::TestNewVersion>(loader, typeId<test::TestOldVersion>());
+  EXPECT_STREQ(Schema::from<test::TestNewVersion>().getProto().getDisplayName(),
+               schema.getProto().getDisplayName());
+
+  // The old version was loaded before, but against a version that has since been replaced, so it
+  // must be compared again -- and loses.
+  loader.load(oldNode);
+  EXPECT_STREQ(Schema::from<test::TestNewVersion>().getProto().getDisplayName(),
+               schema.getProto().getDisplayName());
+}
+
 TEST(SchemaLoader, Enumerate) {
   SchemaLoader loader;
   loader.loadCompiledTypeAndDependencies<TestAllTypes>();
@@ -217,6 +370,485 @@ TEST(SchemaLoader, Enumerate) {
   }
 }
 
+TEST(SchemaLoader, Concurrent) {
+  // Several threads load an interdependent set of nodes, in different orders, while others look
+  // them up.  Dependencies get loaded as empty placeholders first and are upgraded in place later,
+  // so readers also race with upgrades.
+
+  SchemaLoader source;
+  source.loadCompiledTypeAndDependencies<TestAllTypes>();
+  source.loadCompiledTypeAndDependencies<TestDefaults>();
+  source.loadCompiledTypeAndDependencies<TestUnion>();
+  source.loadCompiledTypeAndDependencies<test::TestLists>();
+  auto nodes = source.getAllLoaded();
+  ASSERT_GT(nodes.size(), 4u);
+
+  SchemaLoader loader;
+  std::atomic<bool> done(false);
+  std::atomic<uint> failures(0);
+
+  auto read = [&]() {
+    while (!done.load(std::memory_order_acquire)) {
+      for (auto node: nodes) {
+        uint64_t id = node.getProto().getId();
+        Maybe<Schema> schema = loader.tryGet(id);
+        if (schema == nullptr) continue;
+        if (schema->getProto().getId() != id) ++failures;
+        if (schema->getProto().getBody().which() != schema::Node::Body::STRUCT_NODE) continue;
+
+        // Whatever version of the struct we see, its own members and field types must resolve.
+        StructSchema structSchema = schema->asStruct();
+        for (auto member: structSchema.getMembers()) {
+          auto found = structSchema.findMemberByName(member.getProto().getName());
+          if (found == nullptr || found->getIndex() != member.getIndex()) ++failures;
+
+          auto body = member.getProto().getBody();
+          if (body.which() != schema::StructNode::Member::Body::FIELD_MEMBER) continue;
+          auto type = body.getFieldMember().getType().getBody();
+          if (type.which() == schema::Type::Body::STRUCT_TYPE) {
+            if (structSchema.getDependency(type.getStructType()).getProto().getId() !=
+                type.getStructType()) {
+              ++failures;
+            }
+          }
+        }
+      }
+    }
+  };
+
+  auto write = [&](uint offset) {
+    for (uint i = 0; i < nodes.size(); i++) {
+      loader.load(nodes[(i + offset * 5) % nodes.size()].getProto());
+    }
+  };
+
+  std::vector<std::thread> readers;
+  for (uint i = 0; i < 4; i++) {
+    readers.emplace_back(read);
+  }
+
+  std::vector<std::thread> writers;
+  for (uint i = 0; i < 4; i++) {
+    writers.emplace_back(write, i);
+  }
+  for (auto& writer: writers) {
+    writer.join();
+  }
+
+  done.store(true, std::memory_order_release);
+  for (auto& reader: readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(0u, failures.load());
+
+  EXPECT_EQ(nodes.size(), loader.getAllLoaded().size());
+  for (auto node: nodes) {
+    EXPECT_STREQ(node.getProto().debugString().cStr(),
+                 loader.get(node.getProto().getId()).getProto().debugString().cStr());
+  }
+}
+
+void buildGrowingStruct(schema::Node::Builder node, uint fieldCount) {
+  // A struct with `fieldCount` pointer fields, each of a different (unknown) struct type.  Each
+  // added field's name and type ID sort before all earlier ones, so an upgrade shifts every
+  // existing entry in the name and dependency arrays.
+  node.setId(0x8000000000004321ull);
+  node.setDisplayName("GrowingStruct");
+  auto structNode = node.getBody().initStructNode();
+  structNode.setPointerSectionSize(fieldCount);
+  structNode.setPreferredListEncoding(schema::ElementSize::INLINE_COMPOSITE);
+  auto members = structNode.initMembers(fieldCount);
+  for (uint i = 0; i < fieldCount; i++) {
+    members[i].setName(str("field", 900 - i, '\0').begin());
+    members[i].setOrdinal(i);
+    members[i].setCodeOrder(i);
+    auto field = members[i].getBody().initFieldMember();
+    field.setOffset(i);
+    field.getType().getBody().setStructType(0x8000000000005000ull - i);
+    field.getDefaultValue().getBody().setStructValueNull();
+  }
+}
+
+TEST(SchemaLoader, ConcurrentUpgradeShiftsIndexes) {
+  // Readers must never pair a lookup table from one version with the array it indexes from
+  // another, even though upgrades move every existing entry.
+
+  static const uint VERSION_COUNT = 64;
+  uint64_t id = 0x8000000000004321ull;
+
+  SchemaLoader loader;
+  {
+    MallocMessageBuilder builder;
+    buildGrowingStruct(builder.initRoot<schema::Node>(), 1);
+    loader.load(builder.getRoot<schema::Node>());
+  }
+
+  std::atomic<bool> done(false);
+  std::atomic<uint> failures(0);
+
+  auto read = [&]() {
+    while (!done.load(std::memory_order_acquire)) {
+      StructSchema schema = loader.get(id).asStruct();
+      for (auto member: schema.getMembers()) {
+        try {
+          auto found = schema.findMemberByName(member.getProto().getName());
+          if (found == nullptr || found->getIndex() != member.getIndex()) ++failures;
+
+          uint64_t typeId = member.getProto().getBody().getFieldMember()
+              .getType().getBody().getStructType();
+          if (schema.getDependency(typeId).getProto().getId() != typeId) ++failures;
+        } catch (...) {
+          ++failures;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> readers;
+  for (uint i = 0; i < 4; i++) {
+    readers.emplace_back(read);
+  }
+
+  for (uint i = 2; i <= VERSION_COUNT; i++) {
+    MallocMessageBuilder builder;
+    buildGrowingStruct(builder.initRoot<schema::Node>(), i);
+    loader.load(builder.getRoot<schema::Node>());
+  }
+
+  done.store(true, std::memory_order_release);
+  for (auto& reader: readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(0u, failures.load());
+  EXPECT_EQ(VERSION_COUNT, loader.get(id).asStruct().getMembers().size());
+}
+
+TEST(SchemaLoader, Cache) {
+  Array<word> cache;
+  size_t originalCount;
+
+  {
+    SchemaLoader loader;
+    loader.loadCompiledTypeAndDependencies<TestAllTypes>();
+    loader.loadCompiledTypeAndDependencies<TestDefaults>();
+    loader.loadCompiledTypeAndDependencies<TestUnion>();
+    // TestListDefaults' dependencies are never loaded, so their placeholders get cached.
+    loader.load(Schema::from<TestListDefaults>().getProto());
+    originalCount = loader.getAllLoaded().size();
+    cache = loader.saveCache();
+  }
+
+  SchemaLoader loader;
+  loader.loadCache(cache);
+
+  EXPECT_EQ(originalCount, loader.getAllLoaded().size());
+
+  StructSchema schema = loader.get(typeId<TestAllTypes>()).asStruct();
+  EXPECT_STREQ(Schema::from<TestAllTypes>().getProto().debugString().cStr(),
+               schema.getProto().debugString().cStr());
+  EXPECT_TRUE(schema.getDependency(typeId<TestEnum>()) == loader.get(typeId<TestEnum>()));
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.getRoot<DynamicStruct>(schema);
+    initDynamicTestMessage(root);
+    checkDynamicTestMessage(root.asReader());
+    checkTestMessage(builder.getRoot<TestAllTypes>());
+  }
+
+  {
+    AlignedData<1> nullRoot = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    ArrayPtr<const word> segments[1] = {arrayPtr(nullRoot.words, 1)};
+    SegmentArrayMessageReader reader(arrayPtr(segments, 1));
+    checkDynamicTestMessage(
+        reader.getRoot<DynamicStruct>(loader.get(typeId<TestDefaults>()).asStruct()));
+  }
+
+  // Compiled-in types can still be registered afterwards.
+  loader.loadCompiledTypeAndDependencies<TestAllTypes>();
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.getRoot<DynamicStruct>(schema);
+    initDynamicTestMessage(root);
+    checkTestMessage(root.as<TestAllTypes>());
+  }
+}
+
+TEST(SchemaLoader, CacheFile) {
+  SchemaLoader original;
+  original.loadCompiledTypeAndDependencies<TestAllTypes>();
+  Array<word> cache = original.saveCache();
+
+  char filename[] = "/tmp/capnproto-schema-cache-test.XXXXXX";
+  int fd = mkstemp(filename);
+  ASSERT_GE(fd, 0);
+  unlink(filename);
+  ASSERT_EQ(ssize_t(cache.size() * sizeof(word)),
+            write(fd, cache.begin(), cache.size() * sizeof(word)));
+
+  void* mapping = mmap(nullptr, cache.size() * sizeof(word), PROT_READ, MAP_PRIVATE, fd, 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  close(fd);
+
+  {
+    SchemaLoader loader;
+    loader.loadCache(arrayPtr(reinterpret_cast<const word*>(mapping), cache.size()));
+
+    MallocMessageBuilder builder;
+    auto root = builder.getRoot<DynamicStruct>(loader.get(typeId<TestAllTypes>()).asStruct());
+    initDynamicTestMessage(root);
+    checkDynamicTestMessage(root.asReader());
+  }
+
+  munmap(mapping, cache.size() * sizeof(word));
+}
+
+TEST(SchemaLoader, CacheCorrupted) {
+  SchemaLoader original;
+  original.loadCompiledTypeAndDependencies<TestAllTypes>();
+  Array<word> cache = original.saveCache();
+
+  {
+    SchemaLoader loader;
+    EXPECT_ANY_THROW(loader.loadCache(cache.slice(0, cache.size() - 1)));
+    EXPECT_EQ(0u, loader.getAllLoaded().size());
+  }
+
+  reinterpret_cast<uint8_t*>(cache.end())[-3] ^= 1;
+
+  {
+    SchemaLoader loader;
+    EXPECT_ANY_THROW(loader.loadCache(cache));
+    EXPECT_EQ(0u, loader.getAllLoaded().size());
+
+    // The loader is still usable.
+    loader.loadCompiledTypeAndDependencies<TestAllTypes>();
+    EXPECT_EQ(2u, loader.getAllLoaded().size());
+  }
+}
+
+Array<word> tamperWithCache(ArrayPtr<const word> cache, size_t byteOffset,
+                            const void* value, size_t size) {
+  // Returns a copy of `cache` with `size` bytes at `byteOffset` replaced and the checksum fixed
+  // up to match, mimicking a deliberately crafted cache.  The header layout mirrors CacheHeader
+  // in schema-loader.c++:  four words, with the checksum (FNV-1a over each following word) last.
+  Array<word> result = newArray<word>(cache.size());
+  memcpy(static_cast<void*>(result.begin()), cache.begin(), cache.size() * sizeof(word));
+  memcpy(reinterpret_cast<char*>(result.begin()) + byteOffset, value, size);
+
+  uint64_t checksum = 14695981039346656037ull;
+  for (size_t i = 4; i < result.size(); i++) {
+    uint64_t w;
+    memcpy(&w, &result[i], sizeof(w));
+    checksum = (checksum ^ w) * 1099511628211ull;
+  }
+  memcpy(reinterpret_cast<char*>(result.begin()) + 24, &checksum, sizeof(checksum));
+  return result;
+}
+
+TEST(SchemaLoader, CacheTampered) {
+  // The checksum only catches accidents.  Entries which are inconsistent on purpose must be
+  // rejected too, before the loader is changed.
+  SchemaLoader original;
+  original.loadCompiledTypeAndDependencies<TestAllTypes>();
+  Array<word> cache = original.saveCache();
+
+  // Entries follow the header and mirror CacheEntry in schema-loader.c++:  the ID, then the
+  // dependency and member counts, then the node, dependency ID, dependency table, members-by-name,
+  // and member table offsets, all 32-bit.
+  const size_t ENTRY0 = 32;
+  const size_t ENTRY1 = ENTRY0 + 40;
+
+  uint64_t id0;
+  uint32_t tableOffset;
+  memcpy(&id0, reinterpret_cast<const char*>(cache.begin()) + ENTRY0, sizeof(id0));
+  memcpy(&tableOffset, reinterpret_cast<const char*>(cache.begin()) + ENTRY0 + 24,
+         sizeof(tableOffset));
+  uint32_t mask;
+  memcpy(&mask, &cache[tableOffset], sizeof(mask));
+
+  uint32_t outOfBounds = cache.size();
+  uint32_t inHeader = 0;
+  uint32_t badMask = mask * 2 + 1;
+
+  Array<word> tampered[] = {
+    tamperWithCache(cache, ENTRY0 + 16, &outOfBounds, sizeof(outOfBounds)),
+    tamperWithCache(cache, ENTRY0 + 24, &inHeader, sizeof(inHeader)),
+    tamperWithCache(cache, ENTRY1, &id0, sizeof(id0)),
+    tamperWithCache(cache, tableOffset * sizeof(word), &badMask, sizeof(badMask)),
+  };
+
+  for (auto& bad: tampered) {
+    SchemaLoader loader;
+    EXPECT_ANY_THROW(loader.loadCache(bad));
+    EXPECT_EQ(0u, loader.getAllLoaded().size());
+  }
+
+  // Rewriting the checksum alone is harmless.
+  {
+    Array<word> rewritten = tamperWithCache(cache, 0, cache.begin(), 0);
+    SchemaLoader loader;
+    loader.loadCache(rewritten);
+    EXPECT_EQ(original.getAllLoaded().size(), loader.getAllLoaded().size());
+  }
+}
+
+class TestResolver: public SchemaLoader::Resolver {
+public:
+  std::map<uint64_t, schema::Node::Reader> nodes;
+  uint calls = 0;
+
+  Maybe<schema::Node::Reader> resolve(uint64_t id) override {
+    ++calls;
+    auto iter = nodes.find(id);
+    if (iter == nodes.end()) {
+      return nullptr;
+    } else {
+      return iter->second;
+    }
+  }
+};
+
+TEST(SchemaLoader, LazyResolve) {
+  TestResolver resolver;
+  resolver.nodes[typeId<TestEnum>()] = Schema::from<TestEnum>().getProto();
+
+  SchemaLoader loader(resolver);
+  StructSchema schema = loader.load(Schema::from<TestAllTypes>().getProto()).asStruct();
+  EXPECT_EQ(2u, loader.getAllLoaded().size());
+
+  // Looking up the dependency doesn't need it yet.
+  EnumSchema enumSchema = schema.getDependency(typeId<TestEnum>()).asEnum();
+  EXPECT_EQ(0u, resolver.calls);
+
+  EXPECT_EQ(Schema::from<TestEnum>().getEnumerants().size(), enumSchema.getEnumerants().size());
+  EXPECT_EQ(1u, resolver.calls);
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.getRoot<DynamicStruct>(schema);
+    initDynamicTestMessage(root);
+    checkDynamicTestMessage(root.asReader());
+  }
+
+  EXPECT_EQ(1u, resolver.calls);
+}
+
+TEST(SchemaLoader, LazyUnknown) {
+  TestResolver resolver;
+  SchemaLoader loader(resolver);
+  StructSchema schema = loader.load(Schema::from<TestAllTypes>().getProto()).asStruct();
+
+  // The resolver doesn't know TestEnum, so it stays empty.
+  EXPECT_EQ(0u, schema.getDependency(typeId<TestEnum>()).asEnum().getEnumerants().size());
+  EXPECT_EQ(1u, resolver.calls);
+  EXPECT_EQ(0u, schema.getDependency(typeId<TestEnum>()).asEnum().getEnumerants().size());
+  EXPECT_EQ(1u, resolver.calls);
+
+  // Loading it explicitly still works.
+  loader.load(Schema::from<TestEnum>().getProto());
+  EXPECT_EQ(Schema::from<TestEnum>().getEnumerants().size(),
+            schema.getDependency(typeId<TestEnum>()).asEnum().getEnumerants().size());
+}
+
+TEST(SchemaLoader, LazyCompiledType) {
+  TestResolver resolver;
+  SchemaLoader loader(resolver);
+  loader.loadCompiledTypeAndDependencies<TestDefaults>();
+
+  StructSchema schema = loader.get(typeId<TestDefaults>()).asStruct();
+  EXPECT_TRUE(schema != Schema::from<TestDefaults>());
+
+  {
+    AlignedData<1> nullRoot = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    ArrayPtr<const word> segments[1] = {arrayPtr(nullRoot.words, 1)};
+    SegmentArrayMessageReader reader(arrayPtr(segments, 1));
+    checkDynamicTestMessage(reader.getRoot<DynamicStruct>(schema));
+  }
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.getRoot<DynamicStruct>(loader.get(typeId<TestAllTypes>()).asStruct());
+    initDynamicTestMessage(root);
+    checkTestMessage(root.as<TestAllTypes>());
+  }
+
+  // Dependencies of compiled-in types come from the types themselves, never the resolver.
+  EXPECT_EQ(0u, resolver.calls);
+}
+
+TEST(SchemaLoader, LazyCompiledTypeIncompatible) {
+  TestResolver resolver;
+  SchemaLoader loader(resolver);
+  loader.loadCompiledTypeAndDependencies<test::TestDefaults>();
+
+  // TestAllTypes is only a placeholder so far, but a conflicting node must still be checked
+  // against the compiled-in type, as it would be by an eager loader.
+  EXPECT_ANY_THROW(
+      loadUnderAlternateTypeId<test::TestListDefaults>(loader, typeId<TestAllTypes>()));
+
+  StructSchema schema = loader.get(typeId<TestAllTypes>()).asStruct();
+  EXPECT_EQ(Schema::from<TestAllTypes>().getMembers().size(), schema.getMembers().size());
+  schema.requireUsableAs<TestAllTypes>();
+  EXPECT_EQ(0u, resolver.calls);
+}
+
+TEST(SchemaLoader, LazyCache) {
+  TestResolver resolver;
+  resolver.nodes[typeId<TestEnum>()] = Schema::from<TestEnum>().getProto();
+
+  Array<word> cache;
+  {
+    SchemaLoader loader(resolver);
+    loader.load(Schema::from<TestAllTypes>().getProto());
+    cache = loader.saveCache();
+  }
+  EXPECT_EQ(0u, resolver.calls);
+
+  // The unfilled placeholder for TestEnum is still filled in on demand after the round trip.
+  SchemaLoader loader(resolver);
+  loader.loadCache(cache);
+  StructSchema schema = loader.get(typeId<TestAllTypes>()).asStruct();
+  EnumSchema enumSchema = schema.getDependency(typeId<TestEnum>()).asEnum();
+  EXPECT_EQ(0u, resolver.calls);
+  EXPECT_EQ(Schema::from<TestEnum>().getEnumerants().size(), enumSchema.getEnumerants().size());
+  EXPECT_EQ(1u, resolver.calls);
+}
+
+class CallbackResolver: public TestResolver {
+  // Looks at the placeholder it is asked to resolve, which calls back into the loader.
+
+public:
+  SchemaLoader* loader = nullptr;
+  bool callBack = true;
+
+  Maybe<schema::Node::Reader> resolve(uint64_t id) override {
+    if (callBack) {
+      loader->get(id).getProto();
+    }
+    return TestResolver::resolve(id);
+  }
+};
+
+TEST(SchemaLoader, LazyResolverCallsBack) {
+  CallbackResolver resolver;
+  resolver.nodes[typeId<TestEnum>()] = Schema::from<TestEnum>().getProto();
+
+  SchemaLoader loader(resolver);
+  resolver.loader = &loader;
+  StructSchema schema = loader.load(Schema::from<TestAllTypes>().getProto()).asStruct();
+
+  // This would deadlock if it weren't caught.
+  EXPECT_ANY_THROW(schema.getDependency(typeId<TestEnum>()).asEnum().getEnumerants());
+
+  // The loader was unlocked again, and the placeholder is still waiting to be filled in.
+  resolver.callBack = false;
+  EXPECT_EQ(Schema::from<TestEnum>().getEnumerants().size(),
+            schema.getDependency(typeId<TestEnum>()).asEnum().getEnumerants().size());
+}
+
 // TODO(test):  More extensively test upgrade/downgrade checks.
 
 }  // namespace
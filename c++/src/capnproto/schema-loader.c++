@@ -24,17 +24,45 @@
 #define CAPNPROTO_PRIVATE
 #include "schema-loader.h"
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "message.h"
-#include "arena.h"
+#include "memory-arena.h"
 #include "logging.h"
 #include "exception.h"
 
 namespace capnproto {
 
 class SchemaLoader::Impl {
+  // Everything here except lookup() must be called with `mutex` held.
+
 public:
-  Impl();
+  explicit Impl(Resolver* resolver);
+
+  mutable std::mutex mutex;
+  // Serializes loading.  Lookups do not take the lock.  Always lock it through Lock.
+
+  class Lock {
+    // Locks `mutex`.  The mutex isn't recursive, so this first checks that the current thread
+    // doesn't already hold it:  the loader being called back while it holds its lock, e.g. from
+    // Resolver::resolve(), would otherwise deadlock.
+
+  public:
+    explicit Lock(const Impl& impl);
+    CAPNPROTO_DISALLOW_COPY(Lock);
+    ~Lock();
+
+  private:
+    const Impl& impl;
+  };
+
+  mutable std::atomic<std::thread::id> lockHolder;
+  // The thread currently holding `mutex`, if any.  Only ever compared with the current thread's
+  // ID, which no other thread can store, so relaxed accesses suffice.
 
   internal::RawSchema* load(schema::Node::Reader reader);
 
@@ -43,34 +71,111 @@ public:
   internal::RawSchema* loadEmpty(uint64_t id, Text::Reader name, schema::Node::Body::Which kind);
   // Create a dummy empty schema of the given kind for the given id and load it.
 
+  internal::RawSchema* loadPlaceholder(uint64_t id, Text::Reader name,
+                                       schema::Node::Body::Which kind);
+  // Like loadEmpty(), for a dependency which hasn't been loaded.  In lazy mode, the placeholder is
+  // filled in by the resolver on first use.
+
+  internal::RawSchema* loadNativeDependency(const internal::RawSchema* nativeSchema);
+  // Like loadNative(), except that in lazy mode a type which isn't loaded yet only gets a
+  // placeholder, filled in from the native schema on first use.
+
+  void fillFromNative(internal::RawSchema* slot, const internal::RawSchema* nativeSchema);
+  // Overwrite `slot` with a copy of the native schema.
+
+  void initialize(internal::RawSchema* slot);
+  // Fill in a lazy placeholder.
+
+  const internal::MemberPlan* makeMemberPlans(const internal::RawSchema* raw);
+  // Build the member layout plans for the given schema, if it is a struct.  Its encodedNode and
+  // dependencies must already be filled in.
+
+  const uint32_t* makeHashTable(ArrayPtr<const uint32_t> hashes);
+  // Build a RawSchema hash table (see RawSchema::dependencyTable) over entries with the given
+  // hashes.
+
+  void install(internal::RawSchema* slot, const internal::RawSchema* version);
+  // Make `version` the current version of a RawSchema which concurrent readers may be using.  The
+  // version must be complete, since it may not be modified afterwards.
+
+  void publishPending();
+  // Make schemas added since the last call visible to lookup().  Called once the top-level load
+  // operation has finished, so that readers never observe a schema whose dependencies are still
+  // being filled in.
+
   internal::RawSchema* tryGet(uint64_t typeId) const;
+  // Find a schema, including ones that have not been published yet.
+
+  internal::RawSchema* lookup(uint64_t typeId) const;
+  // Find a published schema.  Lock-free; may be called concurrently with loading.
+
   Array<Schema> getAllLoaded() const;
 
+  Array<word> saveCache() const;
+  void loadCache(ArrayPtr<const word> cache);
+
   template <typename T>
   T* allocate(size_t count = 1) {
-    ByteCount bytes = count * sizeof(T) * BYTES;
-    static_assert(sizeof(word) == 8, "This code assumes 64-bit words.");
-    WordCount words = (bytes + 7 * BYTES) / BYTES_PER_WORD;
-
-    while (true) {
-      word* result = segment->allocate(words);
-      if (result != nullptr) {
-        return reinterpret_cast<T*>(result);
-      }
-      segment = arena->getSegmentWithAvailable(words);
-    }
+    // Returns zeroed memory, which lets callers fill in only the fields they care about.
+    return arena.allocateArray<T>(count).begin();
   }
 
 private:
-  MallocMessageBuilder allocator;
-  internal::BuilderArena* arena;
-  internal::SegmentBuilder* segment;
-  // HACK:  We don't actually use these to build messages, we use them to allocate memory that
-  //   should be freed when the loader is freed.  We're reusing BuilderArena as a convenient
-  //   implementation of the general concept of arenas.
-  // TODO(cleanup):  Develop a stand-alone Arena class that can be used for things like this.
+  Arena arena;
+  // Holds everything the loader allocates; freed all at once with the loader.
 
   std::unordered_map<uint64_t, internal::RawSchema*> schemas;
+  std::vector<std::pair<uint64_t, internal::RawSchema*>> pending;
+  // All schemas, and those among them that haven't been published to `published` yet.
+
+  struct IdTable {
+    // Open-addressed hash table from ID to schema, read without locking.  An entry is claimed by
+    // storing its id and then its schema; readers treat a null schema as an empty slot.  Entries
+    // are never removed.  When the table gets half full, a copy twice the size replaces it; old
+    // copies stay allocated until the loader is destroyed, so readers may keep using them.
+
+    struct Entry {
+      std::atomic<uint64_t> id;
+      std::atomic<internal::RawSchema*> schema;
+    };
+
+    uint32_t mask;
+    Entry* entries;
+  };
+
+  std::atomic<IdTable*> published;
+  uint32_t publishedCount;
+
+  class LazyInitializer: public internal::RawSchema::Initializer {
+  public:
+    explicit LazyInitializer(Impl& impl): impl(impl) {}
+    void init(const internal::RawSchema* schema) const override;
+
+  private:
+    Impl& impl;
+  };
+
+  Resolver* resolver;
+  LazyInitializer lazyInitializer;
+  // In lazy mode, `resolver` is non-null, and placeholders point at `lazyInitializer`.
+
+  struct NoOpLoad {
+    const word* loaded;
+    // The encodedNode that was loaded when the version was seen:  either the version itself, or a
+    // newer one which the version was found to be compatible with.
+
+    ArrayPtr<const word> version;
+    // The unchecked copy of the version itself, made by load().
+  };
+
+  std::unordered_map<uint64_t, NoOpLoad> noOpLoads;
+  // Maps the fingerprint of each node version load() has seen to what came of loading it.  As long
+  // as `loaded` is still the loaded version, loading the same version again would change nothing,
+  // so it can be skipped without validating it or comparing it member-by-member.
+  //
+  // The fingerprint is only a 64-bit hash, so a hit is confirmed by comparing the node with
+  // `version` before skipping.  A collision, or the same content laid out differently, just
+  // costs a full load.
 };
 
 // =======================================================================================
@@ -123,6 +228,15 @@ public:
     return result;
   }
 
+  const uint32_t* makeDependencyTable() {
+    CAPNPROTO_STACK_ARRAY(uint32_t, hashes, dependencies.size(), 256);
+    uint pos = 0;
+    for (auto& dep: dependencies) {
+      hashes[pos++] = internal::hashSchemaId(dep.first);
+    }
+    return loader.makeHashTable(hashes);
+  }
+
   const internal::RawSchema::MemberInfo* makeMemberInfoArray(uint32_t* count) {
     *count = members.size();
     internal::RawSchema::MemberInfo* result =
@@ -135,6 +249,16 @@ public:
     return result;
   }
 
+  const uint32_t* makeMemberTable() {
+    CAPNPROTO_STACK_ARRAY(uint32_t, hashes, members.size(), 256);
+    uint pos = 0;
+    for (auto& member: members) {
+      Text::Reader name = member.first.second;
+      hashes[pos++] = internal::hashMemberName(member.first.first, name.data(), name.size());
+    }
+    return loader.makeHashTable(hashes);
+  }
+
 private:
   SchemaLoader::Impl& loader;
   Text::Reader nodeName;
@@ -419,7 +543,7 @@ private:
   void validateTypeId(uint64_t id, schema::Node::Body::Which expectedKind) {
     internal::RawSchema* existing = loader.tryGet(id);
     if (existing != nullptr) {
-      auto node = readMessageUnchecked<schema::Node>(existing->encodedNode);
+      auto node = readMessageUnchecked<schema::Node>(existing->getVersion()->encodedNode);
       VALIDATE_SCHEMA(node.getBody().which() == expectedKind,
           "expected a different kind of node for this ID",
           id, expectedKind, node.getBody().which(), node.getDisplayName());
@@ -428,7 +552,7 @@ private:
     }
 
     // TODO(cleanup):  str() really needs to return something NUL-terminated...
-    dependencies.insert(std::make_pair(id, loader.loadEmpty(
+    dependencies.insert(std::make_pair(id, loader.loadPlaceholder(
         id, str("(unknown type used by ", nodeName , ")", '\0').begin(), expectedKind)));
   }
 
@@ -459,6 +583,10 @@ public:
     return replacementIsNative ? compatibility != OLDER : compatibility == NEWER;
   }
 
+  inline bool isCompatible() const { return compatibility != INCOMPATIBLE; }
+  // After shouldReplace(), whether the two versions were found compatible.  (If exceptions are
+  // disabled, an incompatibility is reported and then shouldReplace() returns false.)
+
 private:
   SchemaLoader::Impl& loader;
   Text::Reader nodeName;
@@ -812,7 +940,7 @@ private:
 
     word scratch[32];
     memset(scratch, 0, sizeof(scratch));
-    MallocMessageBuilder builder(arrayPtr(scratch, sizeof(scratch)));
+    MallocMessageBuilder builder(arrayPtr(scratch, sizeof(scratch) / sizeof(scratch[0])));
     auto node = builder.initRoot<schema::Node>();
     node.setId(structTypeId);
     // TODO(cleanup):  str() really needs to return something NUL-terminated...
@@ -879,11 +1007,45 @@ private:
     member.setName("member0");
     member.setOrdinal(0);
     member.setCodeOrder(0);
-    member.getBody().initFieldMember().setType(type);
+    auto field = member.getBody().initFieldMember();
+    field.setType(type);
+    initZeroDefault(type, field.getDefaultValue().getBody());
 
     loader.load(node);
   }
 
+  static void initZeroDefault(schema::Type::Reader type, schema::Value::Body::Builder value) {
+    // The validator requires a field's default value to be of the field's type, so the field in
+    // a contrived struct needs one too.  What the default is doesn't affect compatibility.
+
+    switch (type.getBody().which()) {
+      case schema::Type::Body::VOID_TYPE: value.setVoidValue(Void::VOID); break;
+      case schema::Type::Body::BOOL_TYPE: value.setBoolValue(false); break;
+      case schema::Type::Body::INT8_TYPE: value.setInt8Value(0); break;
+      case schema::Type::Body::INT16_TYPE: value.setInt16Value(0); break;
+      case schema::Type::Body::INT32_TYPE: value.setInt32Value(0); break;
+      case schema::Type::Body::INT64_TYPE: value.setInt64Value(0); break;
+      case schema::Type::Body::UINT8_TYPE: value.setUint8Value(0); break;
+      case schema::Type::Body::UINT16_TYPE: value.setUint16Value(0); break;
+      case schema::Type::Body::UINT32_TYPE: value.setUint32Value(0); break;
+      case schema::Type::Body::UINT64_TYPE: value.setUint64Value(0); break;
+      case schema::Type::Body::FLOAT32_TYPE: value.setFloat32Value(0); break;
+      case schema::Type::Body::FLOAT64_TYPE: value.setFloat64Value(0); break;
+      case schema::Type::Body::TEXT_TYPE: value.setTextValue(""); break;
+      case schema::Type::Body::DATA_TYPE: value.setDataValue(Data::Reader()); break;
+      case schema::Type::Body::ENUM_TYPE: value.setEnumValue(0); break;
+      case schema::Type::Body::INTERFACE_TYPE: value.setInterfaceValue(Void::VOID); break;
+
+      // An empty list reads as an empty list of any element type.
+      case schema::Type::Body::LIST_TYPE: value.initListValue<List<Void>>(0); break;
+      case schema::Type::Body::OBJECT_TYPE: value.initObjectValue<List<Void>>(0); break;
+
+      case schema::Type::Body::STRUCT_TYPE:
+        // Can't happen:  only the side of an upgrade which isn't a struct is contrived.
+        break;
+    }
+  }
+
   bool canUpgradeToData(schema::Type::Reader type) {
     if (type.getBody().which() == schema::Type::Body::TEXT_TYPE) {
       return true;
@@ -976,13 +1138,58 @@ private:
 
 // =======================================================================================
 
-SchemaLoader::Impl::Impl()
-    : arena(allocator.arena()),
-      segment(allocator.getRootSegment()) {}
+namespace {
+
+bool isSameNode(schema::Node::Reader reader, size_t size, ArrayPtr<const word> version) {
+  // Whether `reader`, which is `size` words when copied, encodes exactly `version`, an unchecked
+  // copy made by SchemaLoader::Impl::load().
+  if (size != version.size()) return false;
+
+  CAPNPROTO_STACK_ARRAY(word, copy, size, 512);
+  memset(static_cast<void*>(copy.begin()), 0, size * sizeof(word));
+  copyToUnchecked(reader, copy);
+  return memcmp(copy.begin(), version.begin(), size * sizeof(word)) == 0;
+}
+
+}  // namespace
+
+SchemaLoader::Impl::Lock::Lock(const Impl& impl): impl(impl) {
+  PRECOND(impl.lockHolder.load(std::memory_order_relaxed) != std::this_thread::get_id(),
+          "SchemaLoader was called back while it held its lock on the same thread, e.g. by a "
+          "Resolver looking at a placeholder schema.  This would deadlock.");
+  impl.mutex.lock();
+  impl.lockHolder.store(std::this_thread::get_id(), std::memory_order_relaxed);
+}
+
+SchemaLoader::Impl::Lock::~Lock() {
+  impl.lockHolder.store(std::thread::id(), std::memory_order_relaxed);
+  impl.mutex.unlock();
+}
+
+SchemaLoader::Impl::Impl(Resolver* resolver)
+    : lockHolder(std::thread::id()),
+      arena(8192),
+      published(nullptr),
+      publishedCount(0),
+      resolver(resolver),
+      lazyInitializer(*this) {}
 
 internal::RawSchema* SchemaLoader::Impl::load(schema::Node::Reader reader) {
-  // Make a copy of the node which can be used unchecked.
+  uint64_t fingerprint = reader.fingerprint();
   size_t size = reader.totalSizeInWords() + 1;
+  {
+    auto iter = noOpLoads.find(fingerprint);
+    if (iter != noOpLoads.end()) {
+      auto known = schemas.find(reader.getId());
+      if (known != schemas.end() &&
+          known->second->getVersion()->encodedNode == iter->second.loaded &&
+          isSameNode(reader, size, iter->second.version)) {
+        return known->second;
+      }
+    }
+  }
+
+  // Make a copy of the node which can be used unchecked.
   word* validated = allocate<word>(size);
   copyToUnchecked(reader, arrayPtr(validated, size));
 
@@ -1002,21 +1209,38 @@ internal::RawSchema* SchemaLoader::Impl::load(schema::Node::Reader reader) {
   if (slot == nullptr) {
     // Nope, allocate a new RawSchema.
     slot = allocate<internal::RawSchema>();
+    pending.push_back(std::make_pair(validatedReader.getId(), slot));
   } else {
+    if (slot->lazyInitializer != nullptr && slot->canCastTo != nullptr) {
+      // A placeholder for a compiled-in type.  Compare against the type itself, as an eager
+      // loader would, rather than against the empty placeholder.
+      fillFromNative(slot, slot->canCastTo);
+    }
+
     // Yes, check if it is compatible and figure out which schema is newer.
-    auto existing = readMessageUnchecked<schema::Node>(slot->encodedNode);
+    const word* existingNode = slot->getVersion()->encodedNode;
+    auto existing = readMessageUnchecked<schema::Node>(existingNode);
     CompatibilityChecker checker(*this);
     if (!checker.shouldReplace(existing, validatedReader, false)) {
       // The new schema does not appear to be any newer than the existing one, so keep the existing.
+      if (checker.isCompatible()) {
+        noOpLoads[fingerprint] = NoOpLoad { existingNode, arrayPtr(validated, size) };
+      }
       return slot;
     }
   }
 
-  // Initialize the RawSchema.
-  slot->encodedNode = validated;
-  slot->dependencies = validator.makeDependencyArray(&slot->dependencyCount);
-  slot->membersByName = validator.makeMemberInfoArray(&slot->memberCount);
-
+  // Build the new version.
+  internal::RawSchema* version = allocate<internal::RawSchema>();
+  version->encodedNode = validated;
+  version->dependencies = validator.makeDependencyArray(&version->dependencyCount);
+  version->dependencyTable = validator.makeDependencyTable();
+  version->membersByName = validator.makeMemberInfoArray(&version->memberCount);
+  version->memberTable = validator.makeMemberTable();
+  version->memberPlans = makeMemberPlans(version);
+  install(slot, version);
+
+  noOpLoads[fingerprint] = NoOpLoad { validated, arrayPtr(validated, size) };
   return slot;
 }
 
@@ -1025,6 +1249,7 @@ internal::RawSchema* SchemaLoader::Impl::loadNative(const internal::RawSchema* n
   internal::RawSchema*& slot = schemas[reader.getId()];
   if (slot == nullptr) {
     slot = allocate<internal::RawSchema>();
+    pending.push_back(std::make_pair(reader.getId(), slot));
   } else if (slot->canCastTo != nullptr) {
     PRECOND(slot->canCastTo == nativeSchema,
         "two different compiled-in type have the same type ID",
@@ -1033,41 +1258,69 @@ internal::RawSchema* SchemaLoader::Impl::loadNative(const internal::RawSchema* n
     // Already loaded.
     return slot;
   } else {
-    auto existing = readMessageUnchecked<schema::Node>(slot->encodedNode);
+    auto existing = readMessageUnchecked<schema::Node>(slot->getVersion()->encodedNode);
     auto native = readMessageUnchecked<schema::Node>(nativeSchema->encodedNode);
     CompatibilityChecker checker(*this);
     if (!checker.shouldReplace(existing, native, true)) {
       // The existing schema is newer, so just make sure the dependencies are loaded.
-      slot->canCastTo = nativeSchema;
+      __atomic_store_n(&slot->canCastTo, nativeSchema, __ATOMIC_RELEASE);
       for (uint i = 0; i < nativeSchema->dependencyCount; i++) {
-        loadNative(nativeSchema->dependencies[i]);
+        loadNativeDependency(nativeSchema->dependencies[i]);
       }
       return slot;
     }
   }
 
-  // Set the slot to a copy of the native schema.
-  *slot = *nativeSchema;
+  fillFromNative(slot, nativeSchema);
+  return slot;
+}
+
+internal::RawSchema* SchemaLoader::Impl::loadNativeDependency(
+    const internal::RawSchema* nativeSchema) {
+  auto reader = readMessageUnchecked<schema::Node>(nativeSchema->encodedNode);
+  if (resolver == nullptr || tryGet(reader.getId()) != nullptr) {
+    return loadNative(nativeSchema);
+  }
 
-  // Indicate that casting is safe.
+  internal::RawSchema* slot = loadEmpty(
+      reader.getId(), reader.getDisplayName(), reader.getBody().which());
   slot->canCastTo = nativeSchema;
+  slot->lazyInitializer = &lazyInitializer;
+  return slot;
+}
+
+void SchemaLoader::Impl::fillFromNative(
+    internal::RawSchema* slot, const internal::RawSchema* nativeSchema) {
+  // Indicate that casting is safe.  Doing this first also stops a dependency cycle from leading
+  // back here.  (The slot's current contents are compatible and older, so they may be cast too.)
+  __atomic_store_n(&slot->canCastTo, nativeSchema, __ATOMIC_RELEASE);
+
+  // Copy the native schema, except that we need to set the dependency list to point at other
+  // loader-owned RawSchemas.  (The native memberPlans may be being filled in concurrently, so
+  // they are rebuilt rather than copied.)
+  internal::RawSchema* version = allocate<internal::RawSchema>();
+  version->encodedNode = nativeSchema->encodedNode;
+  version->dependencyTable = nativeSchema->dependencyTable;
+  version->membersByName = nativeSchema->membersByName;
+  version->memberTable = nativeSchema->memberTable;
+  version->dependencyCount = nativeSchema->dependencyCount;
+  version->memberCount = nativeSchema->memberCount;
 
-  // Except that we need to set the dependency list to point at other loader-owned RawSchemas.
   const internal::RawSchema** dependencies =
-      allocate<const internal::RawSchema*>(slot->dependencyCount);
+      allocate<const internal::RawSchema*>(nativeSchema->dependencyCount);
   for (uint i = 0; i < nativeSchema->dependencyCount; i++) {
-    dependencies[i] = loadNative(nativeSchema->dependencies[i]);
+    dependencies[i] = loadNativeDependency(nativeSchema->dependencies[i]);
   }
-  slot->dependencies = dependencies;
-
-  return slot;
+  version->dependencies = dependencies;
+  version->memberPlans = makeMemberPlans(version);
+  install(slot, version);
 }
 
 internal::RawSchema* SchemaLoader::Impl::loadEmpty(
     uint64_t id, Text::Reader name, schema::Node::Body::Which kind) {
   word scratch[32];
   memset(scratch, 0, sizeof(scratch));
-  MallocMessageBuilder builder(arrayPtr(scratch, sizeof(scratch)));
+  MallocMessageBuilder builder(arrayPtr(scratch, sizeof(scratch) / sizeof(scratch[0])));
   auto node = builder.initRoot<schema::Node>();
   node.setId(id);
   node.setDisplayName(name);
@@ -1086,6 +1339,132 @@ internal::RawSchema* SchemaLoader::Impl::loadEmpty(
   return load(node);
 }
 
+internal::RawSchema* SchemaLoader::Impl::loadPlaceholder(
+    uint64_t id, Text::Reader name, schema::Node::Body::Which kind) {
+  internal::RawSchema* slot = loadEmpty(id, name, kind);
+  if (resolver != nullptr) {
+    // Not yet published, so no need for atomics.
+    slot->lazyInitializer = &lazyInitializer;
+  }
+  return slot;
+}
+
+void SchemaLoader::Impl::initialize(internal::RawSchema* slot) {
+  if (slot->lazyInitializer == nullptr) {
+    // Another thread got here first.
+    return;
+  }
+
+  if (slot->canCastTo != nullptr) {
+    fillFromNative(slot, slot->canCastTo);
+  } else {
+    auto placeholder = readMessageUnchecked<schema::Node>(slot->getVersion()->encodedNode);
+    uint64_t id = placeholder.getId();
+    Maybe<schema::Node::Reader> node = resolver->resolve(id);
+    if (node != nullptr) {
+      bool idMatches = true;
+      VALIDATE_INPUT(node->getId() == id, "Resolver returned a node with the wrong ID.",
+                     id, node->getId()) {
+        idMatches = false;
+      }
+      if (idMatches) {
+        load(*node);
+      }
+    }
+  }
+
+  // If the resolver didn't know the type, or its node turned out to be no newer than the
+  // placeholder, the placeholder stays as it is.
+  __atomic_store_n(&slot->lazyInitializer, nullptr, __ATOMIC_RELEASE);
+}
+
+void SchemaLoader::Impl::LazyInitializer::init(const internal::RawSchema* schema) const {
+  Lock lock(impl);
+  impl.initialize(const_cast<internal::RawSchema*>(schema));
+  impl.publishPending();
+}
+
+const internal::MemberPlan* SchemaLoader::Impl::makeMemberPlans(const internal::RawSchema* raw) {
+  Schema schema(raw);
+  if (schema.getProto().getBody().which() != schema::Node::Body::STRUCT_NODE) {
+    return nullptr;
+  }
+
+  StructSchema structSchema = schema.asStruct();
+  internal::MemberPlan* plans = allocate<internal::MemberPlan>(structSchema.getMemberPlanCount());
+  structSchema.decodeMemberPlans(plans);
+  return plans;
+}
+
+const uint32_t* SchemaLoader::Impl::makeHashTable(ArrayPtr<const uint32_t> hashes) {
+  uint32_t size = internal::hashTableSize(hashes.size());
+  uint32_t mask = size - 1;
+  uint32_t* table = allocate<uint32_t>(size + 1);
+  table[0] = mask;
+  uint32_t* slots = table + 1;
+
+  for (uint i = 0; i < hashes.size(); i++) {
+    uint32_t slot = hashes[i] & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+  }
+
+  return table;
+}
+
+void SchemaLoader::Impl::install(internal::RawSchema* slot, const internal::RawSchema* version) {
+  // Readers may be using `slot` concurrently.  They load `version` once and read everything from
+  // it, so publishing the new node, tables, and plans together with one store means a reader sees
+  // either the old version or the new one, never a mix.  See schema.c++ for the reader side.
+  __atomic_store_n(&slot->version, version, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->lazyInitializer, nullptr, __ATOMIC_RELEASE);
+}
+
+void SchemaLoader::Impl::publishPending() {
+  for (auto& entry: pending) {
+    IdTable* table = published.load(std::memory_order_relaxed);
+
+    if (table == nullptr || (publishedCount + 1) * 2 > table->mask + 1) {
+      // Grow into a new copy.
+      uint32_t size = table == nullptr ? 16 : (table->mask + 1) * 2;
+      IdTable* newTable = allocate<IdTable>();
+      newTable->mask = size - 1;
+      newTable->entries = allocate<IdTable::Entry>(size);
+
+      if (table != nullptr) {
+        for (uint32_t i = 0; i <= table->mask; i++) {
+          IdTable::Entry& old = table->entries[i];
+          internal::RawSchema* schema = old.schema.load(std::memory_order_relaxed);
+          if (schema != nullptr) {
+            uint64_t id = old.id.load(std::memory_order_relaxed);
+            uint32_t pos = internal::hashSchemaId(id) & newTable->mask;
+            while (newTable->entries[pos].schema.load(std::memory_order_relaxed) != nullptr) {
+              pos = (pos + 1) & newTable->mask;
+            }
+            newTable->entries[pos].id.store(id, std::memory_order_relaxed);
+            newTable->entries[pos].schema.store(schema, std::memory_order_relaxed);
+          }
+        }
+      }
+
+      published.store(newTable, std::memory_order_release);
+      table = newTable;
+    }
+
+    uint32_t pos = internal::hashSchemaId(entry.first) & table->mask;
+    while (table->entries[pos].schema.load(std::memory_order_relaxed) != nullptr) {
+      pos = (pos + 1) & table->mask;
+    }
+    table->entries[pos].id.store(entry.first, std::memory_order_relaxed);
+    table->entries[pos].schema.store(entry.second, std::memory_order_release);
+    ++publishedCount;
+  }
+
+  pending.clear();
+}
+
 internal::RawSchema* SchemaLoader::Impl::tryGet(uint64_t typeId) const {
   auto iter = schemas.find(typeId);
   if (iter == schemas.end()) {
@@ -1095,6 +1474,21 @@ internal::RawSchema* SchemaLoader::Impl::tryGet(uint64_t typeId) const {
   }
 }
 
+internal::RawSchema* SchemaLoader::Impl::lookup(uint64_t typeId) const {
+  IdTable* table = published.load(std::memory_order_acquire);
+  if (table == nullptr) return nullptr;
+
+  for (uint32_t pos = internal::hashSchemaId(typeId) & table->mask;;
+       pos = (pos + 1) & table->mask) {
+    internal::RawSchema* schema = table->entries[pos].schema.load(std::memory_order_acquire);
+    if (schema == nullptr) {
+      return nullptr;
+    } else if (table->entries[pos].id.load(std::memory_order_relaxed) == typeId) {
+      return schema;
+    }
+  }
+}
+
 Array<Schema> SchemaLoader::Impl::getAllLoaded() const {
   Array<Schema> result = newArray<Schema>(schemas.size());
   size_t i = 0;
@@ -1105,18 +1499,363 @@ Array<Schema> SchemaLoader::Impl::getAllLoaded() const {
 }
 
 // =======================================================================================
+// Cache files
+//
+// A cache consists of a CacheHeader, then one CacheEntry per schema, then the data the entries
+// refer to, each piece word-aligned:  the encoded node (in the unchecked format, so it is
+// position-independent), the IDs of its dependencies in the same order as
+// RawSchema::dependencies, and RawSchema's dependencyTable, membersByName, and memberTable.
+// Offsets are in words from the start of the cache.
+
+namespace {
+
+static const uint64_t CACHE_MAGIC = 0x65686361636e7063ull;  // "cpncache", little-endian.
+static const uint32_t CACHE_VERSION = 2;
+
+struct CacheHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t schemaCount;
+  uint64_t totalWords;
+  uint64_t checksum;  // Of everything after the header.
+};
+
+struct CacheEntry {
+  uint64_t id;
+  uint32_t dependencyCount;
+  uint32_t memberCount;
+  uint32_t nodeOffset;
+  uint32_t dependencyIdsOffset;
+  uint32_t dependencyTableOffset;
+  uint32_t membersByNameOffset;
+  uint32_t memberTableOffset;
+  uint32_t flags;
+};
+
+static const uint32_t CACHE_ENTRY_PLACEHOLDER = 1;
+// The entry is a lazy-mode placeholder which hadn't been filled in yet.
+
+static_assert(sizeof(CacheHeader) % sizeof(word) == 0, "CacheHeader must be word-aligned.");
+static_assert(sizeof(CacheEntry) % sizeof(word) == 0, "CacheEntry must be word-aligned.");
+
+static const size_t CACHE_HEADER_WORDS = sizeof(CacheHeader) / sizeof(word);
+static const size_t CACHE_ENTRY_WORDS = sizeof(CacheEntry) / sizeof(word);
+
+inline size_t wordsFor(size_t bytes) {
+  return (bytes + sizeof(word) - 1) / sizeof(word);
+}
+
+uint64_t cacheChecksum(ArrayPtr<const word> words) {
+  // FNV-1a, one word at a time.
+  uint64_t result = 14695981039346656037ull;
+  for (const word& w: words) {
+    uint64_t value;
+    memcpy(&value, &w, sizeof(value));
+    result = (result ^ value) * 1099511628211ull;
+  }
+  return result;
+}
+
+inline size_t hashTableBytes(uint32_t count) {
+  // Size of a RawSchema hash table (see RawSchema::dependencyTable) holding `count` entries.
+  return (internal::hashTableSize(count) + 1) * sizeof(uint32_t);
+}
+
+bool isValidHashTable(const uint32_t* table, uint32_t count) {
+  // Checks that a hash table read from a cache has the right size for `count` entries, refers
+  // only to those entries, and has an empty slot for probes to stop at.
+  if (table[0] != internal::hashTableSize(count) - 1) return false;
+
+  uint32_t used = 0;
+  for (uint32_t i = 1; i <= table[0] + 1; i++) {
+    if (table[i] > count) return false;
+    if (table[i] != 0) ++used;
+  }
+  return used == count;
+}
+
+}  // namespace
+
+Array<word> SchemaLoader::Impl::saveCache() const {
+  // Lay out everything first.
+  struct Piece {
+    const void* data;
+    size_t bytes;
+    uint32_t offset;
+  };
+
+  size_t pos = CACHE_HEADER_WORDS + schemas.size() * CACHE_ENTRY_WORDS;
+  auto place = [&](Piece& piece, const void* data, size_t bytes) {
+    piece.data = data;
+    piece.bytes = bytes;
+    piece.offset = pos;
+    pos += wordsFor(bytes);
+  };
+
+  std::vector<CacheEntry> entries;
+  std::vector<Piece> pieces;
+  std::vector<uint64_t> dependencyIds;
+  entries.reserve(schemas.size());
+  pieces.reserve(schemas.size() * 5);
+
+  size_t totalDependencies = 0;
+  for (auto& schema: schemas) {
+    totalDependencies += schema.second->getVersion()->dependencyCount;
+  }
+  dependencyIds.reserve(totalDependencies);
+
+  for (auto& schema: schemas) {
+    const internal::RawSchema* raw = schema.second->getVersion();
+    auto node = readMessageUnchecked<schema::Node>(raw->encodedNode);
+
+    CacheEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.id = schema.first;
+    entry.dependencyCount = raw->dependencyCount;
+    entry.memberCount = raw->memberCount;
+    if (schema.second->lazyInitializer != nullptr) {
+      // Saving the placeholder as an ordinary empty schema would stop a loader restored from the
+      // cache from ever filling it in.
+      entry.flags = CACHE_ENTRY_PLACEHOLDER;
+    }
+
+    Piece piece;
+    place(piece, raw->encodedNode, (node.totalSizeInWords() + 1) * sizeof(word));
+    entry.nodeOffset = piece.offset;
+    pieces.push_back(piece);
+
+    const uint64_t* ids = dependencyIds.data() + dependencyIds.size();
+    for (uint i = 0; i < raw->dependencyCount; i++) {
+      dependencyIds.push_back(
+          readMessageUnchecked<schema::Node>(
+              raw->dependencies[i]->getVersion()->encodedNode).getId());
+    }
+    place(piece, ids, raw->dependencyCount * sizeof(uint64_t));
+    entry.dependencyIdsOffset = piece.offset;
+    pieces.push_back(piece);
+
+    place(piece, raw->dependencyTable, hashTableBytes(raw->dependencyCount));
+    entry.dependencyTableOffset = piece.offset;
+    pieces.push_back(piece);
+
+    place(piece, raw->membersByName, raw->memberCount * sizeof(internal::RawSchema::MemberInfo));
+    entry.membersByNameOffset = piece.offset;
+    pieces.push_back(piece);
+
+    place(piece, raw->memberTable, hashTableBytes(raw->memberCount));
+    entry.memberTableOffset = piece.offset;
+    pieces.push_back(piece);
+
+    entries.push_back(entry);
+  }
+
+  PRECOND(pos <= 0xffffffffu, "Too many schemas to cache.");
+
+  // Now copy it all out.
+  Array<word> result = newArray<word>(pos);
+  memset(static_cast<void*>(result.begin()), 0, result.size() * sizeof(word));
+
+  char* bytes = reinterpret_cast<char*>(result.begin());
+  memcpy(bytes + CACHE_HEADER_WORDS * sizeof(word), entries.data(),
+         entries.size() * sizeof(CacheEntry));
+  for (auto& piece: pieces) {
+    if (piece.bytes > 0) {
+      memcpy(bytes + piece.offset * sizeof(word), piece.data, piece.bytes);
+    }
+  }
 
-SchemaLoader::SchemaLoader(): impl(heap<Impl>()) {}
+  CacheHeader header;
+  header.magic = CACHE_MAGIC;
+  header.version = CACHE_VERSION;
+  header.schemaCount = entries.size();
+  header.totalWords = pos;
+  header.checksum = cacheChecksum(result.slice(CACHE_HEADER_WORDS, result.size()));
+  memcpy(bytes, &header, sizeof(header));
+
+  return result;
+}
+
+void SchemaLoader::Impl::loadCache(ArrayPtr<const word> cache) {
+  PRECOND(schemas.empty(), "loadCache() must be called on an empty SchemaLoader.");
+
+  // Check everything before touching the loader, so that a bad cache leaves it empty and the
+  // caller can fall back to loading nodes normally.
+  VALIDATE_INPUT(cache.size() >= CACHE_HEADER_WORDS, "Schema cache is truncated.") {
+    return;
+  }
+
+  CacheHeader header;
+  memcpy(&header, cache.begin(), sizeof(header));
+
+  VALIDATE_INPUT(header.magic == CACHE_MAGIC && header.version == CACHE_VERSION,
+                 "Not a schema cache, or written by an incompatible version.") {
+    return;
+  }
+  VALIDATE_INPUT(header.totalWords == cache.size() &&
+                 header.schemaCount <= (cache.size() - CACHE_HEADER_WORDS) / CACHE_ENTRY_WORDS,
+                 "Schema cache is truncated.", header.totalWords, cache.size()) {
+    return;
+  }
+  VALIDATE_INPUT(header.checksum == cacheChecksum(cache.slice(CACHE_HEADER_WORDS, cache.size())),
+                 "Schema cache checksum mismatch.") {
+    return;
+  }
+
+  const CacheEntry* entries = reinterpret_cast<const CacheEntry*>(
+      cache.begin() + CACHE_HEADER_WORDS);
+  const byte* bytes = reinterpret_cast<const byte*>(cache.begin());
+  size_t dataStart = CACHE_HEADER_WORDS + header.schemaCount * CACHE_ENTRY_WORDS;
+
+  std::unordered_set<uint64_t> ids;
+  for (uint i = 0; i < header.schemaCount; i++) {
+    VALIDATE_INPUT(ids.insert(entries[i].id).second,
+                   "Schema cache contains duplicate IDs.", entries[i].id) {
+      return;
+    }
+  }
+
+  // Nodes are copied out of the cache, like load() does, so that they can be read unchecked even
+  // if the cache was tampered with.  The copies come from the arena but aren't referenced by
+  // anything until every entry has been checked.
+  std::vector<const word*> nodes;
+  nodes.reserve(header.schemaCount);
+
+  for (uint i = 0; i < header.schemaCount; i++) {
+    const CacheEntry& entry = entries[i];
+
+    auto inBounds = [&](uint32_t offset, size_t size) {
+      return offset >= dataStart && offset <= cache.size() &&
+             wordsFor(size) <= cache.size() - offset;
+    };
+
+    // Bounding the counts first keeps the size arithmetic below from overflowing.
+    VALIDATE_INPUT((entry.flags & ~CACHE_ENTRY_PLACEHOLDER) == 0 &&
+                   entry.dependencyCount < (1u << 30) && entry.memberCount < (1u << 30) &&
+                   entry.nodeOffset < cache.size() && inBounds(entry.nodeOffset, 0) &&
+                   inBounds(entry.dependencyIdsOffset, entry.dependencyCount * sizeof(uint64_t)) &&
+                   inBounds(entry.dependencyTableOffset,
+                            hashTableBytes(entry.dependencyCount)) &&
+                   inBounds(entry.membersByNameOffset,
+                            entry.memberCount * sizeof(internal::RawSchema::MemberInfo)) &&
+                   inBounds(entry.memberTableOffset, hashTableBytes(entry.memberCount)),
+                   "Schema cache entry is out of bounds.", entry.id) {
+      return;
+    }
+
+    const uint64_t* dependencyIds =
+        reinterpret_cast<const uint64_t*>(bytes + entry.dependencyIdsOffset * sizeof(word));
+    for (uint j = 0; j < entry.dependencyCount; j++) {
+      VALIDATE_INPUT(ids.count(dependencyIds[j]) > 0,
+                     "Schema cache is missing a dependency.", entry.id, dependencyIds[j]) {
+        return;
+      }
+    }
+
+    VALIDATE_INPUT(isValidHashTable(reinterpret_cast<const uint32_t*>(
+                       bytes + entry.dependencyTableOffset * sizeof(word)),
+                       entry.dependencyCount) &&
+                   isValidHashTable(reinterpret_cast<const uint32_t*>(
+                       bytes + entry.memberTableOffset * sizeof(word)),
+                       entry.memberCount),
+                   "Schema cache contains a corrupt lookup table.", entry.id) {
+      return;
+    }
+
+    ArrayPtr<const word> segment = cache.slice(entry.nodeOffset, cache.size());
+    ReaderOptions options;
+    options.traversalLimitInWords = cache.size();
+    options.recordErrors = true;
+    SegmentArrayMessageReader reader(arrayPtr(&segment, 1), options);
+    auto node = reader.getRoot<schema::Node>();
+    size_t size = node.totalSizeInWords() + 1;
+    VALIDATE_INPUT(!reader.hasError() && node.getId() == entry.id,
+                   "Schema cache contains an invalid node.", entry.id) {
+      return;
+    }
+
+    word* copy = allocate<word>(size);
+    copyToUnchecked(node, arrayPtr(copy, size));
+    nodes.push_back(copy);
+  }
+
+  // Everything checks out, so fill in the loader.  Allocate all of the RawSchemas up-front so that
+  // dependencies can refer to them.
+  for (uint i = 0; i < header.schemaCount; i++) {
+    internal::RawSchema* slot = allocate<internal::RawSchema>();
+    schemas[entries[i].id] = slot;
+    pending.push_back(std::make_pair(entries[i].id, slot));
+  }
+
+  std::vector<internal::RawSchema*> versions;
+  versions.reserve(header.schemaCount);
+  for (uint i = 0; i < header.schemaCount; i++) {
+    const CacheEntry& entry = entries[i];
+    internal::RawSchema* version = allocate<internal::RawSchema>();
+    versions.push_back(version);
+
+    version->encodedNode = nodes[i];
+    version->dependencyCount = entry.dependencyCount;
+    version->memberCount = entry.memberCount;
+    version->dependencyTable =
+        reinterpret_cast<const uint32_t*>(bytes + entry.dependencyTableOffset * sizeof(word));
+    version->membersByName = reinterpret_cast<const internal::RawSchema::MemberInfo*>(
+        bytes + entry.membersByNameOffset * sizeof(word));
+    version->memberTable =
+        reinterpret_cast<const uint32_t*>(bytes + entry.memberTableOffset * sizeof(word));
+
+    const uint64_t* dependencyIds =
+        reinterpret_cast<const uint64_t*>(bytes + entry.dependencyIdsOffset * sizeof(word));
+    const internal::RawSchema** dependencies =
+        allocate<const internal::RawSchema*>(entry.dependencyCount);
+    for (uint j = 0; j < entry.dependencyCount; j++) {
+      dependencies[j] = schemas[dependencyIds[j]];
+    }
+    version->dependencies = dependencies;
+
+    // Nothing is published yet, so the slot can be filled in directly.
+    schemas[entry.id]->version = version;
+  }
+
+  // Plans look at dependencies' nodes, so wait until all of those are in place.  The checks above
+  // make the cache safe to read, but unlike load() they don't check that the nodes make sense as
+  // schemas, so building a plan can still fail.  If it does, leave the loader empty as promised.
+  try {
+    for (uint i = 0; i < header.schemaCount; i++) {
+      versions[i]->memberPlans = makeMemberPlans(versions[i]);
+    }
+  } catch (...) {
+    schemas.clear();
+    pending.clear();
+    throw;
+  }
+
+  // Only now mark placeholders, since building plans reads every node, which would set off the
+  // placeholder's initializer while we hold the lock.
+  if (resolver != nullptr) {
+    for (uint i = 0; i < header.schemaCount; i++) {
+      if (entries[i].flags & CACHE_ENTRY_PLACEHOLDER) {
+        schemas[entries[i].id]->lazyInitializer = &lazyInitializer;
+      }
+    }
+  }
+}
+
+// =======================================================================================
+
+SchemaLoader::Resolver::~Resolver() {}
+
+SchemaLoader::SchemaLoader(): impl(heap<Impl>(nullptr)) {}
+SchemaLoader::SchemaLoader(Resolver& resolver): impl(heap<Impl>(&resolver)) {}
 SchemaLoader::~SchemaLoader() {}
 
 Schema SchemaLoader::get(uint64_t id) const {
-  internal::RawSchema* raw = impl->tryGet(id);
+  internal::RawSchema* raw = impl->lookup(id);
   PRECOND(raw != nullptr, "no schema node loaded for id", id);
   return Schema(raw);
 }
 
 Maybe<Schema> SchemaLoader::tryGet(uint64_t id) const {
-  internal::RawSchema* raw = impl->tryGet(id);
+  internal::RawSchema* raw = impl->lookup(id);
   if (raw == nullptr) {
     return nullptr;
   } else {
@@ -1125,15 +1864,32 @@ Maybe<Schema> SchemaLoader::tryGet(uint64_t id) const {
 }
 
 Schema SchemaLoader::load(schema::Node::Reader reader) {
-  return Schema(impl->load(reader));
+  Impl::Lock lock(*impl);
+  Schema result(impl->load(reader));
+  impl->publishPending();
+  return result;
 }
 
 Array<Schema> SchemaLoader::getAllLoaded() const {
+  Impl::Lock lock(*impl);
   return impl->getAllLoaded();
 }
 
+Array<word> SchemaLoader::saveCache() const {
+  Impl::Lock lock(*impl);
+  return impl->saveCache();
+}
+
+void SchemaLoader::loadCache(ArrayPtr<const word> cache) {
+  Impl::Lock lock(*impl);
+  impl->loadCache(cache);
+  impl->publishPending();
+}
+
 void SchemaLoader::loadNative(const internal::RawSchema* nativeSchema) {
+  Impl::Lock lock(*impl);
   impl->loadNative(nativeSchema);
+  impl->publishPending();
 }
 
 }  // namespace capnproto
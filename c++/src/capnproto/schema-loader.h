@@ -29,16 +29,45 @@
 namespace capnproto {
 
 class SchemaLoader {
+  // Loads schema nodes at runtime, for use with the dynamic API.
+  //
+  // All methods are thread-safe.  Lookups (get() and tryGet()) are lock-free and never wait for a
+  // concurrent load(); loading is serialized internally.  A schema becomes visible to lookups once
+  // the load() which introduced it has returned.
+
 public:
+  class Resolver {
+  public:
+    virtual ~Resolver();
+
+    virtual Maybe<schema::Node::Reader> resolve(uint64_t id) = 0;
+    // Find the node for the given type ID, e.g. in a local schema store, or return null if it is
+    // unknown.  The loader copies the node, so it need only remain valid until resolve() is next
+    // called.  Called with the loader's internal lock held, so must not call back into the loader,
+    // not even to look at a placeholder schema.  Doing so fails a precondition check.
+  };
+
   SchemaLoader();
+
+  explicit SchemaLoader(Resolver& resolver);
+  // Construct a loader in lazy mode.  Dependencies which haven't been loaded yet -- both those of
+  // nodes passed to load() and the transitive dependencies of compiled-in types passed to
+  // loadCompiledTypeAndDependencies() -- are only registered by ID, as empty placeholders.  Each is
+  // filled in the first time anything beyond its ID and kind is needed, e.g. when members are
+  // looked up or enumerated, or when getProto() is called:  compiled-in types are copied at that
+  // point, and other types are fetched from `resolver` and loaded as if by load().  Placeholders
+  // which the resolver does not know stay empty.  Processes which only touch a few types from a
+  // large schema set thereby avoid paying for the whole graph.
+
   ~SchemaLoader();
   CAPNPROTO_DISALLOW_COPY(SchemaLoader);
 
   Schema get(uint64_t id) const;
   // Gets the schema for the given ID, throwing an exception if it isn't present.
   //
-  // The returned schema may be invalidated if load() is called with a new schema for the same ID.
-  // In general, you should not call load() while a schema from this loader is in-use.
+  // If load() is later called with a newer version of the same type, the returned schema is
+  // upgraded in place.  Threads using it concurrently may observe either version, but will always
+  // be able to look up the members and dependencies of whichever version of the node they see.
 
   Maybe<Schema> tryGet(uint64_t id) const;
   // Like get() but doesn't throw.
@@ -55,7 +84,10 @@ public:
   // found to be incompatible, an exception is thrown.  If the two versions differ but are
   // compatible and the loader cannot determine which is newer (e.g., the only changes are renames),
   // the existing schema will be preferred.  Note that in any case, the loader will end up keeping
-  // around copies of both schemas, so you shouldn't repeatedly reload schemas into the same loader.
+  // around copies of both schemas.  However, the loader remembers the outcome for each version it
+  // has seen, keyed by the node's fingerprint(), so loading a version identical to one loaded
+  // before only costs hashing the node and comparing it with the earlier copy, and doesn't use up
+  // more memory.
   //
   // The following properties of the schema node are validated:
   // - Struct size and preferred list encoding are valid and consistent.
@@ -91,6 +123,25 @@ public:
   // loadCompiledTypeAndDependencies<T>() in order to get a flat list of all of T's transitive
   // dependencies.
 
+  Array<word> saveCache() const;
+  // Serializes everything currently loaded -- encoded nodes, dependency lists, and lookup tables
+  // -- into a single flat array which can be written to a file and later passed to loadCache().
+  // The format is specific to this version of the library and to the machine's byte order.
+
+  void loadCache(ArrayPtr<const word> cache);
+  // Attaches a cache previously produced by saveCache(), typically from a file mapped with
+  // mmap().  Lookup tables are used in place, so `cache` must remain valid for as long as the
+  // loader exists.  Every entry is bounds-checked and its node copied out before the loader is
+  // touched, so a bad cache is reported as invalid input and leaves the loader empty.  The nodes
+  // are not validated as schemas the way load() validates them, though, so only load caches you
+  // wrote yourself.
+  //
+  // The loader must be empty.  Compiled-in types may be registered afterwards with
+  // loadCompiledTypeAndDependencies(), and further nodes loaded with load(), as usual.
+  //
+  // Lazy-mode placeholders which hadn't been filled in when the cache was saved come back as
+  // placeholders, to be filled in from this loader's resolver (or left empty if it has none).
+
 private:
   class Validator;
   class CompatibilityChecker;
@@ -25,29 +25,46 @@
 #include "schema.h"
 #include "message.h"
 #include "logging.h"
+#include <string.h>
 
 namespace capnproto {
 
-schema::Node::Reader Schema::getProto() const {
-  return readMessageUnchecked<schema::Node>(raw->encodedNode);
-}
+// A SchemaLoader may replace a schema while other threads read it.  It does so by publishing a
+// complete new version through RawSchema::version (see SchemaLoader::Impl::install()).  Readers
+// call getVersion() once and take the node, the tables, and the arrays they index all from the
+// result, so they never combine pieces of two different versions.
+//
+// Anything which reads more than the node's ID and kind first calls ensureInitialized(), in case
+// the schema is a placeholder which the loader fills in lazily.
 
-Schema Schema::getDependency(uint64_t id) const {
-  uint lower = 0;
-  uint upper = raw->dependencyCount;
+namespace {
 
-  while (lower < upper) {
-    uint mid = (lower + upper) / 2;
+inline schema::Node::Reader readNode(const internal::RawSchema* raw) {
+  // Reads the node without initializing it.  Only its ID and kind are meaningful for placeholders.
+  return readMessageUnchecked<schema::Node>(raw->getVersion()->encodedNode);
+}
+
+}  // namespace
 
-    Schema candidate(raw->dependencies[mid]);
+schema::Node::Reader Schema::getProto() const {
+  raw->ensureInitialized();
+  return readNode(raw);
+}
 
-    uint64_t candidateId = candidate.getProto().getId();
-    if (candidateId == id) {
-      return candidate;
-    } else if (candidateId < id) {
-      lower = mid + 1;
-    } else {
-      upper = mid;
+Schema Schema::getDependency(uint64_t id) const {
+  raw->ensureInitialized();
+
+  const internal::RawSchema* version = raw->getVersion();
+  const uint32_t* table = version->dependencyTable;
+  const internal::RawSchema* const* dependencies = version->dependencies;
+  uint32_t mask = table[0];
+  const uint32_t* slots = table + 1;
+  for (uint32_t slot = internal::hashSchemaId(id) & mask;
+       slots[slot] != 0; slot = (slot + 1) & mask) {
+    // Don't initialize the dependency yet; it may never be used.
+    const internal::RawSchema* candidate = dependencies[slots[slot] - 1];
+    if (readNode(candidate).getId() == id) {
+      return Schema(candidate);
     }
   }
 
@@ -56,29 +73,31 @@ Schema Schema::getDependency(uint64_t id) const {
 }
 
 StructSchema Schema::asStruct() const {
-  PRECOND(getProto().getBody().which() == schema::Node::Body::STRUCT_NODE,
+  PRECOND(readNode(raw).getBody().which() == schema::Node::Body::STRUCT_NODE,
           "Tried to use non-struct schema as a struct.",
-          getProto().getDisplayName());
+          readNode(raw).getDisplayName());
   return StructSchema(raw);
 }
 
 EnumSchema Schema::asEnum() const {
-  PRECOND(getProto().getBody().which() == schema::Node::Body::ENUM_NODE,
+  PRECOND(readNode(raw).getBody().which() == schema::Node::Body::ENUM_NODE,
           "Tried to use non-enum schema as an enum.",
-          getProto().getDisplayName());
+          readNode(raw).getDisplayName());
   return EnumSchema(raw);
 }
 
 InterfaceSchema Schema::asInterface() const {
-  PRECOND(getProto().getBody().which() == schema::Node::Body::INTERFACE_NODE,
+  PRECOND(readNode(raw).getBody().which() == schema::Node::Body::INTERFACE_NODE,
           "Tried to use non-interface schema as an interface.",
-          getProto().getDisplayName());
+          readNode(raw).getDisplayName());
   return InterfaceSchema(raw);
 }
 
 void Schema::requireUsableAs(const internal::RawSchema* expected) {
+  if (raw != nullptr) raw->ensureInitialized();
   PRECOND(raw == expected ||
-          (raw != nullptr && expected != nullptr && raw->canCastTo == expected),
+          (raw != nullptr && expected != nullptr &&
+           __atomic_load_n(&raw->canCastTo, __ATOMIC_ACQUIRE) == expected),
           "This schema is not compatible with the requested native type.");
 }
 
@@ -86,32 +105,29 @@ void Schema::requireUsableAs(const internal::RawSchema* expected) {
 
 namespace {
 
-template <typename List>
+template <typename MakeList>
 auto findSchemaMemberByName(const internal::RawSchema* raw, Text::Reader name,
-                            uint unionIndex, List&& list)
-    -> Maybe<RemoveReference<decltype(list[0])>> {
-  uint lower = 0;
-  uint upper = raw->memberCount;
-
-  while (lower < upper) {
-    uint mid = (lower + upper) / 2;
-
-    const internal::RawSchema::MemberInfo& member = raw->membersByName[mid];
-
+                            uint unionIndex, MakeList&& makeList)
+    -> Maybe<RemoveReference<decltype(makeList(schema::Node::Reader())[0])>> {
+  // `makeList` returns the list to search given the node, so that the list comes from the same
+  // version as the table.
+  raw->ensureInitialized();
+
+  const internal::RawSchema* version = raw->getVersion();
+  auto list = makeList(readMessageUnchecked<schema::Node>(version->encodedNode));
+  const internal::RawSchema::MemberInfo* membersByName = version->membersByName;
+  const uint32_t* table = version->memberTable;
+  uint32_t mask = table[0];
+  const uint32_t* slots = table + 1;
+
+  for (uint32_t slot = internal::hashMemberName(unionIndex, name.data(), name.size()) & mask;
+       slots[slot] != 0; slot = (slot + 1) & mask) {
+    const internal::RawSchema::MemberInfo& member = membersByName[slots[slot] - 1];
     if (member.unionIndex == unionIndex) {
       auto candidate = list[member.index];
-      Text::Reader candidateName = candidate.getProto().getName();
-      if (candidateName == name) {
+      if (candidate.getProto().getName() == name) {
         return candidate;
-      } else if (candidateName < name) {
-        lower = mid + 1;
-      } else {
-        upper = mid;
       }
-    } else if (member.unionIndex < unionIndex) {
-      lower = mid + 1;
-    } else {
-      upper = mid;
     }
   }
 
@@ -125,7 +141,9 @@ StructSchema::MemberList StructSchema::getMembers() const {
 }
 
 Maybe<StructSchema::Member> StructSchema::findMemberByName(Text::Reader name) const {
-  return findSchemaMemberByName(raw, name, 0, getMembers());
+  return findSchemaMemberByName(raw, name, 0, [this](schema::Node::Reader node) {
+    return MemberList(*this, 0, node.getBody().getStructNode().getMembers());
+  });
 }
 
 StructSchema::Member StructSchema::getMemberByName(Text::Reader name) const {
@@ -139,6 +157,145 @@ Maybe<StructSchema::Union> StructSchema::Member::getContainingUnion() const {
   return parent.getMembers()[unionIndex - 1].asUnion();
 }
 
+namespace {
+
+template <typename T>
+inline uint64_t maskBits(T value) {
+  internal::Mask<T> mask;
+  static_assert(sizeof(mask) == sizeof(value), "Size must match.");
+  memcpy(&mask, &value, sizeof(mask));
+  return static_cast<uint64_t>(mask);
+}
+
+}  // namespace
+
+void StructSchema::Member::decodePlan(internal::MemberPlan& plan) const {
+  plan = internal::MemberPlan();
+
+  auto body = proto.getBody();
+  plan.kind = body.which();
+
+  switch (body.which()) {
+    case schema::StructNode::Member::Body::UNION_MEMBER:
+      plan.offset = body.getUnionMember().getDiscriminantOffset();
+      return;
+
+    case schema::StructNode::Member::Body::FIELD_MEMBER:
+      break;
+  }
+
+  auto field = body.getFieldMember();
+  auto type = field.getType().getBody();
+  auto dval = field.getDefaultValue().getBody();
+  plan.type = type.which();
+  plan.offset = field.getOffset();
+
+  switch (type.which()) {
+    case schema::Type::Body::VOID_TYPE:
+      break;
+
+#define HANDLE_TYPE(discrim, titleCase) \
+    case schema::Type::Body::discrim##_TYPE: \
+      plan.defaultBits = maskBits(dval.get##titleCase##Value()); \
+      break;
+
+    HANDLE_TYPE(BOOL, Bool)
+    HANDLE_TYPE(INT8, Int8)
+    HANDLE_TYPE(INT16, Int16)
+    HANDLE_TYPE(INT32, Int32)
+    HANDLE_TYPE(INT64, Int64)
+    HANDLE_TYPE(UINT8, Uint8)
+    HANDLE_TYPE(UINT16, Uint16)
+    HANDLE_TYPE(UINT32, Uint32)
+    HANDLE_TYPE(UINT64, Uint64)
+    HANDLE_TYPE(FLOAT32, Float32)
+    HANDLE_TYPE(FLOAT64, Float64)
+
+#undef HANDLE_TYPE
+
+    case schema::Type::Body::ENUM_TYPE:
+      plan.defaultBits = dval.getEnumValue();
+      plan.enumType = parent.getDependency(type.getEnumType()).asEnum();
+      break;
+
+    case schema::Type::Body::TEXT_TYPE: {
+      Text::Reader typedDval = dval.getTextValue();
+      plan.defaultPointer = typedDval.data();
+      plan.defaultSize = typedDval.size();
+      break;
+    }
+
+    case schema::Type::Body::DATA_TYPE: {
+      Data::Reader typedDval = dval.getDataValue();
+      plan.defaultPointer = typedDval.data();
+      plan.defaultSize = typedDval.size();
+      break;
+    }
+
+    case schema::Type::Body::LIST_TYPE:
+      plan.defaultPointer = dval.getListValue<internal::UncheckedMessage>();
+      plan.listType = ListSchema::of(type.getListType(), parent);
+      break;
+
+    case schema::Type::Body::STRUCT_TYPE:
+      plan.defaultPointer = dval.getStructValue<internal::UncheckedMessage>();
+      plan.structType = parent.getDependency(type.getStructType()).asStruct();
+      break;
+
+    case schema::Type::Body::OBJECT_TYPE:
+      plan.defaultPointer = dval.getObjectValue<internal::UncheckedMessage>();
+      break;
+
+    case schema::Type::Body::INTERFACE_TYPE:
+      break;
+  }
+}
+
+uint StructSchema::getMemberPlanCount() const {
+  auto members = getMembers();
+  uint count = members.size();
+  for (auto member: members) {
+    if (member.getProto().getBody().which() == schema::StructNode::Member::Body::UNION_MEMBER) {
+      count += member.asUnion().getMembers().size();
+    }
+  }
+  return count;
+}
+
+void StructSchema::decodeMemberPlans(internal::MemberPlan* plans) const {
+  // The struct's own members come first, so that a top-level member's plan is found at its index.
+  // Each union's members follow, at the position recorded in the union's plan.
+  auto members = getMembers();
+  uint pos = members.size();
+  for (auto member: members) {
+    internal::MemberPlan& plan = plans[member.getIndex()];
+    member.decodePlan(plan);
+    if (plan.kind == schema::StructNode::Member::Body::UNION_MEMBER) {
+      plan.unionMemberPlans = pos;
+      for (auto unionMember: member.asUnion().getMembers()) {
+        unionMember.decodePlan(plans[pos++]);
+      }
+    }
+  }
+}
+
+const internal::MemberPlan* StructSchema::initMemberPlans() const {
+  // Only compiled-in structs get here, since SchemaLoader builds plans for every struct it loads.
+  // Like the RawSchema itself, the table lives for the rest of the process.
+  internal::MemberPlan* plans = new internal::MemberPlan[getMemberPlanCount()];
+  decodeMemberPlans(plans);
+
+  const internal::MemberPlan* expected = nullptr;
+  if (__atomic_compare_exchange_n(&raw->getVersion()->memberPlans, &expected, plans, false,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return plans;
+  } else {
+    // Another thread published its table first.
+    delete [] plans;
+    return expected;
+  }
+}
+
 StructSchema::Union StructSchema::Member::asUnion() const {
   PRECOND(proto.getBody().which() == schema::StructNode::Member::Body::UNION_MEMBER,
           "Tried to use non-union struct member as a union.",
@@ -151,7 +308,11 @@ StructSchema::MemberList StructSchema::Union::getMembers() const {
 }
 
 Maybe<StructSchema::Member> StructSchema::Union::findMemberByName(Text::Reader name) const {
-  return findSchemaMemberByName(parent.raw, name, index + 1, getMembers());
+  return findSchemaMemberByName(parent.raw, name, index + 1, [this](schema::Node::Reader node) {
+    // Compatible versions keep each member at the same position, so the union is still here.
+    auto members = node.getBody().getStructNode().getMembers();
+    return MemberList(parent, index + 1, members[index].getBody().getUnionMember().getMembers());
+  });
 }
 
 StructSchema::Member StructSchema::Union::getMemberByName(Text::Reader name) const {
@@ -167,7 +328,9 @@ EnumSchema::EnumerantList EnumSchema::getEnumerants() const {
 }
 
 Maybe<EnumSchema::Enumerant> EnumSchema::findEnumerantByName(Text::Reader name) const {
-  return findSchemaMemberByName(raw, name, 0, getEnumerants());
+  return findSchemaMemberByName(raw, name, 0, [this](schema::Node::Reader node) {
+    return EnumerantList(*this, node.getBody().getEnumNode().getEnumerants());
+  });
 }
 
 EnumSchema::Enumerant EnumSchema::getEnumerantByName(Text::Reader name) const {
@@ -183,7 +346,9 @@ InterfaceSchema::MethodList InterfaceSchema::getMethods() const {
 }
 
 Maybe<InterfaceSchema::Method> InterfaceSchema::findMethodByName(Text::Reader name) const {
-  return findSchemaMemberByName(raw, name, 0, getMethods());
+  return findSchemaMemberByName(raw, name, 0, [this](schema::Node::Reader node) {
+    return MethodList(*this, node.getBody().getInterfaceNode().getMethods());
+  });
 }
 
 InterfaceSchema::Method InterfaceSchema::getMethodByName(Text::Reader name) const {
@@ -75,6 +75,9 @@ public:
   // you want to check if two Schemas represent the same type (but possibly different versions of
   // it), compare their IDs instead.
 
+  inline size_t hashCode() const { return reinterpret_cast<uintptr_t>(raw) / sizeof(void*); }
+  // A hash consistent with operator==, for using Schemas as hash table keys.
+
   template <typename T>
   void requireUsableAs();
   // Throws an exception if a value with this Schema cannot safely be cast to a native value of
@@ -123,7 +126,16 @@ private:
   template <typename T> static inline StructSchema fromImpl() {
     return StructSchema(&internal::rawSchema<T>());
   }
+  uint getMemberPlanCount() const;
+  void decodeMemberPlans(internal::MemberPlan* plans) const;
+  // Size and fill in the plan table laid out as described at RawSchema::memberPlans.
+
+  const internal::MemberPlan* initMemberPlans() const;
+  // Build the plan table for a compiled-in struct and publish it in the RawSchema.  Returns the
+  // table that ended up published, which is another thread's if that thread got there first.
+
   friend class Schema;
+  friend class SchemaLoader;
   friend String internal::debugString(StructReader reader, const RawSchema& schema);
 };
 
@@ -157,7 +169,19 @@ private:
                 schema::StructNode::Member::Reader proto)
       : parent(parent), unionIndex(unionIndex), index(index), proto(proto) {}
 
+  inline const internal::MemberPlan& getPlan() const;
+  // Get this member's precomputed layout.  Compiled-in structs have their plans built the first
+  // time any member's plan is requested.
+
+  void decodePlan(internal::MemberPlan& plan) const;
+  // Decode this member's layout from the schema node.  `unionMemberPlans` is left zero.
+
   friend class StructSchema;
+  friend class SchemaLoader;
+  friend struct DynamicStruct;
+  friend struct DynamicUnion;
+  friend class ColumnExtractor;
+  friend class ColumnarList;
 };
 
 class StructSchema::Union: public Member {
@@ -395,6 +419,46 @@ private:
   friend class Schema;
 };
 
+// -------------------------------------------------------------------
+
+namespace internal {
+
+struct MemberPlan {
+  // The layout of one struct member, decoded from the schema node ahead of time so that the
+  // dynamic API doesn't have to re-read the node on every field access.
+
+  schema::StructNode::Member::Body::Which kind;
+  // Whether the member is a field or a union.
+
+  schema::Type::Body::Which type;
+  // The field's type.  Unused for unions.
+
+  uint32_t offset;
+  // For fields, the offset in multiples of the field's size (pointer fields count pointers).  For
+  // unions, the discriminant's offset.
+
+  uint32_t unionMemberPlans;
+  // For unions, the index in RawSchema::memberPlans of the union's first member.
+
+  uint64_t defaultBits;
+  // For primitive and enum fields, the bits of the default value, i.e. the XOR mask to apply on
+  // load and store.
+
+  const void* defaultPointer;
+  uint32_t defaultSize;
+  // For blob fields, the default value's bytes and byte count.  For other pointer fields, the
+  // default value as an unchecked message, or null if there is none.
+
+  StructSchema structType;
+  EnumSchema enumType;
+  ListSchema listType;
+  // Type of a struct, enum, or list field, respectively.  These refer to the dependencies'
+  // RawSchemas, so they stay valid if a dependency is later replaced by a newer version.  For the
+  // same reason, struct sizes are not cached here.
+};
+
+}  // namespace internal
+
 // =======================================================================================
 // inline implementation
 
@@ -421,6 +485,18 @@ inline void Schema::requireUsableAs() {
 inline bool StructSchema::Member::operator==(const Member& other) const {
   return parent == other.parent && unionIndex == other.unionIndex && index == other.index;
 }
+inline const internal::MemberPlan& StructSchema::Member::getPlan() const {
+  const internal::MemberPlan* plans =
+      __atomic_load_n(&parent.raw->getVersion()->memberPlans, __ATOMIC_ACQUIRE);
+  if (CAPNPROTO_EXPECT_FALSE(plans == nullptr)) {
+    plans = parent.initMemberPlans();
+  }
+  if (unionIndex == 0) {
+    return plans[index];
+  } else {
+    return plans[plans[unionIndex - 1].unionMemberPlans + index];
+  }
+}
 inline bool EnumSchema::Enumerant::operator==(const Enumerant& other) const {
   return parent == other.parent && ordinal == other.ordinal;
 }
@@ -0,0 +1,260 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#define CAPNPROTO_PRIVATE
+#include "serialize-adaptive.h"
+#include "logging.h"
+#include "test.capnp.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <limits>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+class TestOutputStream: public OutputStream {
+public:
+  TestOutputStream(): writeCount(0) {}
+  ~TestOutputStream() {}
+
+  void write(const void* buffer, size_t size) override {
+    data.append(reinterpret_cast<const char*>(buffer), size);
+    ++writeCount;
+  }
+
+  void write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    for (auto& piece: pieces) {
+      data.append(reinterpret_cast<const char*>(piece.begin()), piece.size());
+    }
+    ++writeCount;
+  }
+
+  ArrayPtr<const byte> getBytes() {
+    return arrayPtr(reinterpret_cast<const byte*>(data.data()), data.size());
+  }
+
+  Array<word> getWords() {
+    // Copy into a word-aligned array.
+    Array<word> result = newArray<word>((data.size() + sizeof(word) - 1) / sizeof(word));
+    memset(static_cast<void*>(result.begin()), 0, result.size() * sizeof(word));
+    memcpy(static_cast<void*>(result.begin()), data.data(), data.size());
+    return move(result);
+  }
+
+  uint getWriteCount() { return writeCount; }
+
+private:
+  std::string data;
+  uint writeCount;
+};
+
+AdaptiveWriterOptions forceEncoding(FrameEncoding encoding) {
+  AdaptiveWriterOptions options;
+  switch (encoding) {
+    case FrameEncoding::NONE:
+      options.sampleWords = 0;
+      break;
+    case FrameEncoding::PACKED:
+      options.packThreshold = 0;
+      options.snappyThresholdWords = std::numeric_limits<size_t>::max();
+      break;
+    case FrameEncoding::SNAPPY_PACKED:
+      options.packThreshold = 0;
+      options.snappyThresholdWords = 0;
+      break;
+  }
+  return options;
+}
+
+TEST(SerializeAdaptive, ChooseEncoding) {
+  word zeros[4096];
+  memset(static_cast<void*>(zeros), 0, sizeof(zeros));
+  word ones[4096];
+  memset(static_cast<void*>(ones), 0xff, sizeof(ones));
+
+  ArrayPtr<const word> sparse = arrayPtr(zeros, 64);
+  EXPECT_TRUE(FrameEncoding::PACKED == chooseFrameEncoding(arrayPtr(&sparse, 1)));
+
+  ArrayPtr<const word> dense = arrayPtr(ones, 64);
+  EXPECT_TRUE(FrameEncoding::NONE == chooseFrameEncoding(arrayPtr(&dense, 1)));
+
+  ArrayPtr<const word> bigSparse = arrayPtr(zeros, 4096);
+  EXPECT_TRUE(FrameEncoding::SNAPPY_PACKED == chooseFrameEncoding(arrayPtr(&bigSparse, 1)));
+
+  ArrayPtr<const word> bigDense = arrayPtr(ones, 4096);
+  EXPECT_TRUE(FrameEncoding::NONE == chooseFrameEncoding(arrayPtr(&bigDense, 1)));
+
+  // Samples are spread across segments:  one dense segment followed by three sparse ones of the
+  // same size is mostly zeros overall.
+  ArrayPtr<const word> mixed[4] = {
+    arrayPtr(ones, 256), arrayPtr(zeros, 256), arrayPtr(zeros, 256), arrayPtr(zeros, 256)
+  };
+  EXPECT_TRUE(FrameEncoding::PACKED == chooseFrameEncoding(arrayPtr(mixed, 4)));
+}
+
+TEST(SerializeAdaptive, RoundTrip) {
+  FrameEncoding encodings[3] = {
+    FrameEncoding::NONE, FrameEncoding::PACKED, FrameEncoding::SNAPPY_PACKED
+  };
+
+  for (FrameEncoding encoding: encodings) {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+
+    TestOutputStream output;
+    EXPECT_TRUE(encoding == writeAdaptiveMessage(output, builder, forceEncoding(encoding)));
+
+    ArrayInputStream input(output.getBytes());
+    AdaptiveMessageReader reader(input);
+    EXPECT_TRUE(encoding == reader.getEncoding());
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(SerializeAdaptive, SingleWrite) {
+  // The tag should be merged into the message's own write rather than costing a separate one.
+
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestOutputStream output;
+  writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::NONE));
+  EXPECT_EQ(1u, output.getWriteCount());
+}
+
+TEST(SerializeAdaptive, MixedStream) {
+  TestOutputStream output;
+
+  {
+    MallocMessageBuilder builder;
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::SNAPPY_PACKED));
+  }
+
+  {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().setTextField("second message");
+    writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::NONE));
+  }
+
+  {
+    MallocMessageBuilder builder;
+    builder.initRoot<TestAllTypes>().setTextField("third message");
+    writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::PACKED));
+  }
+
+  ArrayInputStream input(output.getBytes());
+
+  {
+    AdaptiveMessageReader reader(input);
+    EXPECT_TRUE(FrameEncoding::SNAPPY_PACKED == reader.getEncoding());
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+
+  {
+    AdaptiveMessageReader reader(input);
+    EXPECT_TRUE(FrameEncoding::NONE == reader.getEncoding());
+    EXPECT_EQ("second message", reader.getRoot<TestAllTypes>().getTextField());
+  }
+
+  {
+    AdaptiveMessageReader reader(input);
+    EXPECT_TRUE(FrameEncoding::PACKED == reader.getEncoding());
+    EXPECT_EQ("third message", reader.getRoot<TestAllTypes>().getTextField());
+  }
+
+  EXPECT_EQ(0u, input.getReadBuffer().size());
+}
+
+TEST(SerializeAdaptive, ArrayInPlace) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestOutputStream output;
+  writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::NONE));
+  Array<word> words = output.getWords();
+
+  AdaptiveMessageReader reader(arrayPtr(reinterpret_cast<const byte*>(words.begin()),
+                                        reinterpret_cast<const byte*>(words.end())));
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+
+  // Uncompressed frames in an aligned array are not copied.
+  ArrayPtr<const word> segment = reader.getSegment(0);
+  EXPECT_TRUE(segment.begin() > words.begin() && segment.end() <= words.end());
+}
+
+TEST(SerializeAdaptive, ArrayCompressed) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestOutputStream output;
+  writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::SNAPPY_PACKED));
+
+  AdaptiveMessageReader reader(output.getBytes());
+  EXPECT_TRUE(FrameEncoding::SNAPPY_PACKED == reader.getEncoding());
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(SerializeAdaptive, ArrayTruncatedRecordErrors) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestOutputStream output;
+  writeAdaptiveMessage(output, builder, forceEncoding(FrameEncoding::NONE));
+  Array<word> words = output.getWords();
+
+  // Cut off the end of the segment, so that the segment table is wrong.
+  ArrayPtr<const byte> truncated = arrayPtr(reinterpret_cast<const byte*>(words.begin()),
+                                            reinterpret_cast<const byte*>(words.end() - 4));
+
+  EXPECT_ANY_THROW(AdaptiveMessageReader{truncated});
+
+  ReaderOptions options;
+  options.recordErrors = true;
+
+  AdaptiveMessageReader reader(truncated, options);
+  EXPECT_EQ(0, reader.getRoot<TestAllTypes>().getInt32Field());
+  ASSERT_TRUE(reader.hasError());
+  auto description = reader.getError()->getDescription();
+  EXPECT_EQ("expected array.size() >= offset + segmentSize; "
+            "Message ends prematurely in first segment.",
+            std::string(description.begin(), description.size()));
+}
+
+TEST(SerializeAdaptive, RejectUnknownEncoding) {
+  word data[2];
+  memset(static_cast<void*>(data), 0, sizeof(data));
+  reinterpret_cast<WireValue<uint64_t>*>(data)->set(7);
+
+  try {
+    AdaptiveMessageReader reader(arrayPtr(reinterpret_cast<const byte*>(data), sizeof(data)));
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
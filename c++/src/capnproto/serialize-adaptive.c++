@@ -0,0 +1,216 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#define CAPNPROTO_PRIVATE
+#include "serialize-adaptive.h"
+#include "layout.h"
+#include "logging.h"
+
+namespace capnproto {
+
+namespace {
+
+class TaggedOutputStream: public OutputStream {
+  // Prepends the frame tag to the first write, so that it doesn't cost a write of its own.
+
+public:
+  TaggedOutputStream(OutputStream& inner, FrameEncoding encoding)
+      : inner(inner), tagWritten(false) {
+    tag.set(static_cast<uint8_t>(encoding));
+  }
+  ~TaggedOutputStream() {}
+
+  void write(const void* buffer, size_t size) override {
+    if (tagWritten) {
+      inner.write(buffer, size);
+    } else {
+      ArrayPtr<const byte> pieces[2] = {
+        arrayPtr(reinterpret_cast<const byte*>(&tag), sizeof(tag)),
+        arrayPtr(reinterpret_cast<const byte*>(buffer), size)
+      };
+      tagWritten = true;
+      inner.write(arrayPtr(pieces, 2));
+    }
+  }
+
+  void write(ArrayPtr<const ArrayPtr<const byte>> pieces) override {
+    if (tagWritten) {
+      inner.write(pieces);
+    } else {
+      CAPNPROTO_STACK_ARRAY(ArrayPtr<const byte>, allPieces, pieces.size() + 1, 64);
+      allPieces[0] = arrayPtr(reinterpret_cast<const byte*>(&tag), sizeof(tag));
+      for (uint i = 0; i < pieces.size(); i++) {
+        allPieces[i + 1] = pieces[i];
+      }
+      tagWritten = true;
+      inner.write(allPieces);
+    }
+  }
+
+private:
+  OutputStream& inner;
+  internal::WireValue<uint64_t> tag;
+  bool tagWritten;
+};
+
+}  // namespace
+
+FrameEncoding chooseFrameEncoding(ArrayPtr<const ArrayPtr<const word>> segments,
+                                  const AdaptiveWriterOptions& options) {
+  size_t totalWords = 0;
+  for (auto& segment: segments) {
+    totalWords += segment.size();
+  }
+
+  if (totalWords == 0 || options.sampleWords == 0) {
+    return FrameEncoding::NONE;
+  }
+
+  // Sample every stride'th word.  `offset` is the position of the next sample relative to the
+  // start of the current segment.
+  size_t stride = std::max<size_t>(1, totalWords / options.sampleWords);
+  size_t offset = 0;
+  size_t sampledBytes = 0;
+  size_t zeroBytes = 0;
+
+  for (auto& segment: segments) {
+    for (; offset < segment.size(); offset += stride) {
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(segment.begin() + offset);
+      for (uint i = 0; i < sizeof(word); i++) {
+        zeroBytes += bytes[i] == 0;
+      }
+      sampledBytes += sizeof(word);
+    }
+    offset -= segment.size();
+  }
+
+  if (zeroBytes < options.packThreshold * sampledBytes) {
+    return FrameEncoding::NONE;
+  } else if (totalWords >= options.snappyThresholdWords) {
+    return FrameEncoding::SNAPPY_PACKED;
+  } else {
+    return FrameEncoding::PACKED;
+  }
+}
+
+FrameEncoding writeAdaptiveMessage(
+    OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments,
+    const AdaptiveWriterOptions& options,
+    ArrayPtr<byte> snappyBuffer, ArrayPtr<byte> snappyCompressedBuffer) {
+  PRECOND(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  FrameEncoding encoding = chooseFrameEncoding(segments, options);
+  TaggedOutputStream taggedOutput(output, encoding);
+
+  switch (encoding) {
+    case FrameEncoding::NONE:
+      writeMessage(taggedOutput, segments);
+      break;
+    case FrameEncoding::PACKED: {
+      byte buffer[8192];
+      BufferedOutputStreamWrapper bufferedOutput(taggedOutput, arrayPtr(buffer, sizeof(buffer)));
+      writePackedMessage(bufferedOutput, segments);
+      break;
+    }
+    case FrameEncoding::SNAPPY_PACKED:
+      writeSnappyPackedMessage(taggedOutput, segments, snappyBuffer, snappyCompressedBuffer);
+      break;
+  }
+
+  return encoding;
+}
+
+// =======================================================================================
+
+AdaptiveMessageReader::AdaptiveMessageReader(
+    BufferedInputStream& inputStream, ReaderOptions options,
+    ArrayPtr<word> scratchSpace, ArrayPtr<byte> snappyBuffer)
+    : MessageReader(options), encoding(FrameEncoding::NONE), arrayInput(nullptr) {
+  init(inputStream, scratchSpace, snappyBuffer);
+}
+
+AdaptiveMessageReader::AdaptiveMessageReader(
+    ArrayPtr<const byte> array, ReaderOptions options,
+    ArrayPtr<word> scratchSpace, ArrayPtr<byte> snappyBuffer)
+    : MessageReader(options), encoding(FrameEncoding::NONE), arrayInput(array) {
+  if (array.size() >= sizeof(word) &&
+      reinterpret_cast<uintptr_t>(array.begin()) % sizeof(word) == 0) {
+    const word* words = reinterpret_cast<const word*>(array.begin());
+    if (reinterpret_cast<const internal::WireValue<uint64_t>*>(words)->get() ==
+        static_cast<uint8_t>(FrameEncoding::NONE)) {
+      // Uncompressed and aligned:  parse in place.
+      inner = Own<MessageReader>(heap<FlatArrayMessageReader>(
+          arrayPtr(words + 1, words + array.size() / sizeof(word)), options));
+
+      // With recordErrors, a bad segment table is recorded on the inner reader.  Adopt it, since
+      // the caller can only ask us.
+      Maybe<Exception>* record = getErrorRecord();
+      Maybe<const Exception&> error = (*inner)->getError();
+      if (record != nullptr && error != nullptr) {
+        *record = Maybe<Exception>(*error);
+      }
+      return;
+    }
+  }
+
+  init(arrayInput, scratchSpace, snappyBuffer);
+}
+
+AdaptiveMessageReader::~AdaptiveMessageReader() {}
+
+void AdaptiveMessageReader::init(BufferedInputStream& inputStream, ArrayPtr<word> scratchSpace,
+                                 ArrayPtr<byte> snappyBuffer) {
+  internal::WireValue<uint64_t> tag;
+  inputStream.read(&tag, sizeof(tag));
+
+  VALIDATE_INPUT(tag.get() <= static_cast<uint8_t>(FrameEncoding::SNAPPY_PACKED),
+                 "Unknown frame encoding.") {
+    return;
+  }
+
+  encoding = static_cast<FrameEncoding>(tag.get());
+
+  switch (encoding) {
+    case FrameEncoding::NONE:
+      inner = Own<MessageReader>(heap<InputStreamMessageReader>(
+          inputStream, getOptions(), scratchSpace));
+      break;
+    case FrameEncoding::PACKED:
+      inner = Own<MessageReader>(heap<PackedMessageReader>(
+          inputStream, getOptions(), scratchSpace));
+      break;
+    case FrameEncoding::SNAPPY_PACKED:
+      inner = Own<MessageReader>(heap<SnappyPackedMessageReader>(
+          inputStream, getOptions(), scratchSpace, snappyBuffer));
+      break;
+  }
+}
+
+ArrayPtr<const word> AdaptiveMessageReader::getSegment(uint id) {
+  if (inner == nullptr) {
+    return nullptr;
+  } else {
+    return (*inner)->getSegment(id);
+  }
+}
+
+}  // namespace capnproto
@@ -0,0 +1,134 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// This file implements a framing in which each message is individually compressed with
+// whichever encoding suits it:  none, packed, or packed and then Snappy-compressed.  Each frame
+// is:
+//
+// * 64-bit little-endian frame tag (8 bytes).  The low byte is the FrameEncoding; the rest must
+//     be zero.
+// * The message, encoded as by writeMessage(), writePackedMessage(), or
+//     writeSnappyPackedMessage(), respectively.
+//
+// The tag is a full word so that uncompressed frames stay word-aligned, letting a reader parse
+// them in place from a flat array.
+//
+// The writer decides by sampling a handful of words from the message and measuring the fraction
+// of zero bytes, which is what packing removes.  Dense messages (e.g. mostly floating-point data)
+// are sent as-is since packing would cost time for little gain; sparse ones are packed; large
+// sparse ones are also Snappy-compressed, which pays for itself once there is enough data for it
+// to find repetition in.
+
+#ifndef CAPNPROTO_SERIALIZE_ADAPTIVE_H_
+#define CAPNPROTO_SERIALIZE_ADAPTIVE_H_
+
+#include "serialize.h"
+#include "serialize-packed.h"
+#include "serialize-snappy.h"
+
+namespace capnproto {
+
+enum class FrameEncoding: uint8_t {
+  NONE = 0,
+  PACKED = 1,
+  SNAPPY_PACKED = 2
+};
+
+struct AdaptiveWriterOptions {
+  // Options controlling how writeAdaptiveMessage() picks an encoding.
+
+  double packThreshold = 0.25;
+  // Minimum fraction of zero bytes in the sample for the message to be packed.  Packing costs one
+  // tag byte per word, so it saves bandwidth once more than 1/8 of the bytes are zero; the default
+  // leaves some margin to pay for the CPU time spent packing.
+
+  size_t snappyThresholdWords = 2048;
+  // Sparse messages at least this large are packed and then Snappy-compressed.  Set to
+  // std::numeric_limits<size_t>::max() to never use Snappy.
+
+  uint sampleWords = 64;
+  // How many words to sample, spread evenly across the message.  Zero means always use NONE.
+};
+
+FrameEncoding chooseFrameEncoding(ArrayPtr<const ArrayPtr<const word>> segments,
+                                  const AdaptiveWriterOptions& options = AdaptiveWriterOptions());
+// Returns the encoding writeAdaptiveMessage() would use for these segments.
+
+FrameEncoding writeAdaptiveMessage(
+    OutputStream& output, MessageBuilder& builder,
+    const AdaptiveWriterOptions& options = AdaptiveWriterOptions(),
+    ArrayPtr<byte> snappyBuffer = nullptr, ArrayPtr<byte> snappyCompressedBuffer = nullptr);
+FrameEncoding writeAdaptiveMessage(
+    OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments,
+    const AdaptiveWriterOptions& options = AdaptiveWriterOptions(),
+    ArrayPtr<byte> snappyBuffer = nullptr, ArrayPtr<byte> snappyCompressedBuffer = nullptr);
+// Write one tagged frame, returning the encoding chosen.  The buffers are passed through to
+// SnappyOutputStream if the message ends up Snappy-compressed.
+
+class AdaptiveMessageReader: public MessageReader {
+  // Reads one frame written by writeAdaptiveMessage(), dispatching on its tag to
+  // InputStreamMessageReader (or FlatArrayMessageReader), PackedMessageReader, or
+  // SnappyPackedMessageReader.
+
+public:
+  AdaptiveMessageReader(BufferedInputStream& inputStream, ReaderOptions options = ReaderOptions(),
+                        ArrayPtr<word> scratchSpace = nullptr,
+                        ArrayPtr<byte> snappyBuffer = nullptr);
+  // Reads a frame from a stream.
+
+  AdaptiveMessageReader(ArrayPtr<const byte> array, ReaderOptions options = ReaderOptions(),
+                        ArrayPtr<word> scratchSpace = nullptr,
+                        ArrayPtr<byte> snappyBuffer = nullptr);
+  // Reads a frame from a byte array, which must remain valid until the reader is destroyed.  If
+  // the frame is uncompressed and the array is word-aligned, the message is used in place.
+
+  CAPNPROTO_DISALLOW_COPY(AdaptiveMessageReader);
+  ~AdaptiveMessageReader();
+
+  inline FrameEncoding getEncoding() { return encoding; }
+  // The encoding found in the frame tag.
+
+  // implements MessageReader ----------------------------------------
+  ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  FrameEncoding encoding;
+  ArrayInputStream arrayInput;          // Only used when constructed from an array.
+  Maybe<Own<MessageReader>> inner;      // Null if the tag was invalid.
+
+  void init(BufferedInputStream& inputStream, ArrayPtr<word> scratchSpace,
+            ArrayPtr<byte> snappyBuffer);
+};
+
+// =======================================================================================
+// inline stuff
+
+inline FrameEncoding writeAdaptiveMessage(
+    OutputStream& output, MessageBuilder& builder, const AdaptiveWriterOptions& options,
+    ArrayPtr<byte> snappyBuffer, ArrayPtr<byte> snappyCompressedBuffer) {
+  return writeAdaptiveMessage(output, builder.getSegmentsForOutput(), options,
+                              snappyBuffer, snappyCompressedBuffer);
+}
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_SERIALIZE_ADAPTIVE_H_
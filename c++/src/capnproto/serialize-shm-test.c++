@@ -0,0 +1,272 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "serialize-shm.h"
+#include "logging.h"
+#include "test.capnp.h"
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+TEST(SerializeShm, RoundTrip) {
+  ShmRing ring(65536);
+
+  {
+    ShmMessageBuilder builder(ring);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    builder.send();
+  }
+
+  {
+    ShmMessageReader reader(ring);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(SerializeShm, MultiSegment) {
+  ShmRing ring(65536);
+
+  {
+    // Force every object into its own segment.
+    ShmMessageBuilder builder(ring, 0);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    EXPECT_GT(builder.getSegmentsForOutput().size(), 1u);
+    builder.send();
+  }
+
+  {
+    ShmMessageReader reader(ring);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+}
+
+TEST(SerializeShm, WrapAround) {
+  // A small ring forces messages to wrap around many times.
+  ShmRing ring(1024);
+
+  for (uint i = 0; i < 100; i++) {
+    {
+      ShmMessageBuilder builder(ring, i % 7);
+      initTestMessage(builder.initRoot<TestAllTypes>());
+      builder.send();
+    }
+
+    {
+      ShmMessageReader reader(ring);
+      checkTestMessage(reader.getRoot<TestAllTypes>());
+    }
+  }
+}
+
+TEST(SerializeShm, Pipelined) {
+  ShmRing ring(4096);
+
+  for (uint i = 0; i < 3; i++) {
+    ShmMessageBuilder builder(ring, 16);
+    builder.initRoot<TestAllTypes>().setUInt32Field(i);
+    builder.send();
+  }
+
+  for (uint i = 0; i < 3; i++) {
+    ShmMessageReader reader(ring);
+    EXPECT_EQ(i, reader.getRoot<TestAllTypes>().getUInt32Field());
+  }
+}
+
+TEST(SerializeShm, Abandoned) {
+  ShmRing ring(4096);
+
+  {
+    ShmMessageBuilder builder(ring);
+    builder.initRoot<TestAllTypes>().setUInt32Field(123);
+    // Not sent.
+  }
+
+  {
+    ShmMessageBuilder builder(ring);
+    builder.initRoot<TestAllTypes>().setTextField("foo");
+    builder.send();
+  }
+
+  {
+    ShmMessageReader reader(ring);
+    auto root = reader.getRoot<TestAllTypes>();
+    EXPECT_EQ(0u, root.getUInt32Field());
+    EXPECT_EQ("foo", root.getTextField());
+  }
+}
+
+TEST(SerializeShm, TooLarge) {
+  ShmRing ring(64);
+
+  ShmMessageBuilder builder(ring);
+  try {
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+}
+
+TEST(SerializeShm, FirstSegmentTooLarge) {
+  // The header is reserved before the first segment is found not to fit.  It must be given back,
+  // or the next message would be published behind an empty header.
+  ShmRing ring(64);
+
+  {
+    ShmMessageBuilder builder(ring);
+    EXPECT_ANY_THROW(builder.allocateSegment(100));
+  }
+
+  {
+    ShmMessageBuilder builder(ring);
+    builder.initRoot<TestAllTypes>().setUInt32Field(123);
+    builder.send();
+  }
+
+  {
+    ShmMessageReader reader(ring);
+    EXPECT_EQ(123u, reader.getRoot<TestAllTypes>().getUInt32Field());
+  }
+}
+
+TEST(SerializeShm, CrossProcess) {
+  ShmRing requests(1024);
+  ShmRing responses(1024);
+
+  pid_t child = fork();
+  ASSERT_GE(child, 0);
+
+  if (child == 0) {
+    // Echo each request's uint32 field back, plus one.
+    for (uint i = 0; i < 1000; i++) {
+      ShmMessageReader reader(requests);
+      ShmMessageBuilder builder(responses);
+      builder.initRoot<TestAllTypes>().setUInt32Field(
+          reader.getRoot<TestAllTypes>().getUInt32Field() + 1);
+      builder.send();
+    }
+    _exit(0);
+  }
+
+  for (uint i = 0; i < 1000; i++) {
+    {
+      ShmMessageBuilder builder(requests);
+      initTestMessage(builder.initRoot<TestAllTypes>());
+      builder.getRoot<TestAllTypes>().setUInt32Field(i);
+      builder.send();
+    }
+
+    {
+      ShmMessageReader reader(responses);
+      EXPECT_EQ(i + 1, reader.getRoot<TestAllTypes>().getUInt32Field());
+    }
+  }
+
+  int status;
+  ASSERT_EQ(child, waitpid(child, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(SerializeShm, Corrupt) {
+  ShmRing ring(4096);
+
+  // Map the ring a second time so that we can scribble on it.  The data area starts 4096 bytes in.
+  size_t size = 4096 + 4096 * sizeof(word);
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.getFd(), 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  uint32_t* data = reinterpret_cast<uint32_t*>(reinterpret_cast<char*>(mapping) + 4096);
+
+  for (uint i = 0; i < 3; i++) {
+    ShmMessageBuilder builder(ring, 16);
+    builder.initRoot<TestAllTypes>().setUInt32Field(i);
+    builder.send();
+  }
+
+  // Make the first message's only segment claim to be bigger than the space allocated for it.
+  data[3] = data[2] + 1;
+  EXPECT_ANY_THROW(ShmMessageReader reader(ring));
+
+  // The corrupt message was skipped, and the ring is still usable.
+  for (uint i = 1; i < 3; i++) {
+    ShmMessageReader reader(ring);
+    EXPECT_EQ(i, reader.getRoot<TestAllTypes>().getUInt32Field());
+  }
+
+  // Enough traffic to wrap around the ring several times, which would block if the space of the
+  // corrupt message had not been released.  Each message also checks that it got zeroed space.
+  for (uint i = 0; i < 1000; i++) {
+    {
+      ShmMessageBuilder builder(ring, 16);
+      builder.initRoot<TestAllTypes>().setUInt32Field(i);
+      builder.send();
+    }
+    {
+      ShmMessageReader reader(ring);
+      auto root = reader.getRoot<TestAllTypes>();
+      EXPECT_EQ(i, root.getUInt32Field());
+      EXPECT_EQ(0, root.getInt32Field());
+    }
+  }
+
+  munmap(mapping, size);
+}
+
+TEST(SerializeShm, NotARing) {
+  // A file that is the right size but doesn't hold a ring is rejected.
+  ShmRing ring(4096);
+  AutoCloseFd fd(dup(ring.getFd()));
+  void* mapping = mmap(nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ASSERT_NE(MAP_FAILED, mapping);
+  memset(mapping, 0, 8);  // Clobber the magic number.
+  munmap(mapping, 4096);
+
+  EXPECT_ANY_THROW(ShmRing other{move(fd)});
+}
+
+TEST(SerializeShm, PassFd) {
+  ShmRing ring(4096);
+  ShmRing other{AutoCloseFd(dup(ring.getFd()))};
+
+  {
+    ShmMessageBuilder builder(ring);
+    builder.initRoot<TestAllTypes>().setTextField("through another mapping");
+    builder.send();
+  }
+
+  {
+    ShmMessageReader reader(other);
+    EXPECT_EQ("through another mapping", reader.getRoot<TestAllTypes>().getTextField());
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
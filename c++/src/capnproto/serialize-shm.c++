@@ -0,0 +1,475 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "serialize-shm.h"
+#include "logging.h"
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace capnproto {
+
+namespace {
+
+constexpr uint64_t RING_MAGIC = 0x676e69722d706e63ull;  // "cnp-ring"
+constexpr size_t HEADER_SPACE = 4096;
+constexpr uint32_t PADDING = 0xffffffffu;
+constexpr uint MAX_SEGMENTS = 512;
+constexpr uint SPIN_COUNT = 256;
+
+struct MessageHeader {
+  uint32_t segmentCount;
+  uint32_t totalWords;
+};
+
+struct ChunkHeader {
+  uint32_t allocatedWords;
+  uint32_t usedWords;
+};
+
+static_assert(sizeof(MessageHeader) == sizeof(word), "MessageHeader must be one word.");
+static_assert(sizeof(ChunkHeader) == sizeof(word), "ChunkHeader must be one word.");
+
+inline MessageHeader* messageHeaderAt(word* ptr) { return reinterpret_cast<MessageHeader*>(ptr); }
+inline ChunkHeader* chunkHeaderAt(word* ptr) { return reinterpret_cast<ChunkHeader*>(ptr); }
+
+inline void zeroWords(word* ptr, size_t count) {
+  memset(static_cast<void*>(ptr), 0, count * sizeof(word));
+}
+
+void futexWait(std::atomic<uint32_t>* futex, uint32_t expected) {
+  // Spurious returns (EINTR, EAGAIN) are fine since all callers re-check their condition.
+  syscall(SYS_futex, futex, FUTEX_WAIT, expected, nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>* futex) {
+  syscall(SYS_futex, futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline void cpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#endif
+}
+
+uint64_t roundUpToPowerOfTwo(uint64_t n) {
+  uint64_t result = 1;
+  while (result < n) result <<= 1;
+  return result;
+}
+
+}  // namespace
+
+struct ShmRing::Header {
+  // Lives at the start of the shared mapping.  The producer and consumer halves are kept on
+  // separate cache lines so that the two sides don't fight over them.
+
+  uint64_t magic;
+  uint64_t capacity;  // in words
+
+  alignas(64) std::atomic<uint64_t> head;
+  // Position up to which messages have been published.  Written only by the producer.
+  std::atomic<uint32_t> headFutex;
+  std::atomic<uint32_t> consumerWaiting;
+
+  alignas(64) std::atomic<uint64_t> tail;
+  // Position up to which space has been released.  Written only by the consumer.
+  std::atomic<uint32_t> tailFutex;
+  std::atomic<uint32_t> producerWaiting;
+};
+
+// Waits until `position` no longer equals `seen`, using `futex` to sleep and `waiting` to tell
+// the other side that it needs to wake us.
+static uint64_t awaitChange(std::atomic<uint64_t>& position, uint64_t seen,
+                            std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiting) {
+  // Messages tend to come in bursts, so spin briefly before going to sleep.
+  for (uint i = 0; i < SPIN_COUNT; i++) {
+    uint64_t current = position.load(std::memory_order_acquire);
+    if (current != seen) return current;
+    cpuRelax();
+  }
+
+  for (;;) {
+    // The other side stores `position` before loading `waiting` and we store `waiting` before
+    // loading `position`.  Both are sequentially consistent, so at least one of us sees the
+    // other's store, and a wakeup can't be lost.
+    waiting.store(1);
+    uint32_t sequence = futex.load();
+    uint64_t current = position.load();
+    if (current != seen) {
+      waiting.store(0, std::memory_order_relaxed);
+      return current;
+    }
+    futexWait(&futex, sequence);
+  }
+}
+
+static void advance(std::atomic<uint64_t>& position, uint64_t value,
+                    std::atomic<uint32_t>& futex, std::atomic<uint32_t>& waiting) {
+  position.store(value);
+  if (waiting.load()) {
+    waiting.store(0, std::memory_order_relaxed);
+    futex.fetch_add(1);
+    futexWake(&futex);
+  }
+}
+
+// =======================================================================================
+
+ShmRing::ShmRing(size_t capacityInWords)
+    : fd(SYSCALL(memfd_create("capnproto-shm-ring", MFD_CLOEXEC))),
+      header(nullptr), data(nullptr), capacity(roundUpToPowerOfTwo(capacityInWords)),
+      writePos(0), building(false), reading(false) {
+  static_assert(sizeof(Header) <= HEADER_SPACE, "ShmRing::Header too big.");
+  PRECOND(capacity >= 4 && capacity <= (uint64_t(1) << 32),
+          "ShmRing capacity must be between 4 and 2^32 words.", capacityInWords);
+
+  mappedSize = HEADER_SPACE + capacity * sizeof(word);
+  SYSCALL(ftruncate(fd, mappedSize), mappedSize);
+  map();
+
+  // The file is initially all zeros, which is exactly what we want for the data area.
+  new (header) Header;
+  header->magic = RING_MAGIC;
+  header->capacity = capacity;
+  header->head.store(0);
+  header->headFutex.store(0);
+  header->consumerWaiting.store(0);
+  header->tail.store(0);
+  header->tailFutex.store(0);
+  header->producerWaiting.store(0);
+}
+
+ShmRing::ShmRing(AutoCloseFd fd)
+    : fd(move(fd)), header(nullptr), data(nullptr), capacity(0),
+      writePos(0), building(false), reading(false) {
+  struct stat stats;
+  SYSCALL(fstat(this->fd, &stats));
+  VALIDATE_INPUT(stats.st_size > (off_t)HEADER_SPACE, "Not a ShmRing.", stats.st_size) {
+    return;
+  }
+  mappedSize = stats.st_size;
+  map();
+
+  bool valid = header->magic == RING_MAGIC &&
+      header->capacity >= 4 && header->capacity <= (uint64_t(1) << 32) &&
+      (header->capacity & (header->capacity - 1)) == 0 &&
+      mappedSize == HEADER_SPACE + header->capacity * sizeof(word);
+  if (!valid) {
+    // Unmap before reporting, since the destructor won't run if the report throws.
+    unmap();
+  }
+  VALIDATE_INPUT(valid, "Not a ShmRing.") {
+    return;
+  }
+  capacity = header->capacity;
+
+  // If we end up being the producer, pick up where the previous one left off.
+  writePos = header->head.load();
+}
+
+ShmRing::~ShmRing() {
+  unmap();
+}
+
+void ShmRing::map() {
+  void* mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    FAIL_SYSCALL("mmap", errno, mappedSize);
+  }
+  header = reinterpret_cast<Header*>(mapping);
+  data = reinterpret_cast<word*>(reinterpret_cast<byte*>(mapping) + HEADER_SPACE);
+}
+
+void ShmRing::unmap() {
+  if (header != nullptr) {
+    if (munmap(header, mappedSize) < 0) {
+      FAIL_RECOVERABLE_SYSCALL("munmap", errno);
+    }
+    header = nullptr;
+    data = nullptr;
+  }
+}
+
+word* ShmRing::allocateChunk(uint64_t messageStart, uint minimumSize, uint& size) {
+  uint64_t needed = uint64_t(minimumSize) + 1;
+
+  for (;;) {
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+    uint64_t free = capacity - (writePos - tail);
+    uint64_t contiguous = capacity - (writePos & (capacity - 1));
+
+    if (contiguous < needed) {
+      // The chunk won't fit before the end of the ring.  Pad out the rest and wrap around.
+      PRECOND(writePos - messageStart + contiguous + needed <= capacity,
+              "Message is too large for the ShmRing.", capacity);
+      if (free >= contiguous) {
+        ChunkHeader* padding = chunkHeaderAt(at(writePos));
+        padding->allocatedWords = contiguous - 1;
+        padding->usedWords = PADDING;
+        writePos += contiguous;
+        continue;
+      }
+    } else {
+      PRECOND(writePos - messageStart + needed <= capacity,
+              "Message is too large for the ShmRing.", capacity);
+      uint64_t available = std::min(free, contiguous);
+      if (available >= needed) {
+        size = std::min<uint64_t>(size, available - 1);
+        ChunkHeader* chunk = chunkHeaderAt(at(writePos));
+        chunk->allocatedWords = size;
+        chunk->usedWords = 0;
+        word* result = at(writePos) + 1;
+        writePos += size + 1;
+        return result;
+      }
+    }
+
+    // Not enough free space.  Wait for the consumer to release some.
+    awaitChange(header->tail, tail, header->tailFutex, header->producerWaiting);
+  }
+}
+
+void ShmRing::publish() {
+  advance(header->head, writePos, header->headFutex, header->consumerWaiting);
+}
+
+uint64_t ShmRing::awaitMessage() {
+  uint64_t tail = header->tail.load(std::memory_order_relaxed);
+  if (header->head.load(std::memory_order_acquire) == tail) {
+    awaitChange(header->head, tail, header->headFutex, header->consumerWaiting);
+  }
+  return tail;
+}
+
+void ShmRing::release(uint64_t newTail) {
+  advance(header->tail, newTail, header->tailFutex, header->producerWaiting);
+}
+
+void ShmRing::zero(uint64_t begin, uint64_t end) {
+  while (begin < end) {
+    uint64_t contiguous = capacity - (begin & (capacity - 1));
+    uint64_t amount = std::min(contiguous, end - begin);
+    zeroWords(at(begin), amount);
+    begin += amount;
+  }
+}
+
+// =======================================================================================
+
+ShmMessageBuilder::ShmMessageBuilder(ShmRing& ring, uint firstSegmentWords)
+    : ring(ring), nextSize(firstSegmentWords), messageStart(ring.writePos),
+      segmentCount(0), sent(false) {
+  PRECOND(!ring.building, "Only one ShmMessageBuilder may exist per ShmRing at a time.");
+  ring.building = true;
+}
+
+ShmMessageBuilder::~ShmMessageBuilder() {
+  if (!sent && ring.writePos != messageStart) {
+    // Abandoned.  Nothing was published, so we can simply zero what we used and rewind.  This
+    // includes the case where the first segment didn't fit after the header was reserved.
+    ring.zero(messageStart, ring.writePos);
+    ring.writePos = messageStart;
+  }
+  ring.building = false;
+}
+
+ArrayPtr<word> ShmMessageBuilder::allocateSegment(uint minimumSize) {
+  PRECOND(!sent, "Can't modify a ShmMessageBuilder after send().");
+
+  if (ring.writePos == messageStart) {
+    // Reserve space for the message header.
+    uint size = 0;
+    ring.allocateChunk(messageStart, 0, size);
+  }
+
+  PRECOND(segmentCount < MAX_SEGMENTS, "Message has too many segments.");
+
+  uint size = std::max(minimumSize, nextSize);
+  word* result = ring.allocateChunk(messageStart, minimumSize, size);
+  nextSize += size;
+  ++segmentCount;
+
+  return arrayPtr(result, size);
+}
+
+void ShmMessageBuilder::send() {
+  PRECOND(!sent, "ShmMessageBuilder::send() called twice.");
+
+  ArrayPtr<const ArrayPtr<const word>> segments = getSegmentsForOutput();
+  PRECOND(segments.size() > 0, "Tried to send uninitialized message.");
+  DCHECK(segments.size() == segmentCount, "Segments don't match allocations?");
+
+  for (auto& segment: segments) {
+    chunkHeaderAt(const_cast<word*>(segment.begin()) - 1)->usedWords = segment.size();
+  }
+
+  // The last segment was the last thing allocated, so we can give back whatever it didn't use.
+  ChunkHeader* last = chunkHeaderAt(const_cast<word*>(segments.back().begin()) - 1);
+  ring.writePos -= last->allocatedWords - last->usedWords;
+  last->allocatedWords = last->usedWords;
+
+  MessageHeader* messageHeader = messageHeaderAt(ring.at(messageStart));
+  messageHeader->segmentCount = segments.size();
+  messageHeader->totalWords = ring.writePos - messageStart;
+
+  ring.publish();
+  sent = true;
+}
+
+// =======================================================================================
+
+ShmMessageReader::ShmMessageReader(ShmRing& ring, ReaderOptions options)
+    : MessageReader(options), ring(ring), messageStart(0), messageEnd(0), padding(nullptr) {
+  PRECOND(!ring.reading, "Only one ShmMessageReader may exist per ShmRing at a time.");
+  ring.reading = true;
+
+  messageStart = ring.awaitMessage();
+
+  try {
+    readRecord();
+  } catch (...) {
+    // The record was corrupt and the report threw, so our destructor won't run.  Skip the record
+    // here, or the next reader would trip over `reading` and the producer would never get the
+    // space back.
+    discard();
+    releaseRecord();
+    throw;
+  }
+}
+
+void ShmMessageReader::readRecord() {
+  uint64_t head = ring.header->head.load(std::memory_order_acquire);
+
+  MessageHeader* messageHeader = messageHeaderAt(ring.at(messageStart));
+  uint segmentCount = messageHeader->segmentCount;
+  uint64_t totalWords = messageHeader->totalWords;
+
+  // Decide how much to skip before reporting anything, in case the report throws.
+  bool headerValid = totalWords > 1 && totalWords <= head - messageStart;
+  messageEnd = headerValid ? messageStart + totalWords : head;
+
+  VALIDATE_INPUT(headerValid, "ShmRing message header is corrupt.") {
+    // We don't know where the record ends, so we skip everything published so far.
+    return;
+  }
+
+  VALIDATE_INPUT(segmentCount > 0 && segmentCount < MAX_SEGMENTS,
+                 "Message has too many segments.") {
+    return;
+  }
+
+  if (segmentCount > 1) {
+    moreSegments = newArray<ArrayPtr<const word>>(segmentCount - 1);
+  }
+
+  uint64_t pos = messageStart + 1;
+  for (uint i = 0; i < segmentCount; i++) {
+    VALIDATE_INPUT(pos < messageEnd, "ShmRing message ends prematurely.") {
+      discard();
+      return;
+    }
+
+    ChunkHeader* chunk = chunkHeaderAt(ring.at(pos));
+    uint64_t contiguous = ring.capacity - (pos & (ring.capacity - 1));
+
+    if (chunk->usedWords == PADDING) {
+      VALIDATE_INPUT(padding == nullptr && chunk->allocatedWords + 1 == contiguous,
+                     "ShmRing padding is corrupt.") {
+        discard();
+        return;
+      }
+      padding = ring.at(pos);
+      pos += contiguous;
+      --i;
+      continue;
+    }
+
+    VALIDATE_INPUT(chunk->usedWords <= chunk->allocatedWords &&
+                   chunk->allocatedWords < contiguous &&
+                   pos + 1 + chunk->allocatedWords <= messageEnd,
+                   "ShmRing segment is corrupt.") {
+      discard();
+      return;
+    }
+
+    ArrayPtr<const word> segment = arrayPtr(ring.at(pos) + 1, chunk->usedWords);
+    if (i == 0) {
+      segment0 = segment;
+    } else {
+      moreSegments[i - 1] = segment;
+    }
+    pos += 1 + chunk->allocatedWords;
+  }
+}
+
+void ShmMessageReader::discard() {
+  segment0 = nullptr;
+  moreSegments = nullptr;
+}
+
+ShmMessageReader::~ShmMessageReader() {
+  releaseRecord();
+}
+
+void ShmMessageReader::releaseRecord() {
+  if (messageEnd > messageStart) {
+    // Hand back zeroed space, as MessageBuilder expects.  We only zero words that were actually
+    // written:  the headers and the used part of each segment.
+    if (segment0 == nullptr) {
+      // The message was malformed, so we don't know what was written.  Zero it all.
+      ring.zero(messageStart, messageEnd);
+    } else {
+      zeroWords(ring.at(messageStart), 1);
+      if (padding != nullptr) {
+        zeroWords(padding, 1);
+      }
+      zeroWords(const_cast<word*>(segment0.begin()) - 1, segment0.size() + 1);
+      for (auto& segment: moreSegments) {
+        zeroWords(const_cast<word*>(segment.begin()) - 1, segment.size() + 1);
+      }
+    }
+
+    ring.release(messageEnd);
+  }
+  ring.reading = false;
+}
+
+ArrayPtr<const word> ShmMessageReader::getSegment(uint id) {
+  if (id == 0) {
+    return segment0;
+  } else if (id <= moreSegments.size()) {
+    return moreSegments[id - 1];
+  } else {
+    return nullptr;
+  }
+}
+
+}  // namespace capnproto
@@ -0,0 +1,183 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// This file implements a same-host transport which passes messages through a single-producer,
+// single-consumer ring buffer in shared memory.  The producer builds its message directly inside
+// the ring -- each segment returned by MessageBuilder::allocateSegment() is carved out of the ring
+// -- and the consumer reads the segments in place.  Compared to writing to a pipe, this saves two
+// copies and at least two system calls per message.  When either side has to wait, it sleeps on
+// a futex, so an idle ring costs nothing.
+//
+// The ring consists of a sequence of records, one per message:
+//
+// * One word message header:  32-bit segment count, then 32-bit total record size in words
+//   (including all headers).
+// * For each segment, one word chunk header (32-bit allocated size, then 32-bit used size)
+//   followed by the allocated space.  The first "used size" words of the space are the segment.
+// * If a segment would not fit before the end of the ring, a padding chunk (whose used size is
+//   0xffffffff) fills out the ring and the segment begins at the start of the ring.  Since a
+//   record can never be larger than the ring, each record contains at most one padding chunk.
+//
+// All sizes are native-endian, since both ends are necessarily on the same machine.  The consumer
+// zeroes every word it has read before releasing it back to the producer, so that the builder
+// always receives zeroed space as MessageBuilder requires.
+//
+// The format of the ring is not a security boundary:  the consumer checks that the record is
+// well-formed, but a malicious producer sharing the memory could still modify a message while it
+// is being read.  Only share rings with processes you trust.
+
+#ifndef CAPNPROTO_SERIALIZE_SHM_H_
+#define CAPNPROTO_SERIALIZE_SHM_H_
+
+#include "message.h"
+#include "io.h"
+
+namespace capnproto {
+
+constexpr size_t SHM_RING_DEFAULT_WORDS = 1024 * 1024;
+
+class ShmRing {
+  // A ring buffer in shared memory, backed by an anonymous memfd.  The ring can be shared with a
+  // child process simply by fork()ing, or with an unrelated process by sending getFd() over a unix
+  // socket and constructing a ShmRing from it on the other end.
+  //
+  // Exactly one process may write to the ring (using ShmMessageBuilder) and exactly one process
+  // may read from it (using ShmMessageReader).  Within each process, only one builder or reader
+  // may exist for the ring at a time.
+
+public:
+  explicit ShmRing(size_t capacityInWords = SHM_RING_DEFAULT_WORDS);
+  // Creates a new ring.  The capacity is rounded up to a power of two.  It must be large enough
+  // to hold the largest message you intend to send, plus a few words of headers.
+
+  explicit ShmRing(AutoCloseFd fd);
+  // Maps an existing ring, e.g. one received from another process.
+
+  CAPNPROTO_DISALLOW_COPY(ShmRing);
+  ~ShmRing();
+
+  inline int getFd() { return fd.get(); }
+
+private:
+  struct Header;
+
+  AutoCloseFd fd;
+  Header* header;
+  word* data;
+  size_t mappedSize;
+  uint64_t capacity;
+
+  // Producer state, local to the writing process.
+  uint64_t writePos;
+  bool building;
+
+  // Consumer state, local to the reading process.
+  bool reading;
+
+  void map();
+  void unmap();
+
+  word* allocateChunk(uint64_t messageStart, uint minimumSize, uint& size);
+  // Carves a chunk of at least minimumSize and at most `size` words out of the ring, waiting for
+  // the consumer to free space if necessary.  On return, `size` is the actual size.
+
+  void publish();
+  // Makes everything up to writePos visible to the consumer.
+
+  uint64_t awaitMessage();
+  // Waits until at least one message is available and returns the ring's tail position.
+
+  void release(uint64_t newTail);
+  // Releases everything before newTail back to the producer.
+
+  word* at(uint64_t pos) { return data + (pos & (capacity - 1)); }
+
+  void zero(uint64_t begin, uint64_t end);
+
+  friend class ShmMessageBuilder;
+  friend class ShmMessageReader;
+};
+
+class ShmMessageBuilder: public MessageBuilder {
+  // A MessageBuilder which allocates its segments directly inside a ShmRing.  Once the message is
+  // complete, call send() to hand it to the consumer.  The builder must not be touched after
+  // send() except to destroy it, since the consumer may already be reading -- and then reusing --
+  // its memory.
+  //
+  // If the builder is destroyed without calling send(), the message is discarded.
+
+public:
+  explicit ShmMessageBuilder(ShmRing& ring, uint firstSegmentWords = SUGGESTED_FIRST_SEGMENT_WORDS);
+  CAPNPROTO_DISALLOW_COPY(ShmMessageBuilder);
+  ~ShmMessageBuilder();
+
+  void send();
+  // Publish the message to the consumer.
+
+  virtual ArrayPtr<word> allocateSegment(uint minimumSize) override;
+
+private:
+  ShmRing& ring;
+  uint nextSize;
+  uint64_t messageStart;
+  uint segmentCount;
+  bool sent;
+};
+
+class ShmMessageReader: public MessageReader {
+  // Reads the next message from a ShmRing, waiting for one to arrive if necessary.  The segments
+  // are read in place, without copying.  The message's space is released back to the producer
+  // when the reader is destroyed, so don't hold on to readers longer than necessary, or the
+  // producer will block once the ring fills up.
+
+public:
+  explicit ShmMessageReader(ShmRing& ring, ReaderOptions options = ReaderOptions());
+  CAPNPROTO_DISALLOW_COPY(ShmMessageReader);
+  ~ShmMessageReader();
+
+  // implements MessageReader ----------------------------------------
+  ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  ShmRing& ring;
+  uint64_t messageStart;
+  uint64_t messageEnd;
+  word* padding;
+
+  // Optimize for single-segment case.
+  ArrayPtr<const word> segment0;
+  Array<ArrayPtr<const word>> moreSegments;
+
+  void readRecord();
+  // Parses the record at messageStart.  Sets messageEnd before reporting any problem.
+
+  void discard();
+  // Called when the message is malformed.  Makes the message appear empty.
+
+  void releaseRecord();
+  // Zeroes the record and hands its space back to the producer.
+};
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_SERIALIZE_SHM_H_
@@ -253,6 +253,169 @@ TEST(Snappy, RoundTripTwoMessages) {
   EXPECT_TRUE(pipe.allRead());
 }
 
+TEST(Snappy, UnpackedRoundTrip) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  SnappyMessageReader reader(pipe);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedRoundTripManySegments) {
+  // More segments than writeSnappyMessage() keeps on the stack.
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  static const word EMPTY[1] = {};
+  Array<ArrayPtr<const word>> segments = newArray<ArrayPtr<const word>>(300);
+  segments[0] = builder.getSegmentsForOutput()[0];
+  for (uint i = 1; i < segments.size(); i++) {
+    segments[i] = arrayPtr(EMPTY, 1);
+  }
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, segments);
+
+  ReaderOptions options;
+  options.segmentLimit = 300;
+  SnappyMessageReader reader(pipe, options);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_EQ(1u, reader.getSegment(299).size());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedRoundTripScratchSpace) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  word scratch[1024];
+  SnappyMessageReader reader(pipe, ReaderOptions(), ArrayPtr<word>(scratch, 1024));
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+
+  // Decompressed in place.
+  ArrayPtr<const word> segment = reader.getSegment(0);
+  EXPECT_TRUE(segment.begin() > scratch && segment.end() <= scratch + 1024);
+}
+
+TEST(Snappy, UnpackedRoundTripLazy) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe(1);
+  writeSnappyMessage(pipe, builder);
+
+  SnappyMessageReader reader(pipe);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedRoundTripOddSegmentCount) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  SnappyMessageReader reader(pipe);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedRoundTripEvenSegmentCount) {
+  TestMessageBuilder builder(10);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  SnappyMessageReader reader(pipe);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedManyBlocks) {
+  // A message spanning several Snappy blocks, read both with too little scratch space (so the
+  // reader must grow it) and with plenty.
+
+  MallocMessageBuilder builder;
+  auto list = builder.initRoot<TestAllTypes>().initUInt64List(30000);
+  for (uint i = 0; i < list.size(); i++) {
+    list.set(i, i * 12345);
+  }
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  {
+    word scratch[1024];
+    SnappyMessageReader reader(pipe, ReaderOptions(), ArrayPtr<word>(scratch, 1024));
+    auto result = reader.getRoot<TestAllTypes>().getUInt64List();
+    ASSERT_EQ(30000u, result.size());
+    for (uint i = 0; i < result.size(); i++) {
+      ASSERT_EQ(i * 12345, result[i]);
+    }
+    EXPECT_TRUE(pipe.allRead());
+  }
+
+  pipe.resetRead();
+
+  {
+    Array<word> scratch = newArray<word>(65536);
+    SnappyMessageReader reader(pipe, ReaderOptions(), scratch);
+    auto result = reader.getRoot<TestAllTypes>().getUInt64List();
+    ASSERT_EQ(30000u, result.size());
+    EXPECT_EQ(29999u * 12345, result[29999]);
+    EXPECT_TRUE(pipe.allRead());
+  }
+}
+
+TEST(Snappy, UnpackedCompatibleWithSnappyInputStream) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestPipe pipe;
+  writeSnappyMessage(pipe, builder);
+
+  SnappyInputStream snappyInput(pipe);
+  InputStreamMessageReader reader(snappyInput);
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+  EXPECT_TRUE(pipe.allRead());
+}
+
+TEST(Snappy, UnpackedTwoMessages) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  TestMessageBuilder builder2(1);
+  builder2.initRoot<TestAllTypes>().setTextField("Second message.");
+
+  TestPipe pipe(1);
+  writeSnappyMessage(pipe, builder);
+  size_t firstSize = pipe.getData().size();
+  writeSnappyMessage(pipe, builder2);
+
+  {
+    SnappyMessageReader reader(pipe);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+
+  EXPECT_EQ(firstSize, pipe.getReadPos());
+
+  {
+    SnappyMessageReader reader(pipe);
+    EXPECT_EQ("Second message.", reader.getRoot<TestAllTypes>().getTextField());
+  }
+  EXPECT_TRUE(pipe.allRead());
+}
+
 // TODO(test):  Test error cases.
 
 }  // namespace
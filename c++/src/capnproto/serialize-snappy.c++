@@ -31,7 +31,9 @@
 
 namespace capnproto {
 
-class SnappyInputStream::InputStreamSnappySource: public snappy::Source {
+namespace {
+
+class InputStreamSnappySource: public snappy::Source {
 public:
   inline InputStreamSnappySource(BufferedInputStream& inputStream)
       : inputStream(inputStream) {}
@@ -58,6 +60,62 @@ private:
   BufferedInputStream& inputStream;
 };
 
+class PiecesSnappySource: public snappy::Source {
+  // Presents a series of byte arrays as one snappy::Source, limited to a block at a time.
+
+public:
+  inline explicit PiecesSnappySource(ArrayPtr<const ArrayPtr<const byte>> pieces)
+      : pieces(pieces), current(0), offset(0), limit(0) {}
+  inline ~PiecesSnappySource() {}
+
+  inline void setLimit(size_t bytes) { limit = bytes; }
+  // Make the next `bytes` bytes available, to be compressed as one block.
+
+  // implements snappy::Source ---------------------------------------
+
+  size_t Available() const override {
+    return limit;
+  }
+
+  const char* Peek(size_t* len) override {
+    while (current < pieces.size() && offset == pieces[current].size()) {
+      ++current;
+      offset = 0;
+    }
+
+    if (current == pieces.size()) {
+      *len = 0;
+      return nullptr;
+    }
+
+    *len = std::min(pieces[current].size() - offset, limit);
+    return reinterpret_cast<const char*>(pieces[current].begin() + offset);
+  }
+
+  void Skip(size_t n) override {
+    limit -= n;
+    while (n > 0) {
+      size_t available = pieces[current].size() - offset;
+      if (available == 0) {
+        ++current;
+        offset = 0;
+      } else {
+        size_t amount = std::min(n, available);
+        offset += amount;
+        n -= amount;
+      }
+    }
+  }
+
+private:
+  ArrayPtr<const ArrayPtr<const byte>> pieces;
+  size_t current;
+  size_t offset;
+  size_t limit;
+};
+
+}  // namespace
+
 SnappyInputStream::SnappyInputStream(BufferedInputStream& inner, ArrayPtr<byte> buffer)
     : inner(inner) {
   if (buffer.size() < SNAPPY_BUFFER_SIZE) {
@@ -154,19 +212,21 @@ SnappyOutputStream::~SnappyOutputStream() {
 
 void SnappyOutputStream::flush() {
   if (bufferPos > buffer.begin()) {
-    snappy::ByteArraySource source(
-        reinterpret_cast<char*>(buffer.begin()), bufferPos - buffer.begin());
-    snappy::UncheckedByteArraySink sink(reinterpret_cast<char*>(compressedBuffer.begin()));
-
-    size_t n = snappy::Compress(&source, &sink);
-    CHECK(n <= compressedBuffer.size(),
-        "Critical security bug:  Snappy compression overran its output buffer.");
-    inner.write(compressedBuffer.begin(), n);
-
+    compress(buffer.begin(), bufferPos - buffer.begin());
     bufferPos = buffer.begin();
   }
 }
 
+void SnappyOutputStream::compress(const byte* data, size_t size) {
+  snappy::ByteArraySource source(reinterpret_cast<const char*>(data), size);
+  snappy::UncheckedByteArraySink sink(reinterpret_cast<char*>(compressedBuffer.begin()));
+
+  size_t n = snappy::Compress(&source, &sink);
+  CHECK(n <= compressedBuffer.size(),
+      "Critical security bug:  Snappy compression overran its output buffer.");
+  inner.write(compressedBuffer.begin(), n);
+}
+
 ArrayPtr<byte> SnappyOutputStream::getWriteBuffer() {
   return arrayPtr(bufferPos, buffer.end());
 }
@@ -176,6 +236,14 @@ void SnappyOutputStream::write(const void* src, size_t size) {
     // Oh goody, the caller wrote directly into our buffer.
     bufferPos += size;
   } else {
+    // Whole blocks can be compressed straight from the caller's memory as long as nothing is
+    // buffered ahead of them.
+    while (bufferPos == buffer.begin() && size >= buffer.size()) {
+      compress(reinterpret_cast<const byte*>(src), buffer.size());
+      src = reinterpret_cast<const byte*>(src) + buffer.size();
+      size -= buffer.size();
+    }
+
     for (;;) {
       size_t available = buffer.end() - bufferPos;
       if (size < available) break;
@@ -207,4 +275,204 @@ void writeSnappyPackedMessage(OutputStream& output, ArrayPtr<const ArrayPtr<cons
   writePackedMessage(snappyOut, segments);
 }
 
+// =======================================================================================
+
+namespace {
+
+class BlockReader {
+  // Decompresses consecutive Snappy blocks into one contiguous word array, growing it if needed.
+
+public:
+  BlockReader(BufferedInputStream& input, ArrayPtr<word> space, Array<word>& ownedSpace)
+      : input(input), space(space), ownedSpace(ownedSpace), filled(0) {}
+
+  inline ArrayPtr<word> getSpace() { return space; }
+  inline size_t getFilled() { return filled; }
+
+  void reserve(size_t words) {
+    // Make sure the space has room for at least `words` words, keeping what's been filled.
+
+    if (space.size() < words) {
+      Array<word> newSpace = newArray<word>(words);
+      memcpy(static_cast<void*>(newSpace.begin()), space.begin(), filled);
+      ownedSpace = move(newSpace);
+      space = ownedSpace;
+    }
+  }
+
+  bool fillTo(size_t bytes) {
+    // Decompress blocks until at least `bytes` bytes are filled.  Returns false on error.
+
+    while (filled < bytes) {
+      // If the block's length can be read from the buffer, make room for exactly that much;
+      // otherwise assume the worst.
+      size_t blockSize = SNAPPY_BUFFER_SIZE;
+      ArrayPtr<const byte> buffered = input.getReadBuffer();
+      snappy::GetUncompressedLength(
+          reinterpret_cast<const char*>(buffered.begin()), buffered.size(), &blockSize);
+      blockSize = std::min(blockSize, SNAPPY_BUFFER_SIZE);
+      reserve((filled + blockSize + sizeof(word) - 1) / sizeof(word));
+
+      uint32_t length = 0;
+      InputStreamSnappySource snappySource(input);
+      VALIDATE_INPUT(
+          snappy::RawUncompress(&snappySource,
+                                reinterpret_cast<char*>(space.begin()) + filled,
+                                space.size() * sizeof(word) - filled, &length),
+          "Snappy decompression failed.") {
+        return false;
+      }
+
+      VALIDATE_INPUT(length > 0, "Empty Snappy block.") {
+        return false;
+      }
+
+      filled += length;
+    }
+
+    return true;
+  }
+
+private:
+  BufferedInputStream& input;
+  ArrayPtr<word> space;
+  Array<word>& ownedSpace;
+  size_t filled;
+};
+
+}  // namespace
+
+SnappyMessageReader::SnappyMessageReader(
+    BufferedInputStream& inputStream, ReaderOptions options, ArrayPtr<word> scratchSpace)
+    : MessageReader(options) {
+  BlockReader blocks(inputStream, scratchSpace, ownedSpace);
+
+  // The first block contains at least the start of the segment table.
+  if (!blocks.fillTo(sizeof(word))) {
+    return;
+  }
+
+  const internal::WireValue<uint32_t>* table =
+      reinterpret_cast<const internal::WireValue<uint32_t>*>(blocks.getSpace().begin());
+
+  uint segmentCount = table[0].get() + 1;
+
+  VALIDATE_INPUT(segmentCount > 0 && segmentCount <= options.segmentLimit,
+                 "Message has too many segments.") {
+    return;
+  }
+
+  size_t tableWords = segmentCount / 2 + 1;
+  if (!blocks.fillTo(tableWords * sizeof(word))) {
+    return;
+  }
+
+  // The space may have moved.
+  table = reinterpret_cast<const internal::WireValue<uint32_t>*>(blocks.getSpace().begin());
+
+  size_t totalWords = tableWords;
+  for (uint i = 0; i < segmentCount; i++) {
+    totalWords += table[i + 1].get();
+  }
+
+  // Don't accept a message which the receiver couldn't possibly traverse without hitting the
+  // traversal limit.  Without this check, a malicious client could transmit a very large segment
+  // size to make the receiver allocate excessive space and possibly crash.
+  VALIDATE_INPUT(totalWords - tableWords <= options.traversalLimitInWords,
+        "Message is too large.  To increase the limit on the receiving end, see "
+        "capnproto::ReaderOptions.") {
+    return;
+  }
+
+  blocks.reserve(totalWords);
+  if (!blocks.fillTo(totalWords * sizeof(word))) {
+    return;
+  }
+
+  VALIDATE_INPUT(blocks.getFilled() == totalWords * sizeof(word),
+                 "Snappy block extends past the end of the message.") {
+    return;
+  }
+
+  ArrayPtr<const word> space = blocks.getSpace();
+  table = reinterpret_cast<const internal::WireValue<uint32_t>*>(space.begin());
+
+  size_t offset = tableWords;
+  segment0 = space.slice(offset, offset + table[1].get());
+  offset += table[1].get();
+
+  if (segmentCount > 1) {
+    moreSegments = newArray<ArrayPtr<const word>>(segmentCount - 1);
+    for (uint i = 1; i < segmentCount; i++) {
+      uint segmentSize = table[i + 1].get();
+      moreSegments[i - 1] = space.slice(offset, offset + segmentSize);
+      offset += segmentSize;
+    }
+  }
+}
+
+SnappyMessageReader::~SnappyMessageReader() {}
+
+ArrayPtr<const word> SnappyMessageReader::getSegment(uint id) {
+  if (id == 0) {
+    return segment0;
+  } else if (id <= moreSegments.size()) {
+    return moreSegments[id - 1];
+  } else {
+    return nullptr;
+  }
+}
+
+void writeSnappyMessage(OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments,
+                        ArrayPtr<byte> compressedBuffer) {
+  PRECOND(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  Array<byte> ownedCompressedBuffer;
+  if (compressedBuffer.size() < SNAPPY_COMPRESSED_BUFFER_SIZE) {
+    ownedCompressedBuffer = newArray<byte>(SNAPPY_COMPRESSED_BUFFER_SIZE);
+    compressedBuffer = ownedCompressedBuffer;
+  }
+
+  CAPNPROTO_STACK_ARRAY(internal::WireValue<uint32_t>, table,
+                        (segments.size() + 2) & ~size_t(1), 256);
+
+  // We write the segment count - 1 because this makes the first word zero for single-segment
+  // messages, improving compression.
+  table[0].set(segments.size() - 1);
+  for (uint i = 0; i < segments.size(); i++) {
+    table[i + 1].set(segments[i].size());
+  }
+  if (segments.size() % 2 == 0) {
+    // Set padding byte.
+    table[segments.size() + 1].set(0);
+  }
+
+  CAPNPROTO_STACK_ARRAY(ArrayPtr<const byte>, pieces, segments.size() + 1, 128);
+  pieces[0] = arrayPtr(reinterpret_cast<const byte*>(table.begin()),
+                       table.size() * sizeof(table[0]));
+  size_t remaining = pieces[0].size();
+
+  for (uint i = 0; i < segments.size(); i++) {
+    pieces[i + 1] = arrayPtr(reinterpret_cast<const byte*>(segments[i].begin()),
+                             reinterpret_cast<const byte*>(segments[i].end()));
+    remaining += pieces[i + 1].size();
+  }
+
+  // Split into blocks the same way SnappyOutputStream would, so that SnappyInputStream can read
+  // the result too.
+  PiecesSnappySource source(pieces);
+  while (remaining > 0) {
+    size_t blockSize = std::min(remaining, SNAPPY_BUFFER_SIZE);
+    source.setLimit(blockSize);
+    snappy::UncheckedByteArraySink sink(reinterpret_cast<char*>(compressedBuffer.begin()));
+
+    size_t n = snappy::Compress(&source, &sink);
+    CHECK(n <= compressedBuffer.size(),
+        "Critical security bug:  Snappy compression overran its output buffer.");
+    output.write(compressedBuffer.begin(), n);
+
+    remaining -= blockSize;
+  }
+}
+
 }  // namespace capnproto
@@ -44,8 +44,6 @@ public:
   void skip(size_t bytes) override;
 
 private:
-  class InputStreamSnappySource;
-
   BufferedInputStream& inner;
   Array<byte> ownedBuffer;
   ArrayPtr<byte> buffer;
@@ -79,6 +77,9 @@ private:
 
   Array<byte> ownedCompressedBuffer;
   ArrayPtr<byte> compressedBuffer;
+
+  void compress(const byte* data, size_t size);
+  // Compress the given bytes as one block and write them to the inner stream.
 };
 
 class SnappyPackedMessageReader: private SnappyInputStream, public PackedMessageReader {
@@ -96,6 +97,42 @@ void writeSnappyPackedMessage(OutputStream& output, ArrayPtr<const ArrayPtr<cons
                               ArrayPtr<byte> buffer = nullptr,
                               ArrayPtr<byte> compressedBuffer = nullptr);
 
+// -------------------------------------------------------------------
+
+class SnappyMessageReader: public MessageReader {
+  // Reads a message written by writeSnappyMessage().  Each Snappy block is decompressed directly
+  // into the scratch space, or into a single allocation sized from the segment table, so the
+  // segments are never copied out of an intermediate buffer.  If the scratch space is too small,
+  // only the first block is copied once into the new allocation.
+
+public:
+  SnappyMessageReader(BufferedInputStream& inputStream, ReaderOptions options = ReaderOptions(),
+                      ArrayPtr<word> scratchSpace = nullptr);
+  CAPNPROTO_DISALLOW_COPY(SnappyMessageReader);
+  ~SnappyMessageReader();
+
+  // implements MessageReader ----------------------------------------
+  ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  // Optimize for single-segment case.
+  ArrayPtr<const word> segment0;
+  Array<ArrayPtr<const word>> moreSegments;
+
+  Array<word> ownedSpace;
+  // Only if scratchSpace wasn't big enough.
+};
+
+void writeSnappyMessage(OutputStream& output, MessageBuilder& builder,
+                        ArrayPtr<byte> compressedBuffer = nullptr);
+void writeSnappyMessage(OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments,
+                        ArrayPtr<byte> compressedBuffer = nullptr);
+// Snappy-compress the message without packing it, reading straight from the segments rather than
+// copying them into a staging buffer first.  The output is the standard serialization split into
+// blocks exactly as SnappyOutputStream would, so it can also be read with a SnappyInputStream and
+// InputStreamMessageReader.  Packing first usually compresses better; this trades some bandwidth
+// for less CPU time.
+
 // =======================================================================================
 // inline stuff
 
@@ -105,6 +142,11 @@ inline void writeSnappyPackedMessage(OutputStream& output, MessageBuilder& build
   writeSnappyPackedMessage(output, builder.getSegmentsForOutput(), buffer, compressedBuffer);
 }
 
+inline void writeSnappyMessage(OutputStream& output, MessageBuilder& builder,
+                               ArrayPtr<byte> compressedBuffer) {
+  writeSnappyMessage(output, builder.getSegmentsForOutput(), compressedBuffer);
+}
+
 }  // namespace capnproto
 
 #endif  // CAPNPROTO_SERIALIZE_SNAPPY_H_
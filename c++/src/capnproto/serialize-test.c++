@@ -289,6 +289,164 @@ TEST(Serialize, FileDescriptors) {
   }
 }
 
+TEST(Serialize, ForwardFileToFile) {
+  char inName[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd input(mkstemp(inName));
+  ASSERT_GE(input.get(), 0);
+  EXPECT_EQ(0, unlink(inName));
+
+  char outName[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd output(mkstemp(outName));
+  ASSERT_GE(output.get(), 0);
+  EXPECT_EQ(0, unlink(outName));
+
+  {
+    TestMessageBuilder builder(7);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writeMessageToFd(input.get(), builder);
+  }
+
+  {
+    TestMessageBuilder builder(1);
+    builder.initRoot<TestAllTypes>().setTextField("second message in file");
+    writeMessageToFd(input.get(), builder);
+  }
+
+  off_t inputSize = lseek(input, 0, SEEK_CUR);
+  lseek(input, 0, SEEK_SET);
+
+  {
+    FdMessageForwarder forwarder(input, output);
+    size_t first = forwarder.forward();
+    size_t second = forwarder.forward();
+    EXPECT_GT(first, 0u);
+    EXPECT_GT(second, 0u);
+    EXPECT_EQ(inputSize, off_t(first + second));
+    EXPECT_EQ(0u, forwarder.forward());
+  }
+
+  EXPECT_EQ(inputSize, lseek(output, 0, SEEK_CUR));
+  lseek(output, 0, SEEK_SET);
+
+  {
+    StreamFdMessageReader reader(output.get());
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+
+  {
+    StreamFdMessageReader reader(output.get());
+    EXPECT_EQ("second message in file", reader.getRoot<TestAllTypes>().getTextField());
+  }
+}
+
+TEST(Serialize, ForwardFileToPipe) {
+  char filename[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd tmpfile(mkstemp(filename));
+  ASSERT_GE(tmpfile.get(), 0);
+  EXPECT_EQ(0, unlink(filename));
+
+  {
+    TestMessageBuilder builder(7);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writeMessageToFd(tmpfile.get(), builder);
+  }
+
+  lseek(tmpfile, 0, SEEK_SET);
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  AutoCloseFd pipeOut(fds[0]);
+  AutoCloseFd pipeIn(fds[1]);
+
+  // The test message is much smaller than the pipe buffer, so this won't block.
+  FdMessageForwarder forwarder(tmpfile, pipeIn);
+  EXPECT_GT(forwarder.forward(), 0u);
+
+  StreamFdMessageReader reader(pipeOut.get());
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+class RecordingExceptionCallback: public ExceptionCallback {
+  // Records recoverable exceptions instead of throwing them, so that tests can see what a caller
+  // that keeps going would get.
+
+public:
+  RecordingExceptionCallback(): count(0) {}
+
+  void onRecoverableException(Exception&& exception) override {
+    ++count;
+  }
+
+  uint count;
+};
+
+TEST(Serialize, ForwardTruncated) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  Array<word> serialized = messageToFlatArray(builder);
+
+  char filename[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd tmpfile(mkstemp(filename));
+  ASSERT_GE(tmpfile.get(), 0);
+  EXPECT_EQ(0, unlink(filename));
+
+  // Cut the message off in the middle of the body.
+  size_t truncatedSize = serialized.size() * sizeof(word) / 2;
+  FdOutputStream(tmpfile.get()).write(serialized.begin(), truncatedSize);
+
+  char outName[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd output(mkstemp(outName));
+  ASSERT_GE(output.get(), 0);
+  EXPECT_EQ(0, unlink(outName));
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  AutoCloseFd pipeOut(fds[0]);
+  AutoCloseFd pipeIn(fds[1]);
+
+  RecordingExceptionCallback callback;
+  ExceptionCallback::ScopedRegistration registration(callback);
+
+  // File to pipe splices directly; file to file goes through the forwarder's own pipe.
+  int outputs[2] = { pipeIn.get(), output.get() };
+  for (int out: outputs) {
+    lseek(tmpfile, 0, SEEK_SET);
+    callback.count = 0;
+    FdMessageForwarder forwarder(tmpfile, out);
+    EXPECT_EQ(0u, forwarder.forward());
+    EXPECT_EQ(1u, callback.count);
+  }
+}
+
+TEST(Serialize, ForwardRejectsTooManySegments) {
+  Array<word> data = newArray<word>(8192);
+  WireValue<uint32_t>* table = reinterpret_cast<WireValue<uint32_t>*>(data.begin());
+  table[0].set(1024);
+  for (uint i = 0; i < 1024; i++) {
+    table[i+1].set(1);
+  }
+
+  char filename[] = "/tmp/capnproto-serialize-test-XXXXXX";
+  AutoCloseFd tmpfile(mkstemp(filename));
+  ASSERT_GE(tmpfile.get(), 0);
+  EXPECT_EQ(0, unlink(filename));
+  FdOutputStream(tmpfile.get()).write(data.begin(), data.size() * sizeof(word));
+  lseek(tmpfile, 0, SEEK_SET);
+
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  AutoCloseFd pipeOut(fds[0]);
+  AutoCloseFd pipeIn(fds[1]);
+
+  try {
+    FdMessageForwarder forwarder(tmpfile, pipeIn);
+    forwarder.forward();
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+}
+
 TEST(Serialize, RejectTooManySegments) {
   Array<word> data = newArray<word>(8192);
   WireValue<uint32_t>* table = reinterpret_cast<WireValue<uint32_t>*>(data.begin());
@@ -306,6 +464,40 @@ TEST(Serialize, RejectTooManySegments) {
   }
 }
 
+TEST(Serialize, SegmentLimit) {
+  Array<word> data = newArray<word>(8192);
+  memset(static_cast<void*>(data.begin()), 0, data.size() * sizeof(word));
+  WireValue<uint32_t>* table = reinterpret_cast<WireValue<uint32_t>*>(data.begin());
+  table[0].set(1023);
+  for (uint i = 0; i < 1024; i++) {
+    table[i+1].set(1);
+  }
+
+  ReaderOptions options;
+  options.segmentLimit = 1024;
+
+  {
+    TestInputStream input(data.asPtr(), false);
+    InputStreamMessageReader reader(input, options);
+    EXPECT_EQ(1u, reader.getSegment(1023).size());
+    EXPECT_EQ(0u, reader.getSegment(1024).size());
+  }
+
+  // By default, 511 segments are accepted but 512 are not, as it has always been.
+  table[0].set(510);
+  {
+    TestInputStream input(data.asPtr(), false);
+    InputStreamMessageReader reader(input);
+    EXPECT_EQ(1u, reader.getSegment(510).size());
+  }
+
+  table[0].set(511);
+  {
+    TestInputStream input(data.asPtr(), false);
+    EXPECT_ANY_THROW(InputStreamMessageReader reader(input));
+  }
+}
+
 TEST(Serialize, RejectHugeMessage) {
   // A message whose root struct contains two words of data!
   AlignedData<4> data = {{0,0,0,0,3,0,0,0, 0,0,0,0,2,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0}};
@@ -324,6 +516,118 @@ TEST(Serialize, RejectHugeMessage) {
   }
 }
 
+std::string errorDescription(const MessageReader& reader) {
+  auto error = reader.getError();
+  if (error == nullptr) {
+    return std::string();
+  }
+  return std::string(error->getDescription().begin(), error->getDescription().size());
+}
+
+TEST(Serialize, RecordErrors) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  Array<word> serialized = messageToFlatArray(builder);
+
+  ReaderOptions options;
+  options.recordErrors = true;
+
+  {
+    FlatArrayMessageReader reader(serialized.asPtr(), options);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+    EXPECT_FALSE(reader.hasError());
+  }
+
+  // Cut the segment off right after the root pointer.
+  WireValue<uint32_t>* table = reinterpret_cast<WireValue<uint32_t>*>(serialized.begin());
+  table[1].set(1);
+
+  {
+    FlatArrayMessageReader reader(serialized.asPtr());
+    EXPECT_ANY_THROW(reader.getRoot<TestAllTypes>().getInt32Field());
+  }
+
+  {
+    FlatArrayMessageReader reader(serialized.asPtr(), options);
+    TestAllTypes::Reader root = reader.getRoot<TestAllTypes>();
+    EXPECT_EQ(0, root.getInt32Field());
+    EXPECT_EQ("", root.getTextField());
+    EXPECT_TRUE(reader.hasError());
+    EXPECT_EQ("expected boundsCheck(segment, ptr, ptr + ref->structRef.wordSize()); "
+              "Message contained out-of-bounds struct pointer.", errorDescription(reader));
+  }
+
+  // The first error sticks.
+  {
+    FlatArrayMessageReader reader(arrayPtr(serialized.begin(), 1), options);
+    EXPECT_EQ(0, reader.getRoot<TestAllTypes>().getInt32Field());
+    EXPECT_EQ(0, reader.getRoot<TestAllTypes>().getInt32Field());
+    EXPECT_TRUE(reader.hasError());
+    EXPECT_EQ("expected array.size() >= offset + segmentSize; "
+              "Message ends prematurely in first segment.", errorDescription(reader));
+  }
+}
+
+TEST(Serialize, RecordTraversalLimit) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  Array<word> serialized = messageToFlatArray(builder);
+
+  ReaderOptions options;
+  options.recordErrors = true;
+  options.traversalLimitInWords = 8;
+
+  FlatArrayMessageReader reader(serialized.asPtr(), options);
+  TestAllTypes::Reader root = reader.getRoot<TestAllTypes>();
+  for (int i = 0; i < 4; i++) {
+    root.getStructList();
+  }
+  EXPECT_TRUE(reader.hasError());
+  EXPECT_EQ("Exceeded message traversal limit.  See capnproto::ReaderOptions.",
+            errorDescription(reader));
+}
+
+TEST(Serialize, ReadCost) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  Array<word> serialized = messageToFlatArray(builder);
+
+  FlatArrayMessageReader reader(serialized.asPtr());
+  EXPECT_EQ(0u, reader.getReadCost().wordsTraversed);
+  EXPECT_EQ(0u, reader.getReadCost().segmentsTouched);
+
+  TestAllTypes::Reader root = reader.getRoot<TestAllTypes>();
+  ReadCost rootCost = reader.getReadCost();
+  EXPECT_LT(0u, rootCost.wordsTraversed);
+  EXPECT_LT(1u, rootCost.segmentsTouched);
+
+  // Reading the same field again is counted again, as with the traversal limit.
+  root.getStructField();
+  ReadCost fieldCost = reader.getReadCost();
+  root.getStructField();
+  ReadCost secondFieldCost = reader.getReadCost();
+  EXPECT_LT(rootCost.wordsTraversed, fieldCost.wordsTraversed);
+  EXPECT_EQ(fieldCost.wordsTraversed - rootCost.wordsTraversed,
+            secondFieldCost.wordsTraversed - fieldCost.wordsTraversed);
+
+  checkTestMessage(root);
+  ReadCost cost = reader.getReadCost();
+  EXPECT_EQ(7u, cost.segmentsTouched);
+
+#if CAPNPROTO_READ_COST_ACCOUNTING
+  EXPECT_LT(0u, rootCost.farPointersFollowed);
+  EXPECT_EQ(1u, rootCost.nestingDepth);
+  EXPECT_EQ(2u, fieldCost.nestingDepth);
+  EXPECT_LT(fieldCost.farPointersFollowed, cost.farPointersFollowed);
+
+  // structField.structList[i] is at depth 4.
+  EXPECT_EQ(4u, cost.nestingDepth);
+#else
+  EXPECT_EQ(0u, cost.farPointersFollowed);
+  EXPECT_EQ(0u, cost.nestingDepth);
+#endif
+}
+
 // TODO(test):  Test error cases.
 
 }  // namespace
@@ -0,0 +1,318 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define CAPNPROTO_PRIVATE
+#include "serialize-wide.h"
+#include "logging.h"
+#include "test.capnp.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+#include "test-util.h"
+
+namespace capnproto {
+namespace internal {
+namespace {
+
+class TestMessageBuilder: public MallocMessageBuilder {
+  // A MessageBuilder that tries to allocate an exact number of total segments, by allocating
+  // minimum-size segments until it reaches the number, then allocating one large segment to
+  // finish.
+
+public:
+  explicit TestMessageBuilder(uint desiredSegmentCount)
+      : MallocMessageBuilder(0, AllocationStrategy::FIXED_SIZE),
+        desiredSegmentCount(desiredSegmentCount) {}
+  ~TestMessageBuilder() {
+    EXPECT_EQ(0u, desiredSegmentCount);
+  }
+
+  ArrayPtr<word> allocateSegment(uint minimumSize) override {
+    if (desiredSegmentCount <= 1) {
+      if (desiredSegmentCount < 1) {
+        ADD_FAILURE() << "Allocated more segments than desired.";
+      } else {
+        --desiredSegmentCount;
+      }
+      return MallocMessageBuilder::allocateSegment(SUGGESTED_FIRST_SEGMENT_WORDS);
+    } else {
+      --desiredSegmentCount;
+      return MallocMessageBuilder::allocateSegment(minimumSize);
+    }
+  }
+
+private:
+  uint desiredSegmentCount;
+};
+
+class TestInputStream: public InputStream {
+  // Counts read() calls so tests can check that the body arrives in one read.
+
+public:
+  TestInputStream(ArrayPtr<const word> data)
+      : pos(reinterpret_cast<const char*>(data.begin())),
+        end(reinterpret_cast<const char*>(data.end())),
+        readCount(0) {}
+  ~TestInputStream() {}
+
+  size_t read(void* buffer, size_t minBytes, size_t maxBytes) override {
+    CHECK(maxBytes <= size_t(end - pos), "Overran end of stream.");
+    memcpy(buffer, pos, maxBytes);
+    pos += maxBytes;
+    ++readCount;
+    return maxBytes;
+  }
+
+  void skip(size_t bytes) override {
+    CHECK(bytes <= size_t(end - pos), "Overran end of stream.");
+    pos += bytes;
+  }
+
+  bool atEnd() { return pos == end; }
+  uint getReadCount() { return readCount; }
+
+private:
+  const char* pos;
+  const char* end;
+  uint readCount;
+};
+
+class TestOutputStream: public OutputStream {
+public:
+  TestOutputStream() {}
+  ~TestOutputStream() {}
+
+  void write(const void* buffer, size_t size) override {
+    data.append(reinterpret_cast<const char*>(buffer), size);
+  }
+
+  bool dataEquals(ArrayPtr<const word> other) {
+    return data ==
+        std::string(reinterpret_cast<const char*>(other.begin()), other.size() * sizeof(word));
+  }
+
+private:
+  std::string data;
+};
+
+Array<ArrayPtr<const word>> padSegments(MessageBuilder& builder, uint count) {
+  // Returns the builder's segments followed by empty one-word segments, up to `count` total.
+  // MessageBuilders never produce this many segments, but hand-assembled messages can.
+
+  static const word EMPTY[1] = {};
+  ArrayPtr<const ArrayPtr<const word>> real = builder.getSegmentsForOutput();
+  Array<ArrayPtr<const word>> result = newArray<ArrayPtr<const word>>(count);
+  for (uint i = 0; i < count; i++) {
+    result[i] = i < real.size() ? real[i] : arrayPtr(EMPTY, 1);
+  }
+  return move(result);
+}
+
+TEST(SerializeWide, FlatArray) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  WideFlatArrayMessageReader reader(serialized.asPtr());
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(SerializeWide, FlatArrayMultiSegment) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+  EXPECT_EQ(serialized.size() - 1,
+            reinterpret_cast<WireValue<uint64_t>*>(serialized.begin())->get());
+
+  WideFlatArrayMessageReader reader(serialized.asPtr());
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(SerializeWide, InputStream) {
+  TestMessageBuilder builder(10);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  TestInputStream stream(serialized.asPtr());
+  WideMessageReader reader(stream);
+
+  // One read for the length word and one for everything else.
+  EXPECT_EQ(2u, stream.getReadCount());
+  EXPECT_TRUE(stream.atEnd());
+
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(SerializeWide, InputStreamScratchSpace) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  word scratch[4096];
+  TestInputStream stream(serialized.asPtr());
+  WideMessageReader reader(stream, ReaderOptions(), ArrayPtr<word>(scratch, 4096));
+
+  checkTestMessage(reader.getRoot<TestAllTypes>());
+}
+
+TEST(SerializeWide, WriteMessage) {
+  TestMessageBuilder builder(7);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  TestOutputStream output;
+  writeWideMessage(output, builder);
+
+  EXPECT_TRUE(output.dataEquals(serialized.asPtr()));
+}
+
+TEST(SerializeWide, ManySegments) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<ArrayPtr<const word>> segments = padSegments(builder, 2000);
+  Array<word> serialized = messageToWideFlatArray(segments);
+
+  try {
+    WideFlatArrayMessageReader reader(serialized.asPtr());
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+
+  ReaderOptions options;
+  options.segmentLimit = 2000;
+
+  {
+    WideFlatArrayMessageReader reader(serialized.asPtr(), options);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+    EXPECT_EQ(1u, reader.getSegment(1999).size());
+    EXPECT_EQ(0u, reader.getSegment(2000).size());
+  }
+
+  {
+    TestInputStream stream(serialized.asPtr());
+    WideMessageReader reader(stream, options);
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+    EXPECT_EQ(1u, reader.getSegment(1999).size());
+  }
+}
+
+TEST(SerializeWide, FileDescriptors) {
+  char filename[] = "/tmp/capnproto-serialize-wide-test-XXXXXX";
+  AutoCloseFd tmpfile(mkstemp(filename));
+  ASSERT_GE(tmpfile.get(), 0);
+
+  // Unlink the file so that it will be deleted on close.
+  EXPECT_EQ(0, unlink(filename));
+
+  {
+    TestMessageBuilder builder(7);
+    initTestMessage(builder.initRoot<TestAllTypes>());
+    writeWideMessageToFd(tmpfile.get(), builder);
+  }
+
+  {
+    TestMessageBuilder builder(1);
+    builder.initRoot<TestAllTypes>().setTextField("second message in file");
+    writeWideMessageToFd(tmpfile.get(), builder);
+  }
+
+  lseek(tmpfile, 0, SEEK_SET);
+
+  {
+    WideFdMessageReader reader(tmpfile.get());
+    checkTestMessage(reader.getRoot<TestAllTypes>());
+  }
+
+  {
+    WideFdMessageReader reader(tmpfile.get());
+    EXPECT_EQ("second message in file", reader.getRoot<TestAllTypes>().getTextField());
+  }
+}
+
+TEST(SerializeWide, RejectHugeMessage) {
+  TestMessageBuilder builder(1);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  ReaderOptions options;
+  options.traversalLimitInWords = 2;
+
+  TestInputStream stream(serialized.asPtr());
+
+  try {
+    WideMessageReader reader(stream, options);
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+}
+
+TEST(SerializeWide, RejectBadTable) {
+  TestMessageBuilder builder(3);
+  initTestMessage(builder.initRoot<TestAllTypes>());
+
+  Array<word> serialized = messageToWideFlatArray(builder);
+
+  // Claim the first segment is one word longer than it really is.
+  WireValue<uint64_t>* table = reinterpret_cast<WireValue<uint64_t>*>(serialized.begin());
+  table[2].set(table[2].get() + 1);
+
+  try {
+    WideFlatArrayMessageReader reader(serialized.asPtr());
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (...) {
+    // expected
+  }
+}
+
+TEST(SerializeWide, RejectHugeSegment) {
+  // Segments of 2^32 words or more can't be represented in memory, so they are rejected before
+  // the reader even checks whether the data is all there.
+  Array<word> serialized = newArray<word>(4);
+  memset(static_cast<void*>(serialized.begin()), 0, serialized.size() * sizeof(word));
+  WireValue<uint64_t>* table = reinterpret_cast<WireValue<uint64_t>*>(serialized.begin());
+  table[0].set(3);
+  table[1].set(1);
+  table[2].set(uint64_t(1) << 32);
+
+  try {
+    WideFlatArrayMessageReader reader(serialized.asPtr());
+    ADD_FAILURE() << "Should have thrown an exception.";
+  } catch (const Exception& e) {
+    std::string description(e.getDescription().begin(), e.getDescription().size());
+    EXPECT_NE(std::string::npos, description.find("Message segment is too large.")) << description;
+  }
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace capnproto
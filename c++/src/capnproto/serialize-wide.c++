@@ -0,0 +1,225 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#define CAPNPROTO_PRIVATE
+#include "serialize-wide.h"
+#include "layout.h"
+#include "logging.h"
+#include <limits>
+
+namespace capnproto {
+
+namespace {
+
+void parseWideMessage(ArrayPtr<const word> body, uint segmentLimit,
+                      ArrayPtr<const word>& segment0,
+                      Array<ArrayPtr<const word>>& moreSegments) {
+  // Parses everything after the length word.  On error, leaves the message empty.
+
+  VALIDATE_INPUT(body.size() >= 1, "Message ends prematurely in segment table.") {
+    return;
+  }
+
+  const internal::WireValue<uint64_t>* table =
+      reinterpret_cast<const internal::WireValue<uint64_t>*>(body.begin());
+
+  uint64_t segmentCount = table[0].get();
+
+  VALIDATE_INPUT(segmentCount > 0 && segmentCount <= segmentLimit,
+                 "Message has too many segments.") {
+    return;
+  }
+
+  VALIDATE_INPUT(body.size() - 1 >= segmentCount, "Message ends prematurely in segment table.") {
+    return;
+  }
+
+  ++table;
+  size_t offset = segmentCount + 1;
+
+  // Check sizes before slicing anything, so that a bad table leaves no partial state behind.
+  for (uint i = 0; i < segmentCount; i++) {
+    VALIDATE_INPUT(table[i].get() <= 0xffffffffu, "Message segment is too large.") {
+      return;
+    }
+    VALIDATE_INPUT(table[i].get() <= body.size() - offset, "Message ends prematurely.") {
+      return;
+    }
+    offset += table[i].get();
+  }
+
+  VALIDATE_INPUT(offset == body.size(), "Message length doesn't match its segment table.") {
+    return;
+  }
+
+  offset = segmentCount + 1;
+  segment0 = body.slice(offset, offset + table[0].get());
+  offset += table[0].get();
+
+  if (segmentCount > 1) {
+    moreSegments = newArray<ArrayPtr<const word>>(segmentCount - 1);
+    for (uint i = 1; i < segmentCount; i++) {
+      moreSegments[i - 1] = body.slice(offset, offset + table[i].get());
+      offset += table[i].get();
+    }
+  }
+}
+
+ArrayPtr<const word> getWideSegment(uint id, ArrayPtr<const word> segment0,
+                                    ArrayPtr<const ArrayPtr<const word>> moreSegments) {
+  if (id == 0) {
+    return segment0;
+  } else if (id <= moreSegments.size()) {
+    return moreSegments[id - 1];
+  } else {
+    return nullptr;
+  }
+}
+
+}  // namespace
+
+WideFlatArrayMessageReader::WideFlatArrayMessageReader(
+    ArrayPtr<const word> array, ReaderOptions options)
+    : MessageReader(options) {
+  if (array.size() < 1) {
+    // Assume empty message.
+    return;
+  }
+
+  uint64_t bodySize = reinterpret_cast<const internal::WireValue<uint64_t>*>(array.begin())->get();
+
+  VALIDATE_INPUT(bodySize <= array.size() - 1, "Message ends prematurely.") {
+    return;
+  }
+
+  parseWideMessage(array.slice(1, 1 + bodySize), options.segmentLimit, segment0, moreSegments);
+}
+
+ArrayPtr<const word> WideFlatArrayMessageReader::getSegment(uint id) {
+  return getWideSegment(id, segment0, moreSegments);
+}
+
+Array<word> messageToWideFlatArray(ArrayPtr<const ArrayPtr<const word>> segments) {
+  PRECOND(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  size_t bodySize = segments.size() + 1;
+  for (auto& segment: segments) {
+    bodySize += segment.size();
+  }
+
+  Array<word> result = newArray<word>(bodySize + 1);
+
+  internal::WireValue<uint64_t>* table =
+      reinterpret_cast<internal::WireValue<uint64_t>*>(result.begin());
+  table[0].set(bodySize);
+  table[1].set(segments.size());
+  for (uint i = 0; i < segments.size(); i++) {
+    table[i + 2].set(segments[i].size());
+  }
+
+  word* dst = result.begin() + segments.size() + 2;
+
+  for (auto& segment: segments) {
+    memcpy(static_cast<void*>(dst), segment.begin(), segment.size() * sizeof(word));
+    dst += segment.size();
+  }
+
+  DCHECK(dst == result.end(), "Buffer overrun/underrun bug in code above.");
+
+  return move(result);
+}
+
+// =======================================================================================
+
+WideMessageReader::WideMessageReader(
+    InputStream& inputStream, ReaderOptions options, ArrayPtr<word> scratchSpace)
+    : MessageReader(options) {
+  internal::WireValue<uint64_t> lengthWord;
+  inputStream.read(&lengthWord, sizeof(lengthWord));
+
+  uint64_t bodySize = lengthWord.get();
+
+  // Don't accept a message which the receiver couldn't possibly traverse without hitting the
+  // traversal limit, counting one table word per allowed segment plus the segment count.  The
+  // length tells us where the next message starts, so we can skip this one rather than lose our
+  // place in the stream.
+  VALIDATE_INPUT(bodySize <= options.traversalLimitInWords + options.segmentLimit + 1,
+        "Message is too large.  To increase the limit on the receiving end, see "
+        "capnproto::ReaderOptions.") {
+    if (bodySize <= std::numeric_limits<size_t>::max() / sizeof(word)) {
+      inputStream.skip(bodySize * sizeof(word));
+    }
+    return;
+  }
+
+  if (scratchSpace.size() < bodySize) {
+    ownedSpace = newArray<word>(bodySize);
+    scratchSpace = ownedSpace;
+  }
+
+  ArrayPtr<word> body = scratchSpace.slice(0, bodySize);
+  inputStream.read(body.begin(), body.size() * sizeof(word));
+
+  parseWideMessage(body, options.segmentLimit, segment0, moreSegments);
+}
+
+WideMessageReader::~WideMessageReader() {}
+
+ArrayPtr<const word> WideMessageReader::getSegment(uint id) {
+  return getWideSegment(id, segment0, moreSegments);
+}
+
+WideFdMessageReader::~WideFdMessageReader() {}
+
+// -------------------------------------------------------------------
+
+void writeWideMessage(OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments) {
+  PRECOND(segments.size() > 0, "Tried to serialize uninitialized message.");
+
+  CAPNPROTO_STACK_ARRAY(internal::WireValue<uint64_t>, table, segments.size() + 2, 256);
+
+  uint64_t bodySize = segments.size() + 1;
+  table[1].set(segments.size());
+  for (uint i = 0; i < segments.size(); i++) {
+    table[i + 2].set(segments[i].size());
+    bodySize += segments[i].size();
+  }
+  table[0].set(bodySize);
+
+  CAPNPROTO_STACK_ARRAY(ArrayPtr<const byte>, pieces, segments.size() + 1, 256);
+  pieces[0] = arrayPtr(reinterpret_cast<const byte*>(table.begin()),
+                       table.size() * sizeof(table[0]));
+
+  for (uint i = 0; i < segments.size(); i++) {
+    pieces[i + 1] = arrayPtr(reinterpret_cast<const byte*>(segments[i].begin()),
+                             reinterpret_cast<const byte*>(segments[i].end()));
+  }
+
+  output.write(pieces);
+}
+
+void writeWideMessageToFd(int fd, ArrayPtr<const ArrayPtr<const word>> segments) {
+  FdOutputStream output(fd);
+  writeWideMessage(output, segments);
+}
+
+}  // namespace capnproto
@@ -0,0 +1,136 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// This file implements an alternative framing for Cap'n Proto messages, for use when messages are
+// large or have many segments.  The format is as follows:
+//
+// * 64-bit little-endian count of the words that follow (8 bytes).
+// * 64-bit little-endian segment count (8 bytes).
+// * 64-bit little-endian size of each segment, in words (8*(segment count) bytes).
+// * Data from each segment, in order (8*sum(segment sizes) bytes).
+//
+// Compared to the standard format in serialize.h:
+// - The reader learns the total size of the message from the first word, so it can allocate once
+//   and read the rest of the message with a single read() call.
+// - The segment count is limited only by ReaderOptions::segmentLimit.  Segment sizes are 64-bit
+//   on the wire, but readers still reject segments of 2^32 words or more, which the in-memory
+//   representation cannot address.
+// - A reader that rejects a message as too large can still skip over it and stay in sync with
+//   the stream.
+// - The segment table costs twice as many bytes, and a message is always at least 24 bytes.
+//
+// The two formats cannot be distinguished from each other on the wire, so both ends must agree
+// on which one is in use.  The standard format remains the default everywhere.
+
+#ifndef CAPNPROTO_SERIALIZE_WIDE_H_
+#define CAPNPROTO_SERIALIZE_WIDE_H_
+
+#include "serialize.h"
+
+namespace capnproto {
+
+class WideFlatArrayMessageReader: public MessageReader {
+  // Parses a wide-framed message from a flat array.
+
+public:
+  WideFlatArrayMessageReader(ArrayPtr<const word> array, ReaderOptions options = ReaderOptions());
+  // The array must remain valid until the MessageReader is destroyed.
+
+  ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  // Optimize for single-segment case.
+  ArrayPtr<const word> segment0;
+  Array<ArrayPtr<const word>> moreSegments;
+};
+
+Array<word> messageToWideFlatArray(MessageBuilder& builder);
+// Constructs a flat array containing the entire content of the given message, in wide framing.
+
+Array<word> messageToWideFlatArray(ArrayPtr<const ArrayPtr<const word>> segments);
+// Version of messageToWideFlatArray that takes a raw segment array.
+
+// =======================================================================================
+
+class WideMessageReader: public MessageReader {
+  // Reads a wide-framed message from an input stream.  Unlike InputStreamMessageReader, the whole
+  // message is read eagerly in the constructor, using one read() after the length word.
+
+public:
+  WideMessageReader(InputStream& inputStream, ReaderOptions options = ReaderOptions(),
+                    ArrayPtr<word> scratchSpace = nullptr);
+  CAPNPROTO_DISALLOW_COPY(WideMessageReader);
+  ~WideMessageReader();
+
+  // implements MessageReader ----------------------------------------
+  ArrayPtr<const word> getSegment(uint id) override;
+
+private:
+  // Optimize for single-segment case.
+  ArrayPtr<const word> segment0;
+  Array<ArrayPtr<const word>> moreSegments;
+
+  Array<word> ownedSpace;
+  // Only if scratchSpace wasn't big enough.
+};
+
+class WideFdMessageReader: private FdInputStream, public WideMessageReader {
+public:
+  WideFdMessageReader(int fd, ReaderOptions options = ReaderOptions(),
+                      ArrayPtr<word> scratchSpace = nullptr)
+      : FdInputStream(fd), WideMessageReader(*this, options, scratchSpace) {}
+  // Read message from a file descriptor, without taking ownership of the descriptor.
+
+  WideFdMessageReader(AutoCloseFd fd, ReaderOptions options = ReaderOptions(),
+                      ArrayPtr<word> scratchSpace = nullptr)
+      : FdInputStream(move(fd)), WideMessageReader(*this, options, scratchSpace) {}
+  // Read a message from a file descriptor, taking ownership of the descriptor.
+
+  ~WideFdMessageReader();
+};
+
+void writeWideMessage(OutputStream& output, MessageBuilder& builder);
+void writeWideMessage(OutputStream& output, ArrayPtr<const ArrayPtr<const word>> segments);
+// Write a wide-framed message to the given output stream.
+
+void writeWideMessageToFd(int fd, MessageBuilder& builder);
+void writeWideMessageToFd(int fd, ArrayPtr<const ArrayPtr<const word>> segments);
+// Write a single wide-framed message to the file descriptor.
+
+// =======================================================================================
+// inline stuff
+
+inline Array<word> messageToWideFlatArray(MessageBuilder& builder) {
+  return messageToWideFlatArray(builder.getSegmentsForOutput());
+}
+
+inline void writeWideMessage(OutputStream& output, MessageBuilder& builder) {
+  writeWideMessage(output, builder.getSegmentsForOutput());
+}
+
+inline void writeWideMessageToFd(int fd, MessageBuilder& builder) {
+  writeWideMessageToFd(fd, builder.getSegmentsForOutput());
+}
+
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_SERIALIZE_WIDE_H_
@@ -25,6 +25,10 @@
 #include "serialize.h"
 #include "layout.h"
 #include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace capnproto {
 
@@ -41,7 +45,8 @@ FlatArrayMessageReader::FlatArrayMessageReader(ArrayPtr<const word> array, Reade
   uint segmentCount = table[0].get() + 1;
   size_t offset = segmentCount / 2u + 1u;
 
-  VALIDATE_INPUT(array.size() >= offset, "Message ends prematurely in segment table.") {
+  VALIDATE_INPUT_OR_RECORD(getErrorRecord(), array.size() >= offset,
+                           "Message ends prematurely in segment table.") {
     return;
   }
 
@@ -51,8 +56,8 @@ FlatArrayMessageReader::FlatArrayMessageReader(ArrayPtr<const word> array, Reade
 
   uint segmentSize = table[1].get();
 
-  VALIDATE_INPUT(array.size() >= offset + segmentSize,
-                 "Message ends prematurely in first segment.") {
+  VALIDATE_INPUT_OR_RECORD(getErrorRecord(), array.size() >= offset + segmentSize,
+                           "Message ends prematurely in first segment.") {
     return;
   }
 
@@ -65,7 +70,8 @@ FlatArrayMessageReader::FlatArrayMessageReader(ArrayPtr<const word> array, Reade
     for (uint i = 1; i < segmentCount; i++) {
       uint segmentSize = table[i + 1].get();
 
-      VALIDATE_INPUT(array.size() >= offset + segmentSize, "Message ends prematurely.") {
+      VALIDATE_INPUT_OR_RECORD(getErrorRecord(), array.size() >= offset + segmentSize,
+                               "Message ends prematurely.") {
         moreSegments = nullptr;
         return;
       }
@@ -141,15 +147,15 @@ InputStreamMessageReader::InputStreamMessageReader(
   size_t totalWords = segment0Size;
 
   // Reject messages with too many segments for security reasons.
-  VALIDATE_INPUT(segmentCount < 512, "Message has too many segments.") {
+  VALIDATE_INPUT(segmentCount <= options.segmentLimit, "Message has too many segments.") {
     segmentCount = 1;
     segment0Size = 1;
   }
 
   // Read sizes for all segments except the first.  Include padding if necessary.
-  internal::WireValue<uint32_t> moreSizes[segmentCount & ~1];
+  CAPNPROTO_STACK_ARRAY(internal::WireValue<uint32_t>, moreSizes, segmentCount & ~1, 1024);
   if (segmentCount > 1) {
-    inputStream.read(moreSizes, sizeof(moreSizes));
+    inputStream.read(moreSizes.begin(), moreSizes.size() * sizeof(moreSizes[0]));
     for (uint i = 0; i < segmentCount - 1; i++) {
       totalWords += moreSizes[i].get();
     }
@@ -266,6 +272,206 @@ void writeMessage(OutputStream& output, ArrayPtr<const ArrayPtr<const word>> seg
 // =======================================================================================
 StreamFdMessageReader::~StreamFdMessageReader() {}
 
+// -------------------------------------------------------------------
+
+namespace {
+
+bool isPipe(int fd) {
+  struct stat stats;
+  SYSCALL(fstat(fd, &stats), fd);
+  return S_ISFIFO(stats.st_mode);
+}
+
+}  // namespace
+
+FdMessageForwarder::FdMessageForwarder(int inputFd, int outputFd, ReaderOptions options)
+    : inputFd(inputFd), outputFd(outputFd), options(options),
+      inputIsPipe(isPipe(inputFd)), outputIsPipe(isPipe(outputFd)),
+      canSpliceInput(true), canSpliceOutput(true), pipeCapacity(0) {}
+
+FdMessageForwarder::~FdMessageForwarder() {}
+
+size_t FdMessageForwarder::forward() {
+  internal::WireValue<uint32_t> firstWord[2];
+
+  // Read the first word ourselves, since EOF is not an error here.
+  byte* firstWordBytes = reinterpret_cast<byte*>(firstWord);
+  size_t firstWordSize = 0;
+  while (firstWordSize < sizeof(word)) {
+    ssize_t n = SYSCALL(::read(inputFd, firstWordBytes + firstWordSize,
+                               sizeof(word) - firstWordSize), inputFd);
+    if (n == 0) {
+      VALIDATE_INPUT(firstWordSize == 0, "Premature EOF") {}
+      return 0;
+    }
+    firstWordSize += n;
+  }
+
+  // In all of the error cases below, we can't find the next message boundary, so the best we can
+  // do is stop as if we'd reached EOF.
+  // Same limit as InputStreamMessageReader.
+  uint segmentCount = firstWord[0].get() + 1;
+  VALIDATE_INPUT(segmentCount > 0 && segmentCount <= options.segmentLimit,
+                 "Message has too many segments.") {
+    return 0;
+  }
+
+  CAPNPROTO_STACK_ARRAY(internal::WireValue<uint32_t>, table, (segmentCount + 2) & ~1, 1024);
+  table[0] = firstWord[0];
+  table[1] = firstWord[1];
+
+  size_t tableSize = (segmentCount / 2 + 1) * sizeof(word);
+  if (tableSize > sizeof(word)) {
+    size_t rest = tableSize - sizeof(word);
+    FdInputStream(inputFd).read(table.begin() + 2, rest, rest);
+  }
+
+  size_t totalWords = 0;
+  for (uint i = 0; i < segmentCount; i++) {
+    totalWords += table[i + 1].get();
+  }
+
+  VALIDATE_INPUT(totalWords <= options.traversalLimitInWords,
+        "Message is too large.  To increase the limit on the receiving end, see "
+        "capnproto::ReaderOptions.") {
+    return 0;
+  }
+
+  ArrayPtr<const byte> tableBytes =
+      arrayPtr(reinterpret_cast<const byte*>(table.begin()), tableSize);
+  size_t bodySize = totalWords * sizeof(word);
+
+  bool complete;
+  if (inputIsPipe || outputIsPipe || !(canSpliceInput || canSpliceOutput)) {
+    complete = forwardDirect(tableBytes, bodySize);
+  } else {
+    complete = forwardThroughPipe(tableBytes, bodySize);
+  }
+
+  return complete ? tableSize + bodySize : 0;
+}
+
+bool FdMessageForwarder::forwardDirect(ArrayPtr<const byte> table, size_t bodySize) {
+  FdOutputStream(outputFd).write(table.begin(), table.size());
+
+  // At least one end is a pipe, so we can splice directly between them.
+  while (bodySize > 0 && canSpliceInput && canSpliceOutput) {
+    ssize_t n = ::splice(inputFd, nullptr, outputFd, nullptr, bodySize, SPLICE_F_MOVE);
+    if (n < 0) {
+      int error = errno;
+      if (error == EINTR) continue;
+      if (error == EINVAL || error == ENOSYS) {
+        // This pair of descriptors can't be spliced.  Copy from now on.
+        canSpliceInput = false;
+        canSpliceOutput = false;
+        break;
+      }
+      FAIL_SYSCALL("splice", error, inputFd, outputFd);
+    }
+    VALIDATE_INPUT(n > 0, "Premature EOF") {
+      return false;
+    }
+    bodySize -= n;
+  }
+
+  VALIDATE_INPUT(copy(inputFd, outputFd, bodySize) == bodySize, "Premature EOF") {
+    return false;
+  }
+  return true;
+}
+
+bool FdMessageForwarder::forwardThroughPipe(ArrayPtr<const byte> table, size_t bodySize) {
+  if (pipeIn == nullptr) {
+    int fds[2];
+    SYSCALL(pipe2(fds, O_CLOEXEC));
+    pipeOut = AutoCloseFd(fds[0]);
+    pipeIn = AutoCloseFd(fds[1]);
+    pipeCapacity = SYSCALL(fcntl(pipeIn, F_GETPIPE_SZ));
+  }
+
+  // Put the table into the pipe so that it leaves in the same splice() as the start of the body.
+  // This must be a copy:  vmsplice() would leave the pipe referring to `table`, which is on the
+  // caller's stack, and a socket may still be reading those pages after we return.  A table
+  // too big for the pipe (only possible with a raised segmentLimit) is written out directly.
+  size_t inPipe = 0;
+  if (table.size() < pipeCapacity) {
+    FdOutputStream(pipeIn.get()).write(table.begin(), table.size());
+    inPipe = table.size();
+  } else {
+    FdOutputStream(outputFd).write(table.begin(), table.size());
+  }
+
+  bool complete = true;
+  while (bodySize > 0 || inPipe > 0) {
+    if (bodySize > 0 && inPipe < pipeCapacity) {
+      size_t amount = std::min(bodySize, pipeCapacity - inPipe);
+      ssize_t n = -1;
+      if (canSpliceInput) {
+        n = ::splice(inputFd, nullptr, pipeIn, nullptr, amount, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0) {
+          int error = errno;
+          if (error == EINTR) continue;
+          if (error != EINVAL && error != ENOSYS) {
+            FAIL_SYSCALL("splice", error, inputFd);
+          }
+          canSpliceInput = false;
+        }
+      }
+      if (n < 0) {
+        // Can't splice from the input.  Copy into the pipe instead.
+        n = copy(inputFd, pipeIn, std::min<size_t>(amount, 8192));
+      }
+      VALIDATE_INPUT(n > 0, "Premature EOF") {
+        complete = false;
+        break;
+      }
+      bodySize -= n;
+      inPipe += n;
+    }
+
+    ssize_t n = -1;
+    if (canSpliceOutput) {
+      n = ::splice(pipeOut, nullptr, outputFd, nullptr, inPipe,
+                   SPLICE_F_MOVE | (bodySize > 0 ? SPLICE_F_MORE : 0));
+      if (n < 0) {
+        int error = errno;
+        if (error == EINTR) continue;
+        if (error != EINVAL && error != ENOSYS) {
+          FAIL_SYSCALL("splice", error, outputFd);
+        }
+        canSpliceOutput = false;
+      }
+    }
+    if (n < 0) {
+      // Can't splice to the output.  Copy out of the pipe instead.
+      copy(pipeOut, outputFd, inPipe);
+      n = inPipe;
+    }
+    inPipe -= n;
+  }
+
+  // Drain anything left over after a recovered error, so the next message starts clean.
+  if (inPipe > 0) {
+    copy(pipeOut, outputFd, inPipe);
+  }
+  return complete;
+}
+
+size_t FdMessageForwarder::copy(int from, int to, size_t size) {
+  byte buffer[8192];
+  FdOutputStream output(to);
+  size_t copied = 0;
+  while (copied < size) {
+    ssize_t n = SYSCALL(::read(from, buffer, std::min(size - copied, sizeof(buffer))), from);
+    if (n == 0) break;
+    output.write(buffer, n);
+    copied += n;
+  }
+  return copied;
+}
+
+// -------------------------------------------------------------------
+
 void writeMessageToFd(int fd, ArrayPtr<const ArrayPtr<const word>> segments) {
   FdOutputStream stream(fd);
   writeMessage(stream, segments);
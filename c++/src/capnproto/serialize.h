@@ -121,6 +121,51 @@ public:
   ~StreamFdMessageReader();
 };
 
+class FdMessageForwarder {
+  // Copies messages from one file descriptor to another without interpreting them.  Only the
+  // segment table is actually read into memory, to find the message boundary; the rest of the
+  // message is moved using splice(), which on Linux avoids copying the data through user space.
+  // This is useful for relays that route messages without looking at their content.
+  //
+  // If neither descriptor is a pipe, data is routed through an internal pipe, which is created on
+  // first use and reused thereafter.  If the kernel doesn't support splicing for either
+  // descriptor, the forwarder falls back to read() and write().
+
+public:
+  FdMessageForwarder(int inputFd, int outputFd, ReaderOptions options = ReaderOptions());
+  // Does not take ownership of the descriptors.  `options` is used only to enforce the same
+  // size limits InputStreamMessageReader would.
+
+  CAPNPROTO_DISALLOW_COPY(FdMessageForwarder);
+  ~FdMessageForwarder();
+
+  size_t forward();
+  // Forward one message.  Returns the number of bytes forwarded, or zero if the input was at EOF.
+  // If the input is malformed and the ExceptionCallback chooses not to throw, forward() returns zero
+  // as well, since the next message boundary can no longer be found.  If forward() throws, the
+  // forwarder should not be used again.
+
+private:
+  int inputFd;
+  int outputFd;
+  ReaderOptions options;
+
+  bool inputIsPipe;
+  bool outputIsPipe;
+  bool canSpliceInput;
+  bool canSpliceOutput;
+
+  AutoCloseFd pipeOut;  // read end of the internal pipe
+  AutoCloseFd pipeIn;   // write end of the internal pipe
+  size_t pipeCapacity;
+
+  bool forwardDirect(ArrayPtr<const byte> table, size_t bodySize);
+  bool forwardThroughPipe(ArrayPtr<const byte> table, size_t bodySize);
+  // Each returns false if the input ended before the whole body was forwarded.
+  size_t copy(int from, int to, size_t size);
+  // Copies with read() and write().  Returns less than `size` only if `from` reached EOF.
+};
+
 void writeMessageToFd(int fd, MessageBuilder& builder);
 // Write the message to the given file descriptor.
 //
@@ -50,11 +50,32 @@
 #include "logging.h"
 #include <gtest/gtest.h>
 #include "test-util.h"
+#include <limits>
+#include <string>
+#include <string.h>
 
 namespace capnproto {
 namespace internal {
 namespace {
 
+class TestOutputStream: public OutputStream {
+public:
+  TestOutputStream(): writeCount(0) {}
+  ~TestOutputStream() {}
+
+  void write(const void* buffer, size_t size) override {
+    data.append(reinterpret_cast<const char*>(buffer), size);
+    ++writeCount;
+  }
+
+  const std::string& getData() { return data; }
+  uint getWriteCount() { return writeCount; }
+
+private:
+  std::string data;
+  uint writeCount;
+};
+
 TEST(Stringify, DebugString) {
   MallocMessageBuilder builder;
   auto root = builder.initRoot<TestAllTypes>();
@@ -147,6 +168,202 @@ TEST(Stringify, MoreValues) {
   EXPECT_STREQ("123", stringify(static_cast<TestEnum>(123)).cStr());
 }
 
+TEST(Stringify, Numbers) {
+  EXPECT_STREQ("0", stringify(0).cStr());
+  EXPECT_STREQ("-9223372036854775808",
+               stringify(std::numeric_limits<int64_t>::min()).cStr());
+  EXPECT_STREQ("18446744073709551615",
+               stringify(std::numeric_limits<uint64_t>::max()).cStr());
+
+  EXPECT_STREQ("0", stringify(0.0).cStr());
+  EXPECT_STREQ("-0", stringify(-0.0).cStr());
+  EXPECT_STREQ("-12345", stringify(-12345.0).cStr());
+  EXPECT_STREQ("1e15", stringify(1e15).cStr());
+  EXPECT_STREQ("0.1", stringify(0.1).cStr());
+  EXPECT_STREQ("1e-100", stringify(1e-100).cStr());
+  EXPECT_STREQ("1e-05", stringify(1e-5).cStr());
+  EXPECT_STREQ("5e-324", stringify(5e-324).cStr());
+
+  // These need more than DBL_DIG digits to round-trip; we use no more than necessary.
+  EXPECT_STREQ("0.3333333333333333", stringify(1.0 / 3).cStr());
+  EXPECT_STREQ("1.2345678901234568e17", stringify(123456789012345678.0).cStr());
+
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  root.setFloat32Field(0.1f);
+  root.setFloat64Field(0.1);
+  EXPECT_STREQ("(float32Field = 0.1, float64Field = 0.1)", stringify(root.asReader()).cStr());
+  root.setFloat32Field(16777215.0f);
+  root.setFloat64Field(1.0 / 3);
+  EXPECT_STREQ("(float32Field = 16777215, float64Field = 0.3333333333333333)",
+               stringify(root.asReader()).cStr());
+}
+
+TEST(Stringify, Escapes) {
+  // Long enough to exercise the vectorized scan, with special characters at various offsets.
+  EXPECT_STREQ("\"0123456789abcdefghij\\\\0123456789abcdefghij\\'x\\\"\"",
+               stringify("0123456789abcdefghij\\0123456789abcdefghij'x\"").cStr());
+  EXPECT_STREQ("\"\\x01\\x1f\x7f\\x80\\xff 0123456789abcdef\\n\"",
+               stringify("\x01\x1f\x7f\x80\xff 0123456789abcdef\n").cStr());
+  EXPECT_STREQ("\"0123456789abcdef\"", stringify("0123456789abcdef").cStr());
+  EXPECT_STREQ("\"\"", stringify("").cStr());
+}
+
+TEST(Stringify, Streams) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  initTestMessage(root);
+
+  String expected = stringify(root.asReader());
+
+  {
+    // Directly into an array.
+    byte buffer[8192];
+    ArrayOutputStream output(arrayPtr(buffer, sizeof(buffer)));
+    stringify(root.asReader(), output);
+    EXPECT_EQ(std::string(expected.cStr()),
+              std::string(reinterpret_cast<char*>(buffer), output.getArray().size()));
+  }
+
+  {
+    // Unbuffered stream.
+    TestOutputStream output;
+    stringify(root.asReader(), output);
+    EXPECT_EQ(expected.cStr(), output.getData());
+    EXPECT_EQ(1u, output.getWriteCount());
+  }
+
+  {
+    // Buffers too small for a whole number or escape sequence.
+    for (uint size = 1; size < 40; size++) {
+      TestOutputStream output;
+      byte buffer[40];
+      BufferedOutputStreamWrapper wrapper(output, arrayPtr(buffer, size));
+      stringify(root.asReader(), wrapper);
+      wrapper.flush();
+      EXPECT_EQ(expected.cStr(), output.getData()) << "buffer size: " << size;
+    }
+  }
+
+  {
+    // An array that is too small.
+    byte buffer[64];
+    ArrayOutputStream output(arrayPtr(buffer, sizeof(buffer)));
+    EXPECT_ANY_THROW(stringify(root.asReader(), output));
+  }
+}
+
+TEST(Stringify, ParseRoundTrip) {
+  MallocMessageBuilder builder;
+  initTestMessage(builder.initRoot<TestAllTypes>());
+  String text = stringify(builder.getRoot<TestAllTypes>().asReader());
+
+  MallocMessageBuilder builder2;
+  auto root = builder2.initRoot<TestAllTypes>();
+  parseStringified(Text::Reader(text.cStr()), root);
+  checkTestMessage(root.asReader());
+  EXPECT_STREQ(text.cStr(), stringify(root.asReader()).cStr());
+}
+
+TEST(Stringify, ParseUnions) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestUnion>();
+  parseStringified(
+      Text::Reader("(union0 = u0f1s32(1234567), union1 = u1f0sp(\"foo\"), union2 = ?)"), root);
+
+  EXPECT_EQ(TestUnion::Union0::U0F1S32, root.getUnion0().which());
+  EXPECT_EQ(1234567, root.getUnion0().getU0f1s32());
+  EXPECT_EQ(TestUnion::Union1::U1F0SP, root.getUnion1().which());
+  EXPECT_EQ("foo", root.getUnion1().getU1f0sp());
+}
+
+TEST(Stringify, ParseHandWritten) {
+  MallocMessageBuilder builder;
+  auto root = builder.initRoot<TestAllTypes>();
+  parseStringified(Text::Reader(
+      "# A hand-written message.\n"
+      "(\n"
+      "  enumField = garply,  # Members in any order.\n"
+      "  int32Field=-123,\n"
+      "  float64Field = -inf,\n"
+      "  textField = \"a \\\"quoted\\\" ], string\",\n"
+      "  structList = [(int8Field = 1), (textField = \"(\"), ()],\n"
+      "  int32List = [ ],\n"
+      ")"), root);
+
+  EXPECT_EQ(TestEnum::GARPLY, root.getEnumField());
+  EXPECT_EQ(-123, root.getInt32Field());
+  EXPECT_EQ(-std::numeric_limits<double>::infinity(), root.getFloat64Field());
+  EXPECT_EQ("a \"quoted\" ], string", root.getTextField());
+  ASSERT_EQ(3u, root.getStructList().size());
+  EXPECT_EQ(1, root.getStructList()[0].getInt8Field());
+  EXPECT_EQ("(", root.getStructList()[1].getTextField());
+  EXPECT_TRUE(root.hasInt32List());
+  EXPECT_EQ(0u, root.getInt32List().size());
+}
+
+TEST(Stringify, ParseErrors) {
+  const char* inputs[] = {
+    "", "[]", "(", "(int32Field)", "(int32Field = )", "(int32Field = 1,)", "(noSuchField = 1)",
+    "(int8Field = 128)", "(int8Field = -129)", "(uInt32Field = -1)", "(int32Field = 1.5)",
+    "(uInt64Field = 18446744073709551616)", "(textField = \"abc)", "(textField = \"\\q\")",
+    "(textField = \"\\x4\")", "(textField = 5)", "(enumField = nosuch)", "(enumField = 123)",
+    "(int32List = [1,,2])", "(int32List = [1 2])", "(float64Field = 1.)", "(boolField = yes)",
+    "(structField = [])", "() ()",
+  };
+
+  for (const char* input: inputs) {
+    MallocMessageBuilder builder;
+    EXPECT_ANY_THROW(parseStringified(Text::Reader(input), builder.initRoot<TestAllTypes>()))
+        << input;
+  }
+
+  // Errors give the position.
+  MallocMessageBuilder builder;
+  try {
+    parseStringified(Text::Reader("(\n  int32Field = 1,\n  int32List = [1, x]\n)"),
+                     builder.initRoot<TestAllTypes>());
+    ADD_FAILURE() << "Expected an exception.";
+  } catch (const Exception& e) {
+    std::string description(e.getDescription().begin(), e.getDescription().size());
+    EXPECT_EQ(Exception::Nature::INPUT, e.getNature());
+    EXPECT_NE(std::string::npos, description.find("line = 3; column = 20")) << description;
+  }
+
+  // Deeply nested input doesn't overflow the stack.
+  std::string deep = "(structList = ";
+  for (uint i = 0; i < 10000; i++) {
+    deep += "[(structList = ";
+  }
+  EXPECT_ANY_THROW(parseStringified(Text::Reader(deep.c_str()),
+                                    builder.initRoot<TestAllTypes>()));
+}
+
+TEST(Stringify, ParseTruncated) {
+  // Every proper prefix of a message is rejected without reading past the end of the text, even
+  // if it stops in the middle of an escape sequence.
+  std::string text =
+      "(textList = [\"a\\\"b\\\\\", \"\\x01\"], structList = [(textField = \"\\n\")])";
+
+  {
+    MallocMessageBuilder builder;
+    auto root = builder.initRoot<TestAllTypes>();
+    parseStringified(Text::Reader(text.c_str()), root);
+    ASSERT_EQ(2u, root.getTextList().size());
+    EXPECT_EQ("a\"b\\", root.getTextList()[0]);
+    EXPECT_EQ("\n", root.getStructList()[0].getTextField());
+  }
+
+  for (size_t size = 0; size < text.size(); size++) {
+    // Copy into an allocation of exactly the right size, so that a sanitizer catches over-reads.
+    Array<char> input = newArray<char>(size);
+    memcpy(input.begin(), text.data(), size);
+    MallocMessageBuilder builder;
+    EXPECT_ANY_THROW(parseStringified(arrayPtr(static_cast<const char*>(input.begin()), size),
+                                      builder.initRoot<TestAllTypes>())) << text.substr(0, size);
+  }
+}
+
 }  // namespace
 }  // namespace internal
 }  // namespace capnproto
@@ -21,12 +21,18 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+
 #define CAPNPROTO_PRIVATE
 #include "stringify.h"
 #include "logging.h"
-#include <sstream>
+#include "text-input.h"
+#include "text-output.h"
+#include <string.h>
+#include <limits>
 
-// TODO(cleanup):  Rewrite this using something other than iostream?
+#if __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace capnproto {
 
@@ -34,79 +40,143 @@ namespace {
 
 static const char HEXDIGITS[] = "0123456789abcdef";
 
-static void print(std::ostream& os, DynamicValue::Reader value,
-                  schema::Type::Body::Which which) {
+inline bool needsEscape(char c) {
+  // Control characters and bytes >= 0x80 (which are negative as signed char) are hex-escaped
+  // unless they have a short escape.
+  return static_cast<signed char>(c) < 0x20 || c == '\"' || c == '\'' || c == '\\';
+}
+
+const char* findEscape(const char* pos, const char* end) {
+  // Returns a pointer to the first character in [pos, end) which needs escaping, or `end` if
+  // there is none.
+
+#if __SSE2__
+  // Check 16 bytes at a time.  _mm_cmplt_epi8() compares signed bytes, so one comparison catches
+  // both control characters and high bytes.
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i doubleQuote = _mm_set1_epi8('\"');
+  const __m128i singleQuote = _mm_set1_epi8('\'');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  while (end - pos >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmplt_epi8(chunk, space), _mm_cmpeq_epi8(chunk, doubleQuote)),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, singleQuote), _mm_cmpeq_epi8(chunk, backslash)));
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+#endif
+
+  while (pos < end && !needsEscape(*pos)) {
+    ++pos;
+  }
+  return pos;
+}
+
+class Printer {
+public:
+  explicit Printer(BufferedOutputStream& output): out(output) {}
+  CAPNPROTO_DISALLOW_COPY(Printer);
+
+  void print(DynamicValue::Reader value, schema::Type::Body::Which which);
+  void flush() { out.flush(); }
+
+private:
+  internal::TextOutput out;
+
+  void writeQuoted(Data::Reader data);
+};
+
+void Printer::writeQuoted(Data::Reader data) {
+  out.put('\"');
+
+  const char* in = reinterpret_cast<const char*>(data.data());
+  const char* end = in + data.size();
+  for (;;) {
+    // Copy the longest run that needs no escaping all at once.
+    const char* special = findEscape(in, end);
+    out.write(in, special - in);
+    if (special == end) break;
+
+    char c = *special;
+    in = special + 1;
+    switch (c) {
+      case '\a': out.write("\\a"); break;
+      case '\b': out.write("\\b"); break;
+      case '\f': out.write("\\f"); break;
+      case '\n': out.write("\\n"); break;
+      case '\r': out.write("\\r"); break;
+      case '\t': out.write("\\t"); break;
+      case '\v': out.write("\\v"); break;
+      case '\'': out.write("\\\'"); break;
+      case '\"': out.write("\\\""); break;
+      case '\\': out.write("\\\\"); break;
+      default: {
+        uint8_t c2 = c;
+        char escape[4] = { '\\', 'x', HEXDIGITS[c2 / 16], HEXDIGITS[c2 % 16] };
+        out.write(escape, sizeof(escape));
+        break;
+      }
+    }
+  }
+
+  out.put('\"');
+}
+
+void Printer::print(DynamicValue::Reader value, schema::Type::Body::Which which) {
   // Print an arbitrary message via the dynamic API by
   // iterating over the schema.  Look at the handling
   // of STRUCT in particular.
 
   switch (value.getType()) {
     case DynamicValue::UNKNOWN:
-      os << "?";
+      out.put('?');
       break;
     case DynamicValue::VOID:
-      os << "void";
+      out.write("void");
       break;
     case DynamicValue::BOOL:
-      os << (value.as<bool>() ? "true" : "false");
+      if (value.as<bool>()) {
+        out.write("true");
+      } else {
+        out.write("false");
+      }
       break;
     case DynamicValue::INT:
-      os << value.as<int64_t>();
+      out.writeSigned(value.as<int64_t>());
       break;
     case DynamicValue::UINT:
-      os << value.as<uint64_t>();
+      out.writeUnsigned(value.as<uint64_t>());
       break;
-    case DynamicValue::FLOAT: {
+    case DynamicValue::FLOAT:
       if (which == schema::Type::Body::FLOAT32_TYPE) {
-        auto buf = STR * value.as<float>();
-        os.write(buf.begin(), buf.size());
+        out.writeFloat(value.as<float>(), true);
       } else {
-        auto buf = STR * value.as<double>();
-        os.write(buf.begin(), buf.size());
+        out.writeFloat(value.as<double>(), false);
       }
       break;
-    }
     case DynamicValue::TEXT:
-    case DynamicValue::DATA: {
-      os << '\"';
-      for (char c: value.as<Data>()) {
-        switch (c) {
-          case '\a': os << "\\a"; break;
-          case '\b': os << "\\b"; break;
-          case '\f': os << "\\f"; break;
-          case '\n': os << "\\n"; break;
-          case '\r': os << "\\r"; break;
-          case '\t': os << "\\t"; break;
-          case '\v': os << "\\v"; break;
-          case '\'': os << "\\\'"; break;
-          case '\"': os << "\\\""; break;
-          case '\\': os << "\\\\"; break;
-          default:
-            if (c < 0x20) {
-              uint8_t c2 = c;
-              os << "\\x" << HEXDIGITS[c2 / 16] << HEXDIGITS[c2 % 16];
-            } else {
-              os << c;
-            }
-            break;
-        }
-      }
-      os << '\"';
+    case DynamicValue::DATA:
+      writeQuoted(value.as<Data>());
       break;
-    }
     case DynamicValue::LIST: {
-      os << "[";
+      out.put('[');
       bool first = true;
       auto listValue = value.as<DynamicList>();
+      auto elementType = listValue.getSchema().whichElementType();
       for (auto element: listValue) {
         if (first) {
           first = false;
         } else {
-          os << ", ";
+          out.write(", ");
         }
-        print(os, element, listValue.getSchema().whichElementType());
+        print(element, elementType);
       }
-      os << "]";
+      out.put(']');
       break;
     }
     case DynamicValue::ENUM: {
@@ -115,14 +185,14 @@ static void print(std::ostream& os, DynamicValue::Reader value,
           enumValue.getEnumerant();
       if (enumerant == nullptr) {
         // Unknown enum value; output raw number.
-        os << enumValue.getRaw();
+        out.writeUnsigned(enumValue.getRaw());
       } else {
-        os << enumerant->getProto().getName().c_str();
+        out.write(enumerant->getProto().getName());
       }
       break;
     }
     case DynamicValue::STRUCT: {
-      os << "(";
+      out.put('(');
       auto structValue = value.as<DynamicStruct>();
       bool first = true;
       for (auto member: structValue.getSchema().getMembers()) {
@@ -130,23 +200,24 @@ static void print(std::ostream& os, DynamicValue::Reader value,
           if (first) {
             first = false;
           } else {
-            os << ", ";
+            out.write(", ");
           }
-          os << member.getProto().getName().c_str() << " = ";
+          out.write(member.getProto().getName());
+          out.write(" = ");
 
           auto memberBody = member.getProto().getBody();
           switch (memberBody.which()) {
             case schema::StructNode::Member::Body::UNION_MEMBER:
-              print(os, structValue.get(member), schema::Type::Body::VOID_TYPE);
+              print(structValue.get(member), schema::Type::Body::VOID_TYPE);
               break;
             case schema::StructNode::Member::Body::FIELD_MEMBER:
-              print(os, structValue.get(member),
+              print(structValue.get(member),
                     memberBody.getFieldMember().getType().getBody().which());
               break;
           }
         }
       }
-      os << ")";
+      out.put(')');
       break;
     }
     case DynamicValue::UNION: {
@@ -155,12 +226,13 @@ static void print(std::ostream& os, DynamicValue::Reader value,
       if (tag == nullptr) {
         // Unknown union member; must have come from newer
         // version of the protocol.
-        os << "?";
+        out.put('?');
       } else {
-        os << tag->getProto().getName() << "(";
-        print(os, unionValue.get(),
+        out.write(tag->getProto().getName());
+        out.put('(');
+        print(unionValue.get(),
               tag->getProto().getBody().getFieldMember().getType().getBody().which());
-        os << ")";
+        out.put(')');
       }
       break;
     }
@@ -168,18 +240,618 @@ static void print(std::ostream& os, DynamicValue::Reader value,
       FAIL_RECOVERABLE_CHECK("Don't know how to print interfaces.") {}
       break;
     case DynamicValue::OBJECT:
-      os << "(opaque object)";
+      out.write("(opaque object)");
+      break;
+  }
+}
+
+// =======================================================================================
+// Parsing
+
+inline bool isIdentifierStart(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+inline bool isIdentifierChar(char c) {
+  return isIdentifierStart(c) || internal::isDigit(c);
+}
+
+struct StringToken {
+  // A string literal in the input which has been validated but not yet decoded.
+
+  const char* begin;
+  const char* end;
+  // The raw text between the quotes.
+
+  size_t size;
+  // The size of the string once escape sequences are decoded.
+
+  bool escaped;
+  // Whether the raw text contains any escape sequences.  If not, it can be copied as-is.
+};
+
+class Parser {
+  // Parses the output of Printer back into a message, in a single pass.  Errors are reported
+  // through VALIDATE_INPUT, so they throw by default.  If exceptions are disabled, the first error
+  // is logged, the rest of the input is skipped, and the output is left partially filled in.
+
+public:
+  explicit Parser(ArrayPtr<const char> input)
+      : start(input.begin()), pos(input.begin()), end(input.end()), failed(false) {}
+  CAPNPROTO_DISALLOW_COPY(Parser);
+
+  void parseStruct(DynamicStruct::Builder builder, uint depth);
+  void finish();
+
+private:
+  const char* start;
+  const char* pos;
+  const char* end;
+  bool failed;
+
+  Array<char> scratch;
+
+  void fail(const char* error) { failAt(pos, error); }
+  void failAt(const char* at, const char* error);
+
+  void skipSpace();
+  bool consume(char c);
+  bool expect(char c, const char* error);
+  bool consumeWord(const char* word, size_t size);
+
+  Text::Reader parseIdentifier(const char* error);
+  // Returns the identifier, copied so that it's NUL-terminated, or an empty string on failure.
+
+  bool parseString(StringToken& token);
+  void decodeString(const StringToken& token, char* out);
+  bool parseSigned(int64_t& value, int64_t max);
+  bool parseUnsigned(uint64_t& value, uint64_t max);
+  bool parseInteger(bool& negative, uint64_t& magnitude);
+  bool parseFloat(double& value);
+  bool parseEnumerant(EnumSchema schema, Text::Reader& name);
+
+  uint countElements();
+  // Called just after the '[' opening a list.  Returns the number of elements in the list by
+  // scanning ahead to the matching ']', without parsing the elements.
+
+  void parseUnion(DynamicUnion::Builder builder, uint depth);
+  void parseList(DynamicList::Builder builder, uint depth);
+  template <typename Slot>
+  void parseValue(Slot slot, schema::Type::Body::Which which, uint depth);
+};
+
+void Parser::failAt(const char* at, const char* error) {
+  if (failed) return;
+  failed = true;
+
+  uint line, column;
+  internal::findLineAndColumn(start, at, line, column);
+  FAIL_VALIDATE_INPUT("Parse error.", error, line, column) {
+    // Skip the rest of the input.
+  }
+  pos = end;
+}
+
+void Parser::skipSpace() {
+  while (pos < end) {
+    char c = *pos;
+    if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+      ++pos;
+    } else if (c == '#') {
+      // Comment to end of line.
+      const char* newline = reinterpret_cast<const char*>(memchr(pos, '\n', end - pos));
+      pos = newline == nullptr ? end : newline + 1;
+    } else {
+      break;
+    }
+  }
+}
+
+bool Parser::consume(char c) {
+  skipSpace();
+  if (pos < end && *pos == c) {
+    ++pos;
+    return true;
+  }
+  return false;
+}
+
+bool Parser::expect(char c, const char* error) {
+  if (consume(c)) return true;
+  fail(error);
+  return false;
+}
+
+bool Parser::consumeWord(const char* word, size_t size) {
+  // Consumes `word` if it's next and isn't just the start of a longer identifier.
+  skipSpace();
+  if (static_cast<size_t>(end - pos) >= size && memcmp(pos, word, size) == 0 &&
+      (static_cast<size_t>(end - pos) == size || !isIdentifierChar(pos[size]))) {
+    pos += size;
+    return true;
+  }
+  return false;
+}
+
+Text::Reader Parser::parseIdentifier(const char* error) {
+  skipSpace();
+  const char* p = pos;
+  if (p == end || !isIdentifierStart(*p)) {
+    fail(error);
+    return Text::Reader();
+  }
+  while (p < end && isIdentifierChar(*p)) ++p;
+
+  // Text::Reader must be NUL-terminated, so the identifier can't be used in place.
+  size_t size = p - pos;
+  if (scratch.size() <= size) {
+    scratch = newArray<char>(size < 64 ? 128 : size * 2);
+  }
+  memcpy(scratch.begin(), pos, size);
+  scratch[size] = '\0';
+  pos = p;
+  return Text::Reader(scratch.begin(), size);
+}
+
+bool Parser::parseString(StringToken& token) {
+  skipSpace();
+  if (pos == end || *pos != '\"') {
+    fail("Expected a string.");
+    return false;
+  }
+
+  const char* p = pos + 1;
+  token.begin = p;
+  token.escaped = false;
+  size_t size = 0;
+
+  for (;;) {
+    // Skip the longest run that needs no decoding all at once.
+    const char* special = internal::findQuoteOrBackslash(p, end);
+    size += special - p;
+    p = special;
+
+    if (p == end) {
+      failAt(pos, "Unterminated string.");
+      return false;
+    } else if (*p == '\"') {
       break;
+    }
+
+    token.escaped = true;
+    if (end - p < 2) {
+      failAt(pos, "Unterminated string.");
+      return false;
+    }
+    switch (p[1]) {
+      case 'a': case 'b': case 'f': case 'n': case 'r': case 't': case 'v':
+      case '\'': case '\"': case '\\':
+        size += 1;
+        p += 2;
+        break;
+      case 'x':
+        if (end - p < 4 || internal::hexDigitValue(p[2]) < 0 ||
+            internal::hexDigitValue(p[3]) < 0) {
+          failAt(p, "Invalid \\x escape sequence.");
+          return false;
+        }
+        size += 1;
+        p += 4;
+        break;
+      default:
+        failAt(p, "Invalid escape sequence.");
+        return false;
+    }
+  }
+
+  token.end = p;
+  token.size = size;
+  pos = p + 1;
+  return true;
+}
+
+void Parser::decodeString(const StringToken& token, char* out) {
+  if (!token.escaped) {
+    memcpy(out, token.begin, token.size);
+    return;
+  }
+
+  // parseString() already validated the escape sequences.
+  const char* p = token.begin;
+  while (p < token.end) {
+    const char* escape = reinterpret_cast<const char*>(memchr(p, '\\', token.end - p));
+    if (escape == nullptr) escape = token.end;
+    memcpy(out, p, escape - p);
+    out += escape - p;
+    p = escape;
+    if (p == token.end) break;
+
+    switch (p[1]) {
+      case 'a': *out++ = '\a'; break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'v': *out++ = '\v'; break;
+      case 'x':
+        *out++ = (internal::hexDigitValue(p[2]) << 4) | internal::hexDigitValue(p[3]);
+        p += 2;
+        break;
+      default:
+        // '\'', '"', or '\\'.
+        *out++ = p[1];
+        break;
+    }
+    p += 2;
+  }
+}
+
+bool Parser::parseInteger(bool& negative, uint64_t& magnitude) {
+  skipSpace();
+  const char* p = pos;
+  negative = p < end && *p == '-';
+  p += negative;
+
+  if (p == end || !internal::isDigit(*p)) {
+    fail("Expected an integer.");
+    return false;
+  }
+
+  magnitude = 0;
+  while (p < end && internal::isDigit(*p)) {
+    uint digit = *p - '0';
+    if (magnitude > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+      fail("Integer is out of range for its type.");
+      return false;
+    }
+    magnitude = magnitude * 10 + digit;
+    ++p;
+  }
+
+  if (p < end && (*p == '.' || *p == 'e' || *p == 'E' || isIdentifierChar(*p))) {
+    fail("Expected an integer.");
+    return false;
+  }
+
+  pos = p;
+  return true;
+}
+
+bool Parser::parseSigned(int64_t& value, int64_t max) {
+  const char* start = pos;
+  bool negative;
+  uint64_t magnitude;
+  if (!parseInteger(negative, magnitude)) return false;
+
+  // The minimum is -max - 1.
+  if (magnitude > static_cast<uint64_t>(max) + negative) {
+    failAt(start, "Integer is out of range for its type.");
+    return false;
+  }
+  value = negative ? -static_cast<int64_t>(magnitude - 1) - 1 : static_cast<int64_t>(magnitude);
+  return true;
+}
+
+bool Parser::parseUnsigned(uint64_t& value, uint64_t max) {
+  const char* start = pos;
+  bool negative;
+  if (!parseInteger(negative, value)) return false;
+
+  if (value > max || (negative && value != 0)) {
+    failAt(start, "Integer is out of range for its type.");
+    return false;
+  }
+  return true;
+}
+
+bool Parser::parseFloat(double& value) {
+  if (consumeWord("nan", 3)) {
+    value = std::numeric_limits<double>::quiet_NaN();
+    return true;
+  } else if (consumeWord("inf", 3)) {
+    value = std::numeric_limits<double>::infinity();
+    return true;
+  } else if (consumeWord("-inf", 4)) {
+    value = -std::numeric_limits<double>::infinity();
+    return true;
+  }
+
+  // Check the number's syntax, then convert it.
+  const char* p = pos;
+  p += p < end && *p == '-';
+  if (p == end || !internal::isDigit(*p)) {
+    fail("Expected a number.");
+    return false;
+  }
+  while (p < end && internal::isDigit(*p)) ++p;
+
+  if (p < end && *p == '.') {
+    ++p;
+    if (p == end || !internal::isDigit(*p)) {
+      failAt(p, "Expected a digit after the decimal point.");
+      return false;
+    }
+    while (p < end && internal::isDigit(*p)) ++p;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    p += p < end && (*p == '-' || *p == '+');
+    if (p == end || !internal::isDigit(*p)) {
+      failAt(p, "Expected a digit in the exponent.");
+      return false;
+    }
+    while (p < end && internal::isDigit(*p)) ++p;
+  }
+
+  if (p < end && isIdentifierChar(*p)) {
+    failAt(p, "Expected a number.");
+    return false;
+  }
+
+  value = internal::parseDecimal(pos, p);
+  pos = p;
+  return true;
+}
+
+bool Parser::parseEnumerant(EnumSchema schema, Text::Reader& name) {
+  skipSpace();
+  const char* start = pos;
+
+  if (pos < end && internal::isDigit(*pos)) {
+    // An enum value not known to the schema that printed it.  The dynamic API can only set
+    // values the schema defines, though.
+    uint64_t value;
+    if (!parseUnsigned(value, std::numeric_limits<uint16_t>::max())) return false;
+    for (auto enumerant: schema.getEnumerants()) {
+      if (enumerant.getOrdinal() == value) {
+        name = enumerant.getProto().getName();
+        return true;
+      }
+    }
+    failAt(start, "Unknown enumerant.");
+    return false;
+  }
+
+  Text::Reader identifier = parseIdentifier("Expected an enumerant.");
+  if (failed) return false;
+  Maybe<EnumSchema::Enumerant> enumerant = schema.findEnumerantByName(identifier);
+  if (enumerant == nullptr) {
+    failAt(start, "Unknown enumerant.");
+    return false;
+  }
+  name = enumerant->getProto().getName();
+  return true;
+}
+
+uint Parser::countElements() {
+  return internal::countElements(pos, end, '(', ')', true);
+}
+
+void Parser::parseStruct(DynamicStruct::Builder builder, uint depth) {
+  if (!expect('(', "Expected '('.")) return;
+  if (depth == 0) {
+    fail("Nesting limit exceeded.");
+    return;
+  }
+  if (consume(')')) return;
+
+  StructSchema schema = builder.getSchema();
+
+  do {
+    skipSpace();
+    const char* nameStart = pos;
+    Text::Reader name = parseIdentifier("Expected a member name.");
+    if (failed) return;
+
+    Maybe<StructSchema::Member> member = schema.findMemberByName(name);
+    if (member == nullptr) {
+      failAt(nameStart, "No such member.");
+      return;
+    }
+    if (!expect('=', "Expected '='.")) return;
+
+    auto body = member->getProto().getBody();
+    switch (body.which()) {
+      case schema::StructNode::Member::Body::UNION_MEMBER:
+        parseUnion(builder.get(*member).as<DynamicUnion>(), depth - 1);
+        break;
+      case schema::StructNode::Member::Body::FIELD_MEMBER:
+        parseValue(internal::FieldSlot { builder, *member },
+                   body.getFieldMember().getType().getBody().which(), depth - 1);
+        break;
+    }
+    if (failed) return;
+  } while (consume(','));
+
+  expect(')', "Expected ',' or ')'.");
+}
+
+void Parser::parseUnion(DynamicUnion::Builder builder, uint depth) {
+  if (consume('?')) {
+    // The printer's schema didn't know which member was set.  Leave the union alone.
+    return;
+  }
+
+  skipSpace();
+  const char* nameStart = pos;
+  Text::Reader name = parseIdentifier("Expected a union member name.");
+  if (failed) return;
+
+  Maybe<StructSchema::Member> member = builder.getSchema().findMemberByName(name);
+  if (member == nullptr) {
+    failAt(nameStart, "No such union member.");
+    return;
+  }
+
+  if (!expect('(', "Expected '('.")) return;
+  parseValue(internal::UnionSlot { builder, *member },
+             member->getProto().getBody().getFieldMember().getType().getBody().which(), depth);
+  if (failed) return;
+  expect(')', "Expected ')'.");
+}
+
+void Parser::parseList(DynamicList::Builder builder, uint depth) {
+  // The caller already consumed the '['.
+  if (depth == 0) {
+    fail("Nesting limit exceeded.");
+    return;
+  }
+  if (consume(']')) return;
+
+  schema::Type::Body::Which elementType = builder.getSchema().whichElementType();
+  uint index = 0;
+
+  do {
+    if (index == builder.size()) {
+      fail("Expected ']'.");
+      return;
+    }
+    parseValue(internal::ElementSlot { builder, index++ }, elementType, depth - 1);
+    if (failed) return;
+  } while (consume(','));
+
+  expect(']', "Expected ',' or ']'.");
+}
+
+template <typename Slot>
+void Parser::parseValue(Slot slot, schema::Type::Body::Which which, uint depth) {
+  switch (which) {
+    case schema::Type::Body::VOID_TYPE:
+      if (consumeWord("void", 4)) {
+        slot.set(Void::VOID);
+      } else {
+        fail("Expected void.");
+      }
+      break;
+
+    case schema::Type::Body::BOOL_TYPE:
+      if (consumeWord("true", 4)) {
+        slot.set(true);
+      } else if (consumeWord("false", 5)) {
+        slot.set(false);
+      } else {
+        fail("Expected true or false.");
+      }
+      break;
+
+#define HANDLE_SIGNED(discrim, type) \
+    case schema::Type::Body::discrim##_TYPE: { \
+      int64_t value; \
+      if (parseSigned(value, std::numeric_limits<type>::max())) slot.set(value); \
+      break; \
+    }
+#define HANDLE_UNSIGNED(discrim, type) \
+    case schema::Type::Body::discrim##_TYPE: { \
+      uint64_t value; \
+      if (parseUnsigned(value, std::numeric_limits<type>::max())) slot.set(value); \
+      break; \
+    }
+
+    HANDLE_SIGNED(INT8, int8_t)
+    HANDLE_SIGNED(INT16, int16_t)
+    HANDLE_SIGNED(INT32, int32_t)
+    HANDLE_SIGNED(INT64, int64_t)
+    HANDLE_UNSIGNED(UINT8, uint8_t)
+    HANDLE_UNSIGNED(UINT16, uint16_t)
+    HANDLE_UNSIGNED(UINT32, uint32_t)
+    HANDLE_UNSIGNED(UINT64, uint64_t)
+
+#undef HANDLE_SIGNED
+#undef HANDLE_UNSIGNED
+
+    case schema::Type::Body::FLOAT32_TYPE:
+    case schema::Type::Body::FLOAT64_TYPE: {
+      double value;
+      if (parseFloat(value)) slot.set(value);
+      break;
+    }
+
+    case schema::Type::Body::TEXT_TYPE: {
+      StringToken token;
+      if (parseString(token)) {
+        decodeString(token, slot.init(token.size).template as<Text>().data());
+      }
+      break;
+    }
+
+    case schema::Type::Body::DATA_TYPE: {
+      StringToken token;
+      if (parseString(token)) {
+        decodeString(token, slot.init(token.size).template as<Data>().data());
+      }
+      break;
+    }
+
+    case schema::Type::Body::LIST_TYPE:
+      if (expect('[', "Expected '['.")) {
+        // Size the list up front, since lists can't grow once allocated.
+        uint size = countElements();
+        parseList(slot.init(size).template as<DynamicList>(), depth);
+      }
+      break;
+
+    case schema::Type::Body::ENUM_TYPE: {
+      Text::Reader name;
+      if (parseEnumerant(slot.getEnumSchema(), name)) slot.set(name);
+      break;
+    }
+
+    case schema::Type::Body::STRUCT_TYPE:
+      parseStruct(slot.init().template as<DynamicStruct>(), depth);
+      break;
+
+    case schema::Type::Body::INTERFACE_TYPE:
+      fail("Can't parse interfaces.");
+      break;
+
+    case schema::Type::Body::OBJECT_TYPE:
+      // The printer can't show what's in an Object field, so there's nothing to set.
+      if (!consume('(') || !consumeWord("opaque", 6) || !consumeWord("object", 6) ||
+          !consume(')')) {
+        fail("Expected (opaque object).");
+      }
+      break;
+  }
+}
+
+void Parser::finish() {
+  skipSpace();
+  if (pos != end) {
+    fail("Expected end of input.");
   }
 }
 
 }  // namespace
 
 String stringify(DynamicValue::Reader value) {
-  std::stringstream out;
-  print(out, value, schema::Type::Body::STRUCT_TYPE);
-  auto content = out.str();
-  return String(content.data(), content.size());
+  internal::StringOutputStream output;
+  stringify(value, output);
+  return output.finish();
+}
+
+void stringify(DynamicValue::Reader value, BufferedOutputStream& output) {
+  Printer printer(output);
+  printer.print(value, schema::Type::Body::STRUCT_TYPE);
+  printer.flush();
+}
+
+void stringify(DynamicValue::Reader value, OutputStream& output) {
+  if (BufferedOutputStream* bufferedOutputPtr = dynamic_cast<BufferedOutputStream*>(&output)) {
+    stringify(value, *bufferedOutputPtr);
+  } else {
+    byte buffer[8192];
+    BufferedOutputStreamWrapper bufferedOutput(output, arrayPtr(buffer, sizeof(buffer)));
+    stringify(value, bufferedOutput);
+    bufferedOutput.flush();
+  }
+}
+
+void parseStringified(ArrayPtr<const char> text, DynamicStruct::Builder output) {
+  Parser parser(text);
+  parser.parseStruct(output, internal::TEXT_NESTING_LIMIT);
+  parser.finish();
 }
 
 namespace internal {
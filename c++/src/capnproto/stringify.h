@@ -21,10 +21,12 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+
 #ifndef CAPNPROTO_STRINGIFY_H_
 #define CAPNPROTO_STRINGIFY_H_
 
 #include "dynamic.h"
+#include "io.h"
 
 namespace capnproto {
 
@@ -32,6 +34,36 @@ String stringify(DynamicValue::Reader value);
 // Stringify an arbitrary Cap'n Proto value.  Note that DynamicValue::Reader can be implicitly
 // constructed from any Cap'n Proto field type, so this will accept pretty much anything.
 
+void stringify(DynamicValue::Reader value, BufferedOutputStream& output);
+void stringify(DynamicValue::Reader value, OutputStream& output);
+// Like stringify(value), but writes the text to the given stream as it is produced rather than
+// building a String.  Given a BufferedOutputStream, the text is formatted directly into the
+// stream's buffer, so printing a large message allocates nothing.  A plain OutputStream is
+// wrapped in a temporary buffer on the stack.
+
+void parseStringified(ArrayPtr<const char> text, DynamicStruct::Builder output);
+inline void parseStringified(Text::Reader text, DynamicStruct::Builder output) {
+  parseStringified(arrayPtr(text.begin(), text.size()), output);
+}
+// The inverse of stringify():  parses a struct in the format stringify() writes and fills in
+// `output`, typically the root of a fresh MessageBuilder.  Values are written straight into the
+// message as they are parsed; lists and blobs are sized up front by scanning ahead, so nothing
+// is allocated twice.  This makes the format usable for hand-written configs and test fixtures,
+// e.g.:
+//
+//     parseStringified("(name = \"foo\", tags = [\"a\", \"b\"], body = text(\"...\"))",
+//                      message.initRoot<DynamicStruct>(schema));
+//
+// Whitespace is free-form and '#' starts a comment running to the end of the line.  Members may
+// appear in any order; members not mentioned keep their default values.  A union is written as
+// its member's name with the value in parentheses.  Unlike stringify(), the parser rejects
+// names the schema doesn't define, since in hand-written text they're most likely typos.
+// Enum numbers must name an enumerant the schema knows about, since there is no way to set any
+// other value through the dynamic API.
+//
+// Malformed text throws an exception with nature INPUT whose description gives the line and
+// column of the error.  The output may have been partially filled in by then.
+
 }  // namespace capnproto
 
 #endif  // CAPNPROTO_STRINGIFY_H_
@@ -0,0 +1,214 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#define CAPNPROTO_PRIVATE
+#include "text-input.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace capnproto {
+namespace internal {
+
+namespace {
+
+static const double POWERS_OF_TEN[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+// Every power of ten that is exactly representable as a double.
+
+}  // namespace
+
+double parseDecimal(const char* begin, const char* end) {
+  const char* p = begin;
+  bool negative = *p == '-';
+  p += negative;
+
+  // Collect up to 19 significant digits, which always fit in a uint64_t.
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool truncated = false;
+
+  for (; p < end && isDigit(*p); ++p) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+    } else {
+      ++exponent;
+      truncated = truncated || *p != '0';
+    }
+  }
+
+  if (p < end && *p == '.') {
+    for (++p; p < end && isDigit(*p); ++p) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        --exponent;
+      } else {
+        truncated = truncated || *p != '0';
+      }
+    }
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negativeExponent = *p == '-';
+    p += *p == '-' || *p == '+';
+    int explicitExponent = 0;
+    for (; p < end && isDigit(*p); ++p) {
+      // Clamp absurd exponents; the result is zero or infinity either way.
+      if (explicitExponent < 100000) {
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+      }
+    }
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+
+  if (!truncated && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+    // The mantissa and the power of ten are both exact, so a single multiplication or division
+    // rounds correctly.
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0) {
+      result /= POWERS_OF_TEN[-exponent];
+    } else {
+      result *= POWERS_OF_TEN[exponent];
+    }
+    return negative ? -result : result;
+  }
+
+  // Fall back to strtod(), which needs a NUL-terminated copy.
+  size_t size = end - begin;
+  char stackBuffer[64];
+  Array<char> heapBuffer;
+  char* buffer = stackBuffer;
+  if (size >= sizeof(stackBuffer)) {
+    heapBuffer = newArray<char>(size + 1);
+    buffer = heapBuffer.begin();
+  }
+  memcpy(buffer, begin, size);
+  buffer[size] = '\0';
+  return strtod(buffer, nullptr);
+}
+
+void findLineAndColumn(const char* begin, const char* pos, uint& line, uint& column) {
+  line = 1;
+  column = 1;
+  for (const char* p = begin; p < pos; ++p) {
+    if (*p == '\n') {
+      ++line;
+      column = 1;
+    } else {
+      ++column;
+    }
+  }
+}
+
+const char* findQuoteOrBackslash(const char* pos, const char* end) {
+#if __SSE2__
+  const __m128i doubleQuote = _mm_set1_epi8('\"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  while (end - pos >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, doubleQuote), _mm_cmpeq_epi8(chunk, backslash)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+#endif
+
+  while (pos < end && *pos != '\"' && *pos != '\\') {
+    ++pos;
+  }
+  return pos;
+}
+
+uint countElements(const char* pos, const char* end, char open, char close, bool hashComments) {
+  const char* p = pos;
+  uint depth = 0;
+  uint count = 0;
+  bool sawValue = false;
+
+  while (p < end) {
+    char c = *p++;
+    if (c == '[' || c == open) {
+      ++depth;
+      sawValue = true;
+    } else if (c == ']' || c == close) {
+      if (depth == 0) {
+        return count + sawValue;
+      }
+      --depth;
+    } else if (c == ',') {
+      if (depth == 0) {
+        if (!sawValue) {
+          // An empty element; parsing will fail here, so don't bother counting the rest.
+          return count + 1;
+        }
+        ++count;
+        sawValue = false;
+      }
+    } else if (c == '\"') {
+      // Skip to the closing quote.
+      for (;;) {
+        p = findQuoteOrBackslash(p, end);
+        if (p == end) break;
+        if (*p == '\"') {
+          ++p;
+          break;
+        }
+        if (end - p < 2) {
+          // The text ends in the middle of an escape; the parser will report it.
+          p = end;
+          break;
+        }
+        p += 2;
+      }
+      sawValue = true;
+    } else if (c == '#' && hashComments) {
+      const char* newline = reinterpret_cast<const char*>(memchr(p, '\n', end - p));
+      p = newline == nullptr ? end : newline + 1;
+    } else if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+      sawValue = true;
+    }
+  }
+
+  return count + sawValue;
+}
+
+EnumSchema FieldSlot::getFieldEnumSchema(StructSchema::Member member) {
+  return member.getContainingStruct().getDependency(
+      member.getProto().getBody().getFieldMember().getType().getBody().getEnumType()).asEnum();
+}
+
+}  // namespace internal
+}  // namespace capnproto
@@ -0,0 +1,116 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Building blocks shared by the text parsers, JsonCodec::decode() and parseStringified().
+
+#ifndef CAPNPROTO_TEXT_INPUT_H_
+#define CAPNPROTO_TEXT_INPUT_H_
+
+#ifndef CAPNPROTO_PRIVATE
+#error "This header is only meant to be included by Cap'n Proto's own source code."
+#endif
+
+#include "dynamic.h"
+
+namespace capnproto {
+namespace internal {
+
+static constexpr uint TEXT_NESTING_LIMIT = 64;
+// Maximum depth of nested values the parsers accept, to bound recursion on malicious input.
+// Matches the default ReaderOptions::nestingLimit.
+
+inline bool isDigit(char c) {
+  return static_cast<uint8_t>(c - '0') < 10;
+}
+
+inline int hexDigitValue(char c) {
+  // Returns the value of a hex digit, or -1 if `c` isn't one.
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+double parseDecimal(const char* begin, const char* end);
+// Converts the text of a decimal number to the nearest double.  The caller must already have
+// checked that the text matches `-?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)?`.  Numbers with at most
+// 19 significant digits and a small exponent -- which is nearly all of them -- are converted
+// exactly without calling strtod().
+
+void findLineAndColumn(const char* begin, const char* pos, uint& line, uint& column);
+// Computes the 1-based line and column of `pos` within the text starting at `begin`, for error
+// messages.
+
+const char* findQuoteOrBackslash(const char* pos, const char* end);
+// Returns a pointer to the first '"' or '\\' in [pos, end), or `end` if there is none.
+
+uint countElements(const char* pos, const char* end, char open, char close, bool hashComments);
+// Called with `pos` just after the '[' opening a list.  Returns the number of elements in the list
+// by scanning ahead to the matching ']', without parsing them.  `open` and `close` are the other
+// pair of brackets in the syntax, e.g. '{' and '}' for JSON, and `hashComments` says whether '#'
+// starts a comment running to the end of the line.  Never reads outside [pos, end).  The count is
+// only a hint if the list is malformed; parsing the elements will then report the actual error.
+
+// =======================================================================================
+// The places a parser can put a value it has parsed:  a struct field, a union member, or a list
+// element.  Each has set() for primitives, init() for structs, init(size) for lists and blobs,
+// and getEnumSchema() for enums, so that parsers can fill in any of them with the same template
+// code.
+
+struct FieldSlot {
+  DynamicStruct::Builder builder;
+  StructSchema::Member member;
+
+  inline void set(DynamicValue::Reader value) { builder.set(member, value); }
+  inline DynamicValue::Builder init() { return builder.init(member); }
+  inline DynamicValue::Builder init(uint size) { return builder.init(member, size); }
+  inline EnumSchema getEnumSchema() { return getFieldEnumSchema(member); }
+
+  static EnumSchema getFieldEnumSchema(StructSchema::Member member);
+};
+
+struct UnionSlot {
+  DynamicUnion::Builder builder;
+  StructSchema::Member member;
+
+  inline void set(DynamicValue::Reader value) { builder.set(member, value); }
+  inline DynamicValue::Builder init() { return builder.init(member); }
+  inline DynamicValue::Builder init(uint size) { return builder.init(member, size); }
+  inline EnumSchema getEnumSchema() { return FieldSlot::getFieldEnumSchema(member); }
+};
+
+struct ElementSlot {
+  DynamicList::Builder builder;
+  uint index;
+
+  inline void set(DynamicValue::Reader value) { builder.set(index, value); }
+  inline DynamicValue::Builder init() { return builder[index]; }
+  inline DynamicValue::Builder init(uint size) { return builder.init(index, size); }
+  inline EnumSchema getEnumSchema() { return builder.getSchema().getEnumElementType(); }
+};
+
+}  // namespace internal
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_TEXT_INPUT_H_
@@ -0,0 +1,565 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#define CAPNPROTO_PRIVATE
+#include "text-output.h"
+#include "logging.h"
+#include <float.h>
+#include <cmath>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace capnproto {
+namespace internal {
+
+namespace {
+
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+}  // namespace
+
+char* formatUnsigned(char* out, uint64_t value) {
+  // Digits are produced two at a time, least-significant first, into a scratch buffer.
+
+  char scratch[20];
+  char* pos = scratch + sizeof(scratch);
+  while (value >= 100) {
+    uint pair = (value % 100) * 2;
+    value /= 100;
+    pos -= 2;
+    pos[0] = DIGIT_PAIRS[pair];
+    pos[1] = DIGIT_PAIRS[pair + 1];
+  }
+  if (value >= 10) {
+    pos -= 2;
+    pos[0] = DIGIT_PAIRS[value * 2];
+    pos[1] = DIGIT_PAIRS[value * 2 + 1];
+  } else {
+    *--pos = '0' + value;
+  }
+
+  size_t size = scratch + sizeof(scratch) - pos;
+  memcpy(out, pos, size);
+  return out + size;
+}
+
+char* formatSigned(char* out, int64_t value) {
+  if (value < 0) {
+    *out++ = '-';
+    // Negate as unsigned so that INT64_MIN comes out right.
+    return formatUnsigned(out, -static_cast<uint64_t>(value));
+  } else {
+    return formatUnsigned(out, value);
+  }
+}
+
+// ---------------------------------------------------------------------------------------
+// Floating-point formatting.  We find the shortest digit string that parses back to the value
+// using Grisu3, from Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+// Integers" (PLDI 2010).  Grisu3 works with 64-bit integers only and so is much faster than
+// printf(), but for about 0.5% of values it can't prove that its result is the shortest, in which
+// case we fall back to printf().
+
+namespace {
+
+struct DiyFp {
+  // A floating-point number f * 2^e with a 64-bit significand ("do-it-yourself floating point").
+
+  uint64_t f;
+  int e;
+};
+
+inline DiyFp multiply(DiyFp a, DiyFp b) {
+  // Product of a and b, rounded to 64 bits.
+  unsigned __int128 product = static_cast<unsigned __int128>(a.f) * b.f;
+  uint64_t high = product >> 64;
+  uint64_t low = product;
+  return { high + (low >> 63), a.e + b.e + 64 };
+}
+
+inline DiyFp normalize(DiyFp x) {
+  int shift = __builtin_clzll(x.f);
+  return { x.f << shift, x.e - shift };
+}
+
+struct CachedPower {
+  uint64_t significand;
+  int16_t binaryExponent;
+  int16_t decimalExponent;
+};
+
+static const CachedPower CACHED_POWERS[] = {
+  // 10^k for k = -348, -340, ..., 340, as normalized DiyFps rounded to nearest.
+  { 0xfa8fd5a0081c0288ull, -1220, -348 },
+  { 0xbaaee17fa23ebf76ull, -1193, -340 },
+  { 0x8b16fb203055ac76ull, -1166, -332 },
+  { 0xcf42894a5dce35eaull, -1140, -324 },
+  { 0x9a6bb0aa55653b2dull, -1113, -316 },
+  { 0xe61acf033d1a45dfull, -1087, -308 },
+  { 0xab70fe17c79ac6caull, -1060, -300 },
+  { 0xff77b1fcbebcdc4full, -1034, -292 },
+  { 0xbe5691ef416bd60cull, -1007, -284 },
+  { 0x8dd01fad907ffc3cull, -980, -276 },
+  { 0xd3515c2831559a83ull, -954, -268 },
+  { 0x9d71ac8fada6c9b5ull, -927, -260 },
+  { 0xea9c227723ee8bcbull, -901, -252 },
+  { 0xaecc49914078536dull, -874, -244 },
+  { 0x823c12795db6ce57ull, -847, -236 },
+  { 0xc21094364dfb5637ull, -821, -228 },
+  { 0x9096ea6f3848984full, -794, -220 },
+  { 0xd77485cb25823ac7ull, -768, -212 },
+  { 0xa086cfcd97bf97f4ull, -741, -204 },
+  { 0xef340a98172aace5ull, -715, -196 },
+  { 0xb23867fb2a35b28eull, -688, -188 },
+  { 0x84c8d4dfd2c63f3bull, -661, -180 },
+  { 0xc5dd44271ad3cdbaull, -635, -172 },
+  { 0x936b9fcebb25c996ull, -608, -164 },
+  { 0xdbac6c247d62a584ull, -582, -156 },
+  { 0xa3ab66580d5fdaf6ull, -555, -148 },
+  { 0xf3e2f893dec3f126ull, -529, -140 },
+  { 0xb5b5ada8aaff80b8ull, -502, -132 },
+  { 0x87625f056c7c4a8bull, -475, -124 },
+  { 0xc9bcff6034c13053ull, -449, -116 },
+  { 0x964e858c91ba2655ull, -422, -108 },
+  { 0xdff9772470297ebdull, -396, -100 },
+  { 0xa6dfbd9fb8e5b88full, -369, -92 },
+  { 0xf8a95fcf88747d94ull, -343, -84 },
+  { 0xb94470938fa89bcfull, -316, -76 },
+  { 0x8a08f0f8bf0f156bull, -289, -68 },
+  { 0xcdb02555653131b6ull, -263, -60 },
+  { 0x993fe2c6d07b7facull, -236, -52 },
+  { 0xe45c10c42a2b3b06ull, -210, -44 },
+  { 0xaa242499697392d3ull, -183, -36 },
+  { 0xfd87b5f28300ca0eull, -157, -28 },
+  { 0xbce5086492111aebull, -130, -20 },
+  { 0x8cbccc096f5088ccull, -103, -12 },
+  { 0xd1b71758e219652cull, -77, -4 },
+  { 0x9c40000000000000ull, -50, 4 },
+  { 0xe8d4a51000000000ull, -24, 12 },
+  { 0xad78ebc5ac620000ull, 3, 20 },
+  { 0x813f3978f8940984ull, 30, 28 },
+  { 0xc097ce7bc90715b3ull, 56, 36 },
+  { 0x8f7e32ce7bea5c70ull, 83, 44 },
+  { 0xd5d238a4abe98068ull, 109, 52 },
+  { 0x9f4f2726179a2245ull, 136, 60 },
+  { 0xed63a231d4c4fb27ull, 162, 68 },
+  { 0xb0de65388cc8ada8ull, 189, 76 },
+  { 0x83c7088e1aab65dbull, 216, 84 },
+  { 0xc45d1df942711d9aull, 242, 92 },
+  { 0x924d692ca61be758ull, 269, 100 },
+  { 0xda01ee641a708deaull, 295, 108 },
+  { 0xa26da3999aef774aull, 322, 116 },
+  { 0xf209787bb47d6b85ull, 348, 124 },
+  { 0xb454e4a179dd1877ull, 375, 132 },
+  { 0x865b86925b9bc5c2ull, 402, 140 },
+  { 0xc83553c5c8965d3dull, 428, 148 },
+  { 0x952ab45cfa97a0b3ull, 455, 156 },
+  { 0xde469fbd99a05fe3ull, 481, 164 },
+  { 0xa59bc234db398c25ull, 508, 172 },
+  { 0xf6c69a72a3989f5cull, 534, 180 },
+  { 0xb7dcbf5354e9beceull, 561, 188 },
+  { 0x88fcf317f22241e2ull, 588, 196 },
+  { 0xcc20ce9bd35c78a5ull, 614, 204 },
+  { 0x98165af37b2153dfull, 641, 212 },
+  { 0xe2a0b5dc971f303aull, 667, 220 },
+  { 0xa8d9d1535ce3b396ull, 694, 228 },
+  { 0xfb9b7cd9a4a7443cull, 720, 236 },
+  { 0xbb764c4ca7a44410ull, 747, 244 },
+  { 0x8bab8eefb6409c1aull, 774, 252 },
+  { 0xd01fef10a657842cull, 800, 260 },
+  { 0x9b10a4e5e9913129ull, 827, 268 },
+  { 0xe7109bfba19c0c9dull, 853, 276 },
+  { 0xac2820d9623bf429ull, 880, 284 },
+  { 0x80444b5e7aa7cf85ull, 907, 292 },
+  { 0xbf21e44003acdd2dull, 933, 300 },
+  { 0x8e679c2f5e44ff8full, 960, 308 },
+  { 0xd433179d9c8cb841ull, 986, 316 },
+  { 0x9e19db92b4e31ba9ull, 1013, 324 },
+  { 0xeb96bf6ebadf77d9ull, 1039, 332 },
+  { 0xaf87023b9bf0ee6bull, 1066, 340 },
+};
+
+static const int MIN_TARGET_EXPONENT = -60;
+static const int MAX_TARGET_EXPONENT = -32;
+// We scale the value by a cached power of ten so that its binary exponent lands in this range,
+// which lets the integer part of the scaled value fit in 32 bits.
+
+static const uint MAX_DIGITS = 17;
+
+bool roundWeed(char* digits, uint count, uint64_t distanceTooHighW, uint64_t unsafeInterval,
+               uint64_t rest, uint64_t tenKappa, uint64_t unit) {
+  // Moves the last digit of the result towards the true value while staying inside the rounding
+  // interval, then returns whether the result is provably the closest shortest representation.
+  // The arguments are all scaled by the same factor:  `rest` is the distance from the digits to
+  // the (rounded up) upper boundary, and `tenKappa` is the value of one unit in the last digit.
+  // `unit` bounds the error introduced by the cached power of ten.
+
+  uint64_t smallDistance = distanceTooHighW - unit;
+  uint64_t bigDistance = distanceTooHighW + unit;
+
+  while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+         (rest + tenKappa < smallDistance ||
+          smallDistance - rest >= rest + tenKappa - smallDistance)) {
+    --digits[count - 1];
+    rest += tenKappa;
+  }
+
+  if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+      (rest + tenKappa < bigDistance ||
+       bigDistance - rest > rest + tenKappa - bigDistance)) {
+    // Not sure which candidate is closer.
+    return false;
+  }
+
+  return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+bool grisuDigits(uint64_t significand, int exponent, bool lowerBoundaryIsCloser,
+                 char* digits, uint* count, int* decimalExponent) {
+  // Finds the shortest digits which uniquely identify significand * 2^exponent among values of
+  // its type, returning false if that can't be done quickly.  On success, the value is
+  // approximately digits * 10^decimalExponent.  `lowerBoundaryIsCloser` is true when the value
+  // is a power of two (other than the smallest normal), in which case the next value down is
+  // half as far as the next value up.
+
+  DiyFp w = normalize({ significand, exponent });
+  DiyFp plus = normalize({ (significand << 1) + 1, exponent - 1 });
+  DiyFp minus = lowerBoundaryIsCloser ? DiyFp { (significand << 2) - 1, exponent - 2 }
+                                      : DiyFp { (significand << 1) - 1, exponent - 1 };
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // Pick a power of ten 10^-k which brings w into the target range.
+  int minBinaryExponent = MIN_TARGET_EXPONENT - (w.e + 64);
+  int k = static_cast<int>(ceil((minBinaryExponent + 63) * 0.30102999566398114));
+  const CachedPower& power = CACHED_POWERS[(348 + k - 1) / 8 + 1];
+  DCHECK(minBinaryExponent <= power.binaryExponent &&
+         power.binaryExponent <= MAX_TARGET_EXPONENT - (w.e + 64));
+  DiyFp tenMk = { power.significand, power.binaryExponent };
+
+  DiyFp scaledW = multiply(w, tenMk);
+  DiyFp low = multiply(minus, tenMk);
+  DiyFp high = multiply(plus, tenMk);
+
+  // Each multiplication may be off by up to one unit, so widen the interval accordingly;  digits
+  // inside [tooLow, tooHigh] are "unsafe" but those outside it are certainly wrong.
+  uint64_t unit = 1;
+  uint64_t tooLow = low.f - unit;
+  uint64_t tooHigh = high.f + unit;
+  uint64_t unsafeInterval = tooHigh - tooLow;
+
+  int shift = -scaledW.e;
+  uint64_t one = uint64_t(1) << shift;
+  uint32_t integrals = tooHigh >> shift;
+  uint64_t fractionals = tooHigh & (one - 1);
+
+  uint32_t divisor = 1;
+  int kappa = 1;
+  while (integrals / divisor >= 10) {
+    divisor *= 10;
+    ++kappa;
+  }
+
+  // Generate digits of tooHigh, stopping as soon as the remainder fits in the unsafe interval.
+  uint n = 0;
+  while (kappa > 0) {
+    digits[n++] = '0' + integrals / divisor;
+    integrals %= divisor;
+    --kappa;
+    uint64_t rest = (static_cast<uint64_t>(integrals) << shift) + fractionals;
+    if (rest < unsafeInterval) {
+      *count = n;
+      *decimalExponent = kappa - power.decimalExponent;
+      return roundWeed(digits, n, tooHigh - scaledW.f, unsafeInterval, rest,
+                       static_cast<uint64_t>(divisor) << shift, unit);
+    }
+    divisor /= 10;
+  }
+
+  for (;;) {
+    fractionals *= 10;
+    unit *= 10;
+    unsafeInterval *= 10;
+    digits[n++] = '0' + (fractionals >> shift);
+    fractionals &= one - 1;
+    --kappa;
+    if (fractionals < unsafeInterval) {
+      *count = n;
+      *decimalExponent = kappa - power.decimalExponent;
+      return roundWeed(digits, n, (tooHigh - scaledW.f) * unit, unsafeInterval, fractionals,
+                       one, unit);
+    }
+    if (n == MAX_DIGITS) {
+      return false;
+    }
+  }
+}
+
+char* formatDigits(char* out, const char* digits, uint count, int decimalExponent,
+                   uint precision) {
+  // Writes digits * 10^decimalExponent the way printf("%.*g", precision) would, minus the '+'
+  // in positive exponents.
+
+  int exponent = count + decimalExponent - 1;  // Exponent in scientific notation.
+
+  if (exponent < -4 || exponent >= static_cast<int>(precision)) {
+    *out++ = digits[0];
+    if (count > 1) {
+      *out++ = '.';
+      memcpy(out, digits + 1, count - 1);
+      out += count - 1;
+    }
+    *out++ = 'e';
+    if (exponent < 0) {
+      *out++ = '-';
+      exponent = -exponent;
+    }
+    if (exponent < 10) {
+      // printf() always writes at least two exponent digits.
+      *out++ = '0';
+    }
+    return formatUnsigned(out, exponent);
+  } else if (exponent < 0) {
+    *out++ = '0';
+    *out++ = '.';
+    memset(out, '0', -exponent - 1);
+    out += -exponent - 1;
+    memcpy(out, digits, count);
+    return out + count;
+  } else if (static_cast<uint>(exponent) + 1 >= count) {
+    memcpy(out, digits, count);
+    out += count;
+    memset(out, '0', exponent + 1 - count);
+    return out + exponent + 1 - count;
+  } else {
+    memcpy(out, digits, exponent + 1);
+    out += exponent + 1;
+    *out++ = '.';
+    memcpy(out, digits + exponent + 1, count - exponent - 1);
+    return out + count - exponent - 1;
+  }
+}
+
+char* formatFloatSlow(char* out, double value, bool isFloat32) {
+  // Finds the smallest precision that round-trips using printf() and strtod().  FLT_DIG and
+  // DBL_DIG digits almost always do, and 9 or 17 digits always do.
+
+  int precision = isFloat32 ? FLT_DIG : DBL_DIG;
+  int maxPrecision = isFloat32 ? 9 : 17;
+  char buffer[MAX_NUMBER_TEXT_SIZE];
+  for (;;) {
+    int size = snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    DCHECK(size > 0 && size < (int)sizeof(buffer));
+
+    if (precision >= maxPrecision) break;
+    if (isFloat32) {
+      volatile float parsed = strtof(buffer, nullptr);
+      if (parsed == static_cast<float>(value)) break;
+    } else {
+      // Volatile so that the comparison isn't done with extended precision; see
+      // DoubleToBuffer() in util.c++.
+      volatile double parsed = strtod(buffer, nullptr);
+      if (parsed == value) break;
+    }
+    ++precision;
+  }
+
+  // Copy to the output, dropping '+' signs and replacing the locale's radix character (which may
+  // be more than one byte) with '.'.
+  for (const char* in = buffer; *in != '\0'; ++in) {
+    char c = *in;
+    if (c == '+') {
+      continue;
+    } else if (('0' <= c && c <= '9') || c == '-' || c == 'e' || c == '.') {
+      *out++ = c;
+    } else {
+      *out++ = '.';
+      while (in[1] != '\0' && !('0' <= in[1] && in[1] <= '9') && in[1] != 'e') ++in;
+    }
+  }
+  return out;
+}
+
+}  // namespace
+
+char* formatFloat(char* out, double value, bool isFloat32) {
+  if (std::isinf(value)) {
+    if (value < 0) {
+      memcpy(out, "-inf", 4);
+      return out + 4;
+    } else {
+      memcpy(out, "inf", 3);
+      return out + 3;
+    }
+  } else if (std::isnan(value)) {
+    memcpy(out, "nan", 3);
+    return out + 3;
+  }
+
+  // "%g" prints integers below 10^precision in plain decimal, so we can skip digit generation for
+  // them.  Integer values are common enough in practice that this is worth the check.
+  if (value == std::trunc(value) && std::fabs(value) < (isFloat32 ? 1e6 : 1e15)) {
+    if (value == 0 && std::signbit(value)) {
+      memcpy(out, "-0", 2);
+      return out + 2;
+    }
+    return formatSigned(out, static_cast<int64_t>(value));
+  }
+
+  if (value < 0) {
+    *out++ = '-';
+    value = -value;
+  }
+
+  uint64_t significand;
+  int exponent;
+  bool lowerBoundaryIsCloser;
+  if (isFloat32) {
+    float floatValue = value;
+    uint32_t bits;
+    memcpy(&bits, &floatValue, sizeof(bits));
+    uint biasedExponent = bits >> 23;
+    significand = bits & ((1u << 23) - 1);
+    if (biasedExponent == 0) {
+      exponent = -149;  // Denormal.
+    } else {
+      significand |= 1u << 23;
+      exponent = biasedExponent - 150;
+    }
+    lowerBoundaryIsCloser = significand == (1u << 23) && biasedExponent > 1;
+  } else {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint biasedExponent = bits >> 52;
+    significand = bits & ((uint64_t(1) << 52) - 1);
+    if (biasedExponent == 0) {
+      exponent = -1074;  // Denormal.
+    } else {
+      significand |= uint64_t(1) << 52;
+      exponent = biasedExponent - 1075;
+    }
+    lowerBoundaryIsCloser = significand == (uint64_t(1) << 52) && biasedExponent > 1;
+  }
+
+  char digits[MAX_DIGITS];
+  uint count;
+  int decimalExponent;
+  if (!grisuDigits(significand, exponent, lowerBoundaryIsCloser,
+                   digits, &count, &decimalExponent)) {
+    return formatFloatSlow(out, value, isFloat32);
+  }
+
+  while (count > 1 && digits[count - 1] == '0') {
+    --count;
+    ++decimalExponent;
+  }
+
+  uint precision = isFloat32 ? FLT_DIG : DBL_DIG;
+  return formatDigits(out, digits, count, decimalExponent, count > precision ? count : precision);
+}
+
+// =======================================================================================
+
+void TextOutput::nextBuffer(size_t size) {
+  flush();
+
+  ArrayPtr<byte> buffer = output.getWriteBuffer();
+  if (buffer.size() >= size) {
+    start = pos = reinterpret_cast<char*>(buffer.begin());
+    limit = reinterpret_cast<char*>(buffer.end());
+  } else {
+    start = pos = slowBuffer;
+    limit = slowBuffer + sizeof(slowBuffer);
+  }
+}
+
+void TextOutput::writeSlow(const char* data, size_t size) {
+  while (static_cast<size_t>(limit - pos) < size) {
+    size_t available = limit - pos;
+    memcpy(pos, data, available);
+    pos += available;
+    data += available;
+    size -= available;
+    nextBuffer(1);
+  }
+  memcpy(pos, data, size);
+  pos += size;
+}
+
+void TextOutput::flush() {
+  if (pos > start) {
+    output.write(start, pos - start);
+  }
+  start = pos = limit;
+}
+
+// =======================================================================================
+
+StringOutputStream::StringOutputStream(): buffer(newArray<char>(256)), fill(0) {}
+StringOutputStream::~StringOutputStream() {}
+
+String StringOutputStream::finish() {
+  return String(buffer.begin(), fill);
+}
+
+ArrayPtr<byte> StringOutputStream::getWriteBuffer() {
+  // Grow early rather than hand out a buffer too small for TextOutput to use.
+  if (buffer.size() - fill < TextOutput::MAX_RESERVE) {
+    grow(TextOutput::MAX_RESERVE);
+  }
+  return arrayPtr(reinterpret_cast<byte*>(buffer.begin() + fill), buffer.size() - fill);
+}
+
+void StringOutputStream::write(const void* src, size_t size) {
+  if (src != buffer.begin() + fill) {
+    if (buffer.size() - fill < size) {
+      grow(size);
+    }
+    memcpy(buffer.begin() + fill, src, size);
+  }
+  fill += size;
+}
+
+void StringOutputStream::grow(size_t minimum) {
+  size_t newSize = buffer.size() * 2;
+  if (newSize < fill + minimum) {
+    newSize = fill + minimum;
+  }
+  Array<char> newBuffer = newArray<char>(newSize);
+  memcpy(newBuffer.begin(), buffer.begin(), fill);
+  buffer = move(newBuffer);
+}
+
+}  // namespace internal
+}  // namespace capnproto
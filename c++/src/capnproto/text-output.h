@@ -0,0 +1,159 @@
+// Copyright (c) 2013, Kenton Varda <temporal@gmail.com>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+// ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+// Building blocks shared by the text serializers, stringify() and JsonCodec.
+
+#ifndef CAPNPROTO_TEXT_OUTPUT_H_
+#define CAPNPROTO_TEXT_OUTPUT_H_
+
+#ifndef CAPNPROTO_PRIVATE
+#error "This header is only meant to be included by Cap'n Proto's own source code."
+#endif
+
+#include "io.h"
+#include "blob.h"
+#include <string.h>
+
+namespace capnproto {
+namespace internal {
+
+// =======================================================================================
+// Number formatting.  These functions write the text of a number to `out`, which must have room
+// for MAX_NUMBER_TEXT_SIZE bytes, and return a pointer just past what they wrote.
+
+static constexpr size_t MAX_NUMBER_TEXT_SIZE = 32;
+
+char* formatUnsigned(char* out, uint64_t value);
+char* formatSigned(char* out, int64_t value);
+
+char* formatFloat(char* out, double value, bool isFloat32);
+// Writes the shortest representation of `value` -- which is really a float if `isFloat32` --
+// that parses back to the same value, formatted like printf("%g") with a precision of at least
+// FLT_DIG or DBL_DIG but without the '+' in exponents.  For normal numbers, this is exactly
+// what util.c++'s FloatToBuffer() and DoubleToBuffer() produce whenever those round-trip.
+// Denormals may get fewer digits than those would print.  Infinities and NaN are written as
+// "inf", "-inf", and "nan".
+
+// =======================================================================================
+
+class TextOutput {
+  // Writes text directly into a BufferedOutputStream's write buffer.  When the stream's buffer
+  // is too small for the next piece of output, we hand over what we've written and ask for a new
+  // one, falling back to a small buffer of our own if the stream doesn't have room.  Call flush()
+  // when done.
+
+public:
+  explicit inline TextOutput(BufferedOutputStream& output)
+      : output(output), start(nullptr), pos(nullptr), limit(nullptr) {}
+  CAPNPROTO_DISALLOW_COPY(TextOutput);
+
+  static constexpr size_t MAX_RESERVE = 64;
+
+  inline char* reserve(size_t size) {
+    // Returns a pointer to at least `size` bytes of free space, where `size` is no more than
+    // MAX_RESERVE.  After filling in a prefix of it, pass the end of what was written to
+    // advance().
+    if (CAPNPROTO_EXPECT_FALSE(static_cast<size_t>(limit - pos) < size)) {
+      nextBuffer(size);
+    }
+    return pos;
+  }
+  inline void advance(char* end) { pos = end; }
+
+  inline void put(char c) {
+    *reserve(1) = c;
+    ++pos;
+  }
+
+  inline void write(const char* data, size_t size) {
+    if (CAPNPROTO_EXPECT_TRUE(static_cast<size_t>(limit - pos) >= size)) {
+      memcpy(pos, data, size);
+      pos += size;
+    } else {
+      writeSlow(data, size);
+    }
+  }
+
+  template <size_t size>
+  inline void write(const char (&literal)[size]) {
+    write(literal, size - 1);
+  }
+
+  inline void write(Text::Reader text) {
+    write(text.c_str(), text.size());
+  }
+
+  inline void writeUnsigned(uint64_t value) {
+    advance(formatUnsigned(reserve(MAX_NUMBER_TEXT_SIZE), value));
+  }
+  inline void writeSigned(int64_t value) {
+    advance(formatSigned(reserve(MAX_NUMBER_TEXT_SIZE), value));
+  }
+  inline void writeFloat(double value, bool isFloat32) {
+    advance(formatFloat(reserve(MAX_NUMBER_TEXT_SIZE), value, isFloat32));
+  }
+
+  void flush();
+  // Writes out everything written so far.  Further output goes into a new buffer.
+
+private:
+  BufferedOutputStream& output;
+  char* start;
+  char* pos;
+  char* limit;
+  // The buffer currently being filled:  [start, pos) has been written but not yet handed to the
+  // output stream, and [pos, limit) is free.
+
+  char slowBuffer[MAX_RESERVE];
+
+  void nextBuffer(size_t size);
+  void writeSlow(const char* data, size_t size);
+};
+
+class StringOutputStream: public BufferedOutputStream {
+  // Collects output in a growable buffer, for serializers that return a String.
+
+public:
+  StringOutputStream();
+  CAPNPROTO_DISALLOW_COPY(StringOutputStream);
+  ~StringOutputStream();
+
+  String finish();
+  // Returns everything written so far.
+
+  // implements BufferedOutputStream ---------------------------------
+  ArrayPtr<byte> getWriteBuffer() override;
+  void write(const void* src, size_t size) override;
+
+private:
+  Array<char> buffer;
+  size_t fill;
+
+  void grow(size_t minimum);
+};
+
+}  // namespace internal
+}  // namespace capnproto
+
+#endif  // CAPNPROTO_TEXT_OUTPUT_H_
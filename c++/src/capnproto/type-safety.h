@@ -359,6 +359,9 @@ private:
   Disposer* disposer;  // Only valid if ptr != nullptr.
   T* ptr;
 
+  template <typename U>
+  friend class Own;
+
   inline void dispose() {
     // Make sure that if an exception is thrown, we are left with a null ptr, so we won't possibly
     // dispose again.
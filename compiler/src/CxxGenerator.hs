@@ -27,7 +27,8 @@ module CxxGenerator(generateCxx) where
 
 import qualified Data.ByteString.UTF8 as ByteStringUTF8
 import Data.FileEmbed(embedFile)
-import Data.Word(Word8)
+import Data.Word(Word8, Word32, Word64)
+import Data.Bits((.&.), xor, shiftR)
 import qualified Data.Digest.MD5 as MD5
 import qualified Data.Map as Map
 import qualified Data.Set as Set
@@ -262,6 +263,34 @@ inlineElementType t = elementType t
 repeatedlyTake _ [] = []
 repeatedlyTake n l = take n l : repeatedlyTake n (drop n l)
 
+-- Hash tables for RawSchema lookups.  These must match hashTableSize(), hashSchemaId(), and
+-- hashMemberName() in generated-header-support.h.
+
+hashTableSize :: Int -> Int
+hashTableSize count = until (>= count * 2) (* 2) 1
+
+hashSchemaId :: Word64 -> Word32
+hashSchemaId i = let
+    h0 = fromIntegral (i `xor` shiftR i 32) :: Word32
+    h1 = (h0 `xor` shiftR h0 16) * 0x85ebca6b
+    in h1 `xor` shiftR h1 13
+
+hashMemberName :: Int -> String -> Word32
+hashMemberName unionIndex name = foldl step (step 2166136261 unionIndex) bytes where
+    bytes = map fromIntegral $ UTF8.encode name
+    step :: Word32 -> Int -> Word32
+    step h b = (h `xor` fromIntegral b) * 16777619
+
+-- Lays out entries with the given hashes in an open-addressed table using linear probing.  The
+-- table starts with its mask (size minus one).  Each slot holds the entry's index plus one, or
+-- zero if empty.
+hashTable :: [Word32] -> [Int]
+hashTable hashes = (size - 1) : [Map.findWithDefault 0 slot filled | slot <- [0 .. size - 1]] where
+    size = hashTableSize $ length hashes
+    filled = List.foldl' insert Map.empty $ zip [1..] hashes
+    insert table (i, h) = Map.insert (probe table $ fromIntegral h .&. (size - 1)) i table
+    probe table slot = if Map.member slot table then probe table $ mod (slot + 1) size else slot
+
 typeDependencies (StructType s) = [structId s]
 typeDependencies (EnumType e) = [enumId e]
 typeDependencies (InterfaceType i) = [interfaceId i]
@@ -328,8 +357,10 @@ outerFileContext schemaNodes = fileContext where
 
         depIds = map head $ List.group $ List.sort $ descDependencies desc
 
-        membersByName = map fst $ List.sortBy (compare `on` memberByNameKey) $ memberTable desc
+        sortedMembers = List.sortBy (compare `on` memberByNameKey) $ memberTable desc
+        membersByName = map fst sortedMembers
         memberByNameKey ((unionIndex, _), name) = (unionIndex, name)
+        memberHash ((unionIndex, _), name) = hashMemberName unionIndex name
 
         context "schemaWordCount" = MuVariable $ div (length node + 7) 8
         context "schemaBytes" = MuVariable $ delimit ",\n    " codeLines
@@ -337,9 +368,13 @@ outerFileContext schemaNodes = fileContext where
         context "schemaDependencyCount" = MuVariable $ length depIds
         context "schemaDependencies" =
             MuList $ map (schemaDepContext context) depIds
+        context "schemaDependencyTable" =
+            MuVariable $ delimit ", " $ map show $ hashTable $ map hashSchemaId depIds
         context "schemaMemberCount" = MuVariable $ length membersByName
         context "schemaMembersByName" =
             MuList $ map (schemaMemberByNameContext context) membersByName
+        context "schemaMemberTable" =
+            MuVariable $ delimit ", " $ map show $ hashTable $ map memberHash sortedMembers
         context s = parent s
 
     enumerantContext parent desc = mkStrContext context where